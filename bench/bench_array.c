@@ -0,0 +1,211 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "backend.h"
+#include "buxtonarray.h"
+#include "util.h"
+
+/**
+ * BuxtonArray benchmark
+ *
+ * Times building arrays one element at a time, after a reservation and
+ * with a bulk append, and compares them with the previous growth
+ * strategy, which reallocated the storage on every add. It then lists
+ * the names of large groups through the memory backend, which is how
+ * the daemon builds list_names replies.
+ */
+
+/* The memory backend is linked into this benchmark */
+bool buxton_module_init(BuxtonBackend *backend);
+void buxton_module_destroy(void);
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *op, uint32_t size, uint64_t ns, uint64_t count)
+{
+	printf("%-12s %8u %8.1f ns/op\n", op, size, (double)ns / (double)count);
+}
+
+/* Growth strategy used before capacity tracking, kept for comparison */
+static void legacy_add(void ***data, uint32_t *len, void *item)
+{
+	size_t curr = (size_t)*len * sizeof(void*);
+
+	if (!greedy_realloc((void **)data, &curr, curr + sizeof(void*))) {
+		abort();
+	}
+	(*data)[(*len)++] = item;
+}
+
+static void run_array(void **items, uint32_t size, uint32_t rounds)
+{
+	BuxtonArray *array;
+	void **legacy;
+	uint32_t len;
+	uint64_t start;
+	uint64_t add = 0, reserve = 0, append = 0, old = 0;
+
+	for (uint32_t r = 0; r < rounds; r++) {
+		start = now_ns();
+		array = buxton_array_new();
+		for (uint32_t i = 0; i < size; i++) {
+			if (!buxton_array_add(array, items[i])) {
+				abort();
+			}
+		}
+		add += now_ns() - start;
+		buxton_array_free(&array, NULL);
+
+		start = now_ns();
+		array = buxton_array_new();
+		if (!buxton_array_reserve(array, size)) {
+			abort();
+		}
+		for (uint32_t i = 0; i < size; i++) {
+			if (!buxton_array_add(array, items[i])) {
+				abort();
+			}
+		}
+		reserve += now_ns() - start;
+		buxton_array_free(&array, NULL);
+
+		start = now_ns();
+		array = buxton_array_new();
+		if (!buxton_array_append(array, items, size)) {
+			abort();
+		}
+		append += now_ns() - start;
+		buxton_array_free(&array, NULL);
+
+		start = now_ns();
+		legacy = NULL;
+		len = 0;
+		for (uint32_t i = 0; i < size; i++) {
+			legacy_add(&legacy, &len, items[i]);
+		}
+		old += now_ns() - start;
+		free(legacy);
+	}
+
+	report("add", size, add, (uint64_t)size * rounds);
+	report("reserve+add", size, reserve, (uint64_t)size * rounds);
+	report("append", size, append, (uint64_t)size * rounds);
+	report("legacy-add", size, old, (uint64_t)size * rounds);
+}
+
+static void run_list_names(BuxtonBackend *backend, uint32_t size,
+			   uint32_t rounds)
+{
+	BuxtonLayer layer;
+	_BuxtonKey key;
+	BuxtonData data;
+	BuxtonString label = buxton_string_pack("_");
+	BuxtonArray *list;
+	char group[32];
+	char name[32];
+	uint64_t start;
+	uint64_t ns = 0;
+
+	memzero(&layer, sizeof(layer));
+	layer.name = buxton_string_pack("bench");
+	layer.type = LAYER_SYSTEM;
+	memzero(&key, sizeof(key));
+	snprintf(group, sizeof(group), "group%u", size);
+	key.group = buxton_string_pack(group);
+	key.type = BUXTON_TYPE_UINT32;
+	data.type = BUXTON_TYPE_UINT32;
+
+	for (uint32_t i = 0; i < size; i++) {
+		snprintf(name, sizeof(name), "key%u", i);
+		key.name = buxton_string_pack(name);
+		data.store.d_uint32 = i;
+		if (backend->set_value(&layer, &key, &data, &label)) {
+			abort();
+		}
+	}
+
+	for (uint32_t r = 0; r < rounds; r++) {
+		start = now_ns();
+		if (!backend->list_names(&layer, &key.group, NULL, &list)) {
+			abort();
+		}
+		ns += now_ns() - start;
+		if (list->len != size) {
+			abort();
+		}
+		buxton_array_free(&list, (buxton_free_func)data_free);
+	}
+
+	report("list_names", size, ns, (uint64_t)size * rounds);
+}
+
+int main(void)
+{
+	uint32_t sizes[] = { 1000, 100000, 1000000 };
+	uint32_t max = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+	BuxtonBackend backend;
+	void **items;
+
+	items = malloc(sizeof(void *) * max);
+	if (!items) {
+		abort();
+	}
+	for (uint32_t i = 0; i < max; i++) {
+		items[i] = &items[i];
+	}
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		run_array(items, sizes[s], max / sizes[s] * 4);
+	}
+
+	memzero(&backend, sizeof(backend));
+	if (!buxton_module_init(&backend)) {
+		abort();
+	}
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		run_list_names(&backend, sizes[s], max / sizes[s]);
+	}
+	buxton_module_destroy();
+
+	free(items);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
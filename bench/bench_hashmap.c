@@ -0,0 +1,198 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+/**
+ * Hashmap microbenchmark
+ *
+ * Times insertion, successful and failed lookups, iteration and removal
+ * in maps of string keys (as used for layers and notifications) and of
+ * uint64_t keys (as used for client keys), and prints ns/op for each.
+ * Lookups and removals are done in random order, so that large maps
+ * don't get an unrealistically cache friendly access pattern.
+ */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *map, unsigned int size, const char *op,
+		   uint64_t ns, uint64_t count)
+{
+	printf("%-8s %8u %-10s %8.1f ns/op\n", map, size, op,
+	       (double)ns / (double)count);
+}
+
+static void run(const char *name, hash_func_t hash, compare_func_t compare,
+		void **keys, void **misses, unsigned int *order,
+		unsigned int size, unsigned int rounds)
+{
+	Hashmap *map;
+	Iterator iterator;
+	uint64_t start;
+	uint64_t put = 0;
+	uint64_t remove = 0;
+	uint64_t found = 0;
+	void *value;
+
+	map = hashmap_new(hash, compare);
+	if (!map) {
+		abort();
+	}
+
+	/* insert in key order, look up and remove in random order */
+	for (unsigned int r = 0; r < rounds; r++) {
+		start = now_ns();
+		for (unsigned int i = 0; i < size; i++) {
+			if (hashmap_put(map, keys[i], keys[i]) != 1) {
+				abort();
+			}
+		}
+		put += now_ns() - start;
+
+		start = now_ns();
+		for (unsigned int i = 0; i < size; i++) {
+			if (!hashmap_remove(map, keys[order[i]])) {
+				abort();
+			}
+		}
+		remove += now_ns() - start;
+	}
+	report(name, size, "put", put, (uint64_t)size * rounds);
+	report(name, size, "remove", remove, (uint64_t)size * rounds);
+
+	for (unsigned int i = 0; i < size; i++) {
+		if (hashmap_put(map, keys[i], keys[i]) != 1) {
+			abort();
+		}
+	}
+
+	start = now_ns();
+	for (unsigned int r = 0; r < rounds; r++) {
+		for (unsigned int i = 0; i < size; i++) {
+			found += hashmap_get(map, keys[order[i]]) != NULL;
+		}
+	}
+	report(name, size, "get", now_ns() - start, (uint64_t)size * rounds);
+
+	start = now_ns();
+	for (unsigned int r = 0; r < rounds; r++) {
+		for (unsigned int i = 0; i < size; i++) {
+			found += hashmap_get(map, misses[order[i]]) != NULL;
+		}
+	}
+	report(name, size, "get-miss", now_ns() - start,
+	       (uint64_t)size * rounds);
+
+	start = now_ns();
+	for (unsigned int r = 0; r < rounds; r++) {
+		HASHMAP_FOREACH(value, map, iterator) {
+			found++;
+		}
+	}
+	report(name, size, "iterate", now_ns() - start,
+	       (uint64_t)size * rounds);
+
+	hashmap_free(map);
+	if (found != (uint64_t)size * rounds * 2) {
+		abort();
+	}
+}
+
+int main(void)
+{
+	unsigned int sizes[] = { 100, 10000, 1000000 };
+	unsigned int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+	unsigned int max = sizes[nsizes - 1];
+	void **keys, **misses;
+	unsigned int *order;
+	uint64_t *ints;
+	char *strings;
+
+	keys = malloc(sizeof(void *) * max);
+	misses = malloc(sizeof(void *) * max);
+	ints = malloc(sizeof(uint64_t) * max * 2);
+	strings = malloc((size_t)max * 2 * 32);
+	order = malloc(sizeof(unsigned int) * max);
+	if (!keys || !misses || !ints || !strings || !order) {
+		abort();
+	}
+
+	srandom(1);
+	for (unsigned int s = 0; s < nsizes; s++) {
+		/* each run uses a random permutation of its keys */
+		for (unsigned int i = 0; i < sizes[s]; i++) {
+			order[i] = i;
+		}
+		for (unsigned int i = sizes[s] - 1; i > 0; i--) {
+			unsigned int j = (unsigned int)random() % (i + 1);
+			unsigned int t = order[i];
+
+			order[i] = order[j];
+			order[j] = t;
+		}
+
+		for (unsigned int i = 0; i < sizes[s]; i++) {
+			keys[i] = strings + (size_t)i * 64;
+			misses[i] = strings + (size_t)i * 64 + 32;
+			snprintf(keys[i], 32, "group%u/key%u", i % 64, i);
+			snprintf(misses[i], 32, "group%u/miss%u", i % 64, i);
+		}
+		run("string", string_hash_func, string_compare_func, keys,
+		    misses, order, sizes[s], max / sizes[s] * 2);
+
+		for (unsigned int i = 0; i < sizes[s]; i++) {
+			ints[i] = i;
+			ints[max + i] = (uint64_t)max + i;
+			keys[i] = &ints[i];
+			misses[i] = &ints[max + i];
+		}
+		run("uint64", uint64_hash_func, uint64_compare_func, keys,
+		    misses, order, sizes[s], max / sizes[s] * 2);
+	}
+
+	free(keys);
+	free(misses);
+	free(ints);
+	free(strings);
+	free(order);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,676 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buxton.h"
+#include "stats.h"
+#include "util.h"
+
+/**
+ * Concurrent load benchmark
+ *
+ * Starts a buxtond with a temporary configuration and database
+ * directory, then runs client processes against it for a fixed time.
+ * Each client picks a random key in one of the configured layers and
+ * either reads or writes it. Watcher processes register for changes on
+ * every key and time how long notifications take to arrive, using the
+ * timestamp the writer stored at the start of each value.
+ *
+ * Results are written to stdout as a single JSON object, so runs of
+ * different daemon builds can be compared by scripts.
+ */
+
+#define BENCH_GROUP "bench"
+#define BENCH_MAX_LAYERS 8
+
+typedef struct BenchConfig {
+	const char *daemon; /**<Path to the buxtond binary */
+	const char *modules; /**<Backend module directory */
+	char *layers[BENCH_MAX_LAYERS]; /**<Layers to spread the keys over */
+	unsigned int nlayers; /**<Number of layers */
+	unsigned int clients; /**<Reading and writing processes */
+	unsigned int watchers; /**<Notified processes */
+	unsigned int interval; /**<Milliseconds between notifications of a watcher */
+	unsigned int keys; /**<Keys per layer */
+	unsigned int value_size; /**<Bytes per value */
+	unsigned int read_percent; /**<Share of reads, the rest are writes */
+	unsigned int workers; /**<Daemon worker threads */
+	unsigned int seconds; /**<Duration of the run */
+	char dir[64]; /**<Temporary directory */
+	char conf[128]; /**<Temporary configuration file */
+} BenchConfig;
+
+/* Shared with the client processes */
+typedef struct BenchShared {
+	unsigned int ready; /**<Watchers registered for notifications */
+	int stop; /**<Set when watchers should exit */
+	BuxtonOpStats results[]; /**<GET, SET and CHANGED counters per process */
+} BenchShared;
+
+static BenchShared *shared;
+static size_t shared_size;
+static BuxtonKey *keys;
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [OPTION...]\n\n"
+	       "  -d, --daemon PATH      buxtond binary to benchmark (./buxtond)\n"
+	       "  -m, --modules DIR      backend module directory\n"
+	       "  -l, --layers LIST      comma separated layers: temp, base, user (temp)\n"
+	       "  -c, --clients N        reading and writing clients (16)\n"
+	       "  -n, --watchers N       clients notified of every change (2)\n"
+	       "  -i, --interval N       coalesce notifications of watchers to one\n"
+	       "                         per N milliseconds, 0 for none (0)\n"
+	       "  -k, --keys N           keys per layer (100)\n"
+	       "  -s, --value-size N     bytes per value (32)\n"
+	       "  -r, --read-percent N   share of reads, the rest are writes (80)\n"
+	       "  -w, --workers N        daemon worker threads (4)\n"
+	       "  -t, --time N           seconds to run (5)\n"
+	       "  -h, --help             show this help\n", name);
+}
+
+static bool parse_uint(const char *arg, unsigned int min, unsigned int max,
+		       unsigned int *out)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(arg, &end, 10);
+	if (errno || *end || end == arg || v < min || v > max) {
+		return false;
+	}
+	*out = (unsigned int)v;
+	return true;
+}
+
+static bool parse_layers(BenchConfig *cfg, char *arg)
+{
+	char *save = NULL;
+	char *layer;
+
+	cfg->nlayers = 0;
+	for (layer = strtok_r(arg, ",", &save); layer;
+	     layer = strtok_r(NULL, ",", &save)) {
+		if (cfg->nlayers == BENCH_MAX_LAYERS) {
+			return false;
+		}
+		if (!streq(layer, "temp") && !streq(layer, "base") &&
+		    !streq(layer, "user")) {
+			return false;
+		}
+		cfg->layers[cfg->nlayers++] = layer;
+	}
+	return cfg->nlayers > 0;
+}
+
+static bool write_config(BenchConfig *cfg)
+{
+	FILE *f;
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/load2", cfg->dir);
+	f = fopen(path, "w");
+	if (!f) {
+		return false;
+	}
+	fclose(f);
+
+	snprintf(cfg->conf, sizeof(cfg->conf), "%s/buxton.conf", cfg->dir);
+	f = fopen(cfg->conf, "w");
+	if (!f) {
+		return false;
+	}
+	fprintf(f, "[Configuration]\n"
+		"ModuleDirectory=%s\n"
+		"DatabasePath=%s\n"
+		"SmackLoadFile=%s/load2\n"
+		"SocketPath=%s/socket\n"
+		"WorkerThreads=%u\n\n"
+		"[base]\nType=System\nBackend=gdbm\nPriority=0\n"
+		"Description=Benchmark system layer\n\n"
+		"[temp]\nType=System\nBackend=memory\nPriority=99\n"
+		"Description=Benchmark memory layer\n\n"
+		"[user]\nType=User\nBackend=gdbm\nPriority=1000\n"
+		"Description=Benchmark user layer\n",
+		cfg->modules, cfg->dir, cfg->dir, cfg->dir, cfg->workers);
+	return fclose(f) == 0;
+}
+
+static int remove_entry(const char *path,
+			__attribute__((unused)) const struct stat *sb,
+			__attribute__((unused)) int flag,
+			__attribute__((unused)) struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static pid_t start_daemon(BenchConfig *cfg)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execl(cfg->daemon, cfg->daemon, "-c", cfg->conf,
+		      (const char *)NULL);
+		fprintf(stderr, "Failed to run %s: %s\n", cfg->daemon,
+			strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+	return pid;
+}
+
+static int connect_client(BuxtonClient *client)
+{
+	int fd;
+
+	/* The daemon may still be starting */
+	for (int i = 0; i < 500; i++) {
+		fd = buxton_open(client);
+		if (fd >= 0) {
+			return fd;
+		}
+		usleep(10000);
+	}
+	return -1;
+}
+
+static void status_callback(BuxtonResponse response, void *data)
+{
+	int32_t *status = data;
+
+	*status = buxton_response_status(response);
+}
+
+static BuxtonKey *key_at(BenchConfig *cfg, unsigned int layer,
+			 unsigned int key)
+{
+	return &keys[layer * cfg->keys + key];
+}
+
+static bool create_keys(BenchConfig *cfg)
+{
+	char name[32];
+
+	keys = calloc((size_t)cfg->nlayers * cfg->keys, sizeof(BuxtonKey));
+	if (!keys) {
+		return false;
+	}
+	for (unsigned int l = 0; l < cfg->nlayers; l++) {
+		for (unsigned int k = 0; k < cfg->keys; k++) {
+			snprintf(name, sizeof(name), "k%u", k);
+			*key_at(cfg, l, k) = buxton_key_create(BENCH_GROUP, name,
+							       cfg->layers[l],
+							       BUXTON_TYPE_STRING);
+			if (!*key_at(cfg, l, k)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static void fill_value(char *value, unsigned int size)
+{
+	char stamp[24];
+	int len;
+
+	memset(value, 'x', size);
+	value[size] = '\0';
+	/* Watchers read the time of the write back from the value */
+	len = snprintf(stamp, sizeof(stamp), "%" PRIu64, buxton_stats_now());
+	if (len > 0 && (unsigned int)len < size) {
+		memcpy(value, stamp, (size_t)len);
+		value[len] = ' ';
+	}
+}
+
+static bool populate(BenchConfig *cfg)
+{
+	BuxtonClient client;
+	BuxtonKey group;
+	_cleanup_free_ char *value = NULL;
+	int32_t status;
+
+	if (connect_client(&client) < 0) {
+		fprintf(stderr, "Failed to connect to the daemon\n");
+		return false;
+	}
+	if (!create_keys(cfg)) {
+		abort();
+	}
+	value = malloc(cfg->value_size + 1);
+	if (!value) {
+		abort();
+	}
+
+	for (unsigned int l = 0; l < cfg->nlayers; l++) {
+		group = buxton_key_create(BENCH_GROUP, NULL, cfg->layers[l],
+					  BUXTON_TYPE_STRING);
+		if (!group) {
+			abort();
+		}
+		/* The group may exist already if a layer is listed twice */
+		if (buxton_create_group(client, group, NULL, NULL, true)) {
+			buxton_key_free(group);
+			goto fail;
+		}
+		buxton_key_free(group);
+
+		for (unsigned int k = 0; k < cfg->keys; k++) {
+			fill_value(value, cfg->value_size);
+			status = -1;
+			if (buxton_set_value(client, *key_at(cfg, l, k), value,
+					     status_callback, &status, true) ||
+			    status) {
+				fprintf(stderr, "Failed to set %s key %u\n",
+					cfg->layers[l], k);
+				goto fail;
+			}
+		}
+	}
+
+	buxton_close(client);
+	return true;
+
+fail:
+	buxton_close(client);
+	return false;
+}
+
+static int run_client(BenchConfig *cfg, unsigned int id, BuxtonOpStats *out)
+{
+	BuxtonClient client;
+	BuxtonControlMessage msg;
+	BuxtonKey key;
+	_cleanup_free_ char *value = NULL;
+	unsigned int seed = id + 1;
+	uint64_t end;
+	uint64_t start;
+	int32_t status;
+	int r;
+
+	if (connect_client(&client) < 0) {
+		return EXIT_FAILURE;
+	}
+	if (!create_keys(cfg)) {
+		abort();
+	}
+	value = malloc(cfg->value_size + 1);
+	if (!value) {
+		abort();
+	}
+
+	end = buxton_stats_now() + (uint64_t)cfg->seconds * 1000000000;
+	while ((start = buxton_stats_now()) < end) {
+		key = *key_at(cfg, (unsigned int)rand_r(&seed) % cfg->nlayers,
+			      (unsigned int)rand_r(&seed) % cfg->keys);
+		status = -1;
+		if ((unsigned int)rand_r(&seed) % 100 < cfg->read_percent) {
+			msg = BUXTON_CONTROL_GET;
+			r = buxton_get_value(client, key, status_callback,
+					     &status, true);
+		} else {
+			msg = BUXTON_CONTROL_SET;
+			fill_value(value, cfg->value_size);
+			r = buxton_set_value(client, key, value,
+					     status_callback, &status, true);
+		}
+		buxton_stats_record(msg, r || status, 0, 0,
+				    buxton_stats_now() - start);
+	}
+
+	buxton_stats_get(BUXTON_CONTROL_GET, &out[0]);
+	buxton_stats_get(BUXTON_CONTROL_SET, &out[1]);
+	buxton_close(client);
+	return EXIT_SUCCESS;
+}
+
+static void notify_callback(BuxtonResponse response,
+			    __attribute__((unused)) void *data)
+{
+	_cleanup_free_ char *value = NULL;
+	uint64_t now = buxton_stats_now();
+	uint64_t stamp;
+	char *end;
+
+	if (buxton_response_type(response) != BUXTON_CONTROL_CHANGED) {
+		return;
+	}
+	value = buxton_response_value(response);
+	if (!value) {
+		/* the key was unset */
+		return;
+	}
+	stamp = strtoull(value, &end, 10);
+	if (end == value || *end != ' ' || stamp > now) {
+		buxton_stats_record(BUXTON_CONTROL_CHANGED, true, 0, 0, 0);
+		return;
+	}
+	buxton_stats_record(BUXTON_CONTROL_CHANGED, false, 0, 0, now - stamp);
+}
+
+static int run_watcher(BenchConfig *cfg, BuxtonOpStats *out)
+{
+	BuxtonClient client;
+	struct pollfd pfd;
+	int ret = EXIT_FAILURE;
+	int r;
+
+	pfd.fd = connect_client(&client);
+	if (pfd.fd < 0) {
+		/* Do not keep the clients waiting */
+		(void)__atomic_add_fetch(&shared->ready, 1, __ATOMIC_SEQ_CST);
+		return EXIT_FAILURE;
+	}
+	if (!create_keys(cfg)) {
+		abort();
+	}
+
+	/* Notifications are per group and name, whatever the layer */
+	for (unsigned int k = 0; k < cfg->keys; k++) {
+		if (buxton_register_coalesced_notification(client,
+							   *key_at(cfg, 0, k),
+							   cfg->interval,
+							   notify_callback,
+							   NULL, true)) {
+			(void)__atomic_add_fetch(&shared->ready, 1,
+						 __ATOMIC_SEQ_CST);
+			goto end;
+		}
+	}
+	(void)__atomic_add_fetch(&shared->ready, 1, __ATOMIC_SEQ_CST);
+
+	pfd.events = POLLIN;
+	while (!__atomic_load_n(&shared->stop, __ATOMIC_SEQ_CST)) {
+		r = poll(&pfd, 1, 100);
+		if (r < 0 && errno != EINTR) {
+			goto end;
+		}
+		if (r > 0 && buxton_client_handle_response(client) < 0) {
+			goto end;
+		}
+	}
+
+	buxton_stats_get(BUXTON_CONTROL_CHANGED, out);
+	ret = EXIT_SUCCESS;
+
+end:
+	buxton_close(client);
+	return ret;
+}
+
+static void merge(BuxtonOpStats *dst, BuxtonOpStats *src)
+{
+	dst->count += src->count;
+	dst->errors += src->errors;
+	dst->total_ns += src->total_ns;
+	if (src->max_ns > dst->max_ns) {
+		dst->max_ns = src->max_ns;
+	}
+	for (unsigned int i = 0; i < BUXTON_STATS_BUCKETS; i++) {
+		dst->latency[i] += src->latency[i];
+	}
+}
+
+static void print_op(const char *name, BuxtonOpStats *stats, double seconds,
+		     bool last)
+{
+	printf("  \"%s\": {\"count\": %" PRIu64 ", \"errors\": %" PRIu64
+	       ", \"per_sec\": %.1f, \"mean_ns\": %" PRIu64
+	       ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+	       ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}%s\n",
+	       name, stats->count, stats->errors,
+	       (double)stats->count / seconds,
+	       stats->count ? stats->total_ns / stats->count : 0,
+	       buxton_stats_percentile(stats, 500),
+	       buxton_stats_percentile(stats, 990),
+	       buxton_stats_percentile(stats, 999),
+	       stats->max_ns, last ? "" : ",");
+}
+
+static void print_results(BenchConfig *cfg, double seconds)
+{
+	BuxtonOpStats get, set, changed;
+
+	memzero(&get, sizeof(get));
+	memzero(&set, sizeof(set));
+	memzero(&changed, sizeof(changed));
+	for (unsigned int i = 0; i < cfg->clients; i++) {
+		merge(&get, &shared->results[i * 2]);
+		merge(&set, &shared->results[i * 2 + 1]);
+	}
+	for (unsigned int i = 0; i < cfg->watchers; i++) {
+		merge(&changed, &shared->results[cfg->clients * 2 + i]);
+	}
+
+	printf("{\n  \"daemon\": \"%s\",\n  \"layers\": [", cfg->daemon);
+	for (unsigned int l = 0; l < cfg->nlayers; l++) {
+		printf("%s\"%s\"", l ? ", " : "", cfg->layers[l]);
+	}
+	printf("],\n  \"clients\": %u,\n  \"watchers\": %u,\n"
+	       "  \"interval\": %u,\n  \"keys\": %u,\n  \"value_size\": %u,\n"
+	       "  \"read_percent\": %u,\n  \"workers\": %u,\n"
+	       "  \"seconds\": %.3f,\n  \"ops_per_sec\": %.1f,\n",
+	       cfg->clients, cfg->watchers, cfg->interval, cfg->keys,
+	       cfg->value_size, cfg->read_percent, cfg->workers, seconds,
+	       (double)(get.count + set.count) / seconds);
+	print_op("get", &get, seconds, false);
+	print_op("set", &set, seconds, false);
+	print_op("notify", &changed, seconds, true);
+	printf("}\n");
+}
+
+static bool wait_children(pid_t *pids, unsigned int count)
+{
+	bool ret = true;
+	int status;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EXIT_SUCCESS) {
+			ret = false;
+		}
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	BenchConfig cfg = {
+		.daemon = "./buxtond",
+		.modules = _MODULE_DIRECTORY,
+		.clients = 16,
+		.watchers = 2,
+		.keys = 100,
+		.value_size = 32,
+		.read_percent = 80,
+		.workers = 4,
+		.seconds = 5,
+	};
+	char default_layers[] = "temp";
+	static struct option opts[] = {
+		{ "daemon", 1, NULL, 'd' },
+		{ "modules", 1, NULL, 'm' },
+		{ "layers", 1, NULL, 'l' },
+		{ "clients", 1, NULL, 'c' },
+		{ "watchers", 1, NULL, 'n' },
+		{ "interval", 1, NULL, 'i' },
+		{ "keys", 1, NULL, 'k' },
+		{ "value-size", 1, NULL, 's' },
+		{ "read-percent", 1, NULL, 'r' },
+		{ "workers", 1, NULL, 'w' },
+		{ "time", 1, NULL, 't' },
+		{ "help", 0, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	_cleanup_free_ pid_t *pids = NULL;
+	pid_t daemon_pid;
+	uint64_t start;
+	double seconds;
+	bool ok = false;
+	int status;
+	int c;
+
+	(void)parse_layers(&cfg, default_layers);
+	while ((c = getopt_long(argc, argv, "d:m:l:c:n:i:k:s:r:w:t:h", opts,
+				NULL)) != -1) {
+		bool valid = true;
+
+		switch (c) {
+		case 'd':
+			cfg.daemon = optarg;
+			break;
+		case 'm':
+			cfg.modules = optarg;
+			break;
+		case 'l':
+			valid = parse_layers(&cfg, optarg);
+			break;
+		case 'c':
+			valid = parse_uint(optarg, 1, 1024, &cfg.clients);
+			break;
+		case 'n':
+			valid = parse_uint(optarg, 0, 64, &cfg.watchers);
+			break;
+		case 'i':
+			valid = parse_uint(optarg, 0, 60000, &cfg.interval);
+			break;
+		case 'k':
+			valid = parse_uint(optarg, 1, 100000, &cfg.keys);
+			break;
+		case 's':
+			valid = parse_uint(optarg, 1, 16384, &cfg.value_size);
+			break;
+		case 'r':
+			valid = parse_uint(optarg, 0, 100, &cfg.read_percent);
+			break;
+		case 'w':
+			valid = parse_uint(optarg, 0, 64, &cfg.workers);
+			break;
+		case 't':
+			valid = parse_uint(optarg, 1, 3600, &cfg.seconds);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			valid = false;
+			break;
+		}
+		if (!valid) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(cfg.dir, sizeof(cfg.dir), "/tmp/buxton-bench-XXXXXX");
+	if (!mkdtemp(cfg.dir)) {
+		fprintf(stderr, "Failed to create a temporary directory: %s\n",
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (!write_config(&cfg)) {
+		fprintf(stderr, "Failed to write the configuration: %s\n",
+			strerror(errno));
+		goto remove;
+	}
+	buxton_set_conf_file(cfg.conf);
+
+	shared_size = sizeof(BenchShared) +
+		sizeof(BuxtonOpStats) * (cfg.clients * 2 + cfg.watchers);
+	shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = calloc(cfg.clients + cfg.watchers, sizeof(pid_t));
+	if (shared == MAP_FAILED || !pids) {
+		abort();
+	}
+
+	daemon_pid = start_daemon(&cfg);
+	if (daemon_pid < 0) {
+		goto remove;
+	}
+	/* Children must not inherit an open connection */
+	if (!populate(&cfg)) {
+		goto stop;
+	}
+
+	for (unsigned int i = 0; i < cfg.watchers; i++) {
+		pids[cfg.clients + i] = fork();
+		if (pids[cfg.clients + i] == 0) {
+			_exit(run_watcher(&cfg,
+					  &shared->results[cfg.clients * 2 + i]));
+		}
+	}
+	while (__atomic_load_n(&shared->ready, __ATOMIC_SEQ_CST) < cfg.watchers) {
+		usleep(10000);
+	}
+
+	start = buxton_stats_now();
+	for (unsigned int i = 0; i < cfg.clients; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			_exit(run_client(&cfg, i, &shared->results[i * 2]));
+		}
+	}
+	ok = wait_children(pids, cfg.clients);
+	seconds = (double)(buxton_stats_now() - start) / 1e9;
+
+	/* Let the last notifications arrive */
+	usleep(100000);
+	__atomic_store_n(&shared->stop, 1, __ATOMIC_SEQ_CST);
+	if (!wait_children(pids + cfg.clients, cfg.watchers)) {
+		ok = false;
+	}
+
+	if (ok) {
+		print_results(&cfg, seconds);
+	} else {
+		fprintf(stderr, "A benchmark client failed\n");
+	}
+
+stop:
+	kill(daemon_pid, SIGTERM);
+	(void)waitpid(daemon_pid, &status, 0);
+remove:
+	(void)nftw(cfg.dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,466 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+/* This program replaces malloc itself, see below */
+#define BUXTON_ALLOC_NO_WRAP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buxtonarray.h"
+#include "hashmap.h"
+#include "serialize.h"
+#include "smack.h"
+#include "util.h"
+
+/**
+ * Hot path microbenchmark
+ *
+ * Times the primitives every request goes through: wire message
+ * serialization, stored value serialization, key hashing, hashmap
+ * lookups and Smack access checks. Inputs are shaped like real
+ * traffic, a SET request, a GET reply and a list_names reply of 100
+ * names. Both ns/op and heap allocations/op are printed, the latter
+ * by counting calls to the malloc family, which this program replaces.
+ */
+
+#define BENCH_VALUE "0123456789abcdef0123456789abcdef"
+#define BENCH_NAMES 100
+#define BENCH_RULES 1000
+
+/* glibc's allocator, wrapped below to count allocations */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocations;
+
+/* Results that must not be optimized away */
+static volatile unsigned sink;
+
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+typedef void (*bench_func_t)(void *data);
+
+/* Inputs shared by the benchmarked functions */
+typedef struct BenchMessage {
+	BuxtonControlMessage type; /**<Message type */
+	BuxtonArray *list; /**<Parameters to serialize */
+	uint8_t *packed; /**<Serialized form of list */
+	size_t size; /**<Length of packed */
+} BenchMessage;
+
+typedef struct BenchValue {
+	BuxtonData data; /**<Value to serialize */
+	BuxtonString label; /**<Label to serialize */
+	uint8_t *packed; /**<Serialized form of data and label */
+} BenchValue;
+
+typedef struct BenchKeys {
+	char **keys; /**<Keys stored in map */
+	char **misses; /**<Keys not stored in map */
+	unsigned int count; /**<Length of keys and misses */
+	unsigned int next; /**<Index of the next key to use */
+	Hashmap *map; /**<Map of keys */
+} BenchKeys;
+
+typedef struct BenchSmack {
+	BuxtonString subject; /**<Subject label */
+	BuxtonString object; /**<Object label */
+	bool expected; /**<Whether read access is granted */
+} BenchSmack;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void run(const char *name, bench_func_t func, void *data,
+		unsigned int count)
+{
+	uint64_t start;
+	uint64_t ns;
+	uint64_t allocs;
+
+	/* warm up caches and lazily allocated state */
+	for (unsigned int i = 0; i < count / 100 + 1; i++) {
+		func(data);
+	}
+
+	allocs = allocations;
+	start = now_ns();
+	for (unsigned int i = 0; i < count; i++) {
+		func(data);
+	}
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+
+	printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name,
+	       (double)ns / (double)count, (double)allocs / (double)count);
+}
+
+static BuxtonData *new_string(const char *value)
+{
+	BuxtonData *d = malloc0(sizeof(BuxtonData));
+
+	if (!d) {
+		abort();
+	}
+	d->type = BUXTON_TYPE_STRING;
+	d->store.d_string.value = strdup(value);
+	if (!d->store.d_string.value) {
+		abort();
+	}
+	d->store.d_string.length = (uint32_t)strlen(value) + 1;
+	return d;
+}
+
+static BuxtonData *new_int32(int32_t value)
+{
+	BuxtonData *d = malloc0(sizeof(BuxtonData));
+
+	if (!d) {
+		abort();
+	}
+	d->type = BUXTON_TYPE_INT32;
+	d->store.d_int32 = value;
+	return d;
+}
+
+static void message_init(BenchMessage *msg, BuxtonControlMessage type,
+			 BuxtonArray *list)
+{
+	msg->type = type;
+	msg->list = list;
+	msg->size = buxton_serialize_message(&msg->packed, type, 1, list);
+	if (!msg->size) {
+		abort();
+	}
+}
+
+static void message_free(BenchMessage *msg)
+{
+	buxton_array_free(&msg->list, (buxton_free_func)data_free);
+	free(msg->packed);
+}
+
+static void serialize_message(void *data)
+{
+	BenchMessage *msg = data;
+	uint8_t *packed = NULL;
+
+	if (!buxton_serialize_message(&packed, msg->type, 1, msg->list)) {
+		abort();
+	}
+	free(packed);
+}
+
+static void deserialize_message(void *data)
+{
+	BenchMessage *msg = data;
+	BuxtonControlMessage type;
+	BuxtonData *list = NULL;
+	uint32_t msgid;
+	ssize_t count;
+
+	count = buxton_deserialize_message(msg->packed, &type, msg->size,
+					   &msgid, &list);
+	if (count != (ssize_t)msg->list->len) {
+		abort();
+	}
+	for (ssize_t i = 0; i < count; i++) {
+		if (list[i].type == BUXTON_TYPE_STRING) {
+			free(list[i].store.d_string.value);
+		}
+	}
+	free(list);
+}
+
+static void serialize_value(void *data)
+{
+	BenchValue *value = data;
+	uint8_t *packed = NULL;
+
+	if (!buxton_serialize(&value->data, &value->label, &packed)) {
+		abort();
+	}
+	free(packed);
+}
+
+static void deserialize_value(void *data)
+{
+	BenchValue *value = data;
+	BuxtonData target;
+	BuxtonString label;
+
+	buxton_deserialize(value->packed, &target, &label);
+	if (target.type == BUXTON_TYPE_STRING) {
+		free(target.store.d_string.value);
+	}
+	free(label.value);
+}
+
+static void hash_key(void *data)
+{
+	BenchKeys *keys = data;
+
+	sink = string_hash_func(keys->keys[keys->next++ % keys->count]);
+}
+
+static void hashmap_hit(void *data)
+{
+	BenchKeys *keys = data;
+
+	if (!hashmap_get(keys->map, keys->keys[keys->next++ % keys->count])) {
+		abort();
+	}
+}
+
+static void hashmap_miss(void *data)
+{
+	BenchKeys *keys = data;
+
+	if (hashmap_get(keys->map, keys->misses[keys->next++ % keys->count])) {
+		abort();
+	}
+}
+
+static void hashmap_put_remove(void *data)
+{
+	BenchKeys *keys = data;
+	char *key = keys->misses[keys->next++ % keys->count];
+
+	if (hashmap_put(keys->map, key, key) != 1) {
+		abort();
+	}
+	if (!hashmap_remove(keys->map, key)) {
+		abort();
+	}
+}
+
+static void smack_access(void *data)
+{
+	BenchSmack *smack = data;
+
+	if (buxton_check_smack_access(&smack->subject, &smack->object,
+				      ACCESS_READ) != smack->expected) {
+		abort();
+	}
+}
+
+static void bench_messages(unsigned int count)
+{
+	BenchMessage msg;
+	BuxtonArray *list;
+	char name[32];
+
+	/* a SET request, as sent by clients */
+	list = buxton_array_new();
+	if (!buxton_array_add(list, new_string("base")) ||
+	    !buxton_array_add(list, new_string("bench")) ||
+	    !buxton_array_add(list, new_string("key42")) ||
+	    !buxton_array_add(list, new_string(BENCH_VALUE))) {
+		abort();
+	}
+	message_init(&msg, BUXTON_CONTROL_SET, list);
+	run("serialize set", serialize_message, &msg, count);
+	run("deserialize set", deserialize_message, &msg, count);
+	message_free(&msg);
+
+	/* a GET reply, as sent by the daemon */
+	list = buxton_array_new();
+	if (!buxton_array_add(list, new_int32(0)) ||
+	    !buxton_array_add(list, new_string(BENCH_VALUE))) {
+		abort();
+	}
+	message_init(&msg, BUXTON_CONTROL_STATUS, list);
+	run("serialize get reply", serialize_message, &msg, count);
+	run("deserialize get reply", deserialize_message, &msg, count);
+	message_free(&msg);
+
+	/* a list_names reply */
+	list = buxton_array_new();
+	if (!buxton_array_add(list, new_int32(0))) {
+		abort();
+	}
+	for (unsigned int i = 0; i < BENCH_NAMES; i++) {
+		snprintf(name, sizeof(name), "key%u", i);
+		if (!buxton_array_add(list, new_string(name))) {
+			abort();
+		}
+	}
+	message_init(&msg, BUXTON_CONTROL_STATUS, list);
+	run("serialize list reply", serialize_message, &msg, count / 20);
+	run("deserialize list reply", deserialize_message, &msg, count / 20);
+	message_free(&msg);
+}
+
+static void bench_values(unsigned int count)
+{
+	BenchValue value;
+
+	value.label = buxton_string_pack("_");
+	value.data.type = BUXTON_TYPE_STRING;
+	value.data.store.d_string = buxton_string_pack(BENCH_VALUE);
+	if (!buxton_serialize(&value.data, &value.label, &value.packed)) {
+		abort();
+	}
+	run("serialize string", serialize_value, &value, count);
+	run("deserialize string", deserialize_value, &value, count);
+	free(value.packed);
+
+	value.data.type = BUXTON_TYPE_INT32;
+	value.data.store.d_int32 = 42;
+	if (!buxton_serialize(&value.data, &value.label, &value.packed)) {
+		abort();
+	}
+	run("serialize int32", serialize_value, &value, count);
+	run("deserialize int32", deserialize_value, &value, count);
+	free(value.packed);
+}
+
+static void bench_keys(unsigned int count)
+{
+	BenchKeys keys;
+
+	keys.count = 1000;
+	keys.next = 0;
+	keys.keys = malloc(sizeof(char *) * keys.count);
+	keys.misses = malloc(sizeof(char *) * keys.count);
+	keys.map = hashmap_new(string_hash_func, string_compare_func);
+	if (!keys.keys || !keys.misses || !keys.map) {
+		abort();
+	}
+	for (unsigned int i = 0; i < keys.count; i++) {
+		if (asprintf(&keys.keys[i], "group%u/key%u", i % 16, i) == -1 ||
+		    asprintf(&keys.misses[i], "group%u/miss%u", i % 16, i) == -1) {
+			abort();
+		}
+		if (hashmap_put(keys.map, keys.keys[i], keys.keys[i]) != 1) {
+			abort();
+		}
+	}
+
+	run("string_hash_func", hash_key, &keys, count);
+	run("hashmap_get", hashmap_hit, &keys, count);
+	run("hashmap_get miss", hashmap_miss, &keys, count);
+	run("hashmap_put+remove", hashmap_put_remove, &keys, count);
+
+	hashmap_free(keys.map);
+	for (unsigned int i = 0; i < keys.count; i++) {
+		free(keys.keys[i]);
+		free(keys.misses[i]);
+	}
+	free(keys.keys);
+	free(keys.misses);
+}
+
+static void bench_smack(unsigned int count)
+{
+	char path[] = "/tmp/buxton-bench-load2-XXXXXX";
+	BenchSmack smack;
+	FILE *f;
+	int fd;
+
+	/* a rule set of realistic size, with the checked rule in it */
+	fd = mkstemp(path);
+	if (fd == -1) {
+		abort();
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		abort();
+	}
+	for (unsigned int i = 0; i < BENCH_RULES; i++) {
+		fprintf(f, "app%u data%u rw\n", i, i % 50);
+	}
+	fclose(f);
+
+	setenv("BUXTON_SMACK_LOAD_FILE", path, 1);
+	if (!buxton_cache_smack_rules()) {
+		abort();
+	}
+	unlink(path);
+	if (!buxton_smack_enabled()) {
+		printf("%-24s skipped, Smack is not enabled\n", "smack");
+		return;
+	}
+
+	smack.subject = buxton_string_pack("app7");
+	smack.object = buxton_string_pack("app7");
+	smack.expected = true;
+	run("smack same label", smack_access, &smack, count);
+	smack.object = buxton_string_pack("data7");
+	run("smack rule hit", smack_access, &smack, count);
+	smack.object = buxton_string_pack("data8");
+	smack.expected = false;
+	run("smack rule miss", smack_access, &smack, count);
+}
+
+int main(void)
+{
+	unsigned int count = 1000000;
+
+	bench_messages(count);
+	bench_values(count);
+	bench_keys(count);
+	bench_smack(count);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -14,6 +14,7 @@
 #endif
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,7 @@
 #include "buxtonarray.h"
 #include "buxtonresponse.h"
 #include "client.h"
+#include "compiler.h"
 #include "direct.h"
 #include "hashmap.h"
 #include "protocol.h"
@@ -74,6 +76,25 @@ bool cli_create_db(BuxtonControl *control,
 	return ret;
 }
 
+bool cli_compile(BuxtonControl *control,
+		 __attribute__((unused)) BuxtonDataType type,
+		 char *one,
+		 char *two,
+		 __attribute__((unused)) char *three,
+		 __attribute__((unused)) char *four)
+{
+	BuxtonString layer_name;
+
+	if (!control->client.direct) {
+		printf("Unable to compile a layer in non direct mode\n");
+		return false;
+	}
+
+	layer_name = buxton_string_pack(one);
+
+	return buxton_compile_layer(control, &layer_name, two);
+}
+
 bool cli_set_label(BuxtonControl *control, BuxtonDataType type,
 		   char *one, char *two, char *three, char *four)
 {
@@ -675,8 +696,8 @@ void free_data_in_array(void *item)
 
 bool get_list_names(BuxtonControl *control, char *layer, char *group, char *prefix, struct nameslist *list)
 {
-	uint16_t index;
-	uint16_t count;
+	uint32_t index;
+	uint32_t count;
 	BuxtonString slayer;
 	BuxtonString sgroup;
 	BuxtonString sprefix;
@@ -774,6 +795,133 @@ bool cli_list_names(BuxtonControl *control,
 	return true;
 }
 
+static void stats_callback(BuxtonResponse response, void *data)
+{
+	bool *ret = (bool *)data;
+	uint32_t count;
+	char *name;
+
+	if (buxton_response_status(response) != 0) {
+		return;
+	}
+
+	count = buxton_response_stats_count(response);
+	for (uint32_t index = 0; index < count; index++) {
+		name = buxton_response_stats_name(response, index);
+		if (!name) {
+			return;
+		}
+		printf("%s %" PRIu64 "\n", name,
+		       buxton_response_stats_value(response, index));
+		free(name);
+	}
+	*ret = true;
+}
+
+bool cli_stats(BuxtonControl *control,
+	       __attribute__((unused)) BuxtonDataType type,
+	       __attribute__((unused)) char *one,
+	       __attribute__((unused)) char *two,
+	       __attribute__((unused)) char *three,
+	       __attribute__((unused)) char *four)
+{
+	bool ret = false;
+
+	if (control->client.direct) {
+		printf("Unable to get statistics in direct mode\n");
+		return false;
+	}
+
+	if (buxton_get_stats(&control->client, stats_callback, &ret, true)) {
+		return false;
+	}
+
+	return ret;
+}
+
+/* Where a change feed stands after a reply */
+typedef struct ChangesCursor {
+	uint64_t resume; /**<Sequence number to resume from */
+	bool more; /**<More changes remain */
+	bool ok; /**<The reply was handled */
+} ChangesCursor;
+
+static void changes_callback(BuxtonResponse response, void *data)
+{
+	ChangesCursor *cursor = (ChangesCursor *)data;
+	uint32_t count;
+	BuxtonKey key;
+	char *layer, *group, *name;
+
+	if (buxton_response_status(response) != 0) {
+		return;
+	}
+
+	if (buxton_response_changes_resync(response)) {
+		printf("resync\n");
+	}
+	count = buxton_response_changes_count(response);
+	for (uint32_t index = 0; index < count; index++) {
+		key = buxton_response_changes_key(response, index);
+		if (!key) {
+			return;
+		}
+		layer = buxton_key_get_layer(key);
+		group = buxton_key_get_group(key);
+		name = buxton_key_get_name(key);
+		if (name) {
+			printf("%s %s %s\n", layer, group, name);
+		} else {
+			printf("%s %s\n", layer, group);
+		}
+		free(layer);
+		free(group);
+		free(name);
+		buxton_key_free(key);
+	}
+	cursor->resume = buxton_response_changes_resume(response);
+	cursor->more = buxton_response_changes_more(response);
+	cursor->ok = true;
+}
+
+bool cli_changes(BuxtonControl *control,
+		 __attribute__((unused)) BuxtonDataType type,
+		 char *one,
+		 __attribute__((unused)) char *two,
+		 __attribute__((unused)) char *three,
+		 __attribute__((unused)) char *four)
+{
+	ChangesCursor cursor = { 0, false, false };
+
+	if (control->client.direct) {
+		printf("Unable to get changes in direct mode\n");
+		return false;
+	}
+
+	if (one) {
+		errno = 0;
+		cursor.resume = strtoull(one, NULL, 10);
+		if (errno) {
+			printf("Invalid sequence number\n");
+			return false;
+		}
+	}
+
+	do {
+		cursor.ok = false;
+		if (buxton_get_changes(&control->client, cursor.resume,
+				       changes_callback, &cursor, true)) {
+			return false;
+		}
+		if (!cursor.ok) {
+			return false;
+		}
+	} while (cursor.more);
+
+	printf("resume %" PRIu64 "\n", cursor.resume);
+	return true;
+}
+
 void unset_value_callback(BuxtonResponse response, void *data)
 {
 	BuxtonKey key = buxton_response_key(response);
@@ -85,6 +85,24 @@ bool cli_create_db(BuxtonControl *control,
 		   char *four)
 	__attribute__((warn_unused_result));
 
+/**
+ * Compile a layer into an immutable file
+ * @param control An initialized control structure
+ * @param type Unused
+ * @param one Layer to compile
+ * @param two Path of the compiled file
+ * @param three Unused
+ * @param four Unused
+ * @returns bool indicating success or failure
+ */
+bool cli_compile(BuxtonControl *control,
+		 BuxtonDataType type,
+		 char *one,
+		 char *two,
+		 char *three,
+		 char *four)
+	__attribute__((warn_unused_result));
+
 /**
  * Set a label in Buxton
  * @param control An initialized control structure
@@ -191,6 +209,42 @@ bool cli_list_keys(BuxtonControl *control,
 		   __attribute__((unused)) char *four)
 	__attribute__((warn_unused_result));
 
+/**
+ * Print the request statistics of the daemon
+ * @param control An initialized control structure
+ * @param type Unused
+ * @param one Unused
+ * @param two Unused
+ * @param three Unused
+ * @param four Unused
+ * @returns bool indicating success or failure
+ */
+bool cli_stats(BuxtonControl *control,
+	       BuxtonDataType type,
+	       char *one,
+	       char *two,
+	       char *three,
+	       char *four)
+	__attribute__((warn_unused_result));
+
+/**
+ * Print the changes made since a sequence number, and where to resume
+ * @param control An initialized control structure
+ * @param type Unused
+ * @param one Sequence number of the last change seen, if any
+ * @param two Unused
+ * @param three Unused
+ * @param four Unused
+ * @returns bool indicating success or failure
+ */
+bool cli_changes(BuxtonControl *control,
+		 BuxtonDataType type,
+		 char *one,
+		 char *two,
+		 char *three,
+		 char *four)
+	__attribute__((warn_unused_result));
+
 /*
  * List keys or groups for a layer in Buxton
  * @param control An initialized control structure
@@ -96,7 +96,10 @@ int main(int argc, char **argv)
 	Command c_create_group, c_remove_group;
 	Command c_unset_value;
 	Command c_create_db;
+	Command c_compile;
 	Command c_list_groups, c_list_keys;
+	Command c_stats;
+	Command c_changes;
 	Command *command;
 	int i = 0;
 	int c;
@@ -229,6 +232,11 @@ int main(int argc, char **argv)
 				    1, 1, "layer", &cli_create_db, BUXTON_TYPE_STRING };
 	hashmap_put(commands, c_create_db.name, &c_create_db);
 
+	/* Compile a layer */
+	c_compile = (Command) { "compile", "Compile a layer into an immutable file",
+				2, 2, "layer file", &cli_compile, BUXTON_TYPE_UNSET };
+	hashmap_put(commands, c_compile.name, &c_compile);
+
 	/* Listing of names */
 	c_list_groups = (Command) { "list-groups", "List the groups for a layer",
 				    1, 2, "layer [prefix-filter]", &cli_list_names, 0 };
@@ -238,6 +246,15 @@ int main(int argc, char **argv)
 				    2, 3, "layer group [prefix-filter]", &cli_list_names, 1 };
 	hashmap_put(commands, c_list_keys.name, &c_list_keys);
 
+	/* Daemon statistics */
+	c_stats = (Command) { "stats", "Print request statistics of the daemon",
+			      0, 0, "", &cli_stats, BUXTON_TYPE_UNSET };
+	hashmap_put(commands, c_stats.name, &c_stats);
+
+	c_changes = (Command) { "changes", "Print the changes made since a sequence number",
+				0, 1, "[since]", &cli_changes, BUXTON_TYPE_UNSET };
+	hashmap_put(commands, c_changes.name, &c_changes);
+
 	static struct option opts[] = {
 		{ "config-file", 1, NULL, 'c' },
 		{ "direct",	 0, NULL, 'd' },
@@ -15,32 +15,384 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <attr/xattr.h>
+#include <sys/eventfd.h>
 
+#include "alloc.h"
 #include "daemon.h"
 #include "direct.h"
 #include "log.h"
+#include "smack.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 #include "buxtonlist.h"
 
-static char *notify_key_name(_BuxtonKey *key)
+/*
+ * With worker threads, each client is served by a single worker, the
+ * only thread to read from or write to its socket. The notification
+ * mappings are shared by all workers and guarded by notify_lock;
+ * notifications for clients of another worker are queued to it.
+ */
+static __thread BuxtonWorker *current_worker = NULL;
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Coalesced notifications held for clients of the main thread */
+static BuxtonNotification *main_held = NULL;
+
+static void lock_notify(void)
+{
+	if (pthread_mutex_lock(&notify_lock)) {
+		abort();
+	}
+}
+
+static void unlock_notify(void)
+{
+	if (pthread_mutex_unlock(&notify_lock)) {
+		abort();
+	}
+}
+
+static void lock_worker(BuxtonWorker *worker)
+{
+	if (pthread_mutex_lock(&worker->lock)) {
+		abort();
+	}
+}
+
+static void unlock_worker(BuxtonWorker *worker)
+{
+	if (pthread_mutex_unlock(&worker->lock)) {
+		abort();
+	}
+}
+
+static void wake_worker(BuxtonWorker *worker)
+{
+	uint64_t one = 1;
+	__attribute__((unused)) bool unused;
+
+	unused = _write(worker->wakeup, (uint8_t *)&one, sizeof(one));
+}
+
+/*
+ * Takes ownership of data. The worker's own messages are written at
+ * the end of its current loop iteration, others are woken up.
+ */
+static void queue_message(BuxtonWorker *worker, client_list_item *client,
+			  uint8_t *data, size_t size)
+{
+	BuxtonQueuedMessage *msg;
+
+	msg = malloc0(sizeof(BuxtonQueuedMessage));
+	if (!msg) {
+		abort();
+	}
+	LIST_INIT(BuxtonQueuedMessage, item, msg);
+	msg->client = client;
+	msg->data = data;
+	msg->size = size;
+	buxton_alloc_hold(BUXTON_ALLOC_CLIENT, msg);
+	buxton_alloc_hold(BUXTON_ALLOC_CLIENT, data);
+
+	lock_worker(worker);
+	LIST_PREPEND(BuxtonQueuedMessage, item, worker->outgoing, msg);
+	unlock_worker(worker);
+	if (worker != current_worker) {
+		wake_worker(worker);
+	}
+}
+
+static void free_queued_message(BuxtonQueuedMessage *msg)
+{
+	buxton_alloc_release(BUXTON_ALLOC_CLIENT, msg->data);
+	buxton_alloc_release(BUXTON_ALLOC_CLIENT, msg);
+	free(msg->data);
+	free(msg);
+}
+
+/* Shared values are charged to notifications, along with registrations */
+static void hold_data(BuxtonData *data)
+{
+	if (!data) {
+		return;
+	}
+	buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, data);
+	if (data->type == BUXTON_TYPE_STRING) {
+		buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, data->store.d_string.value);
+	}
+}
+
+static void release_data(BuxtonData *data)
+{
+	if (!data) {
+		return;
+	}
+	buxton_alloc_release(BUXTON_ALLOC_NOTIFY, data);
+	if (data->type == BUXTON_TYPE_STRING) {
+		buxton_alloc_release(BUXTON_ALLOC_NOTIFY, data->store.d_string.value);
+	}
+}
+
+/*
+ * Takes ownership of data, which may be NULL for an unset key, layer
+ * may be NULL if unknown
+ */
+static BuxtonNotifyValue *notify_value_new(BuxtonNotifyKey *nkey,
+					   BuxtonData *data,
+					   BuxtonString *layer)
+{
+	BuxtonNotifyValue *value;
+
+	value = malloc0(sizeof(BuxtonNotifyValue));
+	if (!value) {
+		abort();
+	}
+	value->data = data;
+	if (layer) {
+		value->layer = *layer;
+	}
+	value->version = ++nkey->version;
+	value->refcount = 1;
+	buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, value);
+	hold_data(data);
+
+	return value;
+}
+
+static BuxtonNotifyValue *notify_value_ref(BuxtonNotifyValue *value)
+{
+	value->refcount++;
+	return value;
+}
+
+static void notify_value_unref(BuxtonNotifyValue *value)
+{
+	if (!value || --value->refcount) {
+		return;
+	}
+	release_data(value->data);
+	buxton_alloc_release(BUXTON_ALLOC_NOTIFY, value);
+	free_buxton_data(&value->data);
+	free(value);
+}
+
+static bool notify_value_equal(BuxtonData *a, BuxtonData *b)
+{
+	if (!a || !b || a->type != b->type) {
+		return false;
+	}
+
+	switch (a->type) {
+	case BUXTON_TYPE_STRING:
+		return a->store.d_string.length == b->store.d_string.length &&
+			!memcmp(a->store.d_string.value, b->store.d_string.value,
+				a->store.d_string.length);
+	case BUXTON_TYPE_INT32:
+		return a->store.d_int32 == b->store.d_int32;
+	case BUXTON_TYPE_UINT32:
+		return a->store.d_uint32 == b->store.d_uint32;
+	case BUXTON_TYPE_INT64:
+		return a->store.d_int64 == b->store.d_int64;
+	case BUXTON_TYPE_UINT64:
+		return a->store.d_uint64 == b->store.d_uint64;
+	case BUXTON_TYPE_FLOAT:
+		return !memcmp(&a->store.d_float, &b->store.d_float,
+			       sizeof(float));
+	case BUXTON_TYPE_DOUBLE:
+		return !memcmp(&a->store.d_double, &b->store.d_double,
+			       sizeof(double));
+	case BUXTON_TYPE_BOOLEAN:
+		return a->store.d_boolean == b->store.d_boolean;
+	default:
+		buxton_log("Internal state corruption: Notification data type invalid\n");
+		abort();
+	}
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Held notifications are flushed by the thread serving their client */
+static BuxtonNotification **held_list(BuxtonWorker *worker)
+{
+	return worker ? &worker->held : &main_held;
+}
+
+static void notify_hold_cancel(BuxtonNotification *nitem)
+{
+	if (!nitem->held) {
+		return;
+	}
+	LIST_REMOVE(BuxtonNotification, hold, *held_list(nitem->worker), nitem);
+	notify_value_unref(nitem->held);
+	nitem->held = NULL;
+}
+
+/*
+ * A subscriber with an interval gets a change right away if it got none
+ * within the interval. Later changes replace each other in held until
+ * the thread serving the client flushes the newest one.
+ */
+static bool notify_hold(BuxtonNotification *nitem, BuxtonNotifyValue *cur,
+			uint64_t now)
+{
+	if (!nitem->held && now >= nitem->next_send) {
+		nitem->next_send = now + nitem->interval;
+		return false;
+	}
+
+	if (nitem->held) {
+		notify_value_unref(nitem->held);
+	} else {
+		LIST_PREPEND(BuxtonNotification, hold,
+			     *held_list(nitem->worker), nitem);
+		/* Its poll timeout doesn't account for the new hold yet */
+		if (nitem->worker && nitem->worker != current_worker) {
+			wake_worker(nitem->worker);
+		}
+	}
+	nitem->held = notify_value_ref(cur);
+
+	return true;
+}
+
+/* Drops the registration, the caller unlinks it */
+static void notification_free(BuxtonNotification *nitem)
+{
+	notify_hold_cancel(nitem);
+	notify_value_unref(nitem->value);
+	buxton_alloc_release(BUXTON_ALLOC_NOTIFY, nitem);
+	free(nitem);
+}
+
+void buxtond_notify_key_free(BuxtonNotifyKey *nkey)
+{
+	BuxtonNotification *nitem, *next;
+
+	if (!nkey) {
+		return;
+	}
+	LIST_FOREACH_SAFE(subscribers, nitem, next, nkey->subscribers) {
+		notification_free(nitem);
+	}
+	notify_value_unref(nkey->value);
+	buxton_alloc_release(BUXTON_ALLOC_NOTIFY, nkey);
+	buxton_key_id_unref(nkey->id);
+	free(nkey->name);
+	free(nkey);
+}
+
+/* Takes the reference to id of a key, or ownership of name of a prefix */
+static BuxtonNotifyKey *notify_key_new(BuxtonKeyId *id, char *name)
+{
+	BuxtonNotifyKey *nkey;
+
+	nkey = malloc0(sizeof(BuxtonNotifyKey));
+	if (!nkey) {
+		abort();
+	}
+	nkey->id = id;
+	nkey->name = name;
+	buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, nkey);
+
+	return nkey;
+}
+
+/* Reference to the identity of a key that can be watched, or NULL */
+static BuxtonKeyId *notify_key_id(BuxtonDaemon *self, _BuxtonKey *key)
+{
+	if (!key->group.value || !*key->group.value ||
+	    !key->name.value || !*key->name.value)
+		return NULL;
+
+	if (key->id) {
+		return buxton_key_id_ref(key->id);
+	}
+	return buxton_key_intern(self->key_ids, key);
+}
+
+/* Subscriptions to a whole group have an empty prefix */
+static char *notify_prefix_name(_BuxtonKey *key)
 {
 	int r;
 	char *result;
 
-	if (!*key->group.value || !*key->name.value)
+	if (!key->group.value || !*key->group.value)
 		return NULL;
 
-	r = asprintf(&result, "%s\n%s", key->group.value, key->name.value);
+	r = asprintf(&result, "%s\n%s", key->group.value,
+		     key->name.value ? key->name.value : "");
 	if (r == -1) {
 		abort();
 	}
 	return result;
 }
 
+/* Links a registration to the key or prefix it watches and to its client */
+static void notification_link(BuxtonNotifyKey *nkey, BuxtonNotification *nitem)
+{
+	nitem->nkey = nkey;
+	LIST_PREPEND(BuxtonNotification, subscribers, nkey->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, client_subs,
+		     nitem->client->subscriptions, nitem);
+}
+
+/* Registration of client on nkey, searched among the client's own */
+static BuxtonNotification *notification_find(client_list_item *client,
+					     BuxtonNotifyKey *nkey)
+{
+	BuxtonNotification *nitem;
+
+	if (!nkey) {
+		return NULL;
+	}
+	LIST_FOREACH(client_subs, nitem, client->subscriptions) {
+		if (nitem->nkey == nkey) {
+			return nitem;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Unlinks and drops a registration, along with the key or prefix it
+ * watches once nobody else does
+ */
+static void notification_remove(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	BuxtonNotifyKey *nkey = nitem->nkey;
+
+	LIST_REMOVE(BuxtonNotification, subscribers, nkey->subscribers, nitem);
+	LIST_REMOVE(BuxtonNotification, client_subs,
+		    nitem->client->subscriptions, nitem);
+	notification_free(nitem);
+
+	if (nkey->subscribers) {
+		return;
+	}
+	if (nkey->id) {
+		(void)hashmap_remove(self->notify_mapping, nkey->id);
+	} else {
+		(void)buxton_trie_remove(self->notify_prefixes, nkey->name);
+	}
+	buxtond_notify_key_free(nkey);
+}
+
 bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		_BuxtonKey *key, BuxtonData **value)
 {
@@ -60,6 +412,39 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->type = list[3].type;
 		*value = &(list[3]);
 		break;
+	case BUXTON_CONTROL_CAS:
+		/* A set followed by a version, then an optional value */
+		if (count != 5 && count != 6) {
+			return false;
+		}
+		if (list[4].type != BUXTON_TYPE_UINT64) {
+			return false;
+		}
+		if (count == 6 && list[5].type != list[3].type) {
+			return false;
+		}
+		return parse_list(BUXTON_CONTROL_SET, 4, list, key, value);
+	case BUXTON_CONTROL_ADD:
+		if (count != 5) {
+			return false;
+		}
+		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING ||
+		    list[2].type != BUXTON_TYPE_STRING || list[3].type != BUXTON_TYPE_UINT32 ||
+		    list[4].type != BUXTON_TYPE_INT64) {
+			return false;
+		}
+		if (list[3].store.d_uint32 != BUXTON_TYPE_INT32 &&
+		    list[3].store.d_uint32 != BUXTON_TYPE_UINT32 &&
+		    list[3].store.d_uint32 != BUXTON_TYPE_INT64 &&
+		    list[3].store.d_uint32 != BUXTON_TYPE_UINT64) {
+			return false;
+		}
+		key->layer = list[0].store.d_string;
+		key->group = list[1].store.d_string;
+		key->name = list[2].store.d_string;
+		key->type = list[3].store.d_uint32;
+		*value = &list[4];
+		break;
 	case BUXTON_CONTROL_SET_LABEL:
 		if (count == 3) {
 			if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING ||
@@ -185,13 +570,20 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->type = list[3].store.d_uint32;
 		break;
 	case BUXTON_CONTROL_NOTIFY:
-		if (count != 3) {
+		if (count != 3 && count != 4) {
 			return false;
 		}
 		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING ||
 		    list[2].type != BUXTON_TYPE_UINT32) {
 			return false;
 		}
+		/* Optional coalescing interval */
+		if (count == 4) {
+			if (list[3].type != BUXTON_TYPE_UINT32) {
+				return false;
+			}
+			*value = &list[3];
+		}
 		key->group = list[0].store.d_string;
 		key->name = list[1].store.d_string;
 		key->type = list[2].store.d_uint32;
@@ -208,6 +600,39 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->name = list[1].store.d_string;
 		key->type = list[2].store.d_uint32;
 		break;
+	case BUXTON_CONTROL_STATS:
+		if (count != 0) {
+			return false;
+		}
+		break;
+	case BUXTON_CONTROL_CHANGES:
+		if (count != 1) {
+			return false;
+		}
+		if (list[0].type != BUXTON_TYPE_UINT64) {
+			return false;
+		}
+		*value = &list[0];
+		break;
+	case BUXTON_CONTROL_GET_IF_CHANGED:
+		/* A get followed by the version known to the client */
+		if (count < 1 || list[count - 1].type != BUXTON_TYPE_UINT64) {
+			return false;
+		}
+		*value = &list[count - 1];
+		return parse_list(BUXTON_CONTROL_GET, count - 1, list, key, value);
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		if (count != 2) {
+			return false;
+		}
+		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING) {
+			return false;
+		}
+		key->type = BUXTON_TYPE_UNSET;
+		key->group = list[0].store.d_string;
+		key->name = list[1].store.d_string;
+		break;
 	default:
 		return false;
 	}
@@ -215,31 +640,63 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 	return true;
 }
 
+/* Number the changes made by a successful request in the change log */
+static void record_change(BuxtonDaemon *self, client_list_item *client,
+			  BuxtonControlMessage msg, _BuxtonKey *key,
+			  int32_t response)
+{
+	BuxtonLayer *layer;
+
+	if (response != 0 || !key->id || !key->layer.value) {
+		return;
+	}
+	if (msg != BUXTON_CONTROL_SET && msg != BUXTON_CONTROL_CAS &&
+	    msg != BUXTON_CONTROL_ADD && msg != BUXTON_CONTROL_UNSET &&
+	    msg != BUXTON_CONTROL_CREATE_GROUP &&
+	    msg != BUXTON_CONTROL_REMOVE_GROUP) {
+		return;
+	}
+
+	layer = hashmap_get(self->buxton.config.layers, key->layer.value);
+	if (!layer) {
+		return;
+	}
+	(void)buxton_change_log_append(self->changes, key->id, layer,
+				       client->cred.uid);
+}
+
 bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t size)
 {
-	BuxtonControlMessage msg;
-	int32_t response;
+	BuxtonControlMessage msg = BUXTON_CONTROL_MIN;
+	int32_t response = 0;
 	BuxtonData *list = NULL;
 	_cleanup_buxton_data_ BuxtonData *data = NULL;
 	uint16_t i;
 	ssize_t p_count;
-	size_t response_len;
+	size_t response_len = 0;
 	BuxtonData response_data, mdata;
 	BuxtonData *value = NULL;
 	_BuxtonKey key = {{0}, {0}, {0}, 0};
-	BuxtonArray *out_list = NULL, *key_list = NULL;
+	BuxtonArray *out_list = NULL, *key_list = NULL, *stats_list = NULL;
+	BuxtonArray *changes_list = NULL;
 	_cleanup_free_ uint8_t *response_store = NULL;
 	uid_t uid;
 	bool ret = false;
 	uint32_t msgid = 0;
 	uint32_t n_msgid = 0;
+	uint64_t start;
 
 	assert(self);
 	assert(client);
 
+	start = buxton_stats_now();
+	buxton_stats_request_begin();
+
 	uid = self->buxton.client.uid;
+	buxton_trace_begin(BUXTON_TRACE_DESERIALIZE);
 	p_count = buxton_deserialize_message((uint8_t*)client->data, &msg, size,
 					     &msgid, &list);
+	buxton_trace_end(BUXTON_TRACE_DESERIALIZE);
 	if (p_count < 0) {
 		if (errno == ENOMEM) {
 			abort();
@@ -254,15 +711,31 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		goto end;
 	}
 
+	buxton_trace_request(msg);
+	buxton_trace_begin(BUXTON_TRACE_PARSE);
 	if (!parse_list(msg, (size_t)p_count, list, &key, &value)) {
+		buxton_trace_end(BUXTON_TRACE_PARSE);
 		goto end;
 	}
+	/* The key is hashed here once, for every lookup of the request */
+	key.id = buxton_key_intern(self->key_ids, &key);
+	buxton_trace_end(BUXTON_TRACE_PARSE);
 
 	/* use internal function from buxtond */
 	switch (msg) {
 	case BUXTON_CONTROL_SET:
 		set_value(self, client, &key, value, &response);
 		break;
+	case BUXTON_CONTROL_CAS:
+		data = compare_and_set(self, client, &key, value,
+				       value[1].store.d_uint64,
+				       p_count == 6 ? &value[2] : NULL,
+				       &response);
+		break;
+	case BUXTON_CONTROL_ADD:
+		data = add_value(self, client, &key, value->store.d_int64,
+				 &response);
+		break;
 	case BUXTON_CONTROL_SET_LABEL:
 		set_label(self, client, &key, value, &response);
 		break;
@@ -275,6 +748,13 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 	case BUXTON_CONTROL_GET:
 		data = get_value(self, client, &key, &response);
 		break;
+	case BUXTON_CONTROL_GET_IF_CHANGED:
+		data = get_value(self, client, &key, &response);
+		if (data && data->version &&
+		    data->version == value->store.d_uint64) {
+			response = BUXTON_STATUS_NOT_MODIFIED;
+		}
+		break;
 	case BUXTON_CONTROL_GET_LABEL:
 		data = get_label(self, client, &key, &response);
 		break;
@@ -289,14 +769,33 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		key_list = list_names(self, client, &key, &response);
 		break;
 	case BUXTON_CONTROL_NOTIFY:
-		register_notification(self, client, &key, msgid, &response);
+		register_notification(self, client, &key, msgid,
+				      value ? value->store.d_uint32 : 0,
+				      &response);
 		break;
 	case BUXTON_CONTROL_UNNOTIFY:
 		n_msgid = unregister_notification(self, client, &key, &response);
 		break;
+	case BUXTON_CONTROL_STATS:
+		stats_list = get_stats(self, client, &response);
+		break;
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+		register_prefix_notification(self, client, &key, msgid,
+					     &response);
+		break;
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		n_msgid = unregister_prefix_notification(self, client, &key,
+							 &response);
+		break;
+	case BUXTON_CONTROL_CHANGES:
+		changes_list = get_changes(self, client, value->store.d_uint64,
+					   &response);
+		break;
 	default:
 		goto end;
 	}
+	record_change(self, client, msg, &key, response);
+
 	/* Set a response code */
 	response_data.type = BUXTON_TYPE_INT32;
 	response_data.store.d_int32 = response;
@@ -308,7 +807,7 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		abort();
 	}
 
-
+	buxton_trace_begin(BUXTON_TRACE_SERIALIZE);
 	switch (msg) {
 		/* TODO: Use cascading switch */
 	case BUXTON_CONTROL_SET:
@@ -360,9 +859,21 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		}
 		break;
 	case BUXTON_CONTROL_GET:
-		if (data && !buxton_array_add(out_list, data)) {
+	case BUXTON_CONTROL_GET_IF_CHANGED:
+	case BUXTON_CONTROL_CAS:
+	case BUXTON_CONTROL_ADD:
+		/* The value is left out if the client has it already */
+		if (data && response != BUXTON_STATUS_NOT_MODIFIED &&
+		    !buxton_array_add(out_list, data)) {
 			abort();
 		}
+		if (data) {
+			mdata.type = BUXTON_TYPE_UINT64;
+			mdata.store.d_uint64 = data->version;
+			if (!buxton_array_add(out_list, &mdata)) {
+				abort();
+			}
+		}
 		response_len = buxton_serialize_message(&response_store,
 							BUXTON_CONTROL_STATUS,
 							msgid, out_list);
@@ -403,10 +914,9 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		break;
 	case BUXTON_CONTROL_LIST:
 		if (key_list) {
-			for (i = 0; i < key_list->len; i++) {
-				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
-					abort();
-				}
+			if (!buxton_array_append(out_list, key_list->data,
+						 key_list->len)) {
+				abort();
 			}
 			buxton_array_free(&key_list, NULL);
 		}
@@ -423,10 +933,9 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		break;
 	case BUXTON_CONTROL_LIST_NAMES:
 		if (key_list) {
-			for (i = 0; i < key_list->len; i++) {
-				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
-					abort();
-				}
+			if (!buxton_array_append(out_list, key_list->data,
+						 key_list->len)) {
+				abort();
 			}
 			buxton_array_free(&key_list, NULL);
 		}
@@ -442,6 +951,7 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		}
 		break;
 	case BUXTON_CONTROL_NOTIFY:
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
 		response_len = buxton_serialize_message(&response_store,
 							BUXTON_CONTROL_STATUS,
 							msgid, out_list);
@@ -454,6 +964,7 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		}
 		break;
 	case BUXTON_CONTROL_UNNOTIFY:
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
 		mdata.type = BUXTON_TYPE_UINT32;
 		mdata.store.d_uint32 = n_msgid;
 		if (!buxton_array_add(out_list, &mdata)) {
@@ -470,28 +981,85 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 			abort();
 		}
 		break;
-	default:
-		goto end;
-	}
-
-	/* Now write the response */
-	ret = _write(client->fd, response_store, response_len);
-	if (ret) {
-		if (msg == BUXTON_CONTROL_SET && response == 0) {
-			buxtond_notify_clients(self, client, &key, value);
-		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
-			buxtond_notify_clients(self, client, &key, NULL);
+	case BUXTON_CONTROL_STATS:
+		if (stats_list) {
+			if (!buxton_array_append(out_list, stats_list->data,
+						 stats_list->len)) {
+				abort();
+			}
 		}
-	}
-
-end:
-	/* Restore our own UID */
-	self->buxton.client.uid = uid;
-	if (out_list) {
-		buxton_array_free(&out_list, NULL);
-	}
-	if (list) {
-		for (i=0; i < p_count; i++) {
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize stats response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_CHANGES:
+		if (changes_list) {
+			if (!buxton_array_append(out_list, changes_list->data,
+						 changes_list->len)) {
+				abort();
+			}
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize changes response message\n");
+			abort();
+		}
+		break;
+	default:
+		goto end;
+	}
+
+	buxton_trace_end(BUXTON_TRACE_SERIALIZE);
+
+	/* Now write the response */
+	buxton_trace_begin(BUXTON_TRACE_WRITE);
+	ret = _write(client->fd, response_store, response_len);
+	buxton_trace_end(BUXTON_TRACE_WRITE);
+	if (ret) {
+		buxton_trace_begin(BUXTON_TRACE_NOTIFY);
+		if (msg == BUXTON_CONTROL_SET && response == 0) {
+			buxtond_notify_clients(self, client, &key, value);
+		} else if ((msg == BUXTON_CONTROL_CAS ||
+			    msg == BUXTON_CONTROL_ADD) && response == 0) {
+			buxtond_notify_clients(self, client, &key, data);
+		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
+			buxtond_notify_clients(self, client, &key, NULL);
+		}
+		buxton_trace_end(BUXTON_TRACE_NOTIFY);
+	}
+
+end:
+	/* Positive statuses, such as BUXTON_STATUS_NOT_MODIFIED, are answers */
+	buxton_stats_record(msg, !ret || response < 0, size,
+			    ret ? response_len : 0, buxton_stats_now() - start);
+	buxton_trace_request_end(start);
+
+	/* Restore our own UID */
+	self->buxton.client.uid = uid;
+	buxton_key_id_unref(key.id);
+	if (out_list) {
+		buxton_array_free(&out_list, NULL);
+	}
+	if (stats_list) {
+		buxton_array_free(&stats_list, (buxton_free_func)data_free);
+	}
+	if (changes_list) {
+		buxton_array_free(&changes_list, (buxton_free_func)data_free);
+	}
+	if (list) {
+		for (i=0; i < p_count; i++) {
 			if (list[i].type == BUXTON_TYPE_STRING) {
 				free(list[i].store.d_string.value);
 			}
@@ -501,130 +1069,415 @@ end:
 	return ret;
 }
 
-void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
-			      _BuxtonKey *key, BuxtonData *value)
+/* Serialize a CHANGED message for params, with a msgid patched per client */
+static size_t notify_serialize(uint8_t **response, BuxtonData **params,
+			       size_t count)
 {
-	BuxtonList *list = NULL;
-	BuxtonList *elem = NULL;
-	BuxtonNotification *nitem;
-	_cleanup_free_ uint8_t* response = NULL;
-	size_t response_len;
 	BuxtonArray *out_list = NULL;
-	_cleanup_free_ char *key_name;
+	size_t response_len;
 
-	assert(self);
-	assert(client);
-	assert(key);
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (params[i] && !buxton_array_add(out_list, params[i])) {
+			abort();
+		}
+	}
 
-	key_name = notify_key_name(key);
-	if (!key_name) {
-		return;
+	response_len = buxton_serialize_message(response, BUXTON_CONTROL_CHANGED,
+						0, out_list);
+	buxton_array_free(&out_list, NULL);
+	if (response_len == 0) {
+		if (errno == ENOMEM) {
+			abort();
+		}
+		buxton_log("Failed to serialize notification\n");
+		abort();
+	}
+
+	return response_len;
+}
+
+/* Changes of a key carry its value and the layer it is effective in */
+static size_t notify_value_serialize(uint8_t **response,
+				     BuxtonNotifyValue *value)
+{
+	BuxtonData d_layer;
+	BuxtonData *params[2];
+
+	if (!value->data) {
+		return notify_serialize(response, NULL, 0);
 	}
-	list = hashmap_get(self->notify_mapping, key_name);
-	if (!list) {
+	buxton_string_to_data(&value->layer, &d_layer);
+	params[0] = value->data;
+	params[1] = value->layer.value ? &d_layer : NULL;
+
+	return notify_serialize(response, params, 2);
+}
+
+/*
+ * Subscribers get the same message but for its msgid, so it is
+ * serialized once and patched for each of them. Sockets are only
+ * written by the worker owning the client, once the notification lock
+ * is released, so a slow subscriber doesn't hold up every change.
+ * Without workers, the main loop writes directly.
+ */
+static void notify_send(BuxtonNotification *nitem, uint8_t *response,
+			size_t response_len)
+{
+	__attribute__((unused)) bool unused;
+	uint8_t *copy;
+
+	buxton_message_set_msgid(response, nitem->msgid);
+
+	if (nitem->worker) {
+		/* The queued copy is owned by the worker */
+		copy = malloc(response_len);
+		if (!copy) {
+			abort();
+		}
+		memcpy(copy, response, response_len);
+		queue_message(nitem->worker, nitem->client, copy,
+			      response_len);
 		return;
 	}
+	unused = _write(nitem->client->fd, response, response_len);
+}
 
-	BUXTON_LIST_FOREACH(list, elem) {
-		nitem = elem->data;
-		int c = 1;
-		__attribute__((unused)) bool unused;
-		free(response);
-		response = NULL;
-
-		if (nitem->old_data && value) {
-			switch (value->type) {
-			case BUXTON_TYPE_STRING:
-				c = memcmp((const void *)
-					   (nitem->old_data->store.d_string.value),
-					   (const void *)(value->store.d_string.value),
-					   value->store.d_string.length);
-				break;
-			case BUXTON_TYPE_INT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int32),
-					   (const void *)&(value->store.d_int32),
-					   sizeof(int32_t));
-				break;
-			case BUXTON_TYPE_UINT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint32),
-					   (const void *)&(value->store.d_uint32),
-					   sizeof(uint32_t));
-				break;
-			case BUXTON_TYPE_INT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int64),
-					   (const void *)&(value->store.d_int64),
-					   sizeof(int64_t));
-				break;
-			case BUXTON_TYPE_UINT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint64),
-					   (const void *)&(value->store.d_uint64),
-					   sizeof(uint64_t));
-				break;
-			case BUXTON_TYPE_FLOAT:
-				c = memcmp((const void *)&(nitem->old_data->store.d_float),
-					   (const void *)&(value->store.d_float),
-					   sizeof(float));
-				break;
-			case BUXTON_TYPE_DOUBLE:
-				c = memcmp((const void *)&(nitem->old_data->store.d_double),
-					   (const void *)&(value->store.d_double),
-					   sizeof(double));
-				break;
-			case BUXTON_TYPE_BOOLEAN:
-				c = memcmp((const void *)&(nitem->old_data->store.d_boolean),
-					   (const void *)&(value->store.d_boolean),
-					   sizeof(bool));
-				break;
-			default:
-				buxton_log("Internal state corruption: Notification data type invalid\n");
+/*
+ * Whether value was overtaken by the one last delivered for the key.
+ * Sets of a key made on different workers are stored in order, but
+ * may reach here in any order, so the stored versions decide. Versions
+ * are only compared within a layer: unsetting a higher layer reveals
+ * an older value that is still the newest state of the key.
+ */
+static bool notify_value_stale(BuxtonNotifyValue *prev, BuxtonData *value,
+			       BuxtonString *layer)
+{
+	if (!prev || !prev->data || !value || !value->version ||
+	    !layer || !layer->value || !prev->layer.value) {
+		return false;
+	}
+	if (!streq(prev->layer.value, layer->value)) {
+		return false;
+	}
+	return value->version < prev->data->version;
+}
+
+/* Returns false if the value is stale and was dropped */
+static bool notify_key_clients(BuxtonNotifyKey *nkey, BuxtonData *value, BuxtonString *layer)
+{
+	BuxtonNotification *nitem;
+	BuxtonNotifyValue *prev;
+	BuxtonNotifyValue *cur;
+	BuxtonData *copy_data = NULL;
+	_cleanup_free_ uint8_t* response = NULL;
+	size_t response_len = 0;
+	uint64_t now = 0;
+
+	/*
+	 * Duplicates are suppressed once per key: the new value is only
+	 * copied if it differs from the last one delivered, and
+	 * subscribers that already have the current version are skipped
+	 */
+	prev = nkey->value;
+	if (notify_value_stale(prev, value, layer)) {
+		buxton_debug("Dropping stale change of %s\n", nkey->id->path);
+		return false;
+	}
+	if (prev && notify_value_equal(prev->data, value)) {
+		cur = prev;
+	} else {
+		if (value) {
+			copy_data = malloc0(sizeof(BuxtonData));
+			if (!copy_data) {
+				abort();
+			}
+			if (!buxton_data_copy(value, copy_data)) {
 				abort();
 			}
 		}
+		cur = notify_value_new(nkey, copy_data, layer);
+		nkey->value = cur;
+	}
 
-		if (!c) {
+	LIST_FOREACH(subscribers, nitem, nkey->subscribers) {
+		if (nitem->value && nitem->value->version == cur->version) {
 			continue;
 		}
-		if (nitem->old_data && (nitem->old_data->type == BUXTON_TYPE_STRING)) {
-			free(nitem->old_data->store.d_string.value);
-		}
-		free(nitem->old_data);
-
-		nitem->old_data = malloc0(sizeof(BuxtonData));
-		if (!nitem->old_data) {
-			abort();
+		/*
+		 * Registered while the key held another value, or changed
+		 * back to the value the client has before a held one was sent
+		 */
+		if (nitem->value != prev &&
+		    notify_value_equal(nitem->value ? nitem->value->data : NULL,
+				       value)) {
+			notify_hold_cancel(nitem);
+			notify_value_unref(nitem->value);
+			nitem->value = notify_value_ref(cur);
+			continue;
 		}
-		if (value) {
-			if (!buxton_data_copy(value, nitem->old_data)) {
-				abort();
+		if (nitem->interval) {
+			if (!now) {
+				now = now_ms();
+			}
+			if (notify_hold(nitem, cur, now)) {
+				continue;
 			}
 		}
+		notify_value_unref(nitem->value);
+		nitem->value = notify_value_ref(cur);
 
-		out_list = buxton_array_new();
-		if (!out_list) {
-			abort();
+		if (!response) {
+			response_len = notify_value_serialize(&response, cur);
 		}
-		if (value) {
-			if (!buxton_array_add(out_list, value)) {
-				abort();
-			}
+		buxton_debug("Notification to %d of key change (%s)\n", nitem->client->fd,
+			     nkey->id->path);
+		notify_send(nitem, response, response_len);
+	}
+
+	/* The key's reference moved to the new value */
+	if (cur != prev) {
+		notify_value_unref(prev);
+	}
+	return true;
+}
+
+/**
+ * State of a change while it is delivered to prefix subscriptions
+ */
+typedef struct BuxtonPrefixChange {
+	BuxtonDaemon *self; /**<buxtond instance being run */
+	_BuxtonKey *key; /**<Key that changed, in the layer it is effective in */
+	BuxtonData *value; /**<New value, NULL if the key was unset */
+	uint8_t *response; /**<Serialized CHANGED message, once needed */
+	size_t response_len; /**<Size of response */
+	BuxtonString label; /**<Label of the key, once needed */
+	bool have_label; /**<Whether the label was looked up */
+} BuxtonPrefixChange;
+
+/*
+ * Prefix subscriptions only checked the group when registered, so
+ * each new key is checked against the client before being sent
+ */
+static bool notify_prefix_allowed(BuxtonPrefixChange *change,
+				  client_list_item *client)
+{
+	BuxtonData data;
+	int ret;
+
+	/* Unset keys have no label left, the group was checked */
+	if (!change->value || !buxton_smack_enabled() ||
+	    !client->smack_label || !client->smack_label->value) {
+		return true;
+	}
+
+	if (!change->have_label) {
+		change->have_label = true;
+		ret = buxton_direct_get_value_for_layer(&change->self->buxton,
+							change->key, &data,
+							&change->label, NULL);
+		if (!ret && data.type == BUXTON_TYPE_STRING) {
+			free(data.store.d_string.value);
 		}
+	}
+	if (!change->label.value) {
+		return false;
+	}
 
-		response_len = buxton_serialize_message(&response,
-							BUXTON_CONTROL_CHANGED,
-							nitem->msgid, out_list);
-		buxton_array_free(&out_list, NULL);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
+	return buxton_check_smack_access(client->smack_label, &change->label,
+					 ACCESS_READ);
+}
+
+static void notify_prefix_clients(void *value, void *data)
+{
+	BuxtonNotifyKey *nkey = value;
+	BuxtonPrefixChange *change = data;
+	BuxtonNotification *nitem;
+	BuxtonData d_group, d_name, d_layer;
+	BuxtonData *params[4];
+
+	LIST_FOREACH(subscribers, nitem, nkey->subscribers) {
+		if (!notify_prefix_allowed(change, nitem->client)) {
+			continue;
+		}
+
+		/* Keys vary, so the message names the key before its value */
+		if (!change->response) {
+			buxton_string_to_data(&change->key->group, &d_group);
+			buxton_string_to_data(&change->key->name, &d_name);
+			buxton_string_to_data(&change->key->layer, &d_layer);
+			params[0] = &d_group;
+			params[1] = &d_name;
+			params[2] = change->value;
+			/* An unset key has no value to follow */
+			params[3] = change->value && change->key->layer.value ?
+				&d_layer : NULL;
+			change->response_len = notify_serialize(&change->response,
+								params, 4);
+		}
+		buxton_debug("Notification to %d of prefix change (%s)\n",
+			     nitem->client->fd, change->key->name.value);
+		notify_send(nitem, change->response, change->response_len);
+	}
+}
+
+/*
+ * Watchers are told about the value of the layer that wins, so a change
+ * hidden by a higher layer isn't sent at all. Returns false for such a
+ * change; if the winning layer was unset, effective is set to the value
+ * revealed and key to its layer.
+ */
+static bool notify_resolve(BuxtonDaemon *self, _BuxtonKey *key,
+			   BuxtonData **effective)
+{
+	BuxtonData *data;
+	BuxtonString label = { NULL, 0 };
+	BuxtonString layer = { NULL, 0 };
+
+	*effective = NULL;
+	if (!key->layer.value) {
+		return true;
+	}
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	if (buxton_direct_get_effective_value(&self->buxton, key, data,
+					      &label, NULL, &layer)) {
+		/* Unset from every layer */
+		free(data);
+		return true;
+	}
+	free(label.value);
+
+	/* The changed layer wins, the value it was given is the effective one */
+	if (!strcmp(layer.value, key->layer.value)) {
+		free_buxton_data(&data);
+		return true;
+	}
+	if (buxton_direct_layer_shadows(&self->buxton, &layer, &key->layer)) {
+		free_buxton_data(&data);
+		return false;
+	}
+
+	key->layer = layer;
+	*effective = data;
+	return true;
+}
+
+void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
+			      _BuxtonKey *key, BuxtonData *value)
+{
+	BuxtonNotifyKey *nkey;
+	BuxtonPrefixChange change;
+	_BuxtonKey changed;
+	_cleanup_buxton_data_ BuxtonData *effective = NULL;
+	BuxtonKeyId *id;
+	bool watched;
+
+	assert(self);
+	assert(client);
+	assert(key);
+
+	id = notify_key_id(self, key);
+	if (!id) {
+		return;
+	}
+
+	/* Resolving the layers reads each of them, only do it for watchers */
+	lock_notify();
+	watched = hashmap_get(self->notify_mapping, id) ||
+		buxton_trie_size(self->notify_prefixes);
+	unlock_notify();
+	if (!watched) {
+		goto end;
+	}
+
+	self->buxton.client.uid = client->cred.uid;
+	changed = *key;
+	if (!notify_resolve(self, &changed, &effective)) {
+		buxton_debug("Change of %s hidden by a higher layer\n",
+			     key->name.value);
+		goto end;
+	}
+	if (effective) {
+		value = effective;
+	}
+
+	lock_notify();
+	nkey = hashmap_get(self->notify_mapping, id);
+	if (nkey && !notify_key_clients(nkey, value, &changed.layer)) {
+		goto unlock;
+	}
+
+	if (buxton_trie_size(self->notify_prefixes)) {
+		memzero(&change, sizeof(BuxtonPrefixChange));
+		change.self = self;
+		change.key = &changed;
+		change.value = value;
+		(void)buxton_trie_foreach_prefix(self->notify_prefixes, id->path,
+						 notify_prefix_clients, &change);
+		free(change.response);
+		free(change.label.value);
+	}
+unlock:
+	unlock_notify();
+
+end:
+	buxton_key_id_unref(id);
+}
+
+int buxtond_notify_flush(void)
+{
+	BuxtonNotification **list;
+	BuxtonNotification *nitem, *next;
+	BuxtonNotifyValue *held;
+	uint8_t *response;
+	size_t response_len;
+	uint64_t now;
+	int timeout = -1;
+
+	lock_notify();
+	list = held_list(current_worker);
+	if (!*list) {
+		unlock_notify();
+		return -1;
+	}
+
+	now = now_ms();
+	LIST_FOREACH_SAFE(hold, nitem, next, *list) {
+		if (nitem->next_send > now) {
+			if (timeout < 0 || nitem->next_send - now < (uint64_t)timeout) {
+				timeout = (int)(nitem->next_send - now);
 			}
-			buxton_log("Failed to serialize notification\n");
-			abort();
+			continue;
 		}
-		buxton_debug("Notification to %d of key change (%s)\n", nitem->client->fd,
-			     key_name);
 
-		unused = _write(nitem->client->fd, response, response_len);
+		LIST_REMOVE(BuxtonNotification, hold, *list, nitem);
+		held = nitem->held;
+		nitem->held = NULL;
+
+		/* A burst that ended on the value the client has sends nothing */
+		if (!notify_value_equal(nitem->value ? nitem->value->data : NULL,
+					held->data)) {
+			response = NULL;
+			response_len = notify_value_serialize(&response, held);
+			buxton_debug("Coalesced notification to %d\n",
+				     nitem->client->fd);
+			notify_send(nitem, response, response_len);
+			free(response);
+			nitem->next_send = now + nitem->interval;
+		}
+		notify_value_unref(nitem->value);
+		nitem->value = held;
 	}
+	unlock_notify();
+
+	return timeout;
 }
 
 void set_value(BuxtonDaemon *self, client_list_item *client, _BuxtonKey *key,
@@ -654,6 +1507,94 @@ void set_value(BuxtonDaemon *self, client_list_item *client, _BuxtonKey *key,
 	buxton_debug("Daemon set value completed\n");
 }
 
+BuxtonData *compare_and_set(BuxtonDaemon *self, client_list_item *client,
+			    _BuxtonKey *key, BuxtonData *value,
+			    uint64_t version, BuxtonData *expected,
+			    int32_t *status)
+{
+	BuxtonData *data = NULL;
+	int ret;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(value);
+	assert(status);
+
+	*status = -1;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+
+	buxton_debug("Daemon comparing and setting [%s][%s][%s]\n",
+		     key->layer.value,
+		     key->group.value,
+		     key->name.value);
+
+	self->buxton.client.uid = client->cred.uid;
+	ret = buxton_direct_compare_and_set(&self->buxton, key, value, expected,
+					    version, data, client->smack_label);
+	if (ret == ECANCELED) {
+		*status = BUXTON_STATUS_MISMATCH;
+		if (data->type == BUXTON_TYPE_UNSET) {
+			goto fail;
+		}
+		return data;
+	}
+	if (ret) {
+		goto fail;
+	}
+
+	/* Reply with the value as stored, with its new version */
+	if (!buxton_data_copy(value, data)) {
+		abort();
+	}
+
+	*status = 0;
+	buxton_debug("Daemon compare and set completed\n");
+	return data;
+
+fail:
+	free(data);
+	return NULL;
+}
+
+BuxtonData *add_value(BuxtonDaemon *self, client_list_item *client,
+		      _BuxtonKey *key, int64_t delta, int32_t *status)
+{
+	BuxtonData *data = NULL;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(status);
+
+	*status = -1;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+
+	buxton_debug("Daemon adding to [%s][%s][%s]\n",
+		     key->layer.value,
+		     key->group.value,
+		     key->name.value);
+
+	self->buxton.client.uid = client->cred.uid;
+	if (buxton_direct_add_value(&self->buxton, key, delta, data,
+				    client->smack_label)) {
+		free(data);
+		return NULL;
+	}
+
+	*status = 0;
+	buxton_debug("Daemon add value completed\n");
+	return data;
+}
+
 void set_label(BuxtonDaemon *self, client_list_item *client, _BuxtonKey *key,
 	       BuxtonData *value, int32_t *status)
 {
@@ -857,50 +1798,230 @@ end:
 	return data;
 }
 
-BuxtonArray *list_keys(BuxtonDaemon *self, client_list_item *client,
-		       BuxtonString *layer, int32_t *status)
+BuxtonArray *list_keys(BuxtonDaemon *self, client_list_item *client,
+		       BuxtonString *layer, int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+	assert(self);
+	assert(client);
+	assert(layer);
+	assert(status);
+
+	*status = -1;
+	if (buxton_direct_list_keys(&self->buxton, layer, &ret_list)) {
+		*status = 0;
+	}
+	return ret_list;
+}
+
+BuxtonArray *list_names(BuxtonDaemon *self,  client_list_item *client,
+			_BuxtonKey *key, int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+	assert(self);
+	assert(client);
+	assert(status);
+
+	*status = -1;
+	if (buxton_direct_list_names(&self->buxton, &key->layer, &key->group,
+	    &key->name, &ret_list)) {
+		*status = 0;
+	}
+	return ret_list;
+}
+
+BuxtonArray *get_stats(BuxtonDaemon *self, client_list_item *client,
+		       int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+	BuxtonCacheStats cache;
+
+	assert(self);
+	assert(client);
+	assert(status);
+
+	ret_list = buxton_array_new();
+	if (!ret_list) {
+		abort();
+	}
+
+	buxton_stats_append(ret_list);
+	buxton_direct_cache_stats(&self->buxton, &cache);
+	buxton_stats_append_value(ret_list, "cache.hits", cache.hits);
+	buxton_stats_append_value(ret_list, "cache.misses", cache.misses);
+	buxton_stats_append_value(ret_list, "cache.evictions", cache.evictions);
+	buxton_stats_append_value(ret_list, "cache.open", cache.open);
+	buxton_stats_append_value(ret_list, "cache.live_bytes", cache.live);
+	buxton_stats_append_value(ret_list, "cache.dead_bytes", cache.dead);
+	buxton_alloc_append(ret_list);
+
+	*status = 0;
+	return ret_list;
+}
+
+/* Serialized size of a parameter, its value aside */
+#define PARAM_WIRE_SIZE (sizeof(uint16_t) + sizeof(uint32_t))
+
+/* Serialized size of a changes reply without any change */
+#define CHANGES_WIRE_SIZE (4 * sizeof(uint32_t) + 4 * PARAM_WIRE_SIZE + \
+			   sizeof(int32_t) + sizeof(uint64_t) + 2 * sizeof(bool))
+
+/* Whether client may read the group a change was made in */
+static bool change_readable(BuxtonDaemon *self, client_list_item *client,
+			    BuxtonChange *change)
+{
+	_BuxtonKey group;
+	BuxtonData data;
+	BuxtonString label = { NULL, 0 };
+	int32_t ret;
+
+	memzero(&group, sizeof(_BuxtonKey));
+	memzero(&data, sizeof(BuxtonData));
+	group.group = change->id->group;
+	group.layer = change->layer->name;
+	group.type = BUXTON_TYPE_STRING;
+	group.id = change->id->parent ? change->id->parent : change->id;
+
+	ret = buxton_direct_get_value(&self->buxton, &group, &data, &label,
+				      client->smack_label);
+	if (!ret) {
+		free(data.store.d_string.value);
+	}
+	free(label.value);
+
+	/* A group removed since can't be checked, only its name is sent */
+	return ret != EPERM;
+}
+
+static BuxtonData *changes_append(BuxtonArray *list, BuxtonDataType type)
+{
+	BuxtonData *d;
+
+	d = malloc0(sizeof(BuxtonData));
+	if (!d) {
+		abort();
+	}
+	d->type = type;
+	if (!buxton_array_add(list, d)) {
+		abort();
+	}
+	return d;
+}
+
+static void changes_append_string(BuxtonArray *list, BuxtonString *string)
 {
-	BuxtonArray *ret_list = NULL;
-	assert(self);
-	assert(client);
-	assert(layer);
-	assert(status);
+	BuxtonData *d;
 
-	*status = -1;
-	if (buxton_direct_list_keys(&self->buxton, layer, &ret_list)) {
-		*status = 0;
+	d = changes_append(list, BUXTON_TYPE_STRING);
+	if (!buxton_string_copy(string, &d->store.d_string)) {
+		abort();
 	}
-	return ret_list;
 }
 
-BuxtonArray *list_names(BuxtonDaemon *self,  client_list_item *client,
-			_BuxtonKey *key, int32_t *status)
+BuxtonArray *get_changes(BuxtonDaemon *self, client_list_item *client,
+			 uint64_t since, int32_t *status)
 {
+	_cleanup_free_ BuxtonChange *changes = NULL;
 	BuxtonArray *ret_list = NULL;
+	BuxtonData *d_resume, *d_resync, *d_more;
+	BuxtonString empty = buxton_string_pack("");
+	BuxtonKeyId *checked_group = NULL;
+	BuxtonLayer *checked_layer = NULL;
+	bool readable = false;
+	bool resync;
+	uint32_t count = 0;
+	uint64_t head;
+	uint64_t resume = since;
+	size_t size;
+	uint32_t i;
+
 	assert(self);
 	assert(client);
 	assert(status);
 
-	*status = -1;
-	if (buxton_direct_list_names(&self->buxton, &key->layer, &key->group,
-	    &key->name, &ret_list)) {
-		*status = 0;
+	changes = malloc0(sizeof(BuxtonChange) * BUXTON_CHANGES_PER_REPLY);
+	if (!changes) {
+		abort();
+	}
+	ret_list = buxton_array_new();
+	if (!ret_list) {
+		abort();
+	}
+
+	resync = !buxton_change_log_read(self->changes, since, changes,
+					 BUXTON_CHANGES_PER_REPLY, &count,
+					 &head);
+	if (resync) {
+		/* The client rereads its keys, then follows from head */
+		resume = head;
+	}
+
+	/* Filled in once the changes that fit are known */
+	d_resume = changes_append(ret_list, BUXTON_TYPE_UINT64);
+	d_resync = changes_append(ret_list, BUXTON_TYPE_BOOLEAN);
+	d_more = changes_append(ret_list, BUXTON_TYPE_BOOLEAN);
+
+	/* Replies must fit in a message, the client drops longer ones */
+	size = CHANGES_WIRE_SIZE;
+	self->buxton.client.uid = client->cred.uid;
+	for (i = 0; i < count; i++) {
+		BuxtonChange *change = &changes[i];
+		BuxtonKeyId *group;
+		BuxtonString *name;
+		size_t change_size;
+
+		/* Other users' layers are nobody else's business */
+		if (change->layer->type == LAYER_USER &&
+		    change->uid != client->cred.uid) {
+			resume = change->seq;
+			continue;
+		}
+
+		group = change->id->parent ? change->id->parent : change->id;
+		if (group != checked_group || change->layer != checked_layer) {
+			readable = change_readable(self, client, change);
+			checked_group = group;
+			checked_layer = change->layer;
+		}
+		if (!readable) {
+			resume = change->seq;
+			continue;
+		}
+
+		name = change->id->name.value ? &change->id->name : &empty;
+		change_size = 3 * PARAM_WIRE_SIZE + change->layer->name.length +
+			change->id->group.length + name->length;
+		if (size + change_size > BUXTON_MESSAGE_MAX_LENGTH) {
+			break;
+		}
+		size += change_size;
+
+		changes_append_string(ret_list, &change->layer->name);
+		changes_append_string(ret_list, &change->id->group);
+		changes_append_string(ret_list, name);
+		resume = change->seq;
 	}
+	for (i = 0; i < count; i++) {
+		buxton_key_id_unref(changes[i].id);
+	}
+
+	d_resume->store.d_uint64 = resume;
+	d_resync->store.d_boolean = resync;
+	d_more->store.d_boolean = resume < head;
+
+	*status = 0;
 	return ret_list;
 }
 
 void register_notification(BuxtonDaemon *self, client_list_item *client,
 			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status)
+			   uint32_t interval, int32_t *status)
 {
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
 	BuxtonNotification *nitem;
+	BuxtonNotifyKey *nkey;
 	BuxtonData *old_data = NULL;
 	int32_t key_status;
-	char *key_name;
-	uint64_t *fd = NULL;
-	char *key_name_copy = NULL;
+	BuxtonKeyId *id;
 
 	assert(self);
 	assert(client);
@@ -909,86 +2030,63 @@ void register_notification(BuxtonDaemon *self, client_list_item *client,
 
 	*status = -1;
 
-	nitem = malloc0(sizeof(BuxtonNotification));
-	if (!nitem) {
-		abort();
+	/* Keys that can't be interned are refused before allocating */
+	id = notify_key_id(self, key);
+	if (!id) {
+		return;
 	}
-	nitem->client = client;
 
 	/* Store data now, cheap */
 	old_data = get_value(self, client, key, &key_status);
 	if (key_status != 0) {
-		free(nitem);
-		return;
-	}
-	nitem->old_data = old_data;
-	nitem->msgid = msgid;
-
-	/* May be null, but will append regardless */
-	key_name = notify_key_name(key);
-	if (!key_name) {
+		buxton_key_id_unref(id);
 		return;
 	}
 
-	key_name_copy = strdup(key_name);
-	if (!key_name_copy) {
+	nitem = malloc0(sizeof(BuxtonNotification));
+	if (!nitem) {
 		abort();
 	}
+	nitem->client = client;
+	nitem->worker = current_worker;
+	nitem->interval = interval;
+	nitem->msgid = msgid;
+	buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, nitem);
 
-	n_list = hashmap_get(self->notify_mapping, key_name);
-	if (!n_list) {
-		if (!buxton_list_append(&n_list, nitem)) {
-			abort();
-		}
-
-		if (hashmap_put(self->notify_mapping, key_name, n_list) < 0) {
+	lock_notify();
+	nkey = hashmap_get(self->notify_mapping, id);
+	if (!nkey) {
+		nkey = notify_key_new(id, NULL);
+		if (hashmap_put(self->notify_mapping, id, nkey) < 0) {
 			abort();
 		}
 	} else {
-		free(key_name);
-		if (!buxton_list_append(&n_list, nitem)) {
-			abort();
-		}
+		buxton_key_id_unref(id);
 	}
 
-	fd = malloc0(sizeof(uint64_t));
-	if (!fd) {
-		abort();
-	}
-	*fd = (uint64_t)client->fd;
-
-	key_list = hashmap_get(self->client_key_mapping, fd);
-	if (!key_list) {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
-			abort();
-		}
-		if(hashmap_put(self->client_key_mapping, fd, key_list) < 0) {
-			abort();
-		}
+	/* Watchers of an unchanged key share its last value */
+	if (nkey->value && notify_value_equal(nkey->value->data, old_data)) {
+		nitem->value = notify_value_ref(nkey->value);
+		free_buxton_data(&old_data);
 	} else {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
-			abort();
+		nitem->value = notify_value_new(nkey, old_data, NULL);
+		if (!nkey->value) {
+			nkey->value = notify_value_ref(nitem->value);
 		}
-		free(fd);
 	}
+	notification_link(nkey, nitem);
+	unlock_notify();
 
 	*status = 0;
 }
 
-uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
-				 _BuxtonKey *key, int32_t *status)
+static uint32_t unregister_notification_locked(BuxtonDaemon *self,
+					       client_list_item *client,
+					       _BuxtonKey *key, int32_t *status)
 {
-	BuxtonList *plist;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem = NULL;
-	BuxtonNotification *nitem, *citem = NULL;
+	BuxtonNotification *citem;
 	uint32_t msgid = 0;
-	_cleanup_free_ char *key_name = NULL;
-	void *old_key_name;
-	char *client_keyname = NULL;
-	uint64_t fd = 0;
-	void *old_fd = NULL;
+	BuxtonKeyId *id;
 
 	assert(self);
 	assert(client);
@@ -996,73 +2094,134 @@ uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
 	assert(status);
 
 	*status = -1;
-	key_name = notify_key_name(key);
-	if (!key_name) {
-		return 0;
-	}
-	n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
-	/* This key isn't actually registered for notifications */
-	if (!n_list) {
+	id = notify_key_id(self, key);
+	if (!id) {
 		return 0;
 	}
-
-	BUXTON_LIST_FOREACH(n_list, elem) {
-		nitem = elem->data;
-		/* Find the list item for this client */
-		if (nitem->client == client) {
-			citem = nitem;
-			break;
-		}
-	};
-
+	citem = notification_find(client, hashmap_get(self->notify_mapping, id));
+	buxton_key_id_unref(id);
 	/* Client hasn't registered for notifications on this key */
 	if (!citem) {
 		return 0;
 	}
 
-	fd = (uint64_t)client->fd;
-	/* Remove key name from client hashmap */
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
+	msgid = citem->msgid;
+	notification_remove(self, citem);
 
-	if (!key_list || !old_fd) {
-		return 0;
-	}
+	*status = 0;
 
-	BUXTON_LIST_FOREACH(key_list, elem) {
-		if (!strcmp(elem->data, key_name)) {
-			client_keyname = elem->data;
-			break;
-		}
-	};
+	return msgid;
+}
 
-	if (client_keyname) {
-		plist = key_list;
-		buxton_list_remove(&key_list, client_keyname, true);
-		if (!key_list) {
-			hashmap_remove(self->client_key_mapping, &fd);
-			free(old_fd);
-		} else if (plist != key_list) {
-			if (hashmap_update(self->client_key_mapping, &fd, key_list) < 0) {
-				abort();
-			}
-		}
+uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
+				 _BuxtonKey *key, int32_t *status)
+{
+	uint32_t msgid;
+
+	lock_notify();
+	msgid = unregister_notification_locked(self, client, key, status);
+	unlock_notify();
+
+	return msgid;
+}
+
+void register_prefix_notification(BuxtonDaemon *self,
+				  client_list_item *client,
+				  _BuxtonKey *key, uint32_t msgid,
+				  int32_t *status)
+{
+	BuxtonNotifyKey *nkey;
+	BuxtonNotification *nitem;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	BuxtonData data;
+	BuxtonString label = {NULL, 0};
+	_cleanup_free_ char *prefix_name = NULL;
+	int32_t ret;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(status);
+
+	*status = -1;
+
+	prefix_name = notify_prefix_name(key);
+	if (!prefix_name) {
+		return;
 	}
 
-	msgid = citem->msgid;
-	/* Remove client from notifications */
-	free_buxton_data(&(citem->old_data));
-	plist = n_list;
-	buxton_list_remove(&n_list, citem, true);
-
-	/* If we removed the last item, remove the mapping too */
-	if (!n_list) {
-		(void)hashmap_remove(self->notify_mapping, key_name);
-		free(old_key_name);
-	} else if (plist != n_list) {
-		if (hashmap_update(self->notify_mapping, key_name, n_list) < 0) {
+	/* Keys created later match too, so only the group can be checked */
+	group.group = key->group;
+	group.type = BUXTON_TYPE_STRING;
+	if (key->id) {
+		group.id = key->id->parent ? key->id->parent : key->id;
+	}
+	self->buxton.client.uid = client->cred.uid;
+	ret = buxton_direct_get_value(&self->buxton, &group, &data, &label,
+				      client->smack_label);
+	if (ret) {
+		buxton_debug("Group %s can't be watched\n", key->group.value);
+		return;
+	}
+	if (data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	free(label.value);
+
+	nitem = malloc0(sizeof(BuxtonNotification));
+	if (!nitem) {
+		abort();
+	}
+	nitem->client = client;
+	nitem->worker = current_worker;
+	nitem->msgid = msgid;
+	buxton_alloc_hold(BUXTON_ALLOC_NOTIFY, nitem);
+
+	lock_notify();
+	nkey = buxton_trie_get(self->notify_prefixes, prefix_name);
+	if (!nkey) {
+		nkey = notify_key_new(NULL, prefix_name);
+		prefix_name = NULL;
+		if (!buxton_trie_put(self->notify_prefixes, nkey->name, nkey)) {
 			abort();
 		}
 	}
+	notification_link(nkey, nitem);
+	unlock_notify();
+
+	*status = 0;
+}
+
+uint32_t unregister_prefix_notification(BuxtonDaemon *self,
+					client_list_item *client,
+					_BuxtonKey *key, int32_t *status)
+{
+	BuxtonNotification *citem;
+	_cleanup_free_ char *prefix_name = NULL;
+	uint32_t msgid;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(status);
+
+	*status = -1;
+
+	prefix_name = notify_prefix_name(key);
+	if (!prefix_name) {
+		return 0;
+	}
+
+	lock_notify();
+	citem = notification_find(client, buxton_trie_get(self->notify_prefixes,
+							  prefix_name));
+	if (!citem) {
+		unlock_notify();
+		return 0;
+	}
+	msgid = citem->msgid;
+	notification_remove(self, citem);
+	unlock_notify();
 
 	*status = 0;
 
@@ -1239,6 +2398,7 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 		cl->data = malloc0(BUXTON_MESSAGE_HEADER_LENGTH);
 		cl->offset = 0;
 		cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
+		buxton_alloc_hold(BUXTON_ALLOC_CLIENT, cl->data);
 	}
 	if (!cl->data) {
 		abort();
@@ -1261,7 +2421,9 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 
 	/* Hand off any read data */
 	do {
+		buxton_trace_begin(BUXTON_TRACE_READ);
 		l = read(self->pollfds[i].fd, (cl->data) + cl->offset, cl->size - cl->offset);
+		buxton_trace_end(BUXTON_TRACE_READ);
 
 		/*
 		 * Close clients with read errors. If there isn't more
@@ -1289,10 +2451,12 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 			}
 		}
 		if (cl->size != BUXTON_MESSAGE_HEADER_LENGTH) {
+			buxton_alloc_release(BUXTON_ALLOC_CLIENT, cl->data);
 			cl->data = realloc(cl->data, cl->size);
 			if (!cl->data) {
 				abort();
 			}
+			buxton_alloc_hold(BUXTON_ALLOC_CLIENT, cl->data);
 		}
 		if (cl->size > cl->offset) {
 			continue;
@@ -1318,6 +2482,7 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 	} while (l > 0);
 
 cleanup:
+	buxton_alloc_release(BUXTON_ALLOC_CLIENT, cl->data);
 	free(cl->data);
 	cl->data = NULL;
 	cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
@@ -1331,75 +2496,312 @@ terminate:
 
 void terminate_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 {
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem, *notify_elem;
-	char *key_name;
-	void *old_key_name = NULL;
-	void *old_fd = NULL;
-	uint64_t fd = (uint64_t)cl->fd;
-
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
+	BuxtonNotification *nitem, *nnext;
+	BuxtonQueuedMessage *msg, *next;
 
-	if (key_list) {
+	lock_notify();
+	if (cl->subscriptions) {
 		buxton_debug("Removing notifications for client before terminating\n");
-		BUXTON_LIST_FOREACH(key_list, elem) {
-			key_name = elem->data;
-			BuxtonList *n_list = NULL;
+	}
+	LIST_FOREACH_SAFE(client_subs, nitem, nnext, cl->subscriptions) {
+		notification_remove(self, nitem);
+	}
+	unlock_notify();
+
+	/* Nothing more can be queued for the client, drop what's pending */
+	if (current_worker) {
+		lock_worker(current_worker);
+		LIST_FOREACH_SAFE(item, msg, next, current_worker->outgoing) {
+			if (msg->client != cl) {
+				continue;
+			}
+			LIST_REMOVE(BuxtonQueuedMessage, item,
+				    current_worker->outgoing, msg);
+			free_queued_message(msg);
+		}
+		unlock_worker(current_worker);
+	}
 
-			n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
-			if (!n_list || !old_key_name) {
-				abort();
+	del_pollfd(self, i);
+	close(cl->fd);
+	if (cl->smack_label) {
+		free(cl->smack_label->value);
+	}
+	free(cl->smack_label);
+	buxton_alloc_release(BUXTON_ALLOC_CLIENT, cl->data);
+	free(cl->data);
+	buxton_debug("Closed connection from fd %d\n", cl->fd);
+	LIST_REMOVE(client_list_item, item, self->client_list, cl);
+	free(cl);
+	cl = NULL;
+}
+
+void buxtond_add_client(BuxtonDaemon *self, client_list_item *cl)
+{
+	BuxtonWorker *worker;
+
+	assert(self);
+	assert(cl);
+
+	if (!self->nworkers) {
+		LIST_PREPEND(client_list_item, item, self->client_list, cl);
+		/* poll for data on this new client as well */
+		add_pollfd(self, cl->fd, POLLIN | POLLPRI, false);
+		return;
+	}
+
+	/* Workers own their clients from here on */
+	worker = &self->workers[self->next_worker];
+	self->next_worker = (self->next_worker + 1) % self->nworkers;
+
+	lock_worker(worker);
+	LIST_PREPEND(client_list_item, item, worker->incoming, cl);
+	unlock_worker(worker);
+	wake_worker(worker);
+}
+
+/* Write and free messages queued for the worker's clients */
+static void write_queued(BuxtonQueuedMessage *outgoing)
+{
+	BuxtonQueuedMessage *msg, *prev;
+	__attribute__((unused)) bool unused;
+
+	if (!outgoing) {
+		return;
+	}
+
+	/* Messages were prepended, so write them from the tail */
+	LIST_FIND_TAIL(BuxtonQueuedMessage, item, outgoing, msg);
+	while (msg) {
+		prev = msg->item_prev;
+		unused = _write(msg->client->fd, msg->data, msg->size);
+		free_queued_message(msg);
+		msg = prev;
+	}
+}
+
+/* Send what the worker queued for its own clients */
+static void worker_flush(BuxtonWorker *worker)
+{
+	BuxtonQueuedMessage *outgoing;
+
+	lock_worker(worker);
+	outgoing = worker->outgoing;
+	worker->outgoing = NULL;
+	unlock_worker(worker);
+
+	write_queued(outgoing);
+}
+
+/* Returns true if the worker was asked to quit */
+static bool worker_wakeup(BuxtonWorker *worker)
+{
+	BuxtonDaemon *self = &worker->daemon;
+	client_list_item *incoming, *cl;
+	BuxtonQueuedMessage *outgoing;
+	uint64_t count;
+	bool quit;
+
+	if (read(worker->wakeup, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		buxton_log("read(): %m\n");
+	}
+
+	lock_worker(worker);
+	incoming = worker->incoming;
+	worker->incoming = NULL;
+	outgoing = worker->outgoing;
+	worker->outgoing = NULL;
+	quit = worker->quit;
+	unlock_worker(worker);
+
+	while ((cl = incoming)) {
+		LIST_REMOVE(client_list_item, item, incoming, cl);
+		LIST_PREPEND(client_list_item, item, self->client_list, cl);
+		add_pollfd(self, cl->fd, POLLIN | POLLPRI, false);
+	}
+
+	write_queued(outgoing);
+
+	return quit;
+}
+
+static void *worker_main(void *data)
+{
+	BuxtonWorker *worker = data;
+	BuxtonDaemon *self = &worker->daemon;
+	bool leftover_messages = false;
+	bool quit = false;
+	int sync_timeout;
+	int notify_timeout;
+	int ret;
+
+	current_worker = worker;
+
+	while (!quit) {
+		/* Flush group commits due after this worker's writes */
+		sync_timeout = buxton_direct_sync(&self->buxton, false);
+		/* and coalesced notifications, waking up for the next ones */
+		notify_timeout = buxtond_notify_flush();
+		if (notify_timeout >= 0 &&
+		    (sync_timeout < 0 || notify_timeout < sync_timeout)) {
+			sync_timeout = notify_timeout;
+		}
+		/* Notifications of the last requests, and of the flush */
+		worker_flush(worker);
+		ret = poll(self->pollfds, self->nfds, leftover_messages ? 0 : sync_timeout);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
+			buxton_log("poll(): %m\n");
+			abort();
+		}
 
-			BuxtonNotification *nitem, *citem = NULL;
+		leftover_messages = false;
 
-			BUXTON_LIST_FOREACH(n_list, notify_elem) {
-				nitem = notify_elem->data;
-				if (nitem->client == cl) {
-					citem = nitem;
+		/* pollfds[0] is the worker's eventfd */
+		if (self->pollfds[0].revents != 0) {
+			quit = worker_wakeup(worker);
+		}
+
+		for (nfds_t i = 1; i < self->nfds; i++) {
+			client_list_item *cl = NULL;
+
+			if (self->pollfds[i].revents == 0) {
+				continue;
+			}
+
+			LIST_FOREACH(item, cl, self->client_list)
+				if (self->pollfds[i].fd == cl->fd) {
 					break;
 				}
-			};
 
-			if (!citem) {
-				abort();
+			assert(cl);
+			if (handle_client(self, cl, i)) {
+				leftover_messages = true;
 			}
+		}
+	}
 
-			/* Remove client from notifications */
-			free_buxton_data(&(citem->old_data));
+	return NULL;
+}
 
-			BuxtonList *old_n_list = n_list;
+void buxtond_start_workers(BuxtonDaemon *self, int count)
+{
+	BuxtonWorker *worker;
+	int r;
 
-			buxton_list_remove(&n_list, citem, true);
+	assert(self);
+	assert(count > 0);
 
-			/* If n_list was changed, hashmap should be updated. */
-			if (n_list && n_list != old_n_list) {
-				hashmap_update(self->notify_mapping, key_name, n_list);
-			}
+	self->workers = malloc0(sizeof(BuxtonWorker) * (size_t)count);
+	if (!self->workers) {
+		abort();
+	}
+	self->nworkers = count;
+	self->next_worker = 0;
+
+	for (int i = 0; i < count; i++) {
+		worker = &self->workers[i];
+
+		/* Configuration and notifications are shared */
+		worker->daemon.buxton = self->buxton;
+		worker->daemon.key_ids = self->key_ids;
+		worker->daemon.changes = self->changes;
+		worker->daemon.notify_mapping = self->notify_mapping;
+		worker->daemon.notify_prefixes = self->notify_prefixes;
+		LIST_HEAD_INIT(client_list_item, worker->daemon.client_list);
+		LIST_HEAD_INIT(client_list_item, worker->incoming);
+		LIST_HEAD_INIT(BuxtonQueuedMessage, worker->outgoing);
+		LIST_HEAD_INIT(BuxtonNotification, worker->held);
+
+		worker->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (worker->wakeup < 0) {
+			buxton_log("eventfd(): %m\n");
+			exit(EXIT_FAILURE);
+		}
+		add_pollfd(&worker->daemon, worker->wakeup, POLLIN, false);
 
-			/* If we removed the last item, remove the mapping too */
-			if (!n_list) {
-				(void)hashmap_remove(self->notify_mapping, key_name);
-				free(old_key_name);
-			}
-		};
-		/* Remove key from client hashmap */
-		hashmap_remove(self->client_key_mapping, &fd);
-		free(old_fd);
-		buxton_list_free_all(&key_list);
+		if (pthread_mutex_init(&worker->lock, NULL)) {
+			abort();
+		}
+
+		r = pthread_create(&worker->thread, NULL, worker_main, worker);
+		if (r) {
+			buxton_log("pthread_create(): %s\n", strerror(r));
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	del_pollfd(self, i);
-	close(cl->fd);
-	if (cl->smack_label) {
-		free(cl->smack_label->value);
+	buxton_debug("Started %d worker threads\n", count);
+}
+
+void buxtond_stop_workers(BuxtonDaemon *self)
+{
+	BuxtonWorker *worker;
+	BuxtonQueuedMessage *msg, *next;
+	BuxtonNotification *nitem, *nnitem;
+	client_list_item *cl, *ncl;
+
+	assert(self);
+
+	for (int i = 0; i < self->nworkers; i++) {
+		worker = &self->workers[i];
+		lock_worker(worker);
+		worker->quit = true;
+		unlock_worker(worker);
+		wake_worker(worker);
 	}
-	free(cl->smack_label);
-	free(cl->data);
-	buxton_debug("Closed connection from fd %d\n", cl->fd);
-	LIST_REMOVE(client_list_item, item, self->client_list, cl);
-	free(cl);
-	cl = NULL;
+
+	for (int i = 0; i < self->nworkers; i++) {
+		worker = &self->workers[i];
+		if (pthread_join(worker->thread, NULL)) {
+			abort();
+		}
+
+		/* Drop what was left to send to the clients */
+		LIST_FOREACH_SAFE(item, msg, next, worker->outgoing) {
+			free_queued_message(msg);
+		}
+		worker->outgoing = NULL;
+		lock_notify();
+		LIST_FOREACH_SAFE(hold, nitem, nnitem, worker->held) {
+			notify_hold_cancel(nitem);
+		}
+		unlock_notify();
+
+		/* Clients not polled yet are torn down like the others */
+		LIST_FOREACH_SAFE(item, cl, ncl, worker->incoming) {
+			LIST_REMOVE(client_list_item, item, worker->incoming, cl);
+			LIST_PREPEND(client_list_item, item,
+				     worker->daemon.client_list, cl);
+			add_pollfd(&worker->daemon, cl->fd, POLLIN | POLLPRI, false);
+		}
+
+		/* Which removes their registrations before freeing them */
+		LIST_FOREACH_SAFE(item, cl, ncl, worker->daemon.client_list) {
+			nfds_t j;
+
+			/* pollfds[0] is the eventfd, the rest are clients */
+			for (j = 1; j < worker->daemon.nfds; j++) {
+				if (worker->daemon.pollfds[j].fd == cl->fd) {
+					break;
+				}
+			}
+			assert(j < worker->daemon.nfds);
+			terminate_client(&worker->daemon, cl, j);
+		}
+		for (nfds_t j = 0; j < worker->daemon.nfds; j++) {
+			close(worker->daemon.pollfds[j].fd);
+		}
+		free(worker->daemon.pollfds);
+		free(worker->daemon.accepting);
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	free(self->workers);
+	self->workers = NULL;
+	self->nworkers = 0;
 }
 
 /*
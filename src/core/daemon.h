@@ -20,15 +20,32 @@
 	#include "config.h"
 #endif
 
+#include <pthread.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 
 #include "buxton.h"
 #include "backend.h"
+#include "buxtonlist.h"
+#include "changelog.h"
 #include "hashmap.h"
+#include "keyid.h"
 #include "list.h"
 #include "protocol.h"
 #include "serialize.h"
+#include "trie.h"
+
+/**
+ * Number of recent changes buxtond remembers for clients catching up
+ */
+#define BUXTON_CHANGE_LOG_SIZE 4096
+
+/**
+ * Most changes retrieved for a single reply
+ */
+#define BUXTON_CHANGES_PER_REPLY 1024
+
+struct BuxtonNotification;
 
 /**
  * List for daemon's clients
@@ -41,17 +58,65 @@ typedef struct client_list_item {
 	uint8_t *data; /**<Data buffer for the client */
 	size_t offset; /**<Current position to write to data buffer */
 	size_t size; /**<Size of the data buffer */
+	struct BuxtonNotification *subscriptions; /**<Registrations of the client, guarded by the notification lock */
 } client_list_item;
 
+struct BuxtonWorker;
+struct BuxtonNotifyKey;
+
+/**
+ * Value of a watched key, shared by the subscribers it was delivered to
+ *
+ * Values are guarded by the notification lock.
+ */
+typedef struct BuxtonNotifyValue {
+	BuxtonData *data; /**<Value, NULL if the key was unset */
+	BuxtonString layer; /**<Layer the value is effective in, owned by the configuration, empty if unknown */
+	uint64_t version; /**<Version of the value within its key */
+	unsigned int refcount; /**<Key and subscribers holding the value */
+} BuxtonNotifyValue;
+
 /**
  * Notification registration
+ *
+ * Registrations are linked both to the key or prefix they watch and
+ * to their client, so either side drops them without searching.
  */
 typedef struct BuxtonNotification {
 	client_list_item *client; /**<Client */
-	BuxtonData *old_data; /**<Old value of a particular key*/
+	struct BuxtonWorker *worker; /**<Worker serving the client, NULL for the main thread */
+	struct BuxtonNotifyKey *nkey; /**<Key or prefix watched */
+	LIST_FIELDS(struct BuxtonNotification, subscribers); /**<List of the registrations of a key or prefix */
+	LIST_FIELDS(struct BuxtonNotification, client_subs); /**<List of the registrations of a client */
+	BuxtonNotifyValue *value; /**<Last value the client was told about */
 	uint32_t msgid; /**<Message id from the client */
+	uint32_t interval; /**<Minimum milliseconds between notifications, 0 to send every change */
+	uint64_t next_send; /**<Time before which changes are held, in milliseconds */
+	BuxtonNotifyValue *held; /**<Newest change held back, NULL if none */
+	LIST_FIELDS(struct BuxtonNotification, hold); /**<List of held notifications of a thread */
 } BuxtonNotification;
 
+/**
+ * Watched key or prefix, the values of notify_mapping and notify_prefixes
+ */
+typedef struct BuxtonNotifyKey {
+	BuxtonNotification *subscribers; /**<Registration of every watcher */
+	BuxtonNotifyValue *value; /**<Last value delivered, NULL until then, unused for prefixes */
+	uint64_t version; /**<Version of the newest value */
+	BuxtonKeyId *id; /**<Key watched, its key in notify_mapping, NULL for a prefix */
+	char *name; /**<"group\nprefix" watched, its key in notify_prefixes */
+} BuxtonNotifyKey;
+
+/**
+ * Message queued for a client served by another worker
+ */
+typedef struct BuxtonQueuedMessage {
+	LIST_FIELDS(struct BuxtonQueuedMessage, item); /**<List type */
+	client_list_item *client; /**<Client to write the message to */
+	uint8_t *data; /**<Serialized message */
+	size_t size; /**<Size of the message */
+} BuxtonQueuedMessage;
+
 /**
  * Global store of buxtond state
  */
@@ -62,11 +127,33 @@ typedef struct BuxtonDaemon {
 	bool *accepting;
 	struct pollfd *pollfds;
 	client_list_item *client_list;
-	Hashmap *notify_mapping;
-	Hashmap *client_key_mapping;
+	BuxtonKeyTable *key_ids; /**<Identities of the keys of requests */
+	BuxtonChangeLog *changes; /**<Recent changes, for clients catching up */
+	Hashmap *notify_mapping; /**<BuxtonNotifyKey of each watched BuxtonKeyId */
+	BuxtonTrie *notify_prefixes; /**<BuxtonNotifyKey of each watched "group\nprefix" */
 	BuxtonControl buxton;
+	struct BuxtonWorker *workers; /**<Worker threads, NULL if clients are served by the main thread */
+	int nworkers; /**<Number of worker threads */
+	int next_worker; /**<Worker the next client is handed to */
 } BuxtonDaemon;
 
+/**
+ * Worker thread serving a share of the clients
+ *
+ * Each worker polls its own clients with its own BuxtonDaemon, which
+ * shares the configuration and notification mappings of the main one.
+ */
+typedef struct BuxtonWorker {
+	BuxtonDaemon daemon; /**<State of the worker's event loop */
+	pthread_t thread; /**<Thread running the worker */
+	int wakeup; /**<eventfd signaled when the worker has work queued */
+	pthread_mutex_t lock; /**<Protects the members below */
+	client_list_item *incoming; /**<Clients handed over by the main thread */
+	BuxtonQueuedMessage *outgoing; /**<Notifications for the worker's clients */
+	BuxtonNotification *held; /**<Coalesced notifications of the worker's clients, guarded by the notification lock */
+	bool quit; /**<Set when the worker should exit */
+} BuxtonWorker;
+
 /**
  * Take a BuxtonData array and set key, layer and value items
  * correctly
@@ -103,6 +190,14 @@ bool buxtond_handle_message(BuxtonDaemon *self,
 void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 			      _BuxtonKey* key, BuxtonData *value);
 
+/**
+ * Send the coalesced notifications held for the clients of the calling
+ * thread whose interval elapsed
+ * @return milliseconds until the next held notification is due, -1 if
+ * none are held
+ */
+int buxtond_notify_flush(void);
+
 /**
  * Buxton daemon function for setting a value
  * @param self buxtond instance being run
@@ -114,6 +209,38 @@ void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 void set_value(BuxtonDaemon *self, client_list_item *client,
 	       _BuxtonKey *key, BuxtonData *value, int32_t *status);
 
+/**
+ * Buxton daemon function for setting a value if the current one matches
+ * @param self buxtond instance being run
+ * @param client Used to validate smack access
+ * @param key Key for the value being set
+ * @param value Value being set
+ * @param version Version the value must have if expected is NULL
+ * @param expected Value the key must have, or NULL
+ * @param status Will be set with the int32_t result of the operation,
+ * BUXTON_STATUS_MISMATCH if the value doesn't match
+ * @returns BuxtonData Value stored for key, or the current value if it
+ * doesn't match, otherwise NULL
+ */
+BuxtonData *compare_and_set(BuxtonDaemon *self, client_list_item *client,
+			    _BuxtonKey *key, BuxtonData *value,
+			    uint64_t version, BuxtonData *expected,
+			    int32_t *status)
+	__attribute__((warn_unused_result));
+
+/**
+ * Buxton daemon function for adding to an integer value
+ * @param self buxtond instance being run
+ * @param client Used to validate smack access
+ * @param key Key for the value being updated, with its integer type
+ * @param delta Amount to add
+ * @param status Will be set with the int32_t result of the operation
+ * @returns BuxtonData Value stored for key if successful otherwise NULL
+ */
+BuxtonData *add_value(BuxtonDaemon *self, client_list_item *client,
+		      _BuxtonKey *key, int64_t delta, int32_t *status)
+	__attribute__((warn_unused_result));
+
 /**
  * Buxton daemon function for setting a label
  * @param self buxtond instance being run
@@ -202,17 +329,47 @@ BuxtonArray *list_names(BuxtonDaemon *self, client_list_item *client,
 			_BuxtonKey *key, int32_t *status)
 	__attribute__((warn_unused_result));
 
+/**
+ * Buxton daemon function for reporting request statistics
+ * @param self buxtond instance being run
+ * @param client Client requesting the statistics
+ * @param status Will be set with the int32_t result of the operation
+ * @returns BuxtonArray of counter name and value pairs, to be freed
+ * with data_free
+ */
+BuxtonArray *get_stats(BuxtonDaemon *self, client_list_item *client,
+		       int32_t *status)
+	__attribute__((warn_unused_result));
+
+/**
+ * Buxton daemon function for retrieving the changes made since a
+ * sequence number, within what a single reply can hold
+ * @param self buxtond instance being run
+ * @param client Client catching up, changes to groups it can't read
+ * and to other users' layers are left out
+ * @param since Sequence number of the last change the client saw
+ * @param status Will be set with the int32_t result of the operation
+ * @returns BuxtonArray of the resume sequence number, the resync and
+ * more flags, then the layer, group and name of each change, to be
+ * freed with data_free
+ */
+BuxtonArray *get_changes(BuxtonDaemon *self, client_list_item *client,
+			 uint64_t since, int32_t *status)
+	__attribute__((warn_unused_result));
+
 /**
  * Buxton daemon function for registering notifications on a given key
  * @param self buxtond instance being run
  * @param client Used to validate smack access
  * @param key Key to notify for changes on
  * @param msgid Message ID from the client
+ * @param interval Minimum milliseconds between two notifications, only
+ * the newest of the changes made meanwhile is sent, 0 to send every change
  * @param status Will be set with the int32_t result of the operation
  */
 void register_notification(BuxtonDaemon *self, client_list_item *client,
 			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status);
+			   uint32_t interval, int32_t *status);
 
 /**
  * Buxton daemon function for unregistering notifications from the given key
@@ -226,6 +383,40 @@ uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
 				 _BuxtonKey *key, int32_t *status)
 	__attribute__((warn_unused_result));
 
+/**
+ * Buxton daemon function for registering notifications on every key of
+ * a group whose name starts with a prefix, including keys created later
+ * @param self buxtond instance being run
+ * @param client Used to validate smack access
+ * @param key Group to watch, with the prefix as name or no name to
+ * watch the whole group
+ * @param msgid Message ID from the client
+ * @param status Will be set with the int32_t result of the operation
+ */
+void register_prefix_notification(BuxtonDaemon *self,
+				  client_list_item *client,
+				  _BuxtonKey *key, uint32_t msgid,
+				  int32_t *status);
+
+/**
+ * Buxton daemon function for unregistering notifications from a prefix
+ * @param self buxtond instance being run
+ * @param client Client that registered for notifications
+ * @param key Group and prefix given when registering
+ * @param status Will be set with the int32_t result of the operation
+ * @return Message ID used to send the prefix's notifications to the client
+ */
+uint32_t unregister_prefix_notification(BuxtonDaemon *self,
+					client_list_item *client,
+					_BuxtonKey *key, int32_t *status)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a watched key or prefix along with its subscribers and values
+ * @param nkey Key to free, removed from its mapping by the caller
+ */
+void buxtond_notify_key_free(BuxtonNotifyKey *nkey);
+
 /**
  * Verify credentials for the client socket
  * @param cl Client to check the credentials of
@@ -269,6 +460,29 @@ void handle_smack_label(client_list_item *cl);
 bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 	__attribute__((warn_unused_result));
 
+/**
+ * Hand a newly accepted client to the event loop serving it
+ * @param self buxtond instance being run
+ * @param cl The client to add
+ */
+void buxtond_add_client(BuxtonDaemon *self, client_list_item *cl);
+
+/**
+ * Start worker threads to serve clients
+ *
+ * Backends must have been loaded with buxton_direct_load_backends(),
+ * and signals blocked, before workers are started.
+ * @param self buxtond instance being run
+ * @param count Number of worker threads to start
+ */
+void buxtond_start_workers(BuxtonDaemon *self, int count);
+
+/**
+ * Stop the worker threads and close their clients
+ * @param self buxtond instance being run
+ */
+void buxtond_stop_workers(BuxtonDaemon *self);
+
 /**
  * Terminate client connectoin
  * @param self buxtond instance being run
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <attr/xattr.h>
@@ -42,6 +43,8 @@
 #include "list.h"
 #include "log.h"
 #include "smack.h"
+#include "alloc.h"
+#include "trace.h"
 #include "util.h"
 #include "configurator.h"
 #include "buxtonlist.h"
@@ -55,6 +58,7 @@ static void print_usage(char *name)
 	printf("%s: Usage\n\n", name);
 
 	printf("  -c, --config-file	   Path to configuration file\n");
+	printf("  -t, --threads		   Number of worker threads serving clients\n");
 	printf("  -h, --help		   Display this help message\n");
 }
 
@@ -76,16 +80,19 @@ int main(int argc, char *argv[])
 	sigset_t mask;
 	int sigfd;
 	bool leftover_messages = false;
+	int sync_timeout;
+	int notify_timeout;
 	struct stat st;
+	struct timespec now;
 	bool help = false;
-	BuxtonList *map_list = NULL;
+	BuxtonNotifyKey *nkey = NULL;
 	Iterator iter;
 	char *notify_key;
-	BuxtonList *key_list = NULL;
-	uint64_t *client_fd;
+	int workers;
 
 	static struct option opts[] = {
 		{ "config-file", 1, NULL, 'c' },
+		{ "threads",	 1, NULL, 't' },
 		{ "help",	 0, NULL, 'h' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -93,7 +100,7 @@ int main(int argc, char *argv[])
 	while (true) {
 		int c;
 		int i;
-		c = getopt_long(argc, argv, "c:h", opts, &i);
+		c = getopt_long(argc, argv, "c:t:h", opts, &i);
 
 		if (c == -1) {
 			break;
@@ -114,6 +121,9 @@ int main(int argc, char *argv[])
 
 			buxton_add_cmd_line(CONFIG_CONF_FILE, optarg);
 			break;
+		case 't':
+			buxton_add_cmd_line(CONFIG_WORKER_THREADS, optarg);
+			break;
 		case 'h':
 			help = true;
 			break;
@@ -155,6 +165,13 @@ int main(int argc, char *argv[])
 	if (ret != 0) {
 		exit(EXIT_FAILURE);
 	}
+#if defined(TRACE) || defined(ALLOC_ACCOUNTING)
+	/* SIGUSR1 dumps the request traces and allocation counters */
+	ret = sigaddset(&mask, SIGUSR1);
+	if (ret != 0) {
+		exit(EXIT_FAILURE);
+	}
+#endif
 
 	ret = sigprocmask(SIG_BLOCK, &mask, NULL);
 	if (ret == -1) {
@@ -168,10 +185,30 @@ int main(int argc, char *argv[])
 
 	add_pollfd(&self, sigfd, POLLIN, false);
 
+	/* Keys of requests, interned once for every subsystem */
+	self.key_ids = buxton_key_table_new();
+	if (!self.key_ids) {
+		exit(EXIT_FAILURE);
+	}
+	/*
+	 * Changes are numbered from the start time, so that those seen
+	 * by clients of an earlier instance are older than any in the log
+	 */
+	clock_gettime(CLOCK_REALTIME, &now);
+	self.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE,
+					     (uint64_t)now.tv_sec * 1000000 +
+					     (uint64_t)now.tv_nsec / 1000);
+	if (!self.changes) {
+		exit(EXIT_FAILURE);
+	}
 	/* For client notifications */
-	self.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	/* For keeping track of keys a client is registered to*/
-	self.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
+	self.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					  trivial_compare_func);
+	/* For notifications on groups and key name prefixes */
+	self.notify_prefixes = buxton_trie_new();
+	if (!self.notify_prefixes) {
+		exit(EXIT_FAILURE);
+	}
 	/* Store a list of connected clients */
 	LIST_HEAD_INIT(client_list_item, self.client_list);
 
@@ -236,11 +273,28 @@ int main(int argc, char *argv[])
 		add_pollfd(&self, smackfd, POLLIN | POLLPRI, false);
 	}
 
+	/* Signals are blocked by now, so workers inherit the mask */
+	workers = buxton_worker_threads();
+	if (workers > 0) {
+		if (!buxton_direct_load_backends(&self.buxton)) {
+			exit(EXIT_FAILURE);
+		}
+		buxtond_start_workers(&self, workers);
+	}
+
 	buxton_log("%s: Started\n", argv[0]);
 
 	/* Enter loop to accept clients */
 	for (;;) {
-		ret = poll(self.pollfds, self.nfds, leftover_messages ? 0 : -1);
+		/* Flush due group commits, and wake up for the next one */
+		sync_timeout = buxton_direct_sync(&self.buxton, false);
+		/* and coalesced notifications, waking up for the next ones */
+		notify_timeout = buxtond_notify_flush();
+		if (notify_timeout >= 0 &&
+		    (sync_timeout < 0 || notify_timeout < sync_timeout)) {
+			sync_timeout = notify_timeout;
+		}
+		ret = poll(self.pollfds, self.nfds, leftover_messages ? 0 : sync_timeout);
 
 		if (ret < 0) {
 			buxton_log("poll(): %m\n");
@@ -267,6 +321,16 @@ int main(int argc, char *argv[])
 			if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
 				break;
 			}
+			if (si.ssi_signo == SIGUSR1) {
+#ifdef TRACE
+				buxton_log("Dumped %zu request phases\n",
+					   buxton_trace_dump(stderr));
+#endif
+#ifdef ALLOC_ACCOUNTING
+				buxton_log("Dumped %zu allocation sites\n",
+					   buxton_alloc_dump(stderr));
+#endif
+			}
 		}
 
 		for (nfds_t i = 1; i < self.nfds; i++) {
@@ -325,10 +389,6 @@ int main(int argc, char *argv[])
 
 				cl->fd = fd;
 				cl->cred = (struct ucred) {0, 0, 0};
-				LIST_PREPEND(client_list_item, item, self.client_list, cl);
-
-				/* poll for data on this new client as well */
-				add_pollfd(&self, cl->fd, POLLIN | POLLPRI, false);
 
 				/* Mark our packets as high prio */
 				if (setsockopt(cl->fd, SOL_SOCKET, SO_PRIORITY, &on, sizeof(on)) == -1) {
@@ -343,6 +403,9 @@ int main(int argc, char *argv[])
 					buxton_log("setsockopt(SO_RCVTIMEO): %m\n");
 				}
 
+				/* poll for data on this new client, possibly from a worker */
+				buxtond_add_client(&self, cl);
+
 				/* check if this is optimal or not */
 				break;
 			}
@@ -368,6 +431,8 @@ int main(int argc, char *argv[])
 
 	buxton_log("%s: Closing all connections\n", argv[0]);
 
+	buxtond_stop_workers(&self);
+
 	if (manual_start) {
 		unlink(buxton_socket());
 	}
@@ -380,27 +445,16 @@ int main(int argc, char *argv[])
 		i = j;
 	}
 	/* Clean up notification lists */
-	HASHMAP_FOREACH_KEY(map_list, notify_key, self.notify_mapping, iter) {
+	HASHMAP_FOREACH_KEY(nkey, notify_key, self.notify_mapping, iter) {
+		/* The key is the identity referenced by nkey */
 		hashmap_remove(self.notify_mapping, notify_key);
-		BuxtonList *elem;
-		BUXTON_LIST_FOREACH(map_list, elem) {
-			BuxtonNotification *notif = (BuxtonNotification*)elem->data;
-			if (notif->old_data) {
-				free_buxton_data(&(notif->old_data));
-			}
-		}
-		free(notify_key);
-		buxton_list_free_all(&map_list);
-	}
-
-	/* Clean up key lists */
-	HASHMAP_FOREACH_KEY(key_list, client_fd, self.client_key_mapping, iter) {
-		hashmap_remove(self.client_key_mapping, client_fd);
-		buxton_list_free_all(&key_list);
-		free(client_fd);
+		buxtond_notify_key_free(nkey);
 	}
+	buxton_trie_free(self.notify_prefixes,
+			 (buxton_free_func)buxtond_notify_key_free);
 	hashmap_free(self.notify_mapping);
-	hashmap_free(self.client_key_mapping);
+	buxton_change_log_free(self.changes);
+	buxton_key_table_free(self.key_ids);
 	buxton_direct_close(&self.buxton);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,549 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "compiler.h"
+#include "hashmap.h"
+#include "serialize.h"
+#include "util.h"
+
+/**
+ * Compiled Database Module
+ *
+ * Serves read-only layers from the immutable files produced by
+ * "buxtonctl compile". The file is mmap'd as a whole: keys are found
+ * through a minimal perfect hash, groups and keys are listed from the
+ * sorted indexes, and values (labels included) are deserialized
+ * straight from the mapping. Nothing is read up front, so opening a
+ * layer doesn't depend on its size.
+ */
+
+/**
+ * A mapped compiled layer
+ */
+typedef struct CompiledLayer {
+	uint8_t *map; /**<Mapping of the file */
+	size_t size; /**<Size of the mapping */
+	CompiledHeader *header; /**<File header */
+	uint32_t *buckets; /**<Perfect hash displacement seeds */
+	uint32_t *slots; /**<Record offset of each hash slot */
+	CompiledGroup *groups; /**<Sorted group index */
+	uint32_t *keys; /**<Sorted key index */
+} CompiledLayer;
+
+static Hashmap *_resources = NULL;
+
+static inline char *record_key(CompiledRecord *rec)
+{
+	return (char *)(rec + 1);
+}
+
+static inline uint8_t *record_value(CompiledRecord *rec)
+{
+	return (uint8_t *)(rec + 1) + COMPILED_ALIGN(rec->key_size);
+}
+
+/* Check that a serialized value stays within its record */
+static bool check_value(uint8_t *value, uint32_t size)
+{
+	uint64_t need = sizeof(uint32_t) * 3;
+	uint32_t stored;
+	uint32_t label;
+	uint32_t length;
+	BuxtonDataType type;
+
+	if (size < need) {
+		return false;
+	}
+	memcpy(&stored, value, sizeof(uint32_t));
+	memcpy(&label, value + sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(&length, value + sizeof(uint32_t) * 2, sizeof(uint32_t));
+	type = (BuxtonDataType)(stored & ~BUXTON_RECORD_VERSIONED);
+	if (type <= BUXTON_TYPE_MIN || type >= BUXTON_TYPE_UNSET) {
+		return false;
+	}
+	if (stored & BUXTON_RECORD_VERSIONED) {
+		need += sizeof(uint64_t);
+	}
+	if (type != BUXTON_TYPE_STRING && length < sizeof(uint64_t)) {
+		return false;
+	}
+
+	return need + label + length <= size;
+}
+
+/*
+ * Get the record at an offset read from the file, or NULL if the record,
+ * its key or its value don't fit in the mapping. Offsets come from the
+ * file itself, so a corrupt layer must not make us read past the end.
+ */
+static CompiledRecord *record_at(CompiledLayer *db, uint32_t offset)
+{
+	CompiledRecord *rec;
+	uint64_t end;
+
+	if (offset % 8 || (uint64_t)offset + sizeof(CompiledRecord) > db->size) {
+		return NULL;
+	}
+	rec = (CompiledRecord *)(db->map + offset);
+
+	end = (uint64_t)offset + sizeof(CompiledRecord) +
+		COMPILED_ALIGN((uint64_t)rec->key_size) + rec->value_size;
+	if (!rec->key_size || end > db->size ||
+	    record_key(rec)[rec->key_size - 1] != '\0' ||
+	    !check_value(record_value(rec), rec->value_size)) {
+		return NULL;
+	}
+
+	return rec;
+}
+
+static bool check_section(CompiledHeader *h, uint64_t offset, uint64_t count,
+			  size_t size)
+{
+	return offset % 8 == 0 && offset <= h->size &&
+		count <= (h->size - offset) / size;
+}
+
+/* Map a compiled file and validate its layout */
+static CompiledLayer *open_compiled(const char *path)
+{
+	CompiledLayer *db = NULL;
+	CompiledHeader *h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CompiledHeader)) {
+		buxton_log("%s is not a compiled layer\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		buxton_log("Failed to map %s: %m\n", path);
+		return NULL;
+	}
+
+	h = map;
+	if (memcmp(h->magic, COMPILED_MAGIC, sizeof(h->magic)) ||
+	    h->size != (uint64_t)st.st_size || h->nbuckets == 0 ||
+	    !check_section(h, h->buckets, h->nbuckets, sizeof(uint32_t)) ||
+	    !check_section(h, h->slots, h->nrecords, sizeof(uint32_t)) ||
+	    !check_section(h, h->groups, h->ngroups, sizeof(CompiledGroup)) ||
+	    !check_section(h, h->keys, h->nkeys, sizeof(uint32_t))) {
+		buxton_log("%s is not a valid compiled layer\n", path);
+		munmap(map, (size_t)st.st_size);
+		return NULL;
+	}
+
+	db = malloc0(sizeof(CompiledLayer));
+	if (!db) {
+		abort();
+	}
+	db->map = map;
+	db->size = (size_t)st.st_size;
+	db->header = h;
+	db->buckets = (uint32_t *)(db->map + h->buckets);
+	db->slots = (uint32_t *)(db->map + h->slots);
+	db->groups = (CompiledGroup *)(db->map + h->groups);
+	db->keys = (uint32_t *)(db->map + h->keys);
+
+	return db;
+}
+
+static CompiledLayer *db_for_resource(BuxtonLayer *layer)
+{
+	CompiledLayer *db;
+	_cleanup_free_ char *path = NULL;
+	char *name = NULL;
+	int r;
+
+	assert(layer);
+	assert(_resources);
+
+	if (layer->type == LAYER_USER) {
+		r = asprintf(&name, "%s-%d", layer->name.value, layer->uid);
+	} else {
+		r = asprintf(&name, "%s", layer->name.value);
+	}
+	if (r == -1) {
+		abort();
+	}
+
+	db = hashmap_get(_resources, name);
+	if (db) {
+		free(name);
+		return db;
+	}
+
+	path = get_layer_path(layer);
+	if (!path) {
+		abort();
+	}
+	db = open_compiled(path);
+	if (!db) {
+		free(name);
+		return NULL;
+	}
+
+	r = hashmap_put(_resources, name, db);
+	if (r != 1) {
+		abort();
+	}
+
+	return db;
+}
+
+/* Find the record of a key, without any allocation */
+static CompiledRecord *find_record(CompiledLayer *db, _BuxtonKey *key)
+{
+	CompiledRecord *rec;
+	uint32_t h;
+	uint32_t seed;
+	uint32_t slot;
+	uint32_t nlen = key->name.value ? key->name.length : 0;
+
+	if (!db->header->nrecords) {
+		return NULL;
+	}
+
+	h = compiled_hash_update(compiled_hash_init(0), key->group.value,
+				 key->group.length);
+	h = compiled_hash_update(h, key->name.value, nlen);
+	seed = db->buckets[compiled_hash_final(h) % db->header->nbuckets];
+
+	h = compiled_hash_update(compiled_hash_init(seed), key->group.value,
+				 key->group.length);
+	h = compiled_hash_update(h, key->name.value, nlen);
+	slot = compiled_hash_final(h) % db->header->nrecords;
+
+	rec = record_at(db, db->slots[slot]);
+
+	/* The slot may belong to another key, compare */
+	if (!rec || rec->key_size != key->group.length + nlen ||
+	    memcmp(record_key(rec), key->group.value, key->group.length) ||
+	    (nlen && memcmp(record_key(rec) + key->group.length,
+			    key->name.value, nlen))) {
+		return NULL;
+	}
+
+	return rec;
+}
+
+static int set_value(__attribute__((unused)) BuxtonLayer *layer,
+		     __attribute__((unused)) _BuxtonKey *key,
+		     __attribute__((unused)) BuxtonData *data,
+		     __attribute__((unused)) BuxtonString *label)
+{
+	/* Compiled layers are immutable */
+	return EROFS;
+}
+
+static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	CompiledLayer *db;
+	CompiledRecord *rec;
+
+	assert(layer);
+	assert(key);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		/*
+		 * Set negative here to indicate layer not found
+		 * rather than key not found, optimization for
+		 * set value
+		 */
+		return -ENOENT;
+	}
+
+	rec = find_record(db, key);
+	if (!rec) {
+		return ENOENT;
+	}
+
+	buxton_deserialize(record_value(rec), data, label);
+
+	if (data->type != key->type && key->type != BUXTON_TYPE_UNSET) {
+		free(label->value);
+		label->value = NULL;
+		if (data->type == BUXTON_TYPE_STRING) {
+			free(data->store.d_string.value);
+			data->store.d_string.value = NULL;
+		}
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static int unset_value(__attribute__((unused)) BuxtonLayer *layer,
+		       __attribute__((unused)) _BuxtonKey *key,
+		       __attribute__((unused)) BuxtonData *data,
+		       __attribute__((unused)) BuxtonString *label)
+{
+	/* Compiled layers are immutable */
+	return EROFS;
+}
+
+/* Append a copy of the string to the list */
+static void add_name(BuxtonArray *list, char *value, uint32_t length)
+{
+	BuxtonData *data;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	data->store.d_string.value = malloc(length);
+	if (!data->store.d_string.value) {
+		abort();
+	}
+	memcpy(data->store.d_string.value, value, length);
+	data->store.d_string.length = length;
+	if (!buxton_array_add(list, data)) {
+		abort();
+	}
+}
+
+static bool list_keys(BuxtonLayer *layer,
+		      BuxtonArray **list)
+{
+	CompiledLayer *db;
+	CompiledRecord *rec;
+	BuxtonArray *k_list;
+	uint32_t glen;
+
+	assert(layer);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		return false;
+	}
+
+	k_list = buxton_array_new();
+	if (!buxton_array_reserve(k_list, db->header->nkeys)) {
+		abort();
+	}
+	for (uint32_t i = 0; i < db->header->nkeys; i++) {
+		rec = record_at(db, db->keys[i]);
+		if (!rec) {
+			continue;
+		}
+		glen = (uint32_t)strlen(record_key(rec)) + 1;
+		add_name(k_list, record_key(rec) + glen, rec->key_size - glen);
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+}
+
+/* Binary search of a group in the sorted group index */
+static CompiledGroup *find_group(CompiledLayer *db, BuxtonString *group)
+{
+	uint32_t lo = 0;
+	uint32_t hi = db->header->ngroups;
+	uint32_t mid;
+	CompiledGroup *g;
+	CompiledRecord *rec;
+	int r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		g = &db->groups[mid];
+		rec = record_at(db, g->record);
+		if (!rec) {
+			return NULL;
+		}
+		r = strcmp(record_key(rec), group->value);
+		if (r == 0) {
+			/* The group's keys must be within the key index */
+			if (g->first > db->header->nkeys ||
+			    g->count > db->header->nkeys - g->first) {
+				return NULL;
+			}
+			return g;
+		} else if (r < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **list)
+{
+	CompiledLayer *db;
+	CompiledGroup *g;
+	CompiledRecord *rec;
+	BuxtonArray *k_list;
+	char *name;
+	uint32_t glen;
+	uint32_t lo, hi, mid;
+
+	assert(layer);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		return false;
+	}
+
+	if (group && !group->length) {
+		group = NULL;
+	}
+	if (prefix && !prefix->length) {
+		prefix = NULL;
+	}
+
+	k_list = buxton_array_new();
+
+	if (!group) {
+		if (!prefix && !buxton_array_reserve(k_list, db->header->ngroups)) {
+			abort();
+		}
+		for (uint32_t i = 0; i < db->header->ngroups; i++) {
+			rec = record_at(db, db->groups[i].record);
+			if (!rec) {
+				continue;
+			}
+			if (prefix && strncmp(record_key(rec), prefix->value,
+					      prefix->length - 1)) {
+				continue;
+			}
+			add_name(k_list, record_key(rec), rec->key_size);
+		}
+		goto end;
+	}
+
+	g = find_group(db, group);
+	if (!g) {
+		goto end;
+	}
+
+	/* Keys are sorted by name, skip straight to the prefix */
+	lo = g->first;
+	hi = g->first + g->count;
+	glen = group->length;
+	if (prefix) {
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			rec = record_at(db, db->keys[mid]);
+			if (!rec || rec->key_size < glen) {
+				goto end;
+			}
+			name = record_key(rec) + glen;
+			if (strcmp(name, prefix->value) < 0) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		hi = g->first + g->count;
+	} else if (!buxton_array_reserve(k_list, g->count)) {
+		abort();
+	}
+
+	for (uint32_t i = lo; i < hi; i++) {
+		rec = record_at(db, db->keys[i]);
+		if (!rec || rec->key_size < glen) {
+			continue;
+		}
+		name = record_key(rec) + glen;
+		if (prefix && strncmp(name, prefix->value, prefix->length - 1)) {
+			break;
+		}
+		add_name(k_list, name, rec->key_size - glen);
+	}
+
+end:
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+}
+
+_bx_export_ void buxton_module_destroy(void)
+{
+	const char *key;
+	Iterator iterator;
+	CompiledLayer *db;
+
+	/* unmap all layers */
+	HASHMAP_FOREACH_KEY(db, key, _resources, iterator) {
+		hashmap_remove(_resources, key);
+		munmap(db->map, db->size);
+		free(db);
+		free((void *)key);
+	}
+	hashmap_free(_resources);
+	_resources = NULL;
+}
+
+_bx_export_ bool buxton_module_init(BuxtonBackend *backend)
+{
+
+	assert(backend);
+
+	/* Point the struct methods back to our own */
+	backend->set_value = &set_value;
+	backend->get_value = &get_value;
+	backend->list_keys = &list_keys;
+	backend->list_names = &list_names;
+	backend->unset_value = &unset_value;
+	backend->create_db = (module_db_init_func) &db_for_resource;
+
+	_resources = hashmap_new(string_hash_func, string_compare_func);
+	if (!_resources) {
+		abort();
+	}
+
+	return true;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -16,20 +16,123 @@
 #include <assert.h>
 #include <errno.h>
 #include <gdbm.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
+#include "configurator.h"
 #include "log.h"
+#include "buxtonlist.h"
 #include "hashmap.h"
+#include "keyid.h"
+#include "list.h"
 #include "serialize.h"
 #include "util.h"
 
 /**
  * GDBM Database Module
+ *
+ * The module is concurrent. The table of open databases, the per-user
+ * LRU and the cache counters are guarded by _resources_lock, and each
+ * database has its own lock for its gdbm handle, so requests on
+ * different databases run in parallel. A gdbm handle updates its
+ * bucket cache on every fetch, so reads of one database are serialized
+ * as well. Databases in use are never evicted. A reorganization only
+ * holds the lock of the database it rewrites.
  */
 
+/* Databases with less dead bytes than this are never reorganized */
+#define REORGANIZE_MIN_DEAD (256 * 1024)
+
+/* Percentage of dead bytes in the file that triggers a reorganization */
+#define REORGANIZE_DEAD_RATIO 50
+
+/* Time (ms) without writes before a database is considered idle */
+#define REORGANIZE_IDLE_DELAY 2000
+
+/**
+ * An open database, along with its pending sync and fragmentation state
+ */
+typedef struct GdbmResource {
+	char *name; /**<Key of the database in _resources */
+	GDBM_FILE db; /**<The gdbm handle */
+	bool writable; /**<Database was opened for writing */
+	BuxtonDurability durability; /**<Durability policy of the layer */
+	int sync_interval; /**<Group commit interval in milliseconds */
+	bool dirty; /**<Writes have been made since the last sync */
+	uint64_t deadline; /**<Monotonic time (ms) the pending sync is due */
+	uint64_t dead; /**<Bytes overwritten or deleted since the last reorganization */
+	uint64_t last_write; /**<Monotonic time (ms) of the last write */
+	bool idle_checked; /**<Fragmentation was checked since the last write */
+	bool user; /**<Per-user database, subject to the open handle limit */
+	LIST_FIELDS(struct GdbmResource, lru); /**<Position in the per-user LRU list */
+	unsigned int users; /**<Requests using the database, guarded by _resources_lock */
+	bool reorganizing; /**<Being reorganized, guarded by _resources_lock */
+	pthread_mutex_t lock; /**<Serializes use of the gdbm handle and the fields above users */
+} GdbmResource;
 
 static Hashmap *_resources = NULL;
+static pthread_mutex_t _resources_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Per-user databases are opened on demand for every uid that talks to
+ * buxtond, so only a bounded number of them is kept open. The most
+ * recently used one is at the head of the list.
+ */
+static LIST_HEAD(GdbmResource, _user_lru);
+static unsigned int _user_open = 0;
+static unsigned int _user_limit = 0;
+static BuxtonCacheStats _user_stats;
+
+static void lock(pthread_mutex_t *mutex)
+{
+	if (pthread_mutex_lock(mutex)) {
+		abort();
+	}
+}
+
+static void unlock(pthread_mutex_t *mutex)
+{
+	if (pthread_mutex_unlock(mutex)) {
+		abort();
+	}
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Record a write on the database, which left dead bytes behind. Sync
+ * layers already had the write flushed by gdbm (GDBM_SYNC),
+ * group-commit layers get a deadline for the next batched sync, async
+ * layers are only synced on close, or when a sync is forced.
+ */
+static void mark_dirty(GdbmResource *res, uint64_t dead)
+{
+	uint64_t now = now_ms();
+
+	res->dead += dead;
+	res->last_write = now;
+	res->idle_checked = false;
+
+	if (res->durability == DURABILITY_SYNC || res->dirty) {
+		return;
+	}
+	res->dirty = true;
+	if (res->durability == DURABILITY_GROUP_COMMIT) {
+		res->deadline = now + (uint64_t)res->sync_interval;
+	}
+}
 
 static char *key_get_name(BuxtonString *key)
 {
@@ -66,10 +169,59 @@ static GDBM_FILE try_open_database(char *path, const int oflag)
 	return db;
 }
 
-/* Open or create databases on the fly */
-static GDBM_FILE db_for_resource(BuxtonLayer *layer)
+/* Flush and close a database, and forget about it */
+static void close_resource(GdbmResource *res)
 {
-	GDBM_FILE db;
+	if (res->dirty) {
+		gdbm_sync(res->db);
+	}
+	gdbm_close(res->db);
+	if (res->user) {
+		LIST_REMOVE(GdbmResource, lru, _user_lru, res);
+		_user_open--;
+	}
+	hashmap_remove(_resources, res->name);
+	pthread_mutex_destroy(&res->lock);
+	buxton_alloc_release(BUXTON_ALLOC_BACKEND, res->name);
+	buxton_alloc_release(BUXTON_ALLOC_BACKEND, res);
+	free(res->name);
+	free(res);
+}
+
+/*
+ * Close the least recently used per-user database that isn't in use.
+ * Pending group commits are flushed first, the database is reopened on
+ * its next use. Returns false if all of them are in use.
+ */
+static bool evict_user_resource(void)
+{
+	GdbmResource *tail;
+
+	if (!_user_lru) {
+		return false;
+	}
+
+	LIST_FIND_TAIL(GdbmResource, lru, _user_lru, tail);
+	while (tail && tail->users) {
+		tail = tail->lru_prev;
+	}
+	if (!tail) {
+		return false;
+	}
+	close_resource(tail);
+	_user_stats.evictions++;
+
+	return true;
+}
+
+/*
+ * Open or create databases on the fly. The database is marked in use
+ * until release_resource() is called, and has to be locked around
+ * uses of its handle.
+ */
+static GdbmResource *resource_for_layer(BuxtonLayer *layer)
+{
+	GdbmResource *res;
 	_cleanup_free_ char *path = NULL;
 	char *name = NULL;
 	int r;
@@ -79,6 +231,10 @@ static GDBM_FILE db_for_resource(BuxtonLayer *layer)
 	assert(layer);
 	assert(_resources);
 
+	if (!layer->readonly && layer->durability == DURABILITY_SYNC) {
+		oflag |= GDBM_SYNC;
+	}
+
 	if (layer->type == LAYER_USER) {
 		r = asprintf(&name, "%s-%d", layer->name.value, layer->uid);
 	} else {
@@ -88,31 +244,90 @@ static GDBM_FILE db_for_resource(BuxtonLayer *layer)
 		abort();
 	}
 
-	db = hashmap_get(_resources, name);
-	if (!db) {
+	lock(&_resources_lock);
+	res = hashmap_get(_resources, name);
+	if (res && res->user) {
+		_user_stats.hits++;
+		LIST_REMOVE(GdbmResource, lru, _user_lru, res);
+		LIST_PREPEND(GdbmResource, lru, _user_lru, res);
+	}
+	if (!res) {
+		if (layer->type == LAYER_USER) {
+			_user_stats.misses++;
+			/* may go over the limit while databases are in use */
+			while (_user_open >= _user_limit) {
+				if (!evict_user_resource()) {
+					break;
+				}
+			}
+		}
+
 		path = get_layer_path(layer);
 		if (!path) {
 			abort();
 		}
 
-		db = try_open_database(path, oflag);
+		res = malloc0(sizeof(GdbmResource));
+		if (!res) {
+			abort();
+		}
+		res->db = try_open_database(path, oflag);
 		save_errno = errno;
-		if (!db) {
+		if (!res->db) {
+			unlock(&_resources_lock);
+			free(res);
 			free(name);
 			buxton_log("Couldn't create db for path: %s\n", path);
-			return 0;
+			return NULL;
 		}
-		r = hashmap_put(_resources, name, db);
+		if (pthread_mutex_init(&res->lock, NULL)) {
+			abort();
+		}
+		res->writable = save_errno != EROFS && !layer->readonly;
+		res->durability = layer->durability;
+		res->sync_interval = layer->sync_interval;
+		res->name = name;
+		r = hashmap_put(_resources, name, res);
 		if (r != 1) {
 			abort();
 		}
+		buxton_alloc_hold(BUXTON_ALLOC_BACKEND, res);
+		buxton_alloc_hold(BUXTON_ALLOC_BACKEND, name);
+		if (layer->type == LAYER_USER) {
+			res->user = true;
+			LIST_PREPEND(GdbmResource, lru, _user_lru, res);
+			_user_open++;
+		}
 	} else {
-		db = (GDBM_FILE) hashmap_get(_resources, name);
 		free(name);
 	}
+	res->users++;
+	unlock(&_resources_lock);
 
 	errno = save_errno;
-	return db;
+	return res;
+}
+
+static void release_resource(GdbmResource *res)
+{
+	lock(&_resources_lock);
+	assert(res->users);
+	res->users--;
+	unlock(&_resources_lock);
+}
+
+static void *create_db(BuxtonLayer *layer)
+{
+	GdbmResource *res;
+
+	res = resource_for_layer(layer);
+	if (!res) {
+		return NULL;
+	}
+	release_resource(res);
+
+	/* Only tells the caller the database exists, never dereferenced */
+	return res;
 }
 
 static void make_key_data(_BuxtonKey *key, datum *key_data)
@@ -120,6 +335,13 @@ static void make_key_data(_BuxtonKey *key, datum *key_data)
 	uint32_t sz;
 	char *ptr;
 
+	/* Interned keys already have the group and name back to back */
+	if (key->id) {
+		key_data->dsize = (int)key->id->size;
+		key_data->dptr = key->id->data;
+		return;
+	}
+
 	/* compute requested size */
 	sz = key->group.length;
 	if (key->name.value) {
@@ -142,9 +364,17 @@ static void make_key_data(_BuxtonKey *key, datum *key_data)
 	}
 }
 
+static void free_key_data(_BuxtonKey *key, datum *key_data)
+{
+	if (!key->id) {
+		free(key_data->dptr);
+	}
+}
+
 static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
+	GdbmResource *res;
 	GDBM_FILE db;
 	int ret = -1;
 	datum key_data;
@@ -152,6 +382,7 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 	datum value;
 	_cleanup_free_ uint8_t *data_store = NULL;
 	size_t size;
+	uint64_t dead = 0;
 	BuxtonData cdata = {0};
 	BuxtonString clabel;
 
@@ -161,18 +392,23 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 
 	make_key_data(key, &key_data);
 
-	db = db_for_resource(layer);
-	if (!db || errno) {
+	res = resource_for_layer(layer);
+	if (!res || errno) {
 		ret = errno;
+		if (res) {
+			release_resource(res);
+		}
 		goto end;
 	}
+	lock(&res->lock);
+	db = res->db;
 
 	/* set_label will pass a NULL for data */
 	if (!data) {
 		cvalue = gdbm_fetch(db, key_data);
 		if (cvalue.dsize < 0 || cvalue.dptr == NULL) {
 			ret = ENOENT;
-			goto end;
+			goto unlock;
 		}
 
 		data_store = (uint8_t*)cvalue.dptr;
@@ -180,24 +416,37 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		free(clabel.value);
 		data = &cdata;
 		data_store = NULL;
+		dead = (uint64_t)(key_data.dsize + cvalue.dsize);
 	}
 
 	size = buxton_serialize(data, label, &data_store);
 
+	/*
+	 * Replacing a record leaves the old one behind, estimate its
+	 * size from the new one rather than fetching it
+	 */
+	if (!dead && gdbm_exists(db, key_data)) {
+		dead = (uint64_t)key_data.dsize + size;
+	}
+
 	value.dptr = (char *)data_store;
 	value.dsize = (int)size;
 	ret = gdbm_store(db, key_data, value, GDBM_REPLACE);
 	if (ret && gdbm_errno == GDBM_READER_CANT_STORE) {
 		ret = EROFS;
-		goto end;
+		goto unlock;
 	}
 	assert(ret == 0);
+	mark_dirty(res, dead);
 
+unlock:
+	unlock(&res->lock);
+	release_resource(res);
 end:
 	if (cdata.type == BUXTON_TYPE_STRING) {
 		free(cdata.store.d_string.value);
 	}
-	free(key_data.dptr);
+	free_key_data(key, &key_data);
 	free(cvalue.dptr);
 
 	return ret;
@@ -206,7 +455,7 @@ end:
 static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	GDBM_FILE db;
+	GdbmResource *res;
 	datum key_data;
 	datum value;
 	uint8_t *data_store = NULL;
@@ -217,8 +466,8 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 	make_key_data(key, &key_data);
 
 	memzero(&value, sizeof(datum));
-	db = db_for_resource(layer);
-	if (!db) {
+	res = resource_for_layer(layer);
+	if (!res) {
 		/*
 		 * Set negative here to indicate layer not found
 		 * rather than key not found, optimization for
@@ -228,7 +477,10 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	value = gdbm_fetch(db, key_data);
+	lock(&res->lock);
+	value = gdbm_fetch(res->db, key_data);
+	unlock(&res->lock);
+	release_resource(res);
 	if (value.dsize < 0 || value.dptr == NULL) {
 		ret = ENOENT;
 		goto end;
@@ -250,19 +502,85 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 	ret = 0;
 
 end:
-	free(key_data.dptr);
+	free_key_data(key, &key_data);
 	free(value.dptr);
 	data_store = NULL;
 
 	return ret;
 }
 
+/* Delete a record, accounting for the bytes it leaves behind */
+static int delete_record(GdbmResource *res, datum key_data)
+{
+	datum value;
+	int ret;
+
+	value = gdbm_fetch(res->db, key_data);
+	ret = gdbm_delete(res->db, key_data);
+	if (ret) {
+		if (gdbm_errno == GDBM_READER_CANT_DELETE) {
+			ret = EROFS;
+		} else if (gdbm_errno == GDBM_ITEM_NOT_FOUND) {
+			ret = ENOENT;
+		} else {
+			abort();
+		}
+	} else {
+		mark_dirty(res, (uint64_t)key_data.dsize +
+			   (value.dptr ? (uint64_t)value.dsize : 0));
+	}
+	free(value.dptr);
+
+	return ret;
+}
+
+/*
+ * Delete the keys of a group. They are collected first, as deleting
+ * while traversing the database could skip some of them.
+ */
+static void delete_group_keys(GdbmResource *res, BuxtonString *group)
+{
+	BuxtonList *keys = NULL;
+	BuxtonList *elem;
+	datum key, nextkey;
+	uint32_t glen;
+	char *gname;
+
+	key = gdbm_firstkey(res->db);
+	while (key.dptr) {
+		gname = (char*)key.dptr;
+		glen = (uint32_t)strlen(gname) + 1;
+		if ((uint32_t)key.dsize > glen && glen == group->length &&
+		    !strcmp(gname, group->value)) {
+			if (!buxton_list_append(&keys, key.dptr)) {
+				abort();
+			}
+			nextkey = gdbm_nextkey(res->db, key);
+		} else {
+			nextkey = gdbm_nextkey(res->db, key);
+			free(key.dptr);
+		}
+		key = nextkey;
+	}
+
+	BUXTON_LIST_FOREACH(keys, elem) {
+		gname = elem->data;
+		glen = (uint32_t)strlen(gname) + 1;
+		key.dptr = gname;
+		key.dsize = (int)(glen + strlen(gname + glen) + 1);
+		if (delete_record(res, key) == EROFS) {
+			break;
+		}
+	}
+	buxton_list_free_all(&keys);
+}
+
 static int unset_value(BuxtonLayer *layer,
 			_BuxtonKey *key,
 			__attribute__((unused)) BuxtonData *data,
 			__attribute__((unused)) BuxtonString *label)
 {
-	GDBM_FILE db;
+	GdbmResource *res;
 	datum key_data;
 	int ret;
 
@@ -272,25 +590,27 @@ static int unset_value(BuxtonLayer *layer,
 	make_key_data(key, &key_data);
 
 	errno = 0;
-	db = db_for_resource(layer);
-	if (!db || gdbm_errno) {
+	res = resource_for_layer(layer);
+	if (!res || gdbm_errno) {
 		ret = EROFS;
+		if (res) {
+			release_resource(res);
+		}
 		goto end;
 	}
 
-	ret = gdbm_delete(db, key_data);
-	if (ret) {
-		if (gdbm_errno == GDBM_READER_CANT_DELETE) {
-			ret = EROFS;
-		} else if (gdbm_errno == GDBM_ITEM_NOT_FOUND) {
-			ret = ENOENT;
-		} else {
-			abort();
-		}
+	lock(&res->lock);
+	ret = delete_record(res, key_data);
+
+	/* Removing a group removes the keys it holds as well */
+	if (!ret && !key->name.value) {
+		delete_group_keys(res, &key->group);
 	}
+	unlock(&res->lock);
+	release_resource(res);
 
 end:
-	free(key_data.dptr);
+	free_key_data(key, &key_data);
 
 	return ret;
 }
@@ -298,6 +618,7 @@ end:
 static bool list_keys(BuxtonLayer *layer,
 		      BuxtonArray **list)
 {
+	GdbmResource *res = NULL;
 	GDBM_FILE db;
 	datum key, nextkey;
 	BuxtonArray *k_list = NULL;
@@ -308,10 +629,12 @@ static bool list_keys(BuxtonLayer *layer,
 
 	assert(layer);
 
-	db = db_for_resource(layer);
-	if (!db) {
+	res = resource_for_layer(layer);
+	if (!res) {
 		goto end;
 	}
+	lock(&res->lock);
+	db = res->db;
 
 	k_list = buxton_array_new();
 	key = gdbm_firstkey(db);
@@ -350,8 +673,12 @@ static bool list_keys(BuxtonLayer *layer,
 	ret = true;
 
 end:
+	if (res) {
+		unlock(&res->lock);
+		release_resource(res);
+	}
 	if (!ret && k_list) {
-		for (uint16_t i = 0; i < k_list->len; i++) {
+		for (uint32_t i = 0; i < k_list->len; i++) {
 			current = buxton_array_get(k_list, i);
 			if (!current) {
 				break;
@@ -369,6 +696,7 @@ static bool list_names(BuxtonLayer *layer,
 		       BuxtonString *prefix,
 		       BuxtonArray **list)
 {
+	GdbmResource *res = NULL;
 	GDBM_FILE db;
 	datum key, nextkey;
 	BuxtonArray *k_list = NULL;
@@ -384,10 +712,12 @@ static bool list_names(BuxtonLayer *layer,
 	assert(layer);
 	assert(group);
 
-	db = db_for_resource(layer);
-	if (!db) {
+	res = resource_for_layer(layer);
+	if (!res) {
 		goto end;
 	}
+	lock(&res->lock);
+	db = res->db;
 
 	if (!group->length) {
 		group = NULL;
@@ -459,26 +789,168 @@ static bool list_names(BuxtonLayer *layer,
 	ret = true;
 
 end:
+	if (res) {
+		unlock(&res->lock);
+		release_resource(res);
+	}
 	if (!ret && k_list) {
 		buxton_array_free(&k_list, (buxton_free_func)data_free);
 	}
 	return ret;
 }
 
+/*
+ * Reorganize the database if more than REORGANIZE_DEAD_RATIO percent
+ * of the file is dead
+ */
+static void maybe_reorganize(const char *name, GdbmResource *res)
+{
+	struct stat st;
+	uint64_t size;
+
+	res->idle_checked = true;
+	if (fstat(gdbm_fdesc(res->db), &st) == -1) {
+		return;
+	}
+	size = (uint64_t)st.st_size;
+	if (res->dead * 100 < size * REORGANIZE_DEAD_RATIO) {
+		return;
+	}
+
+	buxton_debug("Reorganizing %s: %lu live, %lu dead bytes\n", name,
+		     (unsigned long)(size > res->dead ? size - res->dead : 0),
+		     (unsigned long)res->dead);
+	if (gdbm_reorganize(res->db)) {
+		buxton_log("Failed to reorganize %s: %s\n", name,
+			   gdbm_strerror(gdbm_errno));
+		return;
+	}
+	res->dead = 0;
+}
+
+/*
+ * Flush due group commits. Databases that have been idle for long
+ * enough are checked for fragmentation, which happens here, between
+ * requests, so a reorganization never runs in the middle of a burst.
+ * Rewriting a file takes a while, so it is done after _resources_lock
+ * is dropped, with the database marked in use so it isn't evicted.
+ * Requests on other databases carry on in the meantime.
+ */
+static int sync_dbs(bool force)
+{
+	Iterator iterator;
+	GdbmResource *res;
+	BuxtonArray *reorganize = NULL;
+	uint64_t now;
+	uint64_t next = 0;
+	uint64_t due;
+
+	now = now_ms();
+	lock(&_resources_lock);
+	HASHMAP_FOREACH(res, _resources, iterator) {
+		if (res->reorganizing) {
+			continue;
+		}
+		lock(&res->lock);
+		/* Async layers wait for close, or a forced sync */
+		if (res->dirty && (force ||
+				   res->durability == DURABILITY_GROUP_COMMIT)) {
+			if (force || res->deadline <= now) {
+				gdbm_sync(res->db);
+				res->dirty = false;
+			} else if (!next || res->deadline < next) {
+				next = res->deadline;
+			}
+		}
+
+		if (force || !res->writable || res->idle_checked ||
+		    res->dead < REORGANIZE_MIN_DEAD) {
+			unlock(&res->lock);
+			continue;
+		}
+		due = res->last_write + REORGANIZE_IDLE_DELAY;
+		if (due <= now) {
+			if (!reorganize) {
+				reorganize = buxton_array_new();
+			}
+			if (!reorganize || !buxton_array_add(reorganize, res)) {
+				abort();
+			}
+			res->users++;
+			res->reorganizing = true;
+		} else if (!next || due < next) {
+			next = due;
+		}
+		unlock(&res->lock);
+	}
+	unlock(&_resources_lock);
+
+	for (uint32_t i = 0; reorganize && i < reorganize->len; i++) {
+		res = buxton_array_get(reorganize, i);
+		lock(&res->lock);
+		maybe_reorganize(res->name, res);
+		unlock(&res->lock);
+		lock(&_resources_lock);
+		res->reorganizing = false;
+		res->users--;
+		unlock(&_resources_lock);
+	}
+	buxton_array_free(&reorganize, NULL);
+
+	if (!next) {
+		return -1;
+	}
+	return (int)(next - now);
+}
+
 _bx_export_ void buxton_module_destroy(void)
 {
-	const char *key;
 	Iterator iterator;
-	GDBM_FILE db;
+	GdbmResource *res;
 
-	/* close all gdbm handles */
-	HASHMAP_FOREACH_KEY(db, key, _resources, iterator) {
-		hashmap_remove(_resources, key);
-		gdbm_close(db);
-		free((void *)key);
+	/* flush batched writes, then close all gdbm handles */
+	HASHMAP_FOREACH(res, _resources, iterator) {
+		close_resource(res);
 	}
 	hashmap_free(_resources);
 	_resources = NULL;
+
+	buxton_debug("User database cache: %" PRIu64 " hits, %" PRIu64
+		     " misses, %" PRIu64 " evictions\n", _user_stats.hits,
+		     _user_stats.misses, _user_stats.evictions);
+}
+
+/*
+ * Databases being reorganized are left out of the byte counts, rather
+ * than waiting for them
+ */
+static void cache_stats(BuxtonCacheStats *stats)
+{
+	Iterator iterator;
+	GdbmResource *res;
+	struct stat st;
+
+	assert(stats);
+
+	lock(&_resources_lock);
+	*stats = _user_stats;
+	stats->open = _user_open;
+	stats->live = 0;
+	stats->dead = 0;
+	HASHMAP_FOREACH(res, _resources, iterator) {
+		if (res->reorganizing) {
+			continue;
+		}
+		lock(&res->lock);
+		if (fstat(gdbm_fdesc(res->db), &st) == 0) {
+			if ((uint64_t)st.st_size > res->dead) {
+				stats->live += (uint64_t)st.st_size - res->dead;
+			}
+			stats->dead += res->dead;
+		}
+		unlock(&res->lock);
+	}
+	unlock(&_resources_lock);
 }
 
 _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
@@ -492,8 +964,15 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->list_keys = &list_keys;
 	backend->list_names = &list_names;
 	backend->unset_value = &unset_value;
-	backend->create_db = (module_db_init_func) &db_for_resource;
-
+	backend->create_db = &create_db;
+	backend->sync = &sync_dbs;
+	backend->cache_stats = &cache_stats;
+	backend->concurrent = true;
+
+	LIST_HEAD_INIT(GdbmResource, _user_lru);
+	_user_open = 0;
+	_user_limit = (unsigned int)buxton_user_db_cache_size();
+	memset(&_user_stats, 0, sizeof(_user_stats));
 	_resources = hashmap_new(string_hash_func, string_compare_func);
 	if (!_resources) {
 		abort();
@@ -0,0 +1,1004 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "hashmap.h"
+#include "serialize.h"
+#include "util.h"
+
+/**
+ * Log-structured Database Module
+ *
+ * Every change to a layer is appended to a log file as a record,
+ * and an in-memory hash index maps each key to its latest record.
+ * The log is mmap'd, so values are deserialized straight from the
+ * mapping. Records are checksummed: on open, the log is replayed up
+ * to the first torn or corrupt record and the tail is discarded.
+ * Once more than half of the log is made of overwritten or deleted
+ * records, it is compacted into a new file that atomically replaces
+ * the old one.
+ */
+
+/* Identifies a log file, and its format version */
+#define LOG_MAGIC "BXTLOG01"
+#define LOG_HEADER_SIZE (sizeof(LOG_MAGIC) - 1)
+
+/* Record flag marking the deletion of a key */
+#define LOG_RECORD_TOMBSTONE 1
+
+/* Records are aligned so values can be deserialized in place */
+#define LOG_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
+/* The mapping grows in steps of this size */
+#define LOG_MAP_STEP (1024 * 1024)
+
+/* Logs smaller than this are never compacted */
+#define LOG_COMPACT_MIN_SIZE (64 * 1024)
+
+/* Time (ms) to wait before compacting a log again after a failure */
+#define LOG_COMPACT_RETRY_DELAY (60 * 1000)
+
+/**
+ * On-disk record header, followed by the key and the value
+ */
+struct log_record {
+	uint32_t crc; /**<CRC32 of the rest of the record */
+	uint32_t flags; /**<Record flags */
+	uint32_t key_size; /**<Key size, NUL terminators included */
+	uint32_t value_size; /**<Size of the buxton_serialize()d value */
+};
+
+/**
+ * Index entry, locating the latest record of a key
+ */
+struct logent {
+	unsigned hash; /**<Precomputed hash */
+	uint32_t size; /**<Key size in bytes */
+	char *value; /**<The key value */
+	uint64_t offset; /**<Offset of the record in the log */
+	uint32_t value_size; /**<Size of the record's value */
+};
+
+/**
+ * An open log, its mapping and its index
+ */
+typedef struct LogDatabase {
+	char *path; /**<Path of the log file */
+	int fd; /**<Descriptor of the log file */
+	bool readonly; /**<Log can't be written */
+	BuxtonDurability durability; /**<Durability policy of the layer */
+	int sync_interval; /**<Group commit interval in milliseconds */
+	uint8_t *map; /**<Mapping of the log file */
+	size_t map_size; /**<Size of the mapping */
+	uint64_t end; /**<End of the last valid record */
+	uint64_t live; /**<Bytes of records referenced by the index */
+	Hashmap *index; /**<Key to latest record mapping */
+	bool dirty; /**<Writes have been made since the last sync */
+	uint64_t deadline; /**<Monotonic time (ms) the pending sync is due */
+	uint64_t compact_retry; /**<Monotonic time (ms) a failed compaction may be retried */
+} LogDatabase;
+
+static Hashmap *_resources = NULL;
+static uint32_t crc_table[256];
+
+static void crc32_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[i] = c;
+	}
+}
+
+static uint32_t crc32(const uint8_t *buf, size_t len)
+{
+	uint32_t c = 0xffffffff;
+
+	while (len--) {
+		c = crc_table[(c ^ *buf++) & 0xff] ^ (c >> 8);
+	}
+	return c ^ 0xffffffff;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t record_size(uint32_t key_size, uint32_t value_size)
+{
+	return LOG_ALIGN(sizeof(struct log_record) + LOG_ALIGN(key_size) +
+			 value_size);
+}
+
+static inline uint8_t *record_value(LogDatabase *db, struct logent *ent)
+{
+	return db->map + ent->offset + sizeof(struct log_record) +
+		LOG_ALIGN(ent->size);
+}
+
+/* gets the hash code of the logent item */
+static unsigned hash_logent(const struct logent *item)
+{
+	return item->hash;
+}
+
+/* compares two logents a and b */
+static int compare_logent(const struct logent *a, const struct logent *b)
+{
+	return a->size == b->size ? memcmp(a->value, b->value, a->size) :
+		a->size < b->size ? -1 : 1;
+}
+
+/* fills a lookup logent for the given key bytes, without copying them */
+static void pack_logent(struct logent *ent, char *value, uint32_t size)
+{
+	unsigned hash = 5381;
+	uint32_t sz = size;
+
+	/* DJB's hash function */
+	while (sz) {
+		hash = (hash << 5) + hash + (unsigned char)value[--sz];
+	}
+	ent->hash = hash;
+	ent->size = size;
+	ent->value = value;
+}
+
+static void make_key_data(_BuxtonKey *key, char **value, uint32_t *size)
+{
+	uint32_t sz;
+	char *ptr;
+
+	/* compute requested size */
+	sz = key->group.length;
+	if (key->name.value) {
+		sz += key->name.length;
+	}
+
+	/* allocate */
+	ptr = malloc(sz);
+	if (!ptr) {
+		abort();
+	}
+
+	/* set */
+	memcpy(ptr, key->group.value, key->group.length);
+	if (key->name.value) {
+		memcpy(ptr + key->group.length, key->name.value,
+		       key->name.length);
+	}
+	*value = ptr;
+	*size = sz;
+}
+
+/* Make sure the mapping covers the log up to its end */
+static bool map_log(LogDatabase *db)
+{
+	size_t size;
+	void *map;
+
+	if (db->end <= db->map_size) {
+		return true;
+	}
+
+	size = (size_t)((db->end + LOG_MAP_STEP - 1) / LOG_MAP_STEP) *
+		LOG_MAP_STEP;
+	if (db->map) {
+		map = mremap(db->map, db->map_size, size, MREMAP_MAYMOVE);
+	} else {
+		map = mmap(NULL, size, PROT_READ, MAP_SHARED, db->fd, 0);
+	}
+	if (map == MAP_FAILED) {
+		buxton_log("Failed to map log %s: %m\n", db->path);
+		return false;
+	}
+	db->map = map;
+	db->map_size = size;
+
+	return true;
+}
+
+static void index_put(LogDatabase *db, char *value, uint32_t size,
+		      uint64_t offset, uint32_t value_size)
+{
+	struct logent lookup;
+	struct logent *ent;
+
+	pack_logent(&lookup, value, size);
+	ent = hashmap_get(db->index, &lookup);
+	if (ent) {
+		db->live -= record_size(ent->size, ent->value_size);
+	} else {
+		ent = malloc0(sizeof(struct logent));
+		if (!ent) {
+			abort();
+		}
+		*ent = lookup;
+		ent->value = malloc(size);
+		if (!ent->value) {
+			abort();
+		}
+		memcpy(ent->value, value, size);
+		if (hashmap_put(db->index, ent, ent) != 1) {
+			abort();
+		}
+	}
+	ent->offset = offset;
+	ent->value_size = value_size;
+	db->live += record_size(size, value_size);
+}
+
+static void index_remove(LogDatabase *db, struct logent *ent)
+{
+	hashmap_remove(db->index, ent);
+	db->live -= record_size(ent->size, ent->value_size);
+	free(ent->value);
+	free(ent);
+}
+
+/* Write the whole buffer at the given offset */
+static bool write_at(int fd, const uint8_t *buf, size_t len, uint64_t offset)
+{
+	ssize_t r;
+
+	while (len) {
+		r = pwrite(fd, buf, len, (off_t)offset);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		buf += r;
+		len -= (size_t)r;
+		offset += (uint64_t)r;
+	}
+	return true;
+}
+
+/*
+ * Append a record to the log, honouring the layer's durability.
+ * Returns the offset of the record, or 0 on failure.
+ */
+static uint64_t append_record(LogDatabase *db, char *key, uint32_t key_size,
+			      uint8_t *value, uint32_t value_size,
+			      uint32_t flags)
+{
+	_cleanup_free_ uint8_t *buf = NULL;
+	struct log_record *rec;
+	uint64_t size;
+	uint64_t offset;
+
+	size = record_size(key_size, value_size);
+	buf = malloc0((size_t)size);
+	if (!buf) {
+		abort();
+	}
+
+	rec = (struct log_record *)buf;
+	rec->flags = flags;
+	rec->key_size = key_size;
+	rec->value_size = value_size;
+	memcpy(buf + sizeof(struct log_record), key, key_size);
+	if (value_size) {
+		memcpy(buf + sizeof(struct log_record) + LOG_ALIGN(key_size),
+		       value, value_size);
+	}
+	rec->crc = crc32(buf + sizeof(uint32_t), (size_t)size - sizeof(uint32_t));
+
+	offset = db->end;
+	if (!write_at(db->fd, buf, (size_t)size, offset)) {
+		buxton_log("Failed to append to log %s: %m\n", db->path);
+		return 0;
+	}
+	db->end += size;
+	if (!map_log(db)) {
+		abort();
+	}
+
+	if (db->durability == DURABILITY_SYNC) {
+		if (fdatasync(db->fd) == -1) {
+			buxton_log("fdatasync(): %m\n");
+		}
+	} else if (db->durability == DURABILITY_GROUP_COMMIT && !db->dirty) {
+		db->dirty = true;
+		db->deadline = now_ms() + (uint64_t)db->sync_interval;
+	}
+
+	return offset;
+}
+
+/* Replay the log into the index, dropping any torn tail */
+static bool load_log(LogDatabase *db)
+{
+	struct stat st;
+	struct log_record rec;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t rsize;
+
+	if (fstat(db->fd, &st) == -1) {
+		return false;
+	}
+
+	if (st.st_size == 0) {
+		if (db->readonly) {
+			return true;
+		}
+		if (!write_at(db->fd, (uint8_t *)LOG_MAGIC, LOG_HEADER_SIZE, 0) ||
+		    fdatasync(db->fd) == -1) {
+			return false;
+		}
+		db->end = LOG_HEADER_SIZE;
+		return map_log(db);
+	}
+
+	size = (uint64_t)st.st_size;
+	db->end = size;
+	if (size < LOG_HEADER_SIZE || !map_log(db) ||
+	    memcmp(db->map, LOG_MAGIC, LOG_HEADER_SIZE) != 0) {
+		buxton_log("%s is not a valid log\n", db->path);
+		return false;
+	}
+
+	offset = LOG_HEADER_SIZE;
+	while (offset + sizeof(struct log_record) <= size) {
+		memcpy(&rec, db->map + offset, sizeof(struct log_record));
+		rsize = record_size(rec.key_size, rec.value_size);
+		if (rec.key_size == 0 || offset + rsize > size) {
+			break;
+		}
+		if (crc32(db->map + offset + sizeof(uint32_t),
+			  (size_t)rsize - sizeof(uint32_t)) != rec.crc) {
+			break;
+		}
+
+		if (rec.flags & LOG_RECORD_TOMBSTONE) {
+			struct logent lookup;
+			struct logent *ent;
+
+			pack_logent(&lookup, (char *)db->map + offset +
+				    sizeof(struct log_record), rec.key_size);
+			ent = hashmap_get(db->index, &lookup);
+			if (ent) {
+				index_remove(db, ent);
+			}
+		} else {
+			index_put(db, (char *)db->map + offset +
+				  sizeof(struct log_record), rec.key_size,
+				  offset, rec.value_size);
+		}
+		offset += rsize;
+	}
+
+	if (offset != size) {
+		buxton_log("Discarding %lu bytes of torn log tail in %s\n",
+			   (unsigned long)(size - offset), db->path);
+		if (!db->readonly && ftruncate(db->fd, (off_t)offset) == -1) {
+			return false;
+		}
+	}
+	db->end = offset;
+
+	return true;
+}
+
+/*
+ * Rewrite the live records into a new log and atomically swap it in.
+ * On failure the current log is left untouched. This module isn't
+ * concurrent, so buxton_direct_sync() calls sync_dbs() with the backend
+ * mutex held: no request can read the old mapping or append to the old
+ * file while the log is swapped, whichever worker runs the compaction.
+ * Requests to the layer wait for the whole rewrite, which is why it is
+ * only done once most of the log is dead.
+ */
+static bool compact_log(LogDatabase *db)
+{
+	_cleanup_free_ char *tmp = NULL;
+	_cleanup_free_ char *dir = NULL;
+	_cleanup_free_ uint64_t *offsets = NULL;
+	Iterator iterator;
+	struct logent *ent;
+	uint64_t offset;
+	uint64_t rsize;
+	size_t n = 0;
+	int fd;
+	int dfd;
+
+	if (asprintf(&tmp, "%s.compact", db->path) == -1) {
+		abort();
+	}
+	offsets = malloc0(sizeof(uint64_t) * (hashmap_size(db->index) + 1));
+	if (!offsets) {
+		abort();
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		buxton_log("Failed to create %s: %m\n", tmp);
+		return false;
+	}
+	if (!write_at(fd, (uint8_t *)LOG_MAGIC, LOG_HEADER_SIZE, 0)) {
+		goto fail;
+	}
+
+	/* Records are copied as-is, their checksums remain valid */
+	offset = LOG_HEADER_SIZE;
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+		rsize = record_size(ent->size, ent->value_size);
+		if (!write_at(fd, db->map + ent->offset, (size_t)rsize, offset)) {
+			goto fail;
+		}
+		offsets[n++] = offset;
+		offset += rsize;
+	}
+
+	if (fdatasync(fd) == -1 || rename(tmp, db->path) == -1) {
+		goto fail;
+	}
+
+	/* Persist the rename itself */
+	dir = strdup(db->path);
+	if (!dir) {
+		abort();
+	}
+	dfd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd != -1) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	/* Same iteration order, as the index hasn't changed */
+	n = 0;
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+		ent->offset = offsets[n++];
+	}
+
+	munmap(db->map, db->map_size);
+	close(db->fd);
+	db->map = NULL;
+	db->map_size = 0;
+	db->fd = fd;
+	db->end = offset;
+	db->live = offset - LOG_HEADER_SIZE;
+	db->dirty = false;
+	if (!map_log(db)) {
+		abort();
+	}
+
+	buxton_debug("Compacted log %s to %lu bytes\n", db->path,
+		     (unsigned long)offset);
+	return true;
+
+fail:
+	buxton_log("Failed to compact log %s: %m\n", db->path);
+	close(fd);
+	unlink(tmp);
+	return false;
+}
+
+static void free_log(LogDatabase *db)
+{
+	Iterator iterator;
+	struct logent *ent;
+
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+		hashmap_remove(db->index, ent);
+		free(ent->value);
+		free(ent);
+	}
+	hashmap_free(db->index);
+	if (db->map) {
+		munmap(db->map, db->map_size);
+	}
+	if (db->fd >= 0) {
+		if (db->dirty) {
+			fdatasync(db->fd);
+		}
+		close(db->fd);
+	}
+	free(db->path);
+	free(db);
+}
+
+/* Open or create logs on the fly */
+static LogDatabase *db_for_resource(BuxtonLayer *layer)
+{
+	LogDatabase *db;
+	char *name = NULL;
+	int r;
+
+	assert(layer);
+	assert(_resources);
+
+	if (layer->type == LAYER_USER) {
+		r = asprintf(&name, "%s-%d", layer->name.value, layer->uid);
+	} else {
+		r = asprintf(&name, "%s", layer->name.value);
+	}
+	if (r == -1) {
+		abort();
+	}
+
+	db = hashmap_get(_resources, name);
+	if (db) {
+		free(name);
+		return db;
+	}
+
+	db = malloc0(sizeof(LogDatabase));
+	if (!db) {
+		abort();
+	}
+	db->path = get_layer_path(layer);
+	if (!db->path) {
+		abort();
+	}
+	db->index = hashmap_new((hash_func_t)hash_logent,
+				(compare_func_t)compare_logent);
+	if (!db->index) {
+		abort();
+	}
+	db->readonly = layer->readonly;
+	db->durability = layer->durability;
+	db->sync_interval = layer->sync_interval;
+
+	if (db->readonly) {
+		db->fd = open(db->path, O_RDONLY | O_CLOEXEC);
+	} else {
+		db->fd = open(db->path, O_RDWR | O_CREAT | O_CLOEXEC,
+			      S_IRUSR | S_IWUSR);
+		/* fall back to reader mode, as with gdbm */
+		if (db->fd == -1 && (errno == EACCES || errno == EROFS)) {
+			buxton_debug("Attempting to fallback to opening log as read-only\n");
+			db->fd = open(db->path, O_RDONLY | O_CLOEXEC);
+			db->readonly = true;
+		}
+	}
+	if (db->fd == -1 || !load_log(db)) {
+		buxton_log("Couldn't open log for path: %s\n", db->path);
+		free_log(db);
+		free(name);
+		return NULL;
+	}
+
+	r = hashmap_put(_resources, name, db);
+	if (r != 1) {
+		abort();
+	}
+
+	return db;
+}
+
+static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	LogDatabase *db;
+	struct logent lookup;
+	struct logent *ent;
+	_cleanup_free_ char *key_data = NULL;
+	_cleanup_free_ uint8_t *data_store = NULL;
+	uint32_t key_size;
+	uint64_t offset;
+	size_t size;
+	BuxtonData cdata = {0};
+	BuxtonString clabel;
+	int ret;
+
+	assert(layer);
+	assert(key);
+	assert(label);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		ret = ENOENT;
+		goto end;
+	}
+	if (db->readonly) {
+		ret = EROFS;
+		goto end;
+	}
+
+	make_key_data(key, &key_data, &key_size);
+
+	/* set_label will pass a NULL for data */
+	if (!data) {
+		pack_logent(&lookup, key_data, key_size);
+		ent = hashmap_get(db->index, &lookup);
+		if (!ent) {
+			ret = ENOENT;
+			goto end;
+		}
+		buxton_deserialize(record_value(db, ent), &cdata, &clabel);
+		free(clabel.value);
+		data = &cdata;
+	}
+
+	size = buxton_serialize(data, label, &data_store);
+
+	offset = append_record(db, key_data, key_size, data_store,
+			       (uint32_t)size, 0);
+	if (!offset) {
+		ret = EIO;
+		goto end;
+	}
+	index_put(db, key_data, key_size, offset, (uint32_t)size);
+	ret = 0;
+
+end:
+	if (cdata.type == BUXTON_TYPE_STRING) {
+		free(cdata.store.d_string.value);
+	}
+
+	return ret;
+}
+
+static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
+		      BuxtonString *label)
+{
+	LogDatabase *db;
+	struct logent lookup;
+	struct logent *ent;
+	_cleanup_free_ char *key_data = NULL;
+	uint32_t key_size;
+	int ret;
+
+	assert(layer);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		/*
+		 * Set negative here to indicate layer not found
+		 * rather than key not found, optimization for
+		 * set value
+		 */
+		ret = -ENOENT;
+		goto end;
+	}
+
+	make_key_data(key, &key_data, &key_size);
+	pack_logent(&lookup, key_data, key_size);
+	ent = hashmap_get(db->index, &lookup);
+	if (!ent) {
+		ret = ENOENT;
+		goto end;
+	}
+
+	/* Deserialize straight from the mapping */
+	buxton_deserialize(record_value(db, ent), data, label);
+
+	if (data->type != key->type && key->type != BUXTON_TYPE_UNSET) {
+		free(label->value);
+		label->value = NULL;
+		if (data->type == BUXTON_TYPE_STRING) {
+			free(data->store.d_string.value);
+			data->store.d_string.value = NULL;
+		}
+		ret = EINVAL;
+		goto end;
+	}
+	ret = 0;
+
+end:
+	return ret;
+}
+
+static int unset_value(BuxtonLayer *layer,
+			_BuxtonKey *key,
+			__attribute__((unused)) BuxtonData *data,
+			__attribute__((unused)) BuxtonString *label)
+{
+	LogDatabase *db;
+	struct logent lookup;
+	struct logent *ent;
+	Iterator iterator;
+	_cleanup_free_ char *key_data = NULL;
+	uint32_t key_size;
+	int ret;
+
+	assert(layer);
+	assert(key);
+
+	db = db_for_resource(layer);
+	if (!db || db->readonly) {
+		ret = EROFS;
+		goto end;
+	}
+
+	if (key->name.value) {
+		make_key_data(key, &key_data, &key_size);
+		pack_logent(&lookup, key_data, key_size);
+		ent = hashmap_get(db->index, &lookup);
+		if (!ent) {
+			ret = ENOENT;
+			goto end;
+		}
+		if (!append_record(db, ent->value, ent->size, NULL, 0,
+				   LOG_RECORD_TOMBSTONE)) {
+			ret = EIO;
+			goto end;
+		}
+		index_remove(db, ent);
+		ret = 0;
+		goto end;
+	}
+
+	/* Removing a group removes the keys it holds as well */
+	ret = ENOENT;
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+		if (strcmp(ent->value, key->group.value)) {
+			continue;
+		}
+		if (!append_record(db, ent->value, ent->size, NULL, 0,
+				   LOG_RECORD_TOMBSTONE)) {
+			ret = EIO;
+			goto end;
+		}
+		index_remove(db, ent);
+		ret = 0;
+	}
+
+end:
+	return ret;
+}
+
+static bool list_keys(BuxtonLayer *layer,
+		      BuxtonArray **list)
+{
+	LogDatabase *db;
+	Iterator iterator;
+	struct logent *ent;
+	BuxtonArray *k_list = NULL;
+	BuxtonData *current = NULL;
+	uint32_t glen;
+
+	assert(layer);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		return false;
+	}
+
+	k_list = buxton_array_new();
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+		glen = (uint32_t)strlen(ent->value) + 1;
+		if (glen == ent->size) {
+			continue;
+		}
+
+		current = malloc0(sizeof(BuxtonData));
+		if (!current) {
+			abort();
+		}
+		current->type = BUXTON_TYPE_STRING;
+		current->store.d_string.value = strdup(ent->value + glen);
+		if (!current->store.d_string.value) {
+			abort();
+		}
+		current->store.d_string.length = ent->size - glen;
+		if (!buxton_array_add(k_list, current)) {
+			abort();
+		}
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **list)
+{
+	LogDatabase *db;
+	Iterator iterator;
+	struct logent *ent;
+	BuxtonArray *k_list = NULL;
+	BuxtonData *data = NULL;
+	char *gname;
+	char *value;
+	char *copy;
+	uint32_t glen;
+	uint32_t klen;
+	uint32_t length;
+	bool ret = false;
+
+	assert(layer);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		goto end;
+	}
+
+	if (group && !group->length) {
+		group = NULL;
+	}
+	if (prefix && !prefix->length) {
+		prefix = NULL;
+	}
+
+	value = NULL;
+	k_list = buxton_array_new();
+	HASHMAP_FOREACH(ent, db->index, iterator) {
+
+		/* get main data of the key */
+		gname = ent->value;
+		glen = (uint32_t)strlen(gname) + 1;
+		assert(ent->size >= glen);
+		klen = ent->size - glen;
+
+		if (klen) {
+			/* it is a key */
+			if (group && glen == group->length
+				&& !strcmp(gname, group->value)) {
+				value = gname + glen;
+				length = klen;
+			}
+		} else {
+			/* it is a group */
+			if (!group) {
+				value = gname;
+				length = glen;
+			}
+		}
+
+		/* treat a potential value */
+		if (value) {
+			/* check the prefix */
+			if (!prefix || !strncmp(value, prefix->value,
+				prefix->length - 1))  {
+				/* add the value */
+				data = malloc0(sizeof(BuxtonData));
+				copy = malloc(length);
+				if (data && copy
+				    && buxton_array_add(k_list, data)) {
+					data->type = BUXTON_TYPE_STRING;
+					data->store.d_string.value = copy;
+					data->store.d_string.length = length;
+					memcpy(copy, value, length);
+				} else {
+					free(data);
+					free(copy);
+					goto end;
+				}
+			}
+			value = NULL;
+		}
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	ret = true;
+
+end:
+	if (!ret && k_list) {
+		buxton_array_free(&k_list, (buxton_free_func)data_free);
+	}
+	return ret;
+}
+
+/*
+ * Flush due group commits, and compact logs that are mostly made of
+ * dead records. This runs from the daemon loop between requests.
+ */
+static int sync_dbs(bool force)
+{
+	Iterator iterator;
+	LogDatabase *db;
+	uint64_t now;
+	uint64_t next = 0;
+
+	now = now_ms();
+	HASHMAP_FOREACH(db, _resources, iterator) {
+		if (!db->readonly && db->end > LOG_COMPACT_MIN_SIZE &&
+		    db->end - LOG_HEADER_SIZE - db->live > db->live &&
+		    db->compact_retry <= now && !compact_log(db)) {
+			/* Don't rewrite the log on every loop if the disk is full */
+			db->compact_retry = now + LOG_COMPACT_RETRY_DELAY;
+		}
+		if (!db->dirty) {
+			continue;
+		}
+		if (force || db->deadline <= now) {
+			if (fdatasync(db->fd) == -1) {
+				buxton_log("fdatasync(): %m\n");
+			}
+			db->dirty = false;
+			continue;
+		}
+		if (!next || db->deadline < next) {
+			next = db->deadline;
+		}
+	}
+
+	if (!next) {
+		return -1;
+	}
+	return (int)(next - now);
+}
+
+_bx_export_ void buxton_module_destroy(void)
+{
+	const char *key;
+	Iterator iterator;
+	LogDatabase *db;
+
+	/* sync and close all logs */
+	HASHMAP_FOREACH_KEY(db, key, _resources, iterator) {
+		hashmap_remove(_resources, key);
+		free_log(db);
+		free((void *)key);
+	}
+	hashmap_free(_resources);
+	_resources = NULL;
+}
+
+_bx_export_ bool buxton_module_init(BuxtonBackend *backend)
+{
+
+	assert(backend);
+
+	/* Point the struct methods back to our own */
+	backend->set_value = &set_value;
+	backend->get_value = &get_value;
+	backend->list_keys = &list_keys;
+	backend->list_names = &list_names;
+	backend->unset_value = &unset_value;
+	backend->create_db = (module_db_init_func) &db_for_resource;
+	backend->sync = &sync_dbs;
+
+	crc32_init();
+
+	_resources = hashmap_new(string_hash_func, string_compare_func);
+	if (!_resources) {
+		abort();
+	}
+
+	return true;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -15,8 +15,13 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "hashmap.h"
+#include "keyid.h"
 #include "log.h"
 #include "buxton.h"
 #include "backend.h"
@@ -28,153 +33,433 @@
  * Used for quick testing and debugging of Buxton, to ensure protocol
  * and direct access are working as intended.
  * Note this is not persistent.
+ *
+ * Each layer is an open addressing table of records. A record holds the
+ * key, the label and the value in a single allocation carved from size
+ * class slabs, so small keys cost one slot and one slab cell.
+ *
+ * The module is concurrent: each store has a reader/writer lock, so
+ * lookups and listings of a layer run in parallel and modifications
+ * are exclusive. Stores are created on first use under the resources
+ * lock and only freed when the module is destroyed.
  */
 
 
 static Hashmap *_resources;
+static pthread_rwlock_t _resources_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Size of the slab chunks records are carved from */
+#define CHUNK_SIZE (64 * 1024)
+
+/* Initial number of slots of a store, must be a power of two */
+#define STORE_MIN_SLOTS 64
+
+/* Slot hashes below SLOT_FIRST mark empty and deleted slots */
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+#define SLOT_FIRST 2
 
-/* structure for storing keys */
-struct keyrec {
-	unsigned hash; /**< Precomputed hash  */
-	uint32_t size; /**< Key size in bytes */
-	char *value; /**< The key value */
+/* Record size classes, records larger than the last one are malloc'd */
+static const uint32_t class_size[] = {
+	32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
 };
+#define NCLASSES (sizeof(class_size) / sizeof(class_size[0]))
+#define CLASS_LARGE NCLASSES
 
-/* structure for storing values */
-struct valrec {
-	BuxtonData data;    /**< Recorded data */
-	BuxtonString label; /**< Recorded label */
+/*
+ * A key and its value. The key (group and name, NULs included), the
+ * label and a string value are stored inline after the header, other
+ * value types live in the header itself.
+ */
+struct record {
+	uint32_t key_size; /**<Size of the group and name */
+	uint32_t label_size; /**<Size of the label */
+	uint32_t value_size; /**<Size of a string value, 0 for other types */
+	uint8_t type; /**<BuxtonDataType of the value */
+	uint8_t sclass; /**<Size class the record was allocated from */
+	uint64_t scalar; /**<Value of non string types */
+	uint64_t version; /**<Version stamp of the value */
+	char data[]; /**<Key, label and string value, back to back */
 };
 
-/* creates a keyrec from the key */
-static struct keyrec *make_keyrec(_BuxtonKey *key)
-{
-	uint32_t sz;
-	struct keyrec *result;
-        unsigned hash;
+/* A slot of the open addressing table */
+struct slot {
+	uint32_t hash; /**<Cached hash of the key, or SLOT_EMPTY/SLOT_DELETED */
+	struct record *rec; /**<The record stored in the slot */
+};
 
-	/* compute requested size */
-	sz = key->group.length;
-	if (key->name.value) {
-		sz += key->name.length;
-	}
+/* A slab chunk, records are carved from data */
+struct chunk {
+	struct chunk *next; /**<Next chunk of the store */
+	uint64_t data[]; /**<Record storage */
+};
 
-	/* allocate */
-	result = malloc(sizeof(struct keyrec));
-	if (!result) {
-		return NULL;
+/* The contents of a layer */
+struct store {
+	struct slot *slots; /**<Linear probing table */
+	uint32_t mask; /**<Number of slots minus one */
+	uint32_t count; /**<Number of records */
+	uint32_t used; /**<Number of records and deleted slots */
+	struct record *free[NCLASSES]; /**<Freed records of each size class */
+	struct chunk *chunks; /**<Chunks allocated by the store */
+	char *next; /**<Free space in the current chunk */
+	size_t left; /**<Bytes left in the current chunk */
+	pthread_rwlock_t lock; /**<Held shared to read the store, exclusively to modify it */
+};
+
+static void rwlock_read(pthread_rwlock_t *lock)
+{
+	if (pthread_rwlock_rdlock(lock)) {
+		abort();
 	}
-	result->value = malloc(sz);
-	if (!result->value) {
-		free(result);
-		return NULL;
+}
+
+static void rwlock_write(pthread_rwlock_t *lock)
+{
+	if (pthread_rwlock_wrlock(lock)) {
+		abort();
 	}
+}
 
-	/* set */
-	result->size = sz;
-	memcpy(result->value, key->group.value, key->group.length);
-	if (key->name.value) {
-		memcpy(result->value + key->group.length, key->name.value,
-		       key->name.length);
+static void rwlock_unlock(pthread_rwlock_t *lock)
+{
+	if (pthread_rwlock_unlock(lock)) {
+		abort();
 	}
+}
+
+static uint32_t hash_key(_BuxtonKey *key)
+{
+	uint32_t hash;
 
-        /* DJB's hash function */
-        hash = 5381;
-        while (sz) {
-                hash = (hash << 5) + hash + (unsigned char)result->value[--sz];
+	/* Interned keys were hashed once, when buxtond parsed the request */
+	hash = key->id ? key->id->hash : buxton_key_hash(key);
+	if (hash < SLOT_FIRST) {
+		hash += SLOT_FIRST;
 	}
-	result->hash = hash;
 
-	return result;
+	return hash;
 }
 
-/* free the keyrec item */
-static inline void free_keyrec(struct keyrec *item)
+static bool record_matches(struct record *rec, _BuxtonKey *key)
 {
-	free(item->value);
-	free(item);
+	uint32_t nlen = key->name.value ? key->name.length : 0;
+
+	if (rec->key_size != key->group.length + nlen) {
+		return false;
+	}
+	if (memcmp(rec->data, key->group.value, key->group.length) != 0) {
+		return false;
+	}
+	return !nlen || memcmp(rec->data + key->group.length,
+			       key->name.value, nlen) == 0;
 }
 
-/* gets the hash code of the keyrec item */
-static unsigned hash_keyrec(const struct keyrec *item)
+static uint8_t class_for(size_t size)
 {
-	return item->hash;
+	for (uint8_t i = 0; i < NCLASSES; i++) {
+		if (size <= class_size[i]) {
+			return i;
+		}
+	}
+	return CLASS_LARGE;
 }
 
-/* compares two keyrecs a and b */
-static int compare_keyrec(const struct keyrec *a, const struct keyrec *b)
+static struct store *store_new(void)
 {
-	return a->size == b->size ? memcmp(a->value, b->value, a->size) :
-		a->size < b->size ? -1 : 1;
+	struct store *store;
+
+	store = malloc0(sizeof(struct store));
+	if (!store) {
+		abort();
+	}
+	store->slots = calloc(STORE_MIN_SLOTS, sizeof(struct slot));
+	if (!store->slots) {
+		abort();
+	}
+	store->mask = STORE_MIN_SLOTS - 1;
+	if (pthread_rwlock_init(&store->lock, NULL)) {
+		abort();
+	}
+
+	return store;
 }
 
-/* free the valrec item */
-static void free_valrec(struct valrec *item)
+static struct record *record_alloc(struct store *store, uint8_t sclass,
+				   size_t size)
 {
-	if (item) {
-		if (item->data.type == BUXTON_TYPE_STRING) {
-			free(item->data.store.d_string.value);
+	struct record *rec;
+	struct chunk *chunk;
+
+	if (sclass == CLASS_LARGE) {
+		rec = malloc(size);
+		if (!rec) {
+			abort();
+		}
+		rec->sclass = sclass;
+		return rec;
+	}
+
+	rec = store->free[sclass];
+	if (rec) {
+		memcpy(&store->free[sclass], rec->data, sizeof(struct record *));
+		return rec;
+	}
+
+	if (store->left < class_size[sclass]) {
+		/* the tail of the previous chunk is wasted */
+		chunk = malloc(CHUNK_SIZE);
+		if (!chunk) {
+			abort();
 		}
-		free(item->label.value);
-		free(item);
+		chunk->next = store->chunks;
+		store->chunks = chunk;
+		store->next = (char *)chunk->data;
+		store->left = CHUNK_SIZE - offsetof(struct chunk, data);
+	}
+	rec = (struct record *)store->next;
+	store->next += class_size[sclass];
+	store->left -= class_size[sclass];
+	rec->sclass = sclass;
+
+	return rec;
+}
+
+static void record_free(struct store *store, struct record *rec)
+{
+	if (rec->sclass == CLASS_LARGE) {
+		free(rec);
+		return;
 	}
+	/* keep the free list link in the data of the record */
+	memcpy(rec->data, &store->free[rec->sclass], sizeof(struct record *));
+	store->free[rec->sclass] = rec;
 }
 
-static bool set_valrec(struct valrec *item, BuxtonData *data,
-			      BuxtonString *label)
+/*
+ * Look for a key. Returns the slot holding it, or -1 with *insert set to
+ * the slot a new record for the key should go to.
+ */
+static int64_t store_find(struct store *store, _BuxtonKey *key, uint32_t hash,
+			  uint32_t *insert)
 {
-	char *sdata;
-	char *slabel;
-
-	/* allocate data if needed */
-	if (data && data->type == BUXTON_TYPE_STRING &&
-	    data->store.d_string.value) {
-		sdata = malloc(data->store.d_string.length);
-		if (!sdata) {
-			return false;
+	uint32_t i = hash & store->mask;
+	bool found_deleted = false;
+
+	for (;; i = (i + 1) & store->mask) {
+		struct slot *slot = &store->slots[i];
+
+		if (slot->hash == SLOT_EMPTY) {
+			if (insert && !found_deleted) {
+				*insert = i;
+			}
+			return -1;
+		}
+		if (slot->hash == SLOT_DELETED) {
+			if (insert && !found_deleted) {
+				*insert = i;
+				found_deleted = true;
+			}
+			continue;
+		}
+		if (slot->hash == hash && record_matches(slot->rec, key)) {
+			return i;
 		}
-		memcpy(sdata, data->store.d_string.value,
-			data->store.d_string.length);
-	} else {
-		sdata = NULL;
 	}
+}
+
+/* Rehash the live records into a table sized for the record count */
+static void store_resize(struct store *store)
+{
+	struct slot *old = store->slots;
+	uint32_t old_size = store->mask + 1;
+	uint32_t size = STORE_MIN_SLOTS;
 
-	/* allocate label if needed */
-	if (label && label->value) {
-		slabel = malloc(label->length);
-		if (!slabel) {
-			free(sdata);
-			return false;
+	while (size / 2 < store->count + 1) {
+		size *= 2;
+	}
+	store->slots = calloc(size, sizeof(struct slot));
+	if (!store->slots) {
+		abort();
+	}
+	store->mask = size - 1;
+	store->used = store->count;
+
+	for (uint32_t i = 0; i < old_size; i++) {
+		uint32_t j;
+
+		if (old[i].hash < SLOT_FIRST) {
+			continue;
 		}
-		memcpy(slabel, label->value, label->length);
-	} else {
-		slabel = NULL;
+		for (j = old[i].hash & store->mask;
+		     store->slots[j].hash != SLOT_EMPTY;
+		     j = (j + 1) & store->mask);
+		store->slots[j] = old[i];
 	}
+	free(old);
+}
 
-	/* copy now */
-	if (data) {
-		if (item->data.type == BUXTON_TYPE_STRING) {
-			free(item->data.store.d_string.value);
+/* Size of a label or a value once stored in a record */
+static uint32_t label_size_of(BuxtonString *label)
+{
+	return label->value ? label->length : 0;
+}
+
+static uint32_t value_size_of(BuxtonData *data)
+{
+	if (data->type == BUXTON_TYPE_STRING && data->store.d_string.value) {
+		return data->store.d_string.length;
+	}
+	return 0;
+}
+
+/* Copy a new label and/or value into a record with room for them */
+static void record_write(struct record *rec, BuxtonData *data,
+			 BuxtonString *label)
+{
+	if (label) {
+		rec->label_size = label_size_of(label);
+		if (rec->label_size) {
+			memcpy(rec->data + rec->key_size, label->value,
+			       rec->label_size);
 		}
-		item->data = *data;
+	}
+	if (data) {
+		rec->type = (uint8_t)data->type;
+		rec->version = data->version;
+		rec->value_size = value_size_of(data);
 		if (data->type == BUXTON_TYPE_STRING) {
-			item->data.store.d_string.value = sdata;
+			if (rec->value_size) {
+				memcpy(rec->data + rec->key_size +
+				       rec->label_size,
+				       data->store.d_string.value,
+				       rec->value_size);
+			}
+		} else {
+			memcpy(&rec->scalar, &data->store, sizeof(rec->scalar));
 		}
 	}
+}
 
-	if (label) {
-		free(item->label.value);
-		item->label.length = label->length;
-		item->label.value = slabel;
+/*
+ * Write a value and/or a label into a record, moving it to another size
+ * class if it no longer fits. A NULL data or label keeps the current one.
+ */
+static struct record *record_update(struct store *store, struct record *rec,
+				    BuxtonData *data, BuxtonString *label)
+{
+	struct record *dst;
+	uint32_t label_size = label ? label_size_of(label) : rec->label_size;
+	uint32_t value_size = data ? value_size_of(data) : rec->value_size;
+	size_t size;
+	uint8_t sclass;
+
+	size = sizeof(struct record) + rec->key_size + label_size + value_size;
+	sclass = class_for(size);
+	if (sclass == rec->sclass && sclass != CLASS_LARGE) {
+		/* a kept value has to move along with the new label */
+		dst = rec;
+		if (!data) {
+			memmove(rec->data + rec->key_size + label_size,
+				rec->data + rec->key_size + rec->label_size,
+				value_size);
+		}
+	} else {
+		dst = record_alloc(store, sclass, size);
+		dst->key_size = rec->key_size;
+		dst->label_size = label_size;
+		dst->value_size = value_size;
+		dst->type = rec->type;
+		dst->scalar = rec->scalar;
+		dst->version = rec->version;
+		memcpy(dst->data, rec->data, rec->key_size);
+		if (!label) {
+			memcpy(dst->data + dst->key_size,
+			       rec->data + rec->key_size, label_size);
+		}
+		if (!data) {
+			memcpy(dst->data + dst->key_size + label_size,
+			       rec->data + rec->key_size + rec->label_size,
+			       value_size);
+		}
+		record_free(store, rec);
 	}
+	record_write(dst, data, label);
 
-	return true;
+	return dst;
+}
+
+/* Add a new key, which must not exist yet, at the given slot */
+static void store_insert(struct store *store, _BuxtonKey *key, uint32_t hash,
+			 uint32_t slot, BuxtonData *data, BuxtonString *label)
+{
+	struct record *rec;
+	uint32_t key_size = key->group.length;
+	size_t size;
+
+	if (key->name.value) {
+		key_size += key->name.length;
+	}
+	size = sizeof(struct record) + key_size + label_size_of(label) +
+		value_size_of(data);
+
+	rec = record_alloc(store, class_for(size), size);
+	rec->key_size = key_size;
+	rec->label_size = 0;
+	rec->value_size = 0;
+	rec->scalar = 0;
+	rec->version = 0;
+	memcpy(rec->data, key->group.value, key->group.length);
+	if (key->name.value) {
+		memcpy(rec->data + key->group.length, key->name.value,
+		       key->name.length);
+	}
+	record_write(rec, data, label);
+
+	if (store->slots[slot].hash == SLOT_EMPTY) {
+		store->used++;
+	}
+	store->slots[slot].hash = hash;
+	store->slots[slot].rec = rec;
+	store->count++;
+
+	/* keep at most 3/4 of the slots in use */
+	if (store->used * 4 > (store->mask + 1) * 3) {
+		store_resize(store);
+	}
+}
+
+static void store_remove(struct store *store, uint32_t slot)
+{
+	record_free(store, store->slots[slot].rec);
+	store->slots[slot].hash = SLOT_DELETED;
+	store->slots[slot].rec = NULL;
+	store->count--;
+}
+
+static void store_free(struct store *store)
+{
+	struct chunk *chunk;
+
+	for (uint32_t i = 0; i <= store->mask; i++) {
+		if (store->slots[i].hash >= SLOT_FIRST &&
+		    store->slots[i].rec->sclass == CLASS_LARGE) {
+			free(store->slots[i].rec);
+		}
+	}
+	while ((chunk = store->chunks)) {
+		store->chunks = chunk->next;
+		free(chunk);
+	}
+	free(store->slots);
+	pthread_rwlock_destroy(&store->lock);
+	free(store);
 }
 
-/* Return existing hashmap or create new hashmap on the fly */
-static Hashmap *_db_for_resource(BuxtonLayer *layer)
+/* Return existing store or create new store on the fly */
+static struct store *_db_for_resource(BuxtonLayer *layer)
 {
-	Hashmap *db;
+	struct store *db;
 	char *name = NULL;
 	int r;
 
@@ -190,14 +475,24 @@ static Hashmap *_db_for_resource(BuxtonLayer *layer)
 		return NULL;
 	}
 
+	rwlock_read(&_resources_lock);
+	db = hashmap_get(_resources, name);
+	rwlock_unlock(&_resources_lock);
+	if (db) {
+		free(name);
+		return db;
+	}
+
+	/* Look again, another thread may have created it meanwhile */
+	rwlock_write(&_resources_lock);
 	db = hashmap_get(_resources, name);
 	if (!db) {
-		db = hashmap_new((hash_func_t)hash_keyrec,
-				 (compare_func_t)compare_keyrec);
+		db = store_new();
 		hashmap_put(_resources, name, db);
 	} else {
 		free(name);
 	}
+	rwlock_unlock(&_resources_lock);
 
 	return db;
 }
@@ -205,10 +500,11 @@ static Hashmap *_db_for_resource(BuxtonLayer *layer)
 static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	Hashmap *db;
+	struct store *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
+	int64_t slot;
+	uint32_t hash;
+	uint32_t insert;
 
 	assert(layer);
 	assert(key);
@@ -220,34 +516,24 @@ static int set_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		abort();
-	}
-
-	valrec = hashmap_get(db, keyrec);
-	if (valrec) {
-		free_keyrec(keyrec);
-		if (!set_valrec(valrec, data, label)) {
-			abort();
-		}
+	hash = hash_key(key);
+	rwlock_write(&db->lock);
+	slot = store_find(db, key, hash, &insert);
+	if (slot >= 0) {
+		db->slots[slot].rec = record_update(db, db->slots[slot].rec,
+						    data, label);
 	} else {
 		if (!data) {
 			ret = ENOENT;
-			goto end;
-		}
-		valrec = calloc(1, sizeof * valrec);
-		if (!valrec) {
-			abort();
-		}
-		if (!set_valrec(valrec, data, label) ||
-		    hashmap_put(db, keyrec, valrec) != 1) {
-			abort();
+			goto unlock;
 		}
+		store_insert(db, key, hash, insert, data, label);
 	}
 
 	ret = 0;
 
+unlock:
+	rwlock_unlock(&db->lock);
 end:
 	return ret;
 }
@@ -255,10 +541,11 @@ end:
 static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		      BuxtonString *label)
 {
-	Hashmap *db;
+	struct store *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
+	int64_t slot;
+	struct record *rec;
+	BuxtonString rlabel;
 
 	assert(layer);
 	assert(key);
@@ -276,34 +563,43 @@ static int get_value(BuxtonLayer *layer, _BuxtonKey *key, BuxtonData *data,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		ret = ENOMEM;
-		goto end;
-	}
-
-	valrec = hashmap_get(db, keyrec);
-	free_keyrec(keyrec);
-
-	if (!valrec) {
+	rwlock_read(&db->lock);
+	slot = store_find(db, key, hash_key(key), NULL);
+	if (slot < 0) {
 		ret = ENOENT;
-		goto end;
+		goto unlock;
 	}
-	if (valrec->data.type != key->type && key->type != BUXTON_TYPE_UNSET) {
+	rec = db->slots[slot].rec;
+	if (rec->type != key->type && key->type != BUXTON_TYPE_UNSET) {
 		ret = EINVAL;
-		goto end;
+		goto unlock;
 	}
 
-	if (!buxton_data_copy(&valrec->data, data)) {
-		abort();
+	data->type = rec->type;
+	data->version = rec->version;
+	if (rec->type == BUXTON_TYPE_STRING) {
+		data->store.d_string.value = malloc(rec->value_size);
+		if (!data->store.d_string.value) {
+			abort();
+		}
+		memcpy(data->store.d_string.value,
+		       rec->data + rec->key_size + rec->label_size,
+		       rec->value_size);
+		data->store.d_string.length = rec->value_size;
+	} else {
+		memcpy(&data->store, &rec->scalar, sizeof(rec->scalar));
 	}
 
-	if (!buxton_string_copy(&valrec->label, label)) {
+	rlabel.value = rec->data + rec->key_size;
+	rlabel.length = rec->label_size;
+	if (!buxton_string_copy(&rlabel, label)) {
 		abort();
 	}
 
 	ret = 0;
 
+unlock:
+	rwlock_unlock(&db->lock);
 end:
 	return ret;
 }
@@ -311,11 +607,9 @@ end:
 static int unset_key(BuxtonLayer *layer,
 			_BuxtonKey *key)
 {
-	Hashmap *db;
+	struct store *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct keyrec *remkey;
-	struct valrec *valrec;
+	int64_t slot;
 
 	assert(layer);
 	assert(key);
@@ -327,26 +621,21 @@ static int unset_key(BuxtonLayer *layer,
 		goto end;
 	}
 
-	keyrec = make_keyrec(key);
-	if (!keyrec) {
-		ret = ENOMEM;
-		goto end;
-	}
-
 	/* test if the value exists */
-	valrec = hashmap_remove2(db, keyrec, (void**)&remkey);
-	free_keyrec(keyrec);
-	if (!valrec) {
+	rwlock_write(&db->lock);
+	slot = store_find(db, key, hash_key(key), NULL);
+	if (slot < 0) {
 		ret = ENOENT;
-		goto end;
+		goto unlock;
 	}
 
 	/* free the data */
-	free_valrec(valrec);
-	free_keyrec(remkey);
+	store_remove(db, (uint32_t)slot);
 
 	ret = 0;
 
+unlock:
+	rwlock_unlock(&db->lock);
 end:
 	return ret;
 }
@@ -354,11 +643,8 @@ end:
 static int unset_group(BuxtonLayer *layer,
 			_BuxtonKey *key)
 {
-	Hashmap *db;
+	struct store *db;
 	int ret;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
-	Iterator iterator;
 
 	assert(layer);
 	assert(key);
@@ -371,18 +657,22 @@ static int unset_group(BuxtonLayer *layer,
 	}
 
 	ret = ENOENT;
-	/* Iterate through the keys and record matching keys in k_list */
-	HASHMAP_FOREACH_KEY(valrec, keyrec, db, iterator) {
+	/* Remove the group and all of its keys */
+	rwlock_write(&db->lock);
+	for (uint32_t i = 0; i <= db->mask; i++) {
+		struct record *rec = db->slots[i].rec;
 
+		if (db->slots[i].hash < SLOT_FIRST) {
+			continue;
+		}
 		/* test if the key matches the group */
-		if (!strcmp(keyrec->value, key->group.value)) {
+		if (!strcmp(rec->data, key->group.value)) {
 			/* yes it matches */
-			hashmap_remove(db, keyrec);
-			free_valrec(valrec);
-			free_keyrec(keyrec);
+			store_remove(db, i);
 			ret = 0;
 		}
 	}
+	rwlock_unlock(&db->lock);
 
 end:
 	return ret;
@@ -408,11 +698,10 @@ static bool list_names(BuxtonLayer *layer,
 		       BuxtonString *prefix,
 		       BuxtonArray **ret_list)
 {
-	Hashmap *db;
+	struct store *db;
 	BuxtonArray *list = NULL;
 	BuxtonData *data;
-	Iterator iterator;
-	BuxtonArray *array;
+	struct record *rec;
 	char *gname;
 	char *value;
 	char *copy;
@@ -420,7 +709,6 @@ static bool list_names(BuxtonLayer *layer,
 	uint32_t klen;
 	uint32_t length;
 	bool ret = false;
-	struct keyrec *keyrec;
 
 	assert(layer);
 
@@ -440,13 +728,18 @@ static bool list_names(BuxtonLayer *layer,
 	list = buxton_array_new();
 
 	/* Iterate through all of the keys */
-	HASHMAP_FOREACH_KEY(array, keyrec, db, iterator) {
+	rwlock_read(&db->lock);
+	for (uint32_t i = 0; i <= db->mask; i++) {
+		if (db->slots[i].hash < SLOT_FIRST) {
+			continue;
+		}
+		rec = db->slots[i].rec;
 
 		/* get main data of the key */
-		gname = (char*)keyrec->value;
+		gname = rec->data;
 		glen = (uint32_t)strlen(gname) + 1;
-		assert(keyrec->size >= glen);
-		klen = keyrec->size - glen;
+		assert(rec->key_size >= glen);
+		klen = rec->key_size - glen;
 		assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
 
 		/* treat the key value if it*/
@@ -482,7 +775,7 @@ static bool list_names(BuxtonLayer *layer,
 				} else {
 					free(data);
 					free(copy);
-					goto end;
+					goto unlock;
 				}
 			}
 			value = NULL;
@@ -493,6 +786,8 @@ static bool list_names(BuxtonLayer *layer,
 	*ret_list = list;
 	ret = true;
 
+unlock:
+	rwlock_unlock(&db->lock);
 end:
 	if (!ret && list) {
 		buxton_array_free(&list, (buxton_free_func)data_free);
@@ -503,20 +798,13 @@ end:
 _bx_export_ void buxton_module_destroy(void)
 {
 	char *klayer;
-	struct keyrec *keyrec;
-	struct valrec *valrec;
-	Iterator iteratori, iteratoro;
-	Hashmap *map;
-
-	/* free all hashmaps */
-	HASHMAP_FOREACH_KEY(map, klayer, _resources, iteratoro) {
-		HASHMAP_FOREACH_KEY(valrec, keyrec, map, iteratori) {
-			hashmap_remove(map, keyrec);
-			free_valrec(valrec);
-			free_keyrec(keyrec);
-		}
+	Iterator iterator;
+	struct store *store;
+
+	/* free all stores */
+	HASHMAP_FOREACH_KEY(store, klayer, _resources, iterator) {
 		hashmap_remove(_resources, klayer);
-		hashmap_free(map);
+		store_free(store);
 		free(klayer);
 	}
 	hashmap_free(_resources);
@@ -535,6 +823,7 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->list_keys = NULL;
 	backend->list_names = list_names;
 	backend->create_db = NULL;
+	backend->concurrent = true;
 
 	_resources = hashmap_new(string_hash_func, string_compare_func);
 	if (!_resources) {
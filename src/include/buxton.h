@@ -75,9 +75,28 @@ typedef enum BuxtonControlMessage {
 	BUXTON_CONTROL_CHANGED, /**<A key changed in Buxton */
 	BUXTON_CONTROL_GET_LABEL, /**<Get a label from Buxton */
 	BUXTON_CONTROL_LIST_NAMES, /**<List names within Buxton */
+	BUXTON_CONTROL_STATS, /**<Retrieve daemon request statistics */
+	BUXTON_CONTROL_NOTIFY_PREFIX, /**<Register for notification on a group or name prefix */
+	BUXTON_CONTROL_UNNOTIFY_PREFIX, /**<Opt out of notifications on a group or name prefix */
+	BUXTON_CONTROL_CHANGES, /**<Retrieve the changes made since a sequence number */
+	BUXTON_CONTROL_GET_IF_CHANGED, /**<Retrieve a value unless its version is known */
+	BUXTON_CONTROL_CAS, /**<Set a value if its current value or version matches */
+	BUXTON_CONTROL_ADD, /**<Add to an integer value within Buxton */
 	BUXTON_CONTROL_MAX
 } BuxtonControlMessage;
 
+/**
+ * Status of a conditional get whose value still has the version the
+ * client knows
+ */
+#define BUXTON_STATUS_NOT_MODIFIED 1
+
+/**
+ * Status of a compare and set whose key no longer has the expected
+ * value or version
+ */
+#define BUXTON_STATUS_MISMATCH 2
+
 /**
  * Used to communicate with Buxton
  */
@@ -142,6 +161,55 @@ _bx_export_ int buxton_set_value(BuxtonClient client,
 				 bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Set a value within Buxton only if it still has an expected value or
+ * version, in a single request
+ * The response carries the value and version stored, or the status
+ * BUXTON_STATUS_MISMATCH with the current value and version, if any.
+ * @param client An open client connection
+ * @param key The key to set
+ * @param value A pointer to a supported data type
+ * @param expected A pointer to the value the key must have, or NULL
+ * to compare its version instead
+ * @param version Version the key must have if expected is NULL, from
+ * buxton_response_value_version, 0 for a key that must have no value
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return A int value, indicating success of the operation
+ */
+_bx_export_ int buxton_compare_and_set(BuxtonClient client,
+				       BuxtonKey key,
+				       const void *value,
+				       const void *expected,
+				       uint64_t version,
+				       BuxtonCallback callback,
+				       void *data,
+				       bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Add to an integer value within Buxton, in a single request
+ * A key without a value counts as 0. The response carries the new
+ * value and its version; the request fails if the result does not
+ * fit the type of the key.
+ * @param client An open client connection
+ * @param key The key to update, of type BUXTON_TYPE_INT32,
+ * BUXTON_TYPE_UINT32, BUXTON_TYPE_INT64 or BUXTON_TYPE_UINT64
+ * @param delta Amount to add, may be negative
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return A int value, indicating success of the operation
+ */
+_bx_export_ int buxton_add_value(BuxtonClient client,
+				 BuxtonKey key,
+				 int64_t delta,
+				 BuxtonCallback callback,
+				 void *data,
+				 bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Set a label within Buxton
  *
@@ -214,6 +282,27 @@ _bx_export_ int buxton_get_value(BuxtonClient client,
 				 bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Retrieve a value from Buxton unless it still has a known version
+ * The response status is BUXTON_STATUS_NOT_MODIFIED, and carries no
+ * value, if the version of the value is still version.
+ * @param client An open client connection
+ * @param key The key to retrieve
+ * @param version Version of the value known to the client, from
+ * buxton_response_value_version, 0 to always retrieve the value
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_get_value_if_changed(BuxtonClient client,
+					    BuxtonKey key,
+					    uint64_t version,
+					    BuxtonCallback callback,
+					    void *data,
+					    bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Retrieve a label from Buxton
  * @param client An open client connection
@@ -270,8 +359,49 @@ _bx_export_ int buxton_list_names(BuxtonClient client,
 					bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Retrieve the request statistics kept by the daemon
+ * The response holds named counters, read them with
+ * buxton_response_stats_name and buxton_response_stats_value.
+ * @param client An open client connection
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_get_stats(BuxtonClient client,
+				 BuxtonCallback callback,
+				 void *data,
+				 bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Retrieve the keys and groups changed since a sequence number
+ * The response holds the changes, read them with
+ * buxton_response_changes_count and buxton_response_changes_key, and
+ * the sequence number to resume from with buxton_response_changes_resume.
+ * If buxton_response_changes_resync is true, the changes are no longer
+ * known and every key of interest must be read again.
+ * @param client An open client connection
+ * @param since Sequence number of the last change already known, 0 to
+ * only retrieve the current sequence number
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_get_changes(BuxtonClient client,
+				   uint64_t since,
+				   BuxtonCallback callback,
+				   void *data,
+				   bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Register for notifications on the given key in all layers
+ * Notifications carry the effective value of the key, and its key the
+ * layer the value comes from; changes hidden by a higher priority
+ * layer are not notified.
  * @param client An open client connection
  * @param key The key to register interest with
  * @param callback A callback function to handle daemon reply
@@ -286,6 +416,29 @@ _bx_export_ int buxton_register_notification(BuxtonClient client,
 					     bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register for notifications on the given key in all layers, at most
+ * once per interval
+ * Changes made within interval milliseconds of the last notification
+ * are coalesced: only the newest value is sent once the interval
+ * elapsed, and nothing if it is the value last sent.
+ * @param client An open client connection
+ * @param key The key to register interest with
+ * @param interval Minimum milliseconds between two notifications, 0 to
+ * be notified of every change
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_register_coalesced_notification(BuxtonClient client,
+						       BuxtonKey key,
+						       uint32_t interval,
+						       BuxtonCallback callback,
+						       void *data,
+						       bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Unregister from notifications on the given key in all layers
  * @param client An open client connection
@@ -302,6 +455,46 @@ _bx_export_ int buxton_unregister_notification(BuxtonClient client,
 					       bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register for notifications on every key of a group whose name starts
+ * with a prefix, in all layers, including keys created afterwards
+ * Notifications carry the changed key, read it with buxton_response_key.
+ * Reading a key needs the same Smack access as for
+ * buxton_register_notification, keys the client can't read are skipped.
+ * @param client An open client connection
+ * @param group_name The group to watch
+ * @param prefix The prefix of the key names, NULL to watch the whole group
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_register_prefix_notification(BuxtonClient client,
+						    const char *group_name,
+						    const char *prefix,
+						    BuxtonCallback callback,
+						    void *data,
+						    bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Unregister from notifications on a group or prefix
+ * @param client An open client connection
+ * @param group_name The group given when registering
+ * @param prefix The prefix given when registering
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_unregister_prefix_notification(BuxtonClient client,
+						      const char *group_name,
+						      const char *prefix,
+						      BuxtonCallback callback,
+						      void *data,
+						      bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Unset a value by key in the given BuxtonLayer
  * @param client An open client connection
@@ -424,6 +617,17 @@ _bx_export_ void *buxton_response_value(BuxtonResponse response)
 _bx_export_ BuxtonDataType buxton_response_value_type(BuxtonResponse response)
 	__attribute__((warn_unused_result));
 
+/**
+ * Get the version stamp of the value for a buxton response
+ * Applicable to get, conditional get, compare and set and add
+ * responses. Versions of a key only grow, each time its value is set.
+ * @param response a BuxtonResponse
+ * @return the version of the value, or 0 if not applicable or the
+ * value was stored without a version
+ */
+_bx_export_ uint64_t buxton_response_value_version(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
 /**
  * Get the count of value for a buxton response of get list of keys
  * Applicable if buxton_response_type(response) == BUXTON_CONTROL_LIST_NAMES
@@ -444,6 +648,85 @@ _bx_export_ uint32_t buxton_response_list_names_count(BuxtonResponse response)
 _bx_export_ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	__attribute__((warn_unused_result));
 
+/**
+ * Get the count of counters in a buxton response of get stats
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_STATS
+ * @param response a BuxtonResponse
+ * @return the count of counters or zero if not applicable
+ */
+_bx_export_ uint32_t buxton_response_stats_count(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the name of a counter in a buxton response of get stats
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_STATS
+ * The returned value MUST be deleted using free.
+ * @param response a BuxtonResponse
+ * @param index the index of the queried counter
+ * @return the name of the counter or NULL if not applicable or bad index
+ */
+_bx_export_ char *buxton_response_stats_name(BuxtonResponse response, uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the value of a counter in a buxton response of get stats
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_STATS
+ * @param response a BuxtonResponse
+ * @param index the index of the queried counter
+ * @return the value of the counter or zero if not applicable or bad index
+ */
+_bx_export_ uint64_t buxton_response_stats_value(BuxtonResponse response, uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the sequence number to pass to the next get changes request
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_CHANGES
+ * @param response a BuxtonResponse
+ * @return the sequence number of the last change reported or skipped,
+ * or zero if not applicable
+ */
+_bx_export_ uint64_t buxton_response_changes_resume(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Check whether the changes asked for are no longer known
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_CHANGES
+ * @param response a BuxtonResponse
+ * @return true if every key of interest must be read again
+ */
+_bx_export_ bool buxton_response_changes_resync(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Check whether more changes are left after those of a response
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_CHANGES
+ * @param response a BuxtonResponse
+ * @return true if another get changes request would return more changes
+ */
+_bx_export_ bool buxton_response_changes_more(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the count of changes in a buxton response of get changes
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_CHANGES
+ * @param response a BuxtonResponse
+ * @return the count of changes or zero if not applicable
+ */
+_bx_export_ uint32_t buxton_response_changes_count(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the key of a change in a buxton response of get changes
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_CHANGES
+ * The key has no name if its whole group was created or removed.
+ * The returned key MUST be deleted using buxton_key_free.
+ * @param response a BuxtonResponse
+ * @param index the index of the queried change
+ * @return the key of the change or NULL if not applicable or bad index
+ */
+_bx_export_ BuxtonKey buxton_response_changes_key(BuxtonResponse response, uint32_t index)
+	__attribute__((warn_unused_result));
+
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
  *
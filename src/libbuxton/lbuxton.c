@@ -173,11 +173,128 @@ int buxton_get_value(BuxtonClient client,
 	return ret;
 }
 
+int buxton_get_value_if_changed(BuxtonClient client,
+				BuxtonKey key,
+				uint64_t version,
+				BuxtonCallback callback,
+				void *data,
+				bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !(k->group.value) || !(k->name.value) ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_get_value_if_changed((_BuxtonClient *)client, k,
+					     version, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_compare_and_set(BuxtonClient client,
+			   BuxtonKey key,
+			   const void *value,
+			   const void *expected,
+			   uint64_t version,
+			   BuxtonCallback callback,
+			   void *data,
+			   bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !k->group.value || !k->name.value || !k->layer.value ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX ||
+	    k->type == BUXTON_TYPE_UNSET || !value) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_compare_and_set((_BuxtonClient *)client, k, value,
+					expected, version, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_add_value(BuxtonClient client,
+		     BuxtonKey key,
+		     int64_t delta,
+		     BuxtonCallback callback,
+		     void *data,
+		     bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !k->group.value || !k->name.value || !k->layer.value ||
+	    (k->type != BUXTON_TYPE_INT32 && k->type != BUXTON_TYPE_UINT32 &&
+	     k->type != BUXTON_TYPE_INT64 && k->type != BUXTON_TYPE_UINT64)) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_add_value((_BuxtonClient *)client, k, delta, callback,
+				  data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 int buxton_register_notification(BuxtonClient client,
 				 BuxtonKey key,
 				 BuxtonCallback callback,
 				 void *data,
 				 bool sync)
+{
+	return buxton_register_coalesced_notification(client, key, 0, callback,
+						      data, sync);
+}
+
+int buxton_register_coalesced_notification(BuxtonClient client,
+					   BuxtonKey key,
+					   uint32_t interval,
+					   BuxtonCallback callback,
+					   void *data,
+					   bool sync)
 {
 	bool r;
 	int ret = 0;
@@ -189,7 +306,7 @@ int buxton_register_notification(BuxtonClient client,
 	}
 
 	r = buxton_wire_register_notification((_BuxtonClient *)client, k,
-					      callback, data);
+					      interval, callback, data);
 	if (!r) {
 		return -1;
 	}
@@ -239,6 +356,94 @@ int buxton_unregister_notification(BuxtonClient client,
 	return ret;
 }
 
+/* Packs the arguments of the prefix notification functions */
+static bool prefix_strings(const char *group, const char *prefix,
+			   BuxtonString *g, BuxtonString *p)
+{
+	if (!group || !*group) {
+		return false;
+	}
+
+	/* discarding const is okay */
+	*g = buxton_string_pack((char*)group);
+	if (prefix && *prefix) {
+		*p = buxton_string_pack((char*)prefix);
+	} else {
+		p->value = NULL;
+		p->length = 0;
+	}
+
+	return true;
+}
+
+int buxton_register_prefix_notification(BuxtonClient client,
+					const char *group_name,
+					const char *prefix,
+					BuxtonCallback callback,
+					void *data,
+					bool sync)
+{
+	bool r;
+	int ret = 0;
+	BuxtonString g;
+	BuxtonString p;
+
+	if (!prefix_strings(group_name, prefix, &g, &p)) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_register_prefix_notification((_BuxtonClient *)client,
+						     &g, &p, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_unregister_prefix_notification(BuxtonClient client,
+					  const char *group_name,
+					  const char *prefix,
+					  BuxtonCallback callback,
+					  void *data,
+					  bool sync)
+{
+	bool r;
+	int ret = 0;
+	BuxtonString g;
+	BuxtonString p;
+
+	if (!prefix_strings(group_name, prefix, &g, &p)) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_unregister_prefix_notification((_BuxtonClient *)client,
+						       &g, &p, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 int buxton_set_value(BuxtonClient client,
 		     BuxtonKey key,
 		     const void *value,
@@ -493,6 +698,58 @@ int buxton_list_names(BuxtonClient client,
 	return ret;
 }
 
+int buxton_get_stats(BuxtonClient client,
+		     BuxtonCallback callback,
+		     void *data,
+		     bool sync)
+{
+	bool r;
+	int ret = 0;
+
+	r = buxton_wire_get_stats((_BuxtonClient *)client, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_get_changes(BuxtonClient client,
+		       uint64_t since,
+		       BuxtonCallback callback,
+		       void *data,
+		       bool sync)
+{
+	bool r;
+	int ret = 0;
+
+	r = buxton_wire_get_changes((_BuxtonClient *)client, since, callback,
+				    data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 int buxton_unset_value(BuxtonClient client,
 		       BuxtonKey key,
 		       BuxtonCallback callback,
@@ -730,6 +987,14 @@ BuxtonKey buxton_response_key(BuxtonResponse response)
 	return (BuxtonKey)key;
 }
 
+/* Replies carrying a value also carry its version, last */
+static bool value_reply(BuxtonControlMessage type)
+{
+	return type == BUXTON_CONTROL_GET ||
+		type == BUXTON_CONTROL_GET_IF_CHANGED ||
+		type == BUXTON_CONTROL_CAS || type == BUXTON_CONTROL_ADD;
+}
+
 void *buxton_response_value(BuxtonResponse response)
 {
 	void *p = NULL;
@@ -742,8 +1007,13 @@ void *buxton_response_value(BuxtonResponse response)
 	}
 
 	type = buxton_response_type(response);
-	if (type == BUXTON_CONTROL_GET || type == BUXTON_CONTROL_GET_LABEL) {
+	if (type == BUXTON_CONTROL_GET_LABEL) {
 		d = buxton_array_get(r->data, 1);
+	} else if (value_reply(type)) {
+		/* The value sits between the status and the version, if sent */
+		if (r->data->len == 3) {
+			d = buxton_array_get(r->data, 1);
+		}
 	} else if (type == BUXTON_CONTROL_CHANGED) {
 		if (r->data->len) {
 			d = buxton_array_get(r->data, 0);
@@ -827,8 +1097,13 @@ BuxtonDataType buxton_response_value_type(BuxtonResponse response)
 	}
 
 	type = buxton_response_type(response);
-	if (type == BUXTON_CONTROL_GET || type == BUXTON_CONTROL_GET_LABEL) {
+	if (type == BUXTON_CONTROL_GET_LABEL) {
 		d = buxton_array_get(r->data, 1);
+	} else if (value_reply(type)) {
+		/* The value sits between the status and the version, if sent */
+		if (r->data->len == 3) {
+			d = buxton_array_get(r->data, 1);
+		}
 	} else if (type == BUXTON_CONTROL_CHANGED) {
 		if (r->data->len) {
 			d = buxton_array_get(r->data, 0);
@@ -844,6 +1119,30 @@ BuxtonDataType buxton_response_value_type(BuxtonResponse response)
 	return d->type;
 }
 
+uint64_t buxton_response_value_version(BuxtonResponse response)
+{
+	BuxtonData *d = NULL;
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+	BuxtonControlMessage type;
+
+	if (!response) {
+		return 0;
+	}
+
+	type = buxton_response_type(response);
+	if (!value_reply(type) || r->data->len < 2) {
+		return 0;
+	}
+
+	/* The version follows the value, or the status if there is none */
+	d = buxton_array_get(r->data, r->data->len - 1);
+	if (!d || d->type != BUXTON_TYPE_UINT64) {
+		return 0;
+	}
+
+	return d->store.d_uint64;
+}
+
 uint32_t buxton_response_list_names_count(BuxtonResponse response)
 {
 	_BuxtonResponse *r = (_BuxtonResponse *)response;
@@ -857,7 +1156,7 @@ uint32_t buxton_response_list_names_count(BuxtonResponse response)
 	if (type != BUXTON_CONTROL_LIST_NAMES) {
 		return 0;
 	}
-	return r->data->len ? ((uint32_t)r->data->len - 1) : 0;
+	return r->data->len ? (r->data->len - 1) : 0;
 }
 
 char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
@@ -874,10 +1173,10 @@ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	if (type != BUXTON_CONTROL_LIST_NAMES) {
 		return NULL;
 	}
-	if (index + 1 >= r->data->len) {
+	if (!r->data->len || index >= r->data->len - 1) {
 		return NULL;
 	}
-	d = buxton_array_get(r->data, (uint16_t)(index + 1));
+	d = buxton_array_get(r->data, index + 1);
 	if (d == NULL) {
 		return NULL;
 	}
@@ -887,6 +1186,134 @@ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	return strdup(d->store.d_string.value);
 }
 
+uint32_t buxton_response_stats_count(BuxtonResponse response)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (!response) {
+		return 0;
+	}
+
+	if (buxton_response_type(response) != BUXTON_CONTROL_STATS) {
+		return 0;
+	}
+	/* status followed by name and value pairs */
+	return r->data->len ? (r->data->len - 1) / 2 : 0;
+}
+
+char *buxton_response_stats_name(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	if (index >= buxton_response_stats_count(response)) {
+		return NULL;
+	}
+	d = buxton_array_get(((_BuxtonResponse *)response)->data, 1 + index * 2);
+	if (d == NULL || d->type != BUXTON_TYPE_STRING) {
+		return NULL;
+	}
+	return strdup(d->store.d_string.value);
+}
+
+uint64_t buxton_response_stats_value(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	if (index >= buxton_response_stats_count(response)) {
+		return 0;
+	}
+	d = buxton_array_get(((_BuxtonResponse *)response)->data, 2 + index * 2);
+	if (d == NULL || d->type != BUXTON_TYPE_UINT64) {
+		return 0;
+	}
+	return d->store.d_uint64;
+}
+
+/* Status, resume, resync and more come before the changes */
+#define CHANGES_HEADER 4
+
+static BuxtonData *changes_header(BuxtonResponse response, uint32_t index,
+				  BuxtonDataType type)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+	BuxtonData *d;
+
+	if (!response || buxton_response_type(response) != BUXTON_CONTROL_CHANGES) {
+		return NULL;
+	}
+	d = buxton_array_get(r->data, index);
+	if (d == NULL || d->type != type) {
+		return NULL;
+	}
+	return d;
+}
+
+uint64_t buxton_response_changes_resume(BuxtonResponse response)
+{
+	BuxtonData *d = changes_header(response, 1, BUXTON_TYPE_UINT64);
+
+	return d ? d->store.d_uint64 : 0;
+}
+
+bool buxton_response_changes_resync(BuxtonResponse response)
+{
+	BuxtonData *d = changes_header(response, 2, BUXTON_TYPE_BOOLEAN);
+
+	return d ? d->store.d_boolean : false;
+}
+
+bool buxton_response_changes_more(BuxtonResponse response)
+{
+	BuxtonData *d = changes_header(response, 3, BUXTON_TYPE_BOOLEAN);
+
+	return d ? d->store.d_boolean : false;
+}
+
+uint32_t buxton_response_changes_count(BuxtonResponse response)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (!response) {
+		return 0;
+	}
+
+	if (buxton_response_type(response) != BUXTON_CONTROL_CHANGES) {
+		return 0;
+	}
+	/* layer, group and name of each change */
+	return r->data->len > CHANGES_HEADER ?
+		(r->data->len - CHANGES_HEADER) / 3 : 0;
+}
+
+BuxtonKey buxton_response_changes_key(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d[3];
+	uint32_t first;
+
+	if (index >= buxton_response_changes_count(response)) {
+		return NULL;
+	}
+	first = CHANGES_HEADER + index * 3;
+	for (uint32_t i = 0; i < 3; i++) {
+		d[i] = buxton_array_get(((_BuxtonResponse *)response)->data,
+					first + i);
+		if (d[i] == NULL || d[i]->type != BUXTON_TYPE_STRING) {
+			return NULL;
+		}
+	}
+
+	/* Changes to a whole group have an empty name */
+	if (!*d[2]->store.d_string.value) {
+		return buxton_key_create(d[1]->store.d_string.value, NULL,
+					 d[0]->store.d_string.value,
+					 BUXTON_TYPE_STRING);
+	}
+	return buxton_key_create(d[1]->store.d_string.value,
+				 d[2]->store.d_string.value,
+				 d[0]->store.d_string.value,
+				 BUXTON_TYPE_UNSET);
+}
+
 
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
@@ -14,6 +14,7 @@
 #endif
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/inotify.h>
@@ -25,9 +26,13 @@
 #include "hashmap.h"
 #include "log.h"
 #include "smack.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 static Hashmap *_smackrules = NULL;
+/* guards _smackrules, which is replaced while workers check access */
+static pthread_rwlock_t _smackrules_lock = PTHREAD_RWLOCK_INITIALIZER;
 /* set to true unless Smack support is not detected by the daemon */
 static bool have_smack = true;
 
@@ -39,6 +44,18 @@ bool buxton_smack_enabled(void)
 	return have_smack;
 }
 
+static void release_rules(Hashmap *rules)
+{
+	Iterator iterator;
+	const void *key;
+	void *value;
+
+	HASHMAP_FOREACH_KEY(value, key, rules, iterator) {
+		buxton_alloc_release(BUXTON_ALLOC_SMACK, key);
+		buxton_alloc_release(BUXTON_ALLOC_SMACK, value);
+	}
+}
+
 bool buxton_cache_smack_rules(void)
 {
 	smack_check();
@@ -48,14 +65,13 @@ bool buxton_cache_smack_rules(void)
 	int ret = true;
 	bool have_rules = false;
 	struct stat buf;
+	Hashmap *rules;
+	Hashmap *old;
 
-	if (_smackrules) {
-		hashmap_free(_smackrules);
-	}
-
-	_smackrules = hashmap_new(string_hash_func, string_compare_func);
+	/* Rules are loaded into a new map, swapped in once complete */
+	rules = hashmap_new(string_hash_func, string_compare_func);
 
-	if (!_smackrules) {
+	if (!rules) {
 		abort();
 	}
 
@@ -132,7 +148,13 @@ bool buxton_cache_smack_rules(void)
 			*accesstype |= ACCESS_WRITE;
 		}
 
-		hashmap_put(_smackrules, rule_pair, accesstype);
+		if (hashmap_put(rules, rule_pair, accesstype) > 0) {
+			buxton_alloc_hold(BUXTON_ALLOC_SMACK, rule_pair);
+			buxton_alloc_hold(BUXTON_ALLOC_SMACK, accesstype);
+		} else {
+			free(rule_pair);
+			free(accesstype);
+		}
 
 	} while (!feof(load_file));
 
@@ -141,16 +163,29 @@ end:
 		fclose(load_file);
 	}
 
+	if (pthread_rwlock_wrlock(&_smackrules_lock)) {
+		abort();
+	}
+	old = _smackrules;
+	_smackrules = rules;
+	if (pthread_rwlock_unlock(&_smackrules_lock)) {
+		abort();
+	}
+	/* Readers copy rules out under the lock, none can still use these */
+	release_rules(old);
+	hashmap_free_free_free(old);
+
 	return ret;
 }
 
-bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, BuxtonKeyAccessType request)
+static bool check_access(BuxtonString *subject, BuxtonString *object,
+			 BuxtonKeyAccessType request)
 {
-	smack_check();
-
 	_cleanup_free_ char *key = NULL;
 	int r;
-	BuxtonKeyAccessType *access;
+	BuxtonKeyAccessType *rule;
+	BuxtonKeyAccessType value;
+	BuxtonKeyAccessType *access = NULL;
 
 	assert(subject);
 	assert(object);
@@ -194,7 +229,17 @@ bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, Buxt
 
 	buxton_debug("Key: %s\n", key);
 
-	access = hashmap_get(_smackrules, key);
+	if (pthread_rwlock_rdlock(&_smackrules_lock)) {
+		abort();
+	}
+	rule = hashmap_get(_smackrules, key);
+	if (rule) {
+		value = *rule;
+		access = &value;
+	}
+	if (pthread_rwlock_unlock(&_smackrules_lock)) {
+		abort();
+	}
 	if (!access) {
 		/* A null value is not an error, since clients may try to
 		 * read/write keys with labels that are not in the loaded
@@ -225,6 +270,22 @@ bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, Buxt
 	return false;
 }
 
+bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, BuxtonKeyAccessType request)
+{
+	smack_check();
+
+	uint64_t start;
+	bool ret;
+
+	start = buxton_stats_now();
+	buxton_trace_begin(BUXTON_TRACE_SMACK);
+	ret = check_access(subject, object, request);
+	buxton_trace_end(BUXTON_TRACE_SMACK);
+	buxton_stats_smack_time(buxton_stats_now() - start);
+
+	return ret;
+}
+
 int buxton_watch_smack_rules(void)
 {
 	if (!have_smack) {
@@ -0,0 +1,247 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+/* The wrappers call the allocator itself */
+#define BUXTON_ALLOC_NO_WRAP
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "stats.h"
+#include "util.h"
+
+/*
+ * Call sites are found by their file and line in a fixed table. A
+ * slot is claimed under _sites_lock and never released, so lookups
+ * only need to see file published after line. Counters use relaxed
+ * atomics, dumps only need each of them to be untorn.
+ */
+#define ALLOC_SITES 4096
+
+typedef struct BuxtonAllocSite {
+	const char *file; /**<Source file of the call, NULL for a free slot */
+	int line; /**<Line of the call */
+	uint64_t count; /**<Allocations made */
+	uint64_t bytes; /**<Bytes requested */
+} BuxtonAllocSite;
+
+static BuxtonAllocSite _sites[ALLOC_SITES];
+static pthread_mutex_t _sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Charged once the table is full */
+static BuxtonAllocSite _other_site = { .file = "other", .line = 0 };
+
+typedef struct BuxtonAllocLive {
+	int64_t bytes; /**<Usable size of the blocks held */
+	int64_t blocks; /**<Blocks held */
+} BuxtonAllocLive;
+
+static BuxtonAllocLive _live[BUXTON_ALLOC_MAX];
+static uint64_t _total_count;
+static uint64_t _total_bytes;
+
+static const char *_subsystem_names[BUXTON_ALLOC_MAX] = {
+	[BUXTON_ALLOC_NOTIFY] = "notify",
+	[BUXTON_ALLOC_CLIENT] = "client",
+	[BUXTON_ALLOC_BACKEND] = "backend",
+	[BUXTON_ALLOC_SMACK] = "smack",
+	[BUXTON_ALLOC_KEYS] = "keys",
+};
+
+static BuxtonAllocSite *site_for(const char *file, int line)
+{
+	BuxtonAllocSite *site;
+	const char *f;
+	uint32_t i;
+
+	i = ((uint32_t)(uintptr_t)file * 31 + (uint32_t)line) % ALLOC_SITES;
+	for (uint32_t n = 0; n < ALLOC_SITES; n++) {
+		site = &_sites[(i + n) % ALLOC_SITES];
+		f = __atomic_load_n(&site->file, __ATOMIC_ACQUIRE);
+		if (!f) {
+			if (pthread_mutex_lock(&_sites_lock)) {
+				abort();
+			}
+			f = site->file;
+			if (!f) {
+				site->line = line;
+				__atomic_store_n(&site->file, file, __ATOMIC_RELEASE);
+				f = file;
+			}
+			if (pthread_mutex_unlock(&_sites_lock)) {
+				abort();
+			}
+		}
+		if (f == file && site->line == line) {
+			return site;
+		}
+	}
+
+	return &_other_site;
+}
+
+static void charge(const char *file, int line, size_t bytes)
+{
+	BuxtonAllocSite *site = site_for(file, line);
+
+	(void)__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&site->bytes, bytes, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&_total_count, 1, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&_total_bytes, bytes, __ATOMIC_RELAXED);
+	buxton_stats_alloc(bytes);
+}
+
+void *buxton_alloc_malloc(const char *file, int line, size_t size)
+{
+	charge(file, line, size);
+	return malloc(size);
+}
+
+void *buxton_alloc_calloc(const char *file, int line, size_t nmemb,
+			  size_t size)
+{
+	charge(file, line, nmemb * size);
+	return calloc(nmemb, size);
+}
+
+void *buxton_alloc_realloc(const char *file, int line, void *ptr,
+			   size_t size)
+{
+	charge(file, line, size);
+	return realloc(ptr, size);
+}
+
+char *buxton_alloc_strdup(const char *file, int line, const char *s)
+{
+	charge(file, line, strlen(s) + 1);
+	return strdup(s);
+}
+
+int buxton_alloc_asprintf(const char *file, int line, char **strp,
+			  const char *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = vasprintf(strp, fmt, ap);
+	va_end(ap);
+
+	if (r >= 0) {
+		charge(file, line, (size_t)r + 1);
+	}
+	return r;
+}
+
+void buxton_alloc_hold(BuxtonAllocSubsystem subsystem, const void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	(void)__atomic_fetch_add(&_live[subsystem].bytes,
+				 (int64_t)malloc_usable_size((void *)ptr),
+				 __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&_live[subsystem].blocks, 1,
+				 __ATOMIC_RELAXED);
+}
+
+void buxton_alloc_release(BuxtonAllocSubsystem subsystem, const void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	(void)__atomic_fetch_sub(&_live[subsystem].bytes,
+				 (int64_t)malloc_usable_size((void *)ptr),
+				 __ATOMIC_RELAXED);
+	(void)__atomic_fetch_sub(&_live[subsystem].blocks, 1,
+				 __ATOMIC_RELAXED);
+}
+
+/* Counters are read while other threads update them, never below 0 */
+static uint64_t live_read(int64_t *counter)
+{
+	int64_t v = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+	return v > 0 ? (uint64_t)v : 0;
+}
+
+void buxton_alloc_append(BuxtonArray *list)
+{
+	char name[64];
+
+	for (unsigned int i = 0; i < BUXTON_ALLOC_MAX; i++) {
+		snprintf(name, sizeof(name), "alloc.%s.live_bytes",
+			 _subsystem_names[i]);
+		buxton_stats_append_value(list, name,
+					  live_read(&_live[i].bytes));
+		snprintf(name, sizeof(name), "alloc.%s.live_blocks",
+			 _subsystem_names[i]);
+		buxton_stats_append_value(list, name,
+					  live_read(&_live[i].blocks));
+	}
+	buxton_stats_append_value(list, "alloc.total.count",
+				  __atomic_load_n(&_total_count,
+						  __ATOMIC_RELAXED));
+	buxton_stats_append_value(list, "alloc.total.bytes",
+				  __atomic_load_n(&_total_bytes,
+						  __ATOMIC_RELAXED));
+}
+
+size_t buxton_alloc_dump(FILE *out)
+{
+	BuxtonAllocSite *site;
+	const char *file;
+	size_t count = 0;
+
+	for (unsigned int i = 0; i < BUXTON_ALLOC_MAX; i++) {
+		fprintf(out, "alloc subsystem=%s live_bytes=%" PRIu64
+			" live_blocks=%" PRIu64 "\n", _subsystem_names[i],
+			live_read(&_live[i].bytes), live_read(&_live[i].blocks));
+	}
+
+	for (unsigned int i = 0; i <= ALLOC_SITES; i++) {
+		site = i < ALLOC_SITES ? &_sites[i] : &_other_site;
+		file = __atomic_load_n(&site->file, __ATOMIC_ACQUIRE);
+		if (!file || !__atomic_load_n(&site->count, __ATOMIC_RELAXED)) {
+			continue;
+		}
+		fprintf(out, "alloc site=%s:%d count=%" PRIu64
+			" bytes=%" PRIu64 "\n", file, site->line,
+			__atomic_load_n(&site->count, __ATOMIC_RELAXED),
+			__atomic_load_n(&site->bytes, __ATOMIC_RELAXED));
+		count++;
+	}
+	fflush(out);
+
+	return count;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,184 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file alloc.h Internal header
+ * This file is used internally by buxton to account for heap usage
+ *
+ * Accounting is compiled in with --enable-alloc-accounting. util.h
+ * then replaces malloc, calloc, realloc, strdup and asprintf (and so
+ * malloc0 and new0) with wrappers that count allocations and bytes
+ * per call site, and charge them to the request being handled on the
+ * calling thread. Memory owned by long lived structures is tracked per
+ * subsystem with buxton_alloc_hold() and buxton_alloc_release().
+ *
+ * Without --enable-alloc-accounting, all functions are empty inlines.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "buxtonarray.h"
+
+/**
+ * Owners of long lived memory
+ */
+typedef enum BuxtonAllocSubsystem {
+	BUXTON_ALLOC_NOTIFY, /**<Notification registrations and saved values */
+	BUXTON_ALLOC_CLIENT, /**<Client read buffers and queued messages */
+	BUXTON_ALLOC_BACKEND, /**<Databases kept open by the backends */
+	BUXTON_ALLOC_SMACK, /**<Cached Smack rules */
+	BUXTON_ALLOC_KEYS, /**<Interned key identities */
+	BUXTON_ALLOC_MAX
+} BuxtonAllocSubsystem;
+
+#ifdef ALLOC_ACCOUNTING
+
+/**
+ * Counted malloc()
+ * @param file Source file of the call, a string literal
+ * @param line Line of the call
+ * @param size Bytes to allocate
+ * @return the new block, NULL on failure
+ */
+void *buxton_alloc_malloc(const char *file, int line, size_t size);
+
+/**
+ * Counted calloc()
+ * @param file Source file of the call, a string literal
+ * @param line Line of the call
+ * @param nmemb Number of elements
+ * @param size Size of an element
+ * @return the new zeroed block, NULL on failure
+ */
+void *buxton_alloc_calloc(const char *file, int line, size_t nmemb,
+			  size_t size);
+
+/**
+ * Counted realloc(), the new size is charged in full
+ * @param file Source file of the call, a string literal
+ * @param line Line of the call
+ * @param ptr Block to resize, may be NULL
+ * @param size New size in bytes
+ * @return the resized block, NULL on failure
+ */
+void *buxton_alloc_realloc(const char *file, int line, void *ptr,
+			   size_t size);
+
+/**
+ * Counted strdup()
+ * @param file Source file of the call, a string literal
+ * @param line Line of the call
+ * @param s String to copy
+ * @return the copy, NULL on failure
+ */
+char *buxton_alloc_strdup(const char *file, int line, const char *s);
+
+/**
+ * Counted asprintf()
+ * @param file Source file of the call, a string literal
+ * @param line Line of the call
+ * @param strp Where to store the formatted string
+ * @param fmt Format string
+ * @return the length of the string, -1 on failure
+ */
+int buxton_alloc_asprintf(const char *file, int line, char **strp,
+			  const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+/**
+ * Charge memory to a subsystem
+ * @param subsystem Owner of the memory
+ * @param ptr Heap block now owned by subsystem, may be NULL
+ */
+void buxton_alloc_hold(BuxtonAllocSubsystem subsystem, const void *ptr);
+
+/**
+ * Stop charging memory to a subsystem, must be called before it is freed
+ * @param subsystem Owner of the memory, as given to buxton_alloc_hold()
+ * @param ptr Heap block no longer owned by subsystem, may be NULL
+ */
+void buxton_alloc_release(BuxtonAllocSubsystem subsystem, const void *ptr);
+
+/**
+ * Append the live memory of every subsystem and the allocation totals
+ * to a list
+ *
+ * Counters are added in the format of buxton_stats_append(), named
+ * "alloc.<subsystem>.live_bytes", "alloc.<subsystem>.live_blocks",
+ * "alloc.total.count" and "alloc.total.bytes".
+ * @param list A BuxtonArray to append to
+ */
+void buxton_alloc_append(BuxtonArray *list);
+
+/**
+ * Write the counters of every call site and subsystem
+ * @param out Stream to write to
+ * @return the number of call sites written
+ */
+size_t buxton_alloc_dump(FILE *out);
+
+#ifndef BUXTON_ALLOC_NO_WRAP
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef asprintf
+#define malloc(size) buxton_alloc_malloc(__FILE__, __LINE__, (size))
+#define calloc(nmemb, size) \
+	buxton_alloc_calloc(__FILE__, __LINE__, (nmemb), (size))
+#define realloc(ptr, size) \
+	buxton_alloc_realloc(__FILE__, __LINE__, (ptr), (size))
+#define strdup(s) buxton_alloc_strdup(__FILE__, __LINE__, (s))
+#define asprintf(strp, ...) \
+	buxton_alloc_asprintf(__FILE__, __LINE__, (strp), __VA_ARGS__)
+#endif
+
+#else
+
+static inline void buxton_alloc_hold(BuxtonAllocSubsystem subsystem,
+				     const void *ptr)
+{
+}
+
+static inline void buxton_alloc_release(BuxtonAllocSubsystem subsystem,
+					const void *ptr)
+{
+}
+
+static inline void buxton_alloc_append(BuxtonArray *list)
+{
+}
+
+static inline size_t buxton_alloc_dump(FILE *out)
+{
+	return 0;
+}
+
+#endif /* ALLOC_ACCOUNTING */
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -104,6 +104,10 @@ static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer)
 		out->backend = BACKEND_GDBM;
 	} else if (strcmp(conf_layer->backend, "memory") == 0) {
 		out->backend = BACKEND_MEMORY;
+	} else if (strcmp(conf_layer->backend, "log") == 0) {
+		out->backend = BACKEND_LOG;
+	} else if (strcmp(conf_layer->backend, "compiled") == 0) {
+		out->backend = BACKEND_COMPILED;
 	} else {
 		buxton_log("Layer %s has unknown database: %s\n", conf_layer->name, conf_layer->backend);
 		goto fail;
@@ -116,8 +120,29 @@ static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer)
 		}
 	}
 
-	out->readonly = is_read_only(conf_layer);
+	if (strcmp(conf_layer->durability, "sync") == 0) {
+		out->durability = DURABILITY_SYNC;
+	} else if (strcmp(conf_layer->durability, "group-commit") == 0) {
+		out->durability = DURABILITY_GROUP_COMMIT;
+	} else if (strcmp(conf_layer->durability, "async") == 0) {
+		out->durability = DURABILITY_ASYNC;
+	} else {
+		buxton_log("Layer %s has unknown durability: %s\n", conf_layer->name, conf_layer->durability);
+		goto fail;
+	}
+
+	if (conf_layer->sync_interval <= 0) {
+		buxton_log("Layer %s has invalid sync interval: %d\n", conf_layer->name, conf_layer->sync_interval);
+		goto fail;
+	}
+
+	/* Compiled layers are immutable */
+	out->readonly = is_read_only(conf_layer) || out->backend == BACKEND_COMPILED;
 	out->priority = conf_layer->priority;
+	out->sync_interval = conf_layer->sync_interval;
+	if (pthread_rwlock_init(&out->lock, NULL)) {
+		abort();
+	}
 	return out;
 fail:
 	free(out->name.value);
@@ -147,6 +172,10 @@ static void init_backend(BuxtonConfig *config,
 		name = "gdbm";
 	} else if (layer->backend == BACKEND_MEMORY) {
 		name = "memory";
+	} else if (layer->backend == BACKEND_LOG) {
+		name = "log";
+	} else if (layer->backend == BACKEND_COMPILED) {
+		name = "compiled";
 	} else {
 		buxton_log("Invalid backend type for layer: %s\n", layer->name);
 		abort();
@@ -213,6 +242,9 @@ static void init_backend(BuxtonConfig *config,
 
 	backend_tmp->module = handle;
 	backend_tmp->destroy = d_func;
+	if (pthread_mutex_init(&backend_tmp->lock, NULL)) {
+		abort();
+	}
 
 	*backend = backend_tmp;
 }
@@ -253,7 +285,10 @@ void destroy_backend(BuxtonBackend *backend)
 	backend->list_keys = NULL;
 	backend->list_names = NULL;
 	backend->unset_value = NULL;
+	backend->sync = NULL;
+	backend->cache_stats = NULL;
 	backend->destroy();
+	pthread_mutex_destroy(&backend->lock);
 	dlclose(backend->module);
 	free(backend);
 	backend = NULL;
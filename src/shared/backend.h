@@ -21,6 +21,7 @@
 #endif
 
 #include <gdbm.h>
+#include <pthread.h>
 
 #include "buxtonarray.h"
 #include "buxtondata.h"
@@ -35,6 +36,8 @@ typedef enum BuxtonBackendType {
 	BACKEND_UNSET = 0, /**<No backend set */
 	BACKEND_GDBM, /**<GDBM backend */
 	BACKEND_MEMORY, /**<Memory backend */
+	BACKEND_LOG, /**<Log-structured backend */
+	BACKEND_COMPILED, /**<Compiled immutable backend */
 	BACKEND_MAXTYPES
 } BuxtonBackendType;
 
@@ -47,6 +50,16 @@ typedef enum BuxtonLayerType {
 	LAYER_MAXTYPES
 } BuxtonLayerType;
 
+/**
+ * Durability policy of a layer's writes
+ */
+typedef enum BuxtonDurability {
+	DURABILITY_SYNC, /**<Every write is synced to disk before returning */
+	DURABILITY_GROUP_COMMIT, /**<Writes are synced in batches every sync_interval ms */
+	DURABILITY_ASYNC, /**<Writes are left to the OS, synced on close */
+	DURABILITY_MAXTYPES
+} BuxtonDurability;
+
 /**
  * Represents a layer within Buxton
  *
@@ -62,6 +75,9 @@ typedef struct BuxtonLayer {
 	int priority; /**<Priority of this layer */
 	char *description; /**<Description of this layer */
 	bool readonly; /**<Layer is readonly or not */
+	BuxtonDurability durability; /**<Durability policy for writes */
+	int sync_interval; /**<Group commit interval in milliseconds */
+	pthread_rwlock_t lock; /**<Held shared to read the layer, exclusively to modify it */
 } BuxtonLayer;
 
 /**
@@ -101,6 +117,32 @@ typedef bool (*module_list_names_func) (BuxtonLayer *layer, BuxtonString *group,
  */
 typedef void *(*module_db_init_func) (BuxtonLayer *layer);
 
+/**
+ * Backend sync function, flushing batched writes to disk
+ * @param force Sync every pending database, regardless of its interval
+ * @return the time in milliseconds until the next pending sync is
+ * due, or -1 if nothing is pending
+ */
+typedef int (*module_sync_func) (bool force);
+
+/**
+ * Counters of a backend's cache of open databases
+ */
+typedef struct BuxtonCacheStats {
+	uint64_t hits; /**<Lookups served by an already open database */
+	uint64_t misses; /**<Lookups that had to open a database */
+	uint64_t evictions; /**<Databases closed to stay within the limit */
+	uint32_t open; /**<Databases currently open */
+	uint64_t live; /**<Bytes of open database files holding data */
+	uint64_t dead; /**<Bytes overwritten or deleted, not yet reclaimed */
+} BuxtonCacheStats;
+
+/**
+ * Retrieve the counters of a backend's open database cache
+ * @param stats A BuxtonCacheStats to fill in
+ */
+typedef void (*module_cache_stats_func) (BuxtonCacheStats *stats);
+
 /**
  * Destroy (or shutdown) a backend module
  */
@@ -110,6 +152,15 @@ typedef void (*module_destroy_func) (void);
  * A data-backend for Buxton
  *
  * Backends are controlled by Buxton for storing and retrieving data
+ *
+ * Unless a module sets concurrent, calls into it are serialized by the
+ * backend lock. A concurrent module may have any of its functions
+ * called from several threads at once, and must provide the locking
+ * itself: get_value, list_keys and list_names on a database hold it
+ * shared, so reads proceed in parallel, while set_value, unset_value
+ * and create_db hold it exclusively. Calls on different databases
+ * must not block each other beyond the module's own bookkeeping. The
+ * layer passed in is a per-request copy and must not be kept.
  */
 typedef struct BuxtonBackend {
 	void *module; /**<Private handle to the module */
@@ -120,6 +171,10 @@ typedef struct BuxtonBackend {
 	module_list_names_func list_names; /**<List names function */
 	module_value_func unset_value; /**<Unset value function */
 	module_db_init_func create_db; /**<DB file creation function */
+	module_sync_func sync; /**<Batched write sync function (optional) */
+	module_cache_stats_func cache_stats; /**<Open database cache counters (optional) */
+	bool concurrent; /**<Module is safe to call from several threads at once */
+	pthread_mutex_t lock; /**<Serializes calls into modules that aren't concurrent */
 } BuxtonBackend;
 
 /**
@@ -149,6 +204,9 @@ typedef bool (*module_init_func) (BuxtonBackend *backend)
 
 /**
  * Return a valid backend for the given configuration and layer
+ *
+ * Backends are loaded on first use, which modifies the configuration;
+ * see buxton_direct_load_backends() for threaded use.
  * @param config A BuxtonControl's configuration
  * @param layer The layer to query
  * @return an initialised backend, or NULL if the layer is not found
@@ -9,11 +9,18 @@
  * of the License, or (at your option) any later version.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "buxtonarray.h"
-#include "util.h"
+
+/* Smallest allocation made for a non-empty array */
+#define BUXTON_ARRAY_MIN_CAPACITY 8U
+
+/* Largest number of elements, keeps the allocation size within a
+ * 32 bit size_t */
+#define BUXTON_ARRAY_MAX_CAPACITY (UINT32_MAX / (uint32_t)sizeof(void*))
 
 BuxtonArray *buxton_array_new(void)
 {
@@ -24,42 +31,89 @@ BuxtonArray *buxton_array_new(void)
 	return ret;
 }
 
+bool buxton_array_reserve(BuxtonArray *array,
+			  uint32_t capacity)
+{
+	uint32_t new_capacity;
+	void **data;
+
+	if (!array) {
+		return false;
+	}
+	if (capacity <= array->capacity) {
+		return true;
+	}
+	if (capacity > BUXTON_ARRAY_MAX_CAPACITY) {
+		return false;
+	}
+
+	/* Double the storage, so adding one element at a time only
+	 * reallocates log(n) times */
+	new_capacity = array->capacity ? array->capacity : BUXTON_ARRAY_MIN_CAPACITY;
+	while (new_capacity < capacity) {
+		new_capacity *= 2;
+	}
+	if (new_capacity > BUXTON_ARRAY_MAX_CAPACITY) {
+		new_capacity = BUXTON_ARRAY_MAX_CAPACITY;
+	}
+
+	data = realloc(array->data, (size_t)new_capacity * sizeof(void*));
+	if (!data) {
+		return false;
+	}
+	array->data = data;
+	array->capacity = new_capacity;
+	return true;
+}
+
 bool buxton_array_add(BuxtonArray *array,
 		      void *data)
 {
-	uint16_t new_len;
-	size_t curr, new_size;
-
 	if (!array || !data) {
 		return false;
 	}
-	if (!array->data) {
-		array->data = calloc(1, sizeof(void*));
-		if (!array->data) {
-			return false;
-		}
+	if (array->len >= BUXTON_ARRAY_MAX_CAPACITY) {
+		return false;
 	}
+	if (array->len == array->capacity &&
+	    !buxton_array_reserve(array, array->len + 1)) {
+		return false;
+	}
+
+	/* Store the pointer at the end of the array */
+	array->data[array->len++] = data;
+	return true;
+}
 
-	new_len = (uint16_t)(array->len + 1);
-	if (!new_len) {
+bool buxton_array_append(BuxtonArray *array,
+			 void **data,
+			 uint32_t count)
+{
+	if (!array || (!data && count)) {
 		return false;
 	}
-	curr = (size_t)(array->len*sizeof(void*));
-	new_size = curr + sizeof(void*);
-	if (new_len >= array->len) {
-		/* Resize the array to hold one more pointer */
-		array->data = greedy_realloc((void**)&array->data, &curr, new_size);
-		if (!array->data) {
+	if (count > BUXTON_ARRAY_MAX_CAPACITY ||
+	    array->len > BUXTON_ARRAY_MAX_CAPACITY - count) {
+		return false;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (!data[i]) {
 			return false;
 		}
 	}
-	/* Store the pointer at the end of the array */
-	array->len = new_len;
-	array->data[array->len-1] = data;
+	if (!count) {
+		return true;
+	}
+	if (!buxton_array_reserve(array, array->len + count)) {
+		return false;
+	}
+
+	memcpy(array->data + array->len, data, count * sizeof(void*));
+	array->len += count;
 	return true;
 }
 
-void *buxton_array_get(BuxtonArray *array, uint16_t index)
+void *buxton_array_get(BuxtonArray *array, uint32_t index)
 {
 	if (!array) {
 		return NULL;
@@ -74,7 +128,7 @@ void *buxton_array_get(BuxtonArray *array, uint16_t index)
 void buxton_array_free(BuxtonArray **array,
 		       buxton_free_func free_method)
 {
-	int i;
+	uint32_t i;
 	if (!array || !*array) {
 		return;
 	}
@@ -23,10 +23,14 @@
 /**
  * A dynamic array
  * Represents daemon's reply to client
+ *
+ * Storage grows geometrically, so appending is amortized constant
+ * time; use buxton_array_reserve() when the final size is known.
  */
 typedef struct BuxtonArray {
 	void **data; /**<Dynamic array contents */
-	uint16_t len; /**<Length of the array */
+	uint32_t len; /**<Length of the array */
+	uint32_t capacity; /**<Number of elements allocated in data */
 } BuxtonArray;
 
 
@@ -53,6 +57,28 @@ bool buxton_array_add(BuxtonArray *array,
 		      void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Append several pointers to BuxtonArray at once
+ * @param array Valid BuxtonArray
+ * @param data Pointers to add to this array, none may be NULL
+ * @param count Number of pointers in data
+ * @returns bool true if all of the data was added to the array
+ */
+bool buxton_array_append(BuxtonArray *array,
+			 void **data,
+			 uint32_t count)
+	__attribute__((warn_unused_result));
+
+/**
+ * Make room in BuxtonArray for a number of elements
+ * @param array Valid BuxtonArray
+ * @param capacity Total number of elements the array must hold
+ * @returns bool true if the array can hold capacity elements
+ */
+bool buxton_array_reserve(BuxtonArray *array,
+			  uint32_t capacity)
+	__attribute__((warn_unused_result));
+
 /**
  * Free an array, and optionally its members
  * @param array valid BuxtonArray reference
@@ -68,7 +94,7 @@ void buxton_array_free(BuxtonArray **array,
  * @param index index of the element in the array
  * @return a data pointer refered to by index, or NULL
  */
-void *buxton_array_get(BuxtonArray *array, uint16_t index)
+void *buxton_array_get(BuxtonArray *array, uint32_t index)
 	__attribute__((warn_unused_result));
 
 /*
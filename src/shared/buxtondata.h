@@ -43,6 +43,7 @@ typedef struct BuxtonData {
 	BuxtonDataType type; /**<Type of data stored */
 	BuxtonDataStore store; /**<Contains one value, correlating to
 			       * type */
+	uint64_t version; /**<Version stamp of a stored value, 0 if unknown, always stamped when a value is set */
 } BuxtonData;
 
 static inline void buxton_string_to_data(BuxtonString *s, BuxtonData *d)
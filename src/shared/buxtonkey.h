@@ -18,6 +18,8 @@
 #include "buxton.h"
 #include "buxtonstring.h"
 
+struct BuxtonKeyId;
+
 /**
  * Represents a data key in Buxton
  */
@@ -26,6 +28,7 @@ typedef struct BuxtonKey {
 	BuxtonString name; /**<Value of the key's name */
 	BuxtonString layer; /**<Value of the key's layer */
 	BuxtonDataType type; /**<Type of value associated with key */
+	struct BuxtonKeyId *id; /**<Interned group and name, NULL if not interned */
 } _BuxtonKey;
 
 /*
@@ -0,0 +1,155 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "changelog.h"
+#include "util.h"
+
+/* The change numbered seq lives in ring[seq % size] */
+struct BuxtonChangeLog {
+	BuxtonChange *ring; /**<Stored changes */
+	uint32_t size; /**<Number of changes the ring holds */
+	uint32_t count; /**<Number of changes stored */
+	uint64_t head; /**<Sequence number of the newest change */
+	pthread_mutex_t lock; /**<Guards the members above */
+};
+
+static void log_lock(BuxtonChangeLog *log)
+{
+	if (pthread_mutex_lock(&log->lock)) {
+		abort();
+	}
+}
+
+static void log_unlock(BuxtonChangeLog *log)
+{
+	if (pthread_mutex_unlock(&log->lock)) {
+		abort();
+	}
+}
+
+BuxtonChangeLog *buxton_change_log_new(uint32_t size, uint64_t base)
+{
+	BuxtonChangeLog *log;
+
+	assert(size);
+
+	log = malloc0(sizeof(BuxtonChangeLog));
+	if (!log) {
+		return NULL;
+	}
+	log->ring = malloc0(sizeof(BuxtonChange) * size);
+	if (!log->ring) {
+		free(log);
+		return NULL;
+	}
+	log->size = size;
+	log->head = base;
+	pthread_mutex_init(&log->lock, NULL);
+
+	return log;
+}
+
+void buxton_change_log_free(BuxtonChangeLog *log)
+{
+	if (!log) {
+		return;
+	}
+	for (uint32_t i = 0; i < log->size; i++) {
+		buxton_key_id_unref(log->ring[i].id);
+	}
+	pthread_mutex_destroy(&log->lock);
+	free(log->ring);
+	free(log);
+}
+
+uint64_t buxton_change_log_append(BuxtonChangeLog *log, BuxtonKeyId *id,
+				  BuxtonLayer *layer, uid_t uid)
+{
+	BuxtonChange *change;
+	BuxtonKeyId *evicted;
+	uint64_t seq;
+
+	assert(log);
+	assert(id);
+	assert(layer);
+
+	buxton_key_id_ref(id);
+
+	log_lock(log);
+	seq = ++log->head;
+	change = &log->ring[seq % log->size];
+	evicted = change->id;
+	change->seq = seq;
+	change->id = id;
+	change->layer = layer;
+	change->uid = uid;
+	if (log->count < log->size) {
+		log->count++;
+	}
+	log_unlock(log);
+
+	buxton_key_id_unref(evicted);
+
+	return seq;
+}
+
+bool buxton_change_log_read(BuxtonChangeLog *log, uint64_t since,
+			    BuxtonChange *changes, uint32_t max,
+			    uint32_t *count, uint64_t *head)
+{
+	BuxtonChange *change;
+	uint32_t n = 0;
+
+	assert(log);
+	assert(changes || !max);
+	assert(count);
+	assert(head);
+
+	log_lock(log);
+	*head = log->head;
+	/* Changes after since must all still be in the ring */
+	if (since > log->head || log->head - since > log->count) {
+		log_unlock(log);
+		*count = 0;
+		return false;
+	}
+	for (uint64_t seq = since + 1; seq <= log->head && n < max; seq++) {
+		change = &log->ring[seq % log->size];
+		changes[n] = *change;
+		buxton_key_id_ref(change->id);
+		n++;
+	}
+	log_unlock(log);
+
+	*count = n;
+	return true;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
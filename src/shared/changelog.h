@@ -0,0 +1,103 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file changelog.h Internal header
+ * This file is used internally by buxton to remember recent changes
+ *
+ * Every change buxtond makes is numbered from one global sequence and
+ * kept in a fixed size ring, oldest changes being overwritten first.
+ * A client that knows the sequence of the last change it saw fetches
+ * the changes made since, as long as they are still in the ring.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "backend.h"
+#include "keyid.h"
+
+/**
+ * A bounded log of changes, safe to use from any thread
+ */
+typedef struct BuxtonChangeLog BuxtonChangeLog;
+
+/**
+ * A change to a key, or to a whole group
+ */
+typedef struct BuxtonChange {
+	uint64_t seq; /**<Sequence number of the change */
+	BuxtonKeyId *id; /**<Key or group that changed */
+	BuxtonLayer *layer; /**<Layer the change was made in */
+	uid_t uid; /**<User whose database changed, for user layers */
+} BuxtonChange;
+
+/**
+ * Create a new BuxtonChangeLog
+ * @param size Number of changes kept, must not be 0
+ * @param base Sequence number preceding the first change
+ * @returns BuxtonChangeLog a newly allocated log, NULL on failure
+ */
+BuxtonChangeLog *buxton_change_log_new(uint32_t size, uint64_t base)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a BuxtonChangeLog and release the changes it holds
+ * @param log BuxtonChangeLog to free, may be NULL
+ */
+void buxton_change_log_free(BuxtonChangeLog *log);
+
+/**
+ * Record a change, evicting the oldest one if the log is full
+ * @param log Valid BuxtonChangeLog
+ * @param id Key or group that changed, the log takes its own reference
+ * @param layer Layer the change was made in, must outlive the log
+ * @param uid User whose database changed
+ * @returns the sequence number of the change
+ */
+uint64_t buxton_change_log_append(BuxtonChangeLog *log, BuxtonKeyId *id,
+				  BuxtonLayer *layer, uid_t uid);
+
+/**
+ * Retrieve the changes made after a sequence number, oldest first
+ * @param log Valid BuxtonChangeLog
+ * @param since Sequence number of the last change already known
+ * @param changes Array receiving the changes, each with a reference
+ * to its id the caller must drop
+ * @param max Number of changes changes can hold
+ * @param count Set to the number of changes stored in changes
+ * @param head Set to the sequence number of the newest change
+ * @returns false if changes made after since are no longer all in the
+ * log, or since is newer than any change
+ */
+bool buxton_change_log_read(BuxtonChangeLog *log, uint64_t since,
+			    BuxtonChange *changes, uint32_t max,
+			    uint32_t *count, uint64_t *head)
+	__attribute__((warn_unused_result));
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,456 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "log.h"
+#include "serialize.h"
+#include "util.h"
+
+/* Give up on a perfect hash bucket after this many seeds */
+#define COMPILED_MAX_SEED (1 << 22)
+
+/**
+ * A record to be compiled
+ */
+struct entry {
+	char *key; /**<Group and name, NUL terminated */
+	uint32_t key_size; /**<Size of the key */
+	uint32_t group_size; /**<Size of the group part of the key */
+	uint8_t *value; /**<Serialized value */
+	uint32_t value_size; /**<Size of the serialized value */
+	uint32_t offset; /**<Offset of the record in the file */
+	uint32_t bucket; /**<First level hash bucket */
+};
+
+/**
+ * Growable array of entries (BuxtonArray is limited to 65535 items)
+ */
+struct entries {
+	struct entry *items; /**<The entries */
+	size_t len; /**<Number of entries */
+	size_t allocated; /**<Allocated size of items, in bytes */
+};
+
+static uint32_t entry_hash(struct entry *e, uint32_t seed)
+{
+	return compiled_hash_final(compiled_hash_update(compiled_hash_init(seed),
+							e->key, e->key_size));
+}
+
+/* Groups first, then each group's record before its keys, by name */
+static int compare_entry(const void *a, const void *b)
+{
+	const struct entry *ea = a;
+	const struct entry *eb = b;
+	int r;
+
+	r = strcmp(ea->key, eb->key);
+	if (r) {
+		return r;
+	}
+	if (ea->key_size == ea->group_size) {
+		return eb->key_size == eb->group_size ? 0 : -1;
+	}
+	if (eb->key_size == eb->group_size) {
+		return 1;
+	}
+	return strcmp(ea->key + ea->group_size, eb->key + eb->group_size);
+}
+
+/* Fetch a key (or a group when name is NULL) and queue it for compiling */
+static bool add_entry(BuxtonBackend *backend, BuxtonLayer *layer,
+		      struct entries *entries, BuxtonString *group,
+		      BuxtonString *name)
+{
+	_BuxtonKey key;
+	BuxtonData data;
+	BuxtonString label;
+	struct entry *e;
+	int r;
+
+	memzero(&key, sizeof(_BuxtonKey));
+	key.layer = layer->name;
+	key.group = *group;
+	if (name) {
+		key.name = *name;
+	}
+	key.type = BUXTON_TYPE_UNSET;
+
+	r = backend->get_value(layer, &key, &data, &label);
+	if (r) {
+		buxton_log("Failed to read %s from layer %s\n",
+			   name ? name->value : group->value, layer->name.value);
+		return false;
+	}
+
+	if (!greedy_realloc((void **)&entries->items, &entries->allocated,
+			    (entries->len + 1) * sizeof(struct entry))) {
+		abort();
+	}
+	e = &entries->items[entries->len++];
+	memzero(e, sizeof(struct entry));
+
+	e->group_size = group->length;
+	e->key_size = group->length + (name ? name->length : 0);
+	e->key = malloc(e->key_size);
+	if (!e->key) {
+		abort();
+	}
+	memcpy(e->key, group->value, group->length);
+	if (name) {
+		memcpy(e->key + group->length, name->value, name->length);
+	}
+	e->value_size = (uint32_t)buxton_serialize(&data, &label, &e->value);
+
+	if (data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	free(label.value);
+
+	return true;
+}
+
+/* Read every group and key of the layer */
+static bool collect_entries(BuxtonBackend *backend, BuxtonLayer *layer,
+			    struct entries *entries)
+{
+	BuxtonArray *groups = NULL;
+	BuxtonArray *names = NULL;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonData *g;
+	BuxtonData *n;
+	bool ret = false;
+
+	if (!backend->list_names(layer, &empty, NULL, &groups)) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < groups->len; i++) {
+		g = buxton_array_get(groups, i);
+		if (!add_entry(backend, layer, entries, &g->store.d_string, NULL)) {
+			goto end;
+		}
+
+		if (!backend->list_names(layer, &g->store.d_string, NULL, &names)) {
+			goto end;
+		}
+		for (uint32_t j = 0; j < names->len; j++) {
+			n = buxton_array_get(names, j);
+			if (!add_entry(backend, layer, entries,
+				       &g->store.d_string, &n->store.d_string)) {
+				goto end;
+			}
+		}
+		buxton_array_free(&names, (buxton_free_func)data_free);
+	}
+	ret = true;
+
+end:
+	if (names) {
+		buxton_array_free(&names, (buxton_free_func)data_free);
+	}
+	buxton_array_free(&groups, (buxton_free_func)data_free);
+	return ret;
+}
+
+/*
+ * Build a minimal perfect hash with "hash and displace": entries are
+ * spread over buckets by a first hash, then for each bucket, largest
+ * first, a seed is searched that sends all of its entries to free
+ * slots.
+ */
+static bool build_hash(struct entries *entries, uint32_t nbuckets,
+		       uint32_t *buckets, uint32_t *slots)
+{
+	_cleanup_free_ uint32_t *count = NULL;
+	_cleanup_free_ uint32_t *start = NULL;
+	_cleanup_free_ uint32_t *members = NULL;
+	_cleanup_free_ uint32_t *order = NULL;
+	_cleanup_free_ bool *taken = NULL;
+	_cleanup_free_ uint32_t *tried = NULL;
+	uint32_t n = (uint32_t)entries->len;
+	uint32_t maxcount = 0, norder = 0;
+	uint32_t b, seed, k;
+
+	count = malloc0(sizeof(uint32_t) * nbuckets);
+	start = malloc0(sizeof(uint32_t) * (nbuckets + 1));
+	members = malloc0(sizeof(uint32_t) * (n + 1));
+	order = malloc0(sizeof(uint32_t) * nbuckets);
+	taken = malloc0(sizeof(bool) * (n + 1));
+	tried = malloc0(sizeof(uint32_t) * (n + 1));
+	if (!count || !start || !members || !order || !taken || !tried) {
+		abort();
+	}
+
+	/* Bucket the entries (counting sort) */
+	for (uint32_t i = 0; i < n; i++) {
+		b = entry_hash(&entries->items[i], 0) % nbuckets;
+		entries->items[i].bucket = b;
+		count[b]++;
+	}
+	for (b = 0; b < nbuckets; b++) {
+		start[b + 1] = start[b] + count[b];
+		count[b] = 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		b = entries->items[i].bucket;
+		members[start[b] + count[b]++] = i;
+	}
+
+	/* Largest buckets first, while most slots are free */
+	for (b = 0; b < nbuckets; b++) {
+		if (count[b] > maxcount) {
+			maxcount = count[b];
+		}
+	}
+	for (uint32_t size = maxcount; size > 0; size--) {
+		for (b = 0; b < nbuckets; b++) {
+			if (count[b] == size) {
+				order[norder++] = b;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < norder; i++) {
+		b = order[i];
+		for (seed = 1; seed < COMPILED_MAX_SEED; seed++) {
+			for (k = 0; k < count[b]; k++) {
+				uint32_t s;
+
+				s = entry_hash(&entries->items[members[start[b] + k]],
+					       seed) % n;
+				if (taken[s]) {
+					break;
+				}
+				taken[s] = true;
+				tried[k] = s;
+			}
+			if (k == count[b]) {
+				break;
+			}
+			/* Collision, release the slots of this attempt */
+			while (k--) {
+				taken[tried[k]] = false;
+			}
+		}
+		if (seed == COMPILED_MAX_SEED) {
+			buxton_log("Failed to build perfect hash\n");
+			return false;
+		}
+
+		buckets[b] = seed;
+		for (k = 0; k < count[b]; k++) {
+			slots[tried[k]] = entries->items[members[start[b] + k]].offset;
+		}
+	}
+
+	return true;
+}
+
+static bool write_file(const char *path, uint8_t *buf, size_t size)
+{
+	_cleanup_free_ char *tmp = NULL;
+	int fd;
+	bool ret = false;
+
+	if (asprintf(&tmp, "%s.tmp", path) == -1) {
+		abort();
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1) {
+		buxton_log("Failed to create %s: %m\n", tmp);
+		return false;
+	}
+
+	if (!_write(fd, buf, size) || fsync(fd) == -1) {
+		buxton_log("Failed to write %s: %m\n", tmp);
+		goto end;
+	}
+
+	/* Replace any previous file atomically */
+	if (rename(tmp, path) == -1) {
+		buxton_log("Failed to rename %s: %m\n", tmp);
+		goto end;
+	}
+	ret = true;
+
+end:
+	close(fd);
+	if (!ret) {
+		unlink(tmp);
+	}
+	return ret;
+}
+
+bool buxton_compile_layer(BuxtonControl *control, BuxtonString *layer_name,
+			  const char *path)
+{
+	BuxtonLayer *layer;
+	BuxtonBackend *backend;
+	struct entries entries = { NULL, 0, 0 };
+	_cleanup_free_ uint8_t *buf = NULL;
+	CompiledHeader *header;
+	CompiledGroup *groups;
+	uint32_t *keys;
+	uint32_t nbuckets, ngroups = 0, nkeys = 0;
+	size_t kept = 0;
+	char *group = NULL;
+	uint64_t offset;
+	bool ret = false;
+
+	assert(control);
+	assert(layer_name);
+	assert(path);
+
+	layer = hashmap_get(control->config.layers, layer_name->value);
+	if (!layer) {
+		buxton_log("Layer %s not found\n", layer_name->value);
+		return false;
+	}
+	if (layer->type == LAYER_USER) {
+		layer->uid = control->client.uid;
+	}
+
+	backend = backend_for_layer(&control->config, layer);
+	assert(backend);
+	if (!backend->list_names) {
+		buxton_log("Backend of layer %s can't list names\n", layer_name->value);
+		return false;
+	}
+
+	if (!collect_entries(backend, layer, &entries)) {
+		goto end;
+	}
+	if (entries.len > UINT32_MAX / 2) {
+		goto end;
+	}
+	qsort(entries.items, entries.len, sizeof(struct entry), compare_entry);
+
+	/* Keys left behind by a removed group are not reachable, drop them */
+	for (size_t i = 0; i < entries.len; i++) {
+		struct entry *e = &entries.items[i];
+
+		if (e->key_size == e->group_size) {
+			group = e->key;
+			ngroups++;
+		} else if (!group || strcmp(group, e->key)) {
+			free(e->key);
+			free(e->value);
+			continue;
+		} else {
+			nkeys++;
+		}
+		entries.items[kept++] = *e;
+	}
+	entries.len = kept;
+
+	/* Lay the file out */
+	nbuckets = (uint32_t)entries.len / 4 + 1;
+	offset = COMPILED_ALIGN(sizeof(CompiledHeader));
+	offset += COMPILED_ALIGN(sizeof(uint32_t) * nbuckets);
+	offset += COMPILED_ALIGN(sizeof(uint32_t) * entries.len);
+	offset += COMPILED_ALIGN(sizeof(CompiledGroup) * ngroups);
+	offset += COMPILED_ALIGN(sizeof(uint32_t) * nkeys);
+	for (size_t i = 0; i < entries.len; i++) {
+		struct entry *e = &entries.items[i];
+
+		e->offset = (uint32_t)offset;
+		offset += sizeof(CompiledRecord) + COMPILED_ALIGN(e->key_size);
+		offset = COMPILED_ALIGN(offset + e->value_size);
+		if (offset > UINT32_MAX) {
+			buxton_log("Layer %s is too large to compile\n", layer_name->value);
+			goto end;
+		}
+	}
+
+	buf = malloc0((size_t)offset);
+	if (!buf) {
+		abort();
+	}
+	header = (CompiledHeader *)buf;
+	memcpy(header->magic, COMPILED_MAGIC, sizeof(header->magic));
+	header->nrecords = (uint32_t)entries.len;
+	header->nbuckets = nbuckets;
+	header->ngroups = ngroups;
+	header->nkeys = nkeys;
+	header->buckets = COMPILED_ALIGN(sizeof(CompiledHeader));
+	header->slots = header->buckets + COMPILED_ALIGN(sizeof(uint32_t) * nbuckets);
+	header->groups = header->slots + COMPILED_ALIGN(sizeof(uint32_t) * entries.len);
+	header->keys = header->groups + COMPILED_ALIGN(sizeof(CompiledGroup) * ngroups);
+	header->size = offset;
+
+	/* Records, along with the sorted group and key indexes */
+	groups = (CompiledGroup *)(buf + header->groups);
+	keys = (uint32_t *)(buf + header->keys);
+	nkeys = 0;
+	for (size_t i = 0; i < entries.len; i++) {
+		struct entry *e = &entries.items[i];
+		CompiledRecord *rec = (CompiledRecord *)(buf + e->offset);
+
+		rec->key_size = e->key_size;
+		rec->value_size = e->value_size;
+		memcpy(buf + e->offset + sizeof(CompiledRecord), e->key, e->key_size);
+		memcpy(buf + e->offset + sizeof(CompiledRecord) +
+		       COMPILED_ALIGN(e->key_size), e->value, e->value_size);
+
+		if (e->key_size == e->group_size) {
+			groups->record = e->offset;
+			groups->first = nkeys;
+			groups->count = 0;
+			groups++;
+		} else {
+			(groups - 1)->count++;
+			keys[nkeys++] = e->offset;
+		}
+	}
+
+	if (entries.len && !build_hash(&entries, nbuckets,
+				       (uint32_t *)(buf + header->buckets),
+				       (uint32_t *)(buf + header->slots))) {
+		goto end;
+	}
+
+	ret = write_file(path, buf, (size_t)offset);
+
+end:
+	for (size_t i = 0; i < entries.len; i++) {
+		free(entries.items[i].key);
+		free(entries.items[i].value);
+	}
+	free(entries.items);
+	return ret;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,147 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file compiler.h Internal header
+ * This file is used internally by buxton to compile layers into
+ * immutable files, and by the compiled backend to read them
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include "backend.h"
+
+/*
+ * Compiled layer file layout, all in host byte order:
+ *
+ *   CompiledHeader
+ *   uint32_t buckets[nbuckets]    perfect hash displacement seeds
+ *   uint32_t slots[nrecords]      record offset for each hash slot
+ *   CompiledGroup groups[ngroups] groups, sorted by name
+ *   uint32_t keys[nkeys]          key record offsets, sorted by group
+ *                                 then name
+ *   records                       CompiledRecord, key, value
+ *
+ * Record keys are the group and name strings (NUL included) back to
+ * back, group records have no name. Values use the buxton_serialize()
+ * format, so labels are stored inline. Sections and record values are
+ * 8 byte aligned.
+ */
+
+/** Identifies a compiled layer, and its format version */
+#define COMPILED_MAGIC "BXTCMP01"
+
+/** Alignment of sections and values in a compiled layer */
+#define COMPILED_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
+/**
+ * Header of a compiled layer file
+ */
+typedef struct CompiledHeader {
+	char magic[8]; /**<COMPILED_MAGIC */
+	uint32_t nrecords; /**<Number of records (groups and keys) */
+	uint32_t nbuckets; /**<Number of first level hash buckets */
+	uint32_t ngroups; /**<Number of groups */
+	uint32_t nkeys; /**<Number of keys */
+	uint64_t buckets; /**<Offset of the bucket seed table */
+	uint64_t slots; /**<Offset of the slot table */
+	uint64_t groups; /**<Offset of the group index */
+	uint64_t keys; /**<Offset of the key index */
+	uint64_t size; /**<Total size of the file */
+} CompiledHeader;
+
+/**
+ * Entry of the sorted group index
+ */
+typedef struct CompiledGroup {
+	uint32_t record; /**<Offset of the group's record */
+	uint32_t first; /**<Index of the group's first key in the key index */
+	uint32_t count; /**<Number of keys in the group */
+} CompiledGroup;
+
+/**
+ * Header of a record, followed by the key and the value
+ */
+typedef struct CompiledRecord {
+	uint32_t key_size; /**<Size of the key */
+	uint32_t value_size; /**<Size of the serialized value */
+} CompiledRecord;
+
+/**
+ * Start hashing a key
+ * @param seed Hash function seed
+ * @return the initial hash state
+ */
+static inline uint32_t compiled_hash_init(uint32_t seed)
+{
+	return 2166136261u ^ (seed * 0x9e3779b9u);
+}
+
+/**
+ * Feed bytes of a key to the hash (FNV-1a)
+ * @param h Current hash state
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @return the updated hash state
+ */
+static inline uint32_t compiled_hash_update(uint32_t h, const char *data,
+					    uint32_t len)
+{
+	while (len--) {
+		h ^= (uint8_t)*data++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Finish hashing a key
+ * @param h Current hash state
+ * @return the final hash value
+ */
+static inline uint32_t compiled_hash_final(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Compile the contents of a layer into an immutable file
+ * @param control Valid BuxtonControl instance
+ * @param layer_name BuxtonString of the layer name to compile
+ * @param path Path of the compiled file to write
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_compile_layer(BuxtonControl *control, BuxtonString *layer_name,
+			  const char *path)
+	__attribute__((warn_unused_result));
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -14,7 +14,9 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <iniparser.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -29,6 +31,18 @@
  */
 #define CONFIG_SECTION "Configuration"
 
+/**
+ * Default number of per-user databases kept open
+ */
+#define USER_DB_CACHE_SIZE 64
+#define USER_DB_CACHE_SIZE_STR "64"
+
+/**
+ * Default number of worker threads, clients are served by the main loop
+ */
+#define WORKER_THREADS 0
+#define WORKER_THREADS_STR "0"
+
 #ifndef HAVE_SECURE_GETENV
 #  ifdef HAVE___SECURE_GETENV
 #    define secure_getenv __secure_getenv
@@ -62,7 +76,9 @@ static const char *KS[CONFIG_MAX] = {
 	"BUXTON_MODULE_DIR",
 	"BUXTON_DB_PATH",
 	"BUXTON_SMACK_LOAD_FILE",
-	"BUXTON_BUXTON_SOCKET"
+	"BUXTON_BUXTON_SOCKET",
+	"BUXTON_USER_DB_CACHE_SIZE",
+	"BUXTON_WORKER_THREADS"
 };
 
 /**
@@ -75,7 +91,9 @@ static const char *config_keys[CONFIG_MAX] = {
 	"ModuleDirectory",
 	"DatabasePath",
 	"SmackLoadFile",
-	"SocketPath"
+	"SocketPath",
+	"UserDatabaseCacheSize",
+	"WorkerThreads"
 };
 
 static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
@@ -84,7 +102,9 @@ static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
 	_MODULE_DIRECTORY,
 	_DB_PATH,
 	_SMACK_LOAD_FILE,
-	_BUXTON_SOCKET
+	_BUXTON_SOCKET,
+	USER_DB_CACHE_SIZE_STR,
+	WORKER_THREADS_STR
 };
 
 /**
@@ -282,6 +302,40 @@ const char* buxton_socket(void)
 	return (const char*)conf.keys[CONFIG_BUXTON_SOCKET];
 }
 
+int buxton_user_db_cache_size(void)
+{
+	char *end;
+	long size;
+
+	initialize();
+	errno = 0;
+	size = strtol(conf.keys[CONFIG_USER_DB_CACHE_SIZE], &end, 10);
+	if (errno || *end != '\0' || size <= 0 || size > INT_MAX) {
+		buxton_log("Invalid user database cache size %s, using %d\n",
+			   conf.keys[CONFIG_USER_DB_CACHE_SIZE],
+			   USER_DB_CACHE_SIZE);
+		return USER_DB_CACHE_SIZE;
+	}
+	return (int)size;
+}
+
+int buxton_worker_threads(void)
+{
+	char *end;
+	long threads;
+
+	initialize();
+	errno = 0;
+	threads = strtol(conf.keys[CONFIG_WORKER_THREADS], &end, 10);
+	if (errno || *end != '\0' || threads < 0 ||
+	    threads > BUXTON_MAX_WORKER_THREADS) {
+		buxton_log("Invalid number of worker threads %s, using %d\n",
+			   conf.keys[CONFIG_WORKER_THREADS], WORKER_THREADS);
+		return WORKER_THREADS;
+	}
+	return (int)threads;
+}
+
 int buxton_key_get_layers(ConfigLayer **layers)
 {
 	ConfigLayer *_layers;
@@ -320,6 +374,10 @@ int buxton_key_get_layers(ConfigLayer **layers)
 			true, 0);
 		_layers[j].access = get_ini_string(section_name, "Access",
 			false, "read-write");
+		_layers[j].durability = get_ini_string(section_name,
+			"Durability", false, "sync");
+		_layers[j].sync_interval = get_ini_int(section_name,
+			"SyncInterval", false, 100);
 		j++;
 	}
 	*layers = _layers;
@@ -20,6 +20,11 @@
 	#include "config.h"
 #endif
 
+/**
+ * Upper bound of the WorkerThreads setting
+ */
+#define BUXTON_MAX_WORKER_THREADS 64
+
 typedef enum ConfigKey {
 	CONFIG_MIN = 0,
 	CONFIG_CONF_FILE,
@@ -27,6 +32,8 @@ typedef enum ConfigKey {
 	CONFIG_DB_PATH,
 	CONFIG_SMACK_LOAD_FILE,
 	CONFIG_BUXTON_SOCKET,
+	CONFIG_USER_DB_CACHE_SIZE,
+	CONFIG_WORKER_THREADS,
 	CONFIG_MAX
 } ConfigKey;
 
@@ -41,7 +48,9 @@ typedef struct ConfigLayer {
 	char *backend;
 	char *description;
 	char *access;
+	char *durability;
 	int priority;
+	int sync_interval;
 } ConfigLayer;
 
 /**
@@ -105,6 +114,29 @@ const char *buxton_smack_load_file(void)
 const char *buxton_socket(void)
 	__attribute__((warn_unused_result));
 
+/**
+ * @internal
+ * @brief Get the maximum number of per-user databases kept open.
+ *
+ *
+ * @return the number of per-user database handles a backend may keep
+ * open at once, always greater than zero.
+ */
+int buxton_user_db_cache_size(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * @internal
+ * @brief Get the number of worker threads serving clients in buxtond.
+ *
+ *
+ * @return the number of worker threads, between 0 and
+ * BUXTON_MAX_WORKER_THREADS. With 0, clients are served by the main
+ * thread.
+ */
+int buxton_worker_threads(void)
+	__attribute__((warn_unused_result));
+
 /**
  * @internal
  * @brief Get an array of ConfigLayers from the conf file
@@ -16,14 +16,81 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "direct.h"
+#include "keyid.h"
 #include "log.h"
 #include "smack.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #define BUXTON_ROOT_CHECK_ENV "BUXTON_ROOT_CHECK"
 
+/*
+ * Requests may be served from several threads at once. Layers are
+ * locked shared to be read and exclusively to be modified, for the
+ * whole of a request, so its group and label checks can't race with
+ * another writer. Calls into a backend module are serialized, unless
+ * it is concurrent and does its own locking. Backends are handed a per-request copy of
+ * the layer carrying the client's uid, so the configuration itself is
+ * never modified by a request.
+ */
+static void read_lock_layer(BuxtonLayer *layer)
+{
+	if (pthread_rwlock_rdlock(&layer->lock)) {
+		abort();
+	}
+}
+
+static void write_lock_layer(BuxtonLayer *layer)
+{
+	if (pthread_rwlock_wrlock(&layer->lock)) {
+		abort();
+	}
+}
+
+static void unlock_layer(BuxtonLayer *layer)
+{
+	if (pthread_rwlock_unlock(&layer->lock)) {
+		abort();
+	}
+}
+
+static void lock_backend(BuxtonBackend *backend)
+{
+	/* Waiting for a serialized backend counts as backend time */
+	buxton_stats_backend_begin();
+	buxton_trace_begin(BUXTON_TRACE_BACKEND);
+	if (backend->concurrent) {
+		return;
+	}
+	if (pthread_mutex_lock(&backend->lock)) {
+		abort();
+	}
+}
+
+static void unlock_backend(BuxtonBackend *backend)
+{
+	buxton_stats_backend_end();
+	buxton_trace_end(BUXTON_TRACE_BACKEND);
+	if (backend->concurrent) {
+		return;
+	}
+	if (pthread_mutex_unlock(&backend->lock)) {
+		abort();
+	}
+}
+
+static BuxtonLayer request_layer(BuxtonControl *control, BuxtonLayer *layer)
+{
+	BuxtonLayer copy = *layer;
+
+	copy.uid = control->client.uid;
+	return copy;
+}
+
 bool buxton_direct_open(BuxtonControl *control)
 {
 
@@ -38,31 +105,74 @@ bool buxton_direct_open(BuxtonControl *control)
 	return true;
 }
 
+bool buxton_direct_load_backends(BuxtonControl *control)
+{
+	BuxtonLayer *layer;
+	Iterator i;
+
+	assert(control);
+
+	HASHMAP_FOREACH(layer, control->config.layers, i) {
+		if (!backend_for_layer(&control->config, layer)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Whether a value in layer a hides one in layer b: system layers win
+ * over user layers, then the higher priority wins
+ */
+static bool layer_outranks(BuxtonLayer *a, BuxtonLayer *b)
+{
+	if (a->type == LAYER_SYSTEM) {
+		return b->type != LAYER_SYSTEM || b->priority <= a->priority;
+	}
+	return b->type != LAYER_SYSTEM && b->priority <= a->priority;
+}
+
 int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
 			     BuxtonData *data, BuxtonString *data_label,
 			     BuxtonString *client_label)
+{
+	assert(control);
+	assert(key);
+
+	if (key->layer.value) {
+		return (int32_t)buxton_direct_get_value_for_layer(control, key,
+								  data,
+								  data_label,
+								  client_label);
+	}
+
+	return buxton_direct_get_effective_value(control, key, data,
+						 data_label, client_label,
+						 NULL);
+}
+
+int32_t buxton_direct_get_effective_value(BuxtonControl *control,
+					  _BuxtonKey *key,
+					  BuxtonData *data,
+					  BuxtonString *data_label,
+					  BuxtonString *client_label,
+					  BuxtonString *layer)
 {
 	/* Handle direct manipulation */
 	BuxtonLayer *l;
+	BuxtonLayer *best = NULL;
 	BuxtonConfig *config;
-	BuxtonString layer = (BuxtonString){ NULL, 0 };
+	BuxtonString key_layer;
 	Iterator i;
 	BuxtonData d;
-	int priority = 0;
 	int32_t ret;
-	BuxtonLayerType layer_origin = -1;
 
 	assert(control);
 	assert(key);
 
-	if (key->layer.value) {
-		ret = (int32_t)buxton_direct_get_value_for_layer(control, key, data,
-						      data_label,
-						      client_label);
-		return ret;
-	}
-
 	config = &control->config;
+	key_layer = key->layer;
 
 	HASHMAP_FOREACH(l, config->layers, i) {
 		key->layer.value = l->name.value;
@@ -80,56 +190,90 @@ int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
 				free(d.store.d_string.value);
 			}
 
-			if ((l->type == LAYER_SYSTEM && (layer_origin != LAYER_SYSTEM ||
-							 priority <= l->priority)) ||
-			    (l->type == LAYER_USER && layer_origin != LAYER_SYSTEM &&
-			     priority <= l->priority)) {
-				if (l->type == LAYER_SYSTEM) {
-					layer_origin = LAYER_SYSTEM;
-				} else {
-					layer_origin = LAYER_USER;
-				}
-				priority = l->priority;
-				layer.value = l->name.value;
-				layer.length = l->name.length;
+			if (!best || layer_outranks(l, best)) {
+				best = l;
 			}
 		}
 	}
-	if (layer.value) {
-		key->layer.value = layer.value;
-		key->layer.length = layer.length;
+	if (best) {
+		key->layer.value = best->name.value;
+		key->layer.length = best->name.length;
 		ret = (int32_t)buxton_direct_get_value_for_layer(control,
 						      key,
 						      data,
 						      data_label,
 						      client_label);
-		key->layer.value = NULL;
-		key->layer.length = 0;
+		key->layer = key_layer;
+		if (layer) {
+			*layer = best->name;
+		}
 
 		return ret;
 	}
+	key->layer = key_layer;
 	return ENOENT;
 }
 
-int buxton_direct_get_value_for_layer(BuxtonControl *control,
-				       _BuxtonKey *key,
-				       BuxtonData *data,
-				       BuxtonString *data_label,
-				       BuxtonString *client_label)
+bool buxton_direct_layer_shadows(BuxtonControl *control, BuxtonString *upper,
+				 BuxtonString *lower)
+{
+	BuxtonLayer *a, *b;
+
+	assert(control);
+	assert(upper);
+	assert(lower);
+
+	a = hashmap_get(control->config.layers, upper->value);
+	b = hashmap_get(control->config.layers, lower->value);
+	if (!a || !b || a == b) {
+		return false;
+	}
+
+	return layer_outranks(a, b);
+}
+
+/*
+ * Version stamp of a value replacing one stamped old, 0 for a new key.
+ * Stamps follow the clock in microseconds, so a key that is removed
+ * and set again doesn't reuse a version clients may have cached.
+ */
+static uint64_t next_version(uint64_t old)
+{
+	struct timespec now;
+	uint64_t stamp;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	stamp = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+
+	return stamp > old ? stamp : old + 1;
+}
+
+/* The group of key, sharing the strings and the interned group of key */
+static void key_group(_BuxtonKey *key, _BuxtonKey *group)
+{
+	memzero(group, sizeof(_BuxtonKey));
+	group->group = key->group;
+	group->layer = key->layer;
+	group->type = BUXTON_TYPE_STRING;
+	if (key->id) {
+		group->id = key->name.value ? key->id->parent : key->id;
+	}
+}
+
+/* Get a value from a layer, with the layer lock held by the caller */
+static int get_value_locked(BuxtonControl *control, BuxtonLayer *layer,
+			    _BuxtonKey *key, BuxtonData *data,
+			    BuxtonString *data_label,
+			    BuxtonString *client_label)
 {
 	/* Handle direct manipulation */
 	BuxtonBackend *backend = NULL;
-	BuxtonLayer *layer = NULL;
-	BuxtonConfig *config;
+	BuxtonLayer req;
 	BuxtonData g;
 	_BuxtonKey group;
 	BuxtonString group_label;
 	int ret;
 
-	assert(control);
-	assert(key);
-	assert(data_label);
-
 	buxton_debug("get_value '%s:%s' for layer '%s' start\n",
 		     key->group.value, key->name.value, key->layer.value);
 
@@ -137,27 +281,13 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 	memzero(&group, sizeof(_BuxtonKey));
 	memzero(&group_label, sizeof(BuxtonString));
 
-	if (!key->layer.value) {
-		ret = EINVAL;
-		goto fail;
-	}
-
-	config = &control->config;
-	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
-		ret = EINVAL;
-		goto fail;
-	}
-	backend = backend_for_layer(config, layer);
+	backend = backend_for_layer(&control->config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-
 	/* Groups must be created first, so bail if this key's group doesn't exist */
 	if (key->name.value) {
-		if (!buxton_copy_key_group(key, &group)) {
-			abort();
-		}
-		ret = buxton_direct_get_value_for_layer(control, &group, &g, &group_label, NULL);
+		key_group(key, &group);
+		ret = get_value_locked(control, layer, &group, &g, &group_label, NULL);
 		if (ret) {
 			buxton_debug("Group %s for name %s missing for get value\n", key->group.value, key->name.value);
 			goto fail;
@@ -172,7 +302,10 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 		}
 	}
 
-	ret = backend->get_value(layer, key, data, data_label);
+	req = request_layer(control, layer);
+	lock_backend(backend);
+	ret = backend->get_value(&req, key, data, data_label);
+	unlock_backend(backend);
 	if (!ret) {
 		/* Access checks are not needed for direct clients, where client_label is NULL */
 		if (data_label->value && client_label && client_label->value &&
@@ -187,32 +320,66 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 
 fail:
 	free(g.store.d_string.value);
-	free(group.group.value);
-	free(group.name.value);
-	free(group.layer.value);
 	free(group_label.value);
 	buxton_debug("get_value '%s:%s' for layer '%s' end\n",
 		     key->group.value, key->name.value, key->layer.value);
 	return ret;
 }
 
-bool buxton_direct_set_value(BuxtonControl *control,
-			     _BuxtonKey *key,
-			     BuxtonData *data,
-			     BuxtonString *label)
+int buxton_direct_get_value_for_layer(BuxtonControl *control,
+				       _BuxtonKey *key,
+				       BuxtonData *data,
+				       BuxtonString *data_label,
+				       BuxtonString *client_label)
+{
+	BuxtonLayer *layer;
+	int ret;
+
+	assert(control);
+	assert(key);
+	assert(data_label);
+
+	if (!key->layer.value) {
+		return EINVAL;
+	}
+	if ((layer = hashmap_get(control->config.layers, key->layer.value)) == NULL) {
+		return EINVAL;
+	}
+
+	read_lock_layer(layer);
+	ret = get_value_locked(control, layer, key, data, data_label,
+			       client_label);
+	unlock_layer(layer);
+
+	return ret;
+}
+
+/*
+ * Decides, with the layer write lock held, whether data replaces the
+ * current value of a key, NULL if it has none. Returns 0 to store
+ * data, or an errno to leave the key alone.
+ */
+typedef int (*update_func)(BuxtonData *current, BuxtonData *data,
+			   void *user);
+
+/* Set a value, if update agrees to it, while the layer is locked */
+static int update_value(BuxtonControl *control, _BuxtonKey *key,
+			BuxtonData *data, BuxtonString *label,
+			update_func update, void *user)
 {
 	BuxtonDataType memo_type;
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
 	BuxtonString default_label = buxton_string_pack("_");
 	BuxtonString *l;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
 	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
+	_BuxtonKey group;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
 	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
-	bool r = false;
+	int r = EINVAL;
 	int ret;
 
 	assert(control);
@@ -221,10 +388,6 @@ bool buxton_direct_set_value(BuxtonControl *control,
 
 	buxton_debug("set_value start\n");
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
 	g = malloc0(sizeof(BuxtonData));
 	if (!g) {
 		abort();
@@ -243,34 +406,40 @@ bool buxton_direct_set_value(BuxtonControl *control,
 		abort();
 	}
 
-	/* Groups must be created first, so bail if this key's group doesn't exist */
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
+	config = &control->config;
+	if (!key->layer.value ||
+	    (layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
+		goto fail;
 	}
+	write_lock_layer(layer);
 
-	ret = buxton_direct_get_value_for_layer(control, group, g, group_label, NULL);
+	/* Groups must be created first, so bail if this key's group doesn't exist */
+	key_group(key, &group);
+	ret = get_value_locked(control, layer, &group, g, group_label, NULL);
 	if (ret) {
 		buxton_debug("Error(%d): %s\n", ret, strerror(ret));
 		buxton_debug("Group %s for name %s missing for set value\n", key->group.value, key->name.value);
-		goto fail;
+		goto unlock;
 	}
 
 	/* Access checks are not needed for direct clients, where label is NULL */
 	if (label) {
 		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
-			goto fail;
+			r = EPERM;
+			goto unlock;
 		}
 
 		memo_type = key->type;
 		key->type = BUXTON_TYPE_UNSET;
-		ret = buxton_direct_get_value_for_layer(control, key, d, data_label, NULL);
+		ret = get_value_locked(control, layer, key, d, data_label, NULL);
 		key->type = memo_type;
 		if (ret == -ENOENT || ret == EINVAL) {
-			goto fail;
+			goto unlock;
 		}
 		if (!ret) {
 			if (!buxton_check_smack_access(label, data_label, ACCESS_WRITE)) {
-				goto fail;
+				r = EPERM;
+				goto unlock;
 			}
 			l = data_label;
 		} else {
@@ -279,10 +448,10 @@ bool buxton_direct_set_value(BuxtonControl *control,
 	} else {
 		memo_type = key->type;
 		key->type = BUXTON_TYPE_UNSET;
-		ret = buxton_direct_get_value_for_layer(control, key, d, data_label, NULL);
+		ret = get_value_locked(control, layer, key, d, data_label, NULL);
 		key->type = memo_type;
 		if (ret == -ENOENT || ret == EINVAL) {
-			goto fail;
+			goto unlock;
 		} else if (!ret) {
 			l = data_label;
 		} else {
@@ -290,38 +459,181 @@ bool buxton_direct_set_value(BuxtonControl *control,
 		}
 	}
 
-	config = &control->config;
-	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
-		goto fail;
-	}
-
 	if (layer->readonly) {
 		buxton_debug("Read-only layer!\n");
-		goto fail;
+		r = EROFS;
+		goto unlock;
 	}
 
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-	ret = backend->set_value(layer, key, data, l);
-	if (ret) {
-		buxton_debug("set value failed: %s\n", strerror(ret));
-	} else {
-		r = true;
+	/* The lookup above left ret at 0 if the key already had a value */
+	if (update) {
+		r = update(ret ? NULL : d, data, user);
+		if (r) {
+			goto unlock;
+		}
+	}
+	data->version = next_version(ret ? 0 : d->version);
+
+	req = request_layer(control, layer);
+	lock_backend(backend);
+	r = backend->set_value(&req, key, data, l);
+	unlock_backend(backend);
+	if (r) {
+		buxton_debug("set value failed: %s\n", strerror(r));
 	}
 
+unlock:
+	unlock_layer(layer);
 fail:
 	buxton_debug("set_value end\n");
 	return r;
 }
 
+bool buxton_direct_set_value(BuxtonControl *control,
+			     _BuxtonKey *key,
+			     BuxtonData *data,
+			     BuxtonString *label)
+{
+	return update_value(control, key, data, label, NULL, NULL) == 0;
+}
+
+static bool data_equal(BuxtonData *a, BuxtonData *b)
+{
+	if (a->type != b->type) {
+		return false;
+	}
+
+	switch (a->type) {
+	case BUXTON_TYPE_STRING:
+		return a->store.d_string.length == b->store.d_string.length &&
+			memcmp(a->store.d_string.value, b->store.d_string.value,
+			       a->store.d_string.length) == 0;
+	case BUXTON_TYPE_INT32:
+		return a->store.d_int32 == b->store.d_int32;
+	case BUXTON_TYPE_UINT32:
+		return a->store.d_uint32 == b->store.d_uint32;
+	case BUXTON_TYPE_INT64:
+		return a->store.d_int64 == b->store.d_int64;
+	case BUXTON_TYPE_UINT64:
+		return a->store.d_uint64 == b->store.d_uint64;
+	case BUXTON_TYPE_FLOAT:
+		return a->store.d_float == b->store.d_float;
+	case BUXTON_TYPE_DOUBLE:
+		return a->store.d_double == b->store.d_double;
+	case BUXTON_TYPE_BOOLEAN:
+		return a->store.d_boolean == b->store.d_boolean;
+	default:
+		return false;
+	}
+}
+
+struct compare {
+	BuxtonData *expected; /**<Value to match, NULL to match version */
+	uint64_t version; /**<Version to match, 0 for no value */
+	BuxtonData *current; /**<Receives the value that didn't match */
+};
+
+static int compare_update(BuxtonData *current, BuxtonData *data, void *user)
+{
+	struct compare *c = user;
+	bool match;
+
+	if (c->expected) {
+		match = current && data_equal(current, c->expected);
+	} else if (current) {
+		match = current->version && current->version == c->version;
+	} else {
+		match = c->version == 0;
+	}
+	if (match) {
+		return 0;
+	}
+
+	if (current) {
+		if (!buxton_data_copy(current, c->current)) {
+			abort();
+		}
+	} else {
+		c->current->type = BUXTON_TYPE_UNSET;
+		c->current->version = 0;
+	}
+
+	return ECANCELED;
+}
+
+int buxton_direct_compare_and_set(BuxtonControl *control,
+				  _BuxtonKey *key,
+				  BuxtonData *data,
+				  BuxtonData *expected,
+				  uint64_t version,
+				  BuxtonData *current,
+				  BuxtonString *label)
+{
+	struct compare c = { expected, version, current };
+
+	assert(current);
+
+	return update_value(control, key, data, label, compare_update, &c);
+}
+
+/* Add *delta to the current value, an unset key counting as 0 */
+static int add_update(BuxtonData *current, BuxtonData *data, void *user)
+{
+	int64_t delta = *(int64_t *)user;
+	bool overflow;
+
+	if (current && current->type != data->type) {
+		return EINVAL;
+	}
+
+	switch (data->type) {
+	case BUXTON_TYPE_INT32:
+		overflow = __builtin_add_overflow(current ? current->store.d_int32 : 0,
+						  delta, &data->store.d_int32);
+		break;
+	case BUXTON_TYPE_UINT32:
+		overflow = __builtin_add_overflow(current ? current->store.d_uint32 : 0,
+						  delta, &data->store.d_uint32);
+		break;
+	case BUXTON_TYPE_INT64:
+		overflow = __builtin_add_overflow(current ? current->store.d_int64 : 0,
+						  delta, &data->store.d_int64);
+		break;
+	case BUXTON_TYPE_UINT64:
+		overflow = __builtin_add_overflow(current ? current->store.d_uint64 : 0,
+						  delta, &data->store.d_uint64);
+		break;
+	default:
+		return EINVAL;
+	}
+
+	return overflow ? ERANGE : 0;
+}
+
+int buxton_direct_add_value(BuxtonControl *control,
+			    _BuxtonKey *key,
+			    int64_t delta,
+			    BuxtonData *data,
+			    BuxtonString *label)
+{
+	assert(data);
+
+	data->type = key->type;
+	memzero(&data->store, sizeof(BuxtonDataStore));
+
+	return update_value(control, key, data, label, add_update, &delta);
+}
+
 bool buxton_direct_set_label(BuxtonControl *control,
 			     _BuxtonKey *key,
 			     BuxtonString *label)
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
 	bool r = false;
 	int ret;
@@ -358,8 +670,12 @@ bool buxton_direct_set_label(BuxtonControl *control,
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-	ret = backend->set_value(layer, key, NULL, label);
+	req = request_layer(control, layer);
+	write_lock_layer(layer);
+	lock_backend(backend);
+	ret = backend->set_value(&req, key, NULL, label);
+	unlock_backend(backend);
+	unlock_layer(layer);
 	if (ret) {
 		buxton_debug("set label failed: %s\n", strerror(ret));
 	} else {
@@ -376,6 +692,7 @@ bool buxton_direct_create_group(BuxtonControl *control,
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
 	BuxtonString s, l;
 	_cleanup_buxton_data_ BuxtonData *data = NULL;
@@ -427,9 +744,10 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL) != ENOENT) {
+	write_lock_layer(layer);
+	if (get_value_locked(control, layer, key, group, glabel, NULL) != ENOENT) {
 		buxton_debug("Group '%s' already exists\n", key->group.value);
-		goto fail;
+		goto unlock;
 	}
 
 	backend = backend_for_layer(config, layer);
@@ -441,6 +759,7 @@ bool buxton_direct_create_group(BuxtonControl *control,
 	if (!buxton_string_copy(&s, &data->store.d_string)) {
 		abort();
 	}
+	data->version = next_version(0);
 
 	if (label) {
 		if (!buxton_string_copy(label, dlabel)) {
@@ -454,14 +773,18 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		}
 	}
 
-	layer->uid = control->client.uid;
-	ret = backend->set_value(layer, key, data, dlabel);
+	req = request_layer(control, layer);
+	lock_backend(backend);
+	ret = backend->set_value(&req, key, data, dlabel);
+	unlock_backend(backend);
 	if (ret) {
 		buxton_debug("create group failed: %s\n", strerror(ret));
 	} else {
 		r = true;
 	}
 
+unlock:
+	unlock_layer(layer);
 fail:
 	return r;
 }
@@ -472,6 +795,7 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
 	_cleanup_buxton_data_ BuxtonData *group = NULL;
 	_cleanup_buxton_string_ BuxtonString *glabel = NULL;
@@ -512,29 +836,33 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL)) {
+	write_lock_layer(layer);
+	if (get_value_locked(control, layer, key, group, glabel, NULL)) {
 		buxton_debug("Group '%s' doesn't exist\n", key->group.value);
-		goto fail;
+		goto unlock;
 	}
 
 	if (layer->type == LAYER_USER) {
 		if (client_label && !buxton_check_smack_access(client_label, glabel, ACCESS_WRITE)) {
-			goto fail;
+			goto unlock;
 		}
 	}
 
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-
-	ret = backend->unset_value(layer, key, NULL, NULL);
+	req = request_layer(control, layer);
+	lock_backend(backend);
+	ret = backend->unset_value(&req, key, NULL, NULL);
+	unlock_backend(backend);
 	if (ret) {
 		buxton_debug("remove group failed: %s\n", strerror(ret));
 	} else {
 		r = true;
 	}
 
+unlock:
+	unlock_layer(layer);
 fail:
 	return r;
 }
@@ -549,7 +877,9 @@ bool buxton_direct_list_keys(BuxtonControl *control,
 	/* Handle direct manipulation */
 	BuxtonBackend *backend = NULL;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
+	bool r;
 
 	config = &control->config;
 	if ((layer = hashmap_get(config->layers, layer_name->value)) == NULL) {
@@ -558,8 +888,14 @@ bool buxton_direct_list_keys(BuxtonControl *control,
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-	return backend->list_keys(layer, list);
+	req = request_layer(control, layer);
+	read_lock_layer(layer);
+	lock_backend(backend);
+	r = backend->list_keys(&req, list);
+	unlock_backend(backend);
+	unlock_layer(layer);
+
+	return r;
 }
 
 bool buxton_direct_list_names(BuxtonControl *control,
@@ -571,7 +907,9 @@ bool buxton_direct_list_names(BuxtonControl *control,
 	/* Handle direct manipulation */
 	BuxtonBackend *backend = NULL;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
+	bool r;
 
 	assert(control);
 	assert(layer_name && layer_name->value);
@@ -583,8 +921,14 @@ bool buxton_direct_list_names(BuxtonControl *control,
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-	return backend->list_names(layer, group, prefix, list);
+	req = request_layer(control, layer);
+	read_lock_layer(layer);
+	lock_backend(backend);
+	r = backend->list_names(&req, group, prefix, list);
+	unlock_backend(backend);
+	unlock_layer(layer);
+
+	return r;
 }
 
 bool buxton_direct_unset_value(BuxtonControl *control,
@@ -593,22 +937,19 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 {
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
+	BuxtonLayer req;
 	BuxtonConfig *config;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
 	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
 	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
+	_BuxtonKey group;
 	int ret;
 	bool r = false;
 
 	assert(control);
 	assert(key);
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
 	g = malloc0(sizeof(BuxtonData));
 	if (!g) {
 		abort();
@@ -627,50 +968,54 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 		abort();
 	}
 
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
+	key_group(key, &group);
+
+	config = &control->config;
+	if (!key->layer.value ||
+	    (layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
+		goto fail;
 	}
+	write_lock_layer(layer);
 
-	if (buxton_direct_get_value_for_layer(control, group, g, group_label, NULL)) {
+	if (get_value_locked(control, layer, &group, g, group_label, NULL)) {
 		buxton_debug("Group %s for name %s missing for unset value\n", key->group.value, key->name.value);
-		goto fail;
+		goto unlock;
 	}
 
 	/* Access checks are not needed for direct clients, where label is NULL */
 	if (label) {
 		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
-			goto fail;
+			goto unlock;
 		}
-		if (!buxton_direct_get_value_for_layer(control, key, d, data_label, NULL)) {
+		if (!get_value_locked(control, layer, key, d, data_label, NULL)) {
 			if (!buxton_check_smack_access(label, data_label, ACCESS_WRITE)) {
-				goto fail;
+				goto unlock;
 			}
 		} else {
 			buxton_debug("Key %s not found, so unset fails\n", key->name.value);
-			goto fail;
+			goto unlock;
 		}
 	}
 
-	config = &control->config;
-	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
-		return false;
-	}
-
 	if (layer->readonly) {
 		buxton_debug("Read-only layer!\n");
-		return false;
+		goto unlock;
 	}
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
-	layer->uid = control->client.uid;
-	ret = backend->unset_value(layer, key, NULL, NULL);
+	req = request_layer(control, layer);
+	lock_backend(backend);
+	ret = backend->unset_value(&req, key, NULL, NULL);
+	unlock_backend(backend);
 	if (ret) {
 		buxton_debug("Unset value failed: %s\n", strerror(ret));
 	} else {
 		r = true;
 	}
 
+unlock:
+	unlock_layer(layer);
 fail:
 	return r;
 }
@@ -700,7 +1045,11 @@ bool buxton_direct_init_db(BuxtonControl *control, BuxtonString *layer_name)
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
+	write_lock_layer(layer);
+	lock_backend(backend);
 	db = backend->create_db(layer);
+	unlock_backend(backend);
+	unlock_layer(layer);
 	if (db) {
 		ret = true;
 	}
@@ -709,6 +1058,56 @@ end:
 	return ret;
 }
 
+int buxton_direct_sync(BuxtonControl *control, bool force)
+{
+	Iterator iterator;
+	BuxtonBackend *backend;
+	int timeout = -1;
+	int r;
+
+	assert(control);
+
+	HASHMAP_FOREACH(backend, control->config.backends, iterator) {
+		if (!backend->sync) {
+			continue;
+		}
+		lock_backend(backend);
+		r = backend->sync(force);
+		unlock_backend(backend);
+		if (r >= 0 && (timeout < 0 || r < timeout)) {
+			timeout = r;
+		}
+	}
+
+	return timeout;
+}
+
+void buxton_direct_cache_stats(BuxtonControl *control, BuxtonCacheStats *stats)
+{
+	Iterator iterator;
+	BuxtonBackend *backend;
+	BuxtonCacheStats backend_stats;
+
+	assert(control);
+	assert(stats);
+
+	memset(stats, 0, sizeof(BuxtonCacheStats));
+	HASHMAP_FOREACH(backend, control->config.backends, iterator) {
+		if (!backend->cache_stats) {
+			continue;
+		}
+		lock_backend(backend);
+		backend->cache_stats(&backend_stats);
+		unlock_backend(backend);
+		stats->hits += backend_stats.hits;
+		stats->misses += backend_stats.misses;
+		stats->evictions += backend_stats.evictions;
+		stats->open += backend_stats.open;
+		stats->live += backend_stats.live;
+		stats->dead += backend_stats.dead;
+	}
+}
+
 void buxton_direct_close(BuxtonControl *control)
 {
 	Iterator iterator;
@@ -726,6 +1125,7 @@ void buxton_direct_close(BuxtonControl *control)
 
 	HASHMAP_FOREACH_KEY(layer, key, control->config.layers, iterator) {
 		hashmap_remove(control->config.layers, key);
+		pthread_rwlock_destroy(&layer->lock);
 		free(layer->name.value);
 		free(layer->description);
 		free(layer);
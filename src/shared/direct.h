@@ -33,6 +33,18 @@
 bool buxton_direct_open(BuxtonControl *control)
 	__attribute__((warn_unused_result));
 
+/**
+ * Load the backend modules of all configured layers
+ *
+ * Backends are otherwise loaded on first use, which modifies the
+ * configuration, so this must be called before requests are served
+ * from more than one thread.
+ * @param control Valid BuxtonControl instance
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_direct_load_backends(BuxtonControl *control)
+	__attribute__((warn_unused_result));
+
 /**
  * Create a DB for a given layer in Buxton
  *
@@ -43,6 +55,22 @@ bool buxton_direct_open(BuxtonControl *control)
 bool buxton_direct_init_db(BuxtonControl *control, BuxtonString *layer_name)
 	__attribute__((warn_unused_result));
 
+/**
+ * Flush batched writes of group commit layers to disk
+ * @param control Valid BuxtonControl instance
+ * @param force Sync all pending writes, even if their interval hasn't elapsed
+ * @return the time in milliseconds until the next pending sync is due,
+ * or -1 if there is nothing left to sync
+ */
+int buxton_direct_sync(BuxtonControl *control, bool force);
+
+/**
+ * Sum the open database cache counters of all loaded backends
+ * @param control Valid BuxtonControl instance
+ * @param stats A BuxtonCacheStats to fill in
+ */
+void buxton_direct_cache_stats(BuxtonControl *control, BuxtonCacheStats *stats);
+
 /**
  * Close direct Buxton management connection
  * @param control Valid BuxtonControl instance
@@ -99,6 +127,51 @@ bool buxton_direct_set_value(BuxtonControl *control,
 			     BuxtonString *label)
 	__attribute__((warn_unused_result));
 
+/**
+ * Set a value within Buxton only if its current value matches, as one
+ * atomic update of the layer
+ * @param control An initialized control structure
+ * @param key The key struct
+ * @param data A struct containing the data to set, its version is set
+ * to the version stored
+ * @param expected The value the key must have, or NULL to compare its
+ * version instead
+ * @param version The version the key must have if expected is NULL, 0
+ * for a key that must have no value
+ * @param current Set to the value found if it doesn't match, with a
+ * type of BUXTON_TYPE_UNSET if the key has no value
+ * @param label The Smack label for the client
+ * @return 0 on success, ECANCELED if the value doesn't match, or
+ * another errno value on failure
+ */
+int buxton_direct_compare_and_set(BuxtonControl *control,
+				  _BuxtonKey *key,
+				  BuxtonData *data,
+				  BuxtonData *expected,
+				  uint64_t version,
+				  BuxtonData *current,
+				  BuxtonString *label)
+	__attribute__((warn_unused_result));
+
+/**
+ * Add to an integer value within Buxton, as one atomic update of the
+ * layer; a key without a value starts from 0
+ * @param control An initialized control structure
+ * @param key The key struct, whose type is the integer type of the value
+ * @param delta Amount to add, may be negative
+ * @param data An empty BuxtonData, where the new value and its version
+ * are stored
+ * @param label The Smack label for the client
+ * @return 0 on success, ERANGE if the result doesn't fit the type of
+ * the value, or another errno value on failure
+ */
+int buxton_direct_add_value(BuxtonControl *control,
+			    _BuxtonKey *key,
+			    int64_t delta,
+			    BuxtonData *data,
+			    BuxtonString *label)
+	__attribute__((warn_unused_result));
+
 /**
  * Retrieve a value from Buxton
  * @param control An initialized control structure
@@ -115,6 +188,38 @@ int32_t buxton_direct_get_value(BuxtonControl *control,
 			     BuxtonString *client_label)
 	__attribute__((warn_unused_result));
 
+/**
+ * Retrieve the effective value of a key, from the layer that wins
+ * over the others holding it, whatever the layer of the key
+ * @param control An initialized control structure
+ * @param key The key to retrieve
+ * @param data An empty BuxtonData, where data is stored
+ * @param data_label The Smack label of the data
+ * @param client_label The Smack label of the client
+ * @param layer Set to the name of the winning layer, owned by the
+ * configuration, may be NULL
+ * @return A int32_t value, indicating success of the operation
+ */
+int32_t buxton_direct_get_effective_value(BuxtonControl *control,
+					  _BuxtonKey *key,
+					  BuxtonData *data,
+					  BuxtonString *data_label,
+					  BuxtonString *client_label,
+					  BuxtonString *layer)
+	__attribute__((warn_unused_result));
+
+/**
+ * Check whether values in a layer hide those of another one
+ * @param control An initialized control structure
+ * @param upper Name of the layer that may hide the other
+ * @param lower Name of the layer that may be hidden
+ * @return true if upper wins over lower, false if it doesn't, if they
+ * are the same layer or if either is unknown
+ */
+bool buxton_direct_layer_shadows(BuxtonControl *control, BuxtonString *upper,
+				 BuxtonString *lower)
+	__attribute__((warn_unused_result));
+
 /**
  * Retrieve a value from Buxton by layer
  * @param control An initialized control structure
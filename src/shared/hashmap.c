@@ -24,6 +24,7 @@
 #endif
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -32,105 +33,56 @@
 #include "hashmap.h"
 #include "macro.h"
 
-#define INITIAL_N_BUCKETS 31
+/*
+ * Entries are kept in a dense array, in insertion order, which is what
+ * iteration walks. Lookups go through an index of Robin Hood hashed
+ * buckets that store the hash of the key next to the position of its
+ * entry, so probing rarely has to touch the entries or call the compare
+ * function for keys that don't match.
+ *
+ * Removing an entry leaves a hole in the dense array, so the iterator
+ * stays valid when the current entry is removed. Holes are reclaimed
+ * when the array has to grow.
+ */
+
+#define INITIAL_N_BUCKETS 8U
+
+/* Marks an unused bucket */
+#define BUCKET_EMPTY UINT32_MAX
 
 struct hashmap_entry {
         const void *key;
         void *value;
-        struct hashmap_entry *bucket_next, *bucket_previous;
-        struct hashmap_entry *iterate_next, *iterate_previous;
+        unsigned hash;
+        bool live;
+};
+
+struct hashmap_bucket {
+        uint32_t hash;
+        uint32_t entry;
 };
 
 struct Hashmap {
         hash_func_t hash_func;
         compare_func_t compare_func;
 
-        struct hashmap_entry *iterate_list_head, *iterate_list_tail;
-
-        struct hashmap_entry ** buckets;
-        unsigned n_buckets, n_entries;
-
-        bool from_pool;
-};
+        struct hashmap_bucket *buckets;
+        struct hashmap_entry *entries;
 
-struct pool {
-        struct pool *next;
-        unsigned n_tiles;
+        /* number of buckets, always a power of two */
+        unsigned n_buckets;
+        /* 32 - log2(n_buckets) */
+        unsigned shift;
+        /* live entries */
+        unsigned n_entries;
+        /* used slots of the entry array, holes included */
         unsigned n_used;
+        /* first slot of the entry array that may be live */
+        unsigned first;
 };
 
-static struct pool *first_hashmap_pool = NULL;
-static void *first_hashmap_tile = NULL;
-
-static struct pool *first_entry_pool = NULL;
-static void *first_entry_tile = NULL;
-
-static void* allocate_tile(struct pool **first_pool, void **first_tile, size_t tile_size) {
-        unsigned i;
-
-        /* When a tile is released we add it to the list and simply
-         * place the next pointer at its offset 0. */
-
-        assert(tile_size >= sizeof(void*));
-
-        if (*first_tile) {
-                void *r;
-
-                r = *first_tile;
-                *first_tile = * (void**) (*first_tile);
-                return r;
-        }
-
-        if (_unlikely_(!*first_pool) || _unlikely_((*first_pool)->n_used >= (*first_pool)->n_tiles)) {
-                unsigned n;
-                size_t size;
-                struct pool *p;
-
-                n = *first_pool ? (*first_pool)->n_tiles : 0;
-                n = MAX(512U, n * 2);
-                size = PAGE_ALIGN(ALIGN(sizeof(struct pool)) + n*tile_size);
-                n = (unsigned)((size - ALIGN(sizeof(struct pool))) / tile_size);
-
-                p = malloc0(size);
-                if (!p)
-                        return NULL;
-
-                p->next = *first_pool;
-                p->n_tiles = n;
-                p->n_used = 0;
-
-                *first_pool = p;
-        }
-
-        i = (*first_pool)->n_used++;
-
-        return ((uint8_t*) (*first_pool)) + ALIGN(sizeof(struct pool)) + i*tile_size;
-}
-
-static void deallocate_tile(void **first_tile, void *p) {
-        * (void**) p = *first_tile;
-        *first_tile = p;
-}
-
-#ifdef VALGRIND
-
-static void drop_pool(struct pool *p) {
-        while (p) {
-                struct pool *n;
-                n = p->next;
-                free(p);
-                p = n;
-        }
-}
-
-__attribute__((destructor)) static void cleanup_pool(void) {
-        /* Be nice to valgrind */
-
-        drop_pool(first_hashmap_pool);
-        drop_pool(first_entry_pool);
-}
-
-#endif
+/* Entry array size for a bucket count, keeping the load at most 1/2 */
+#define ENTRIES_FOR_BUCKETS(n) ((n) / 2)
 
 unsigned string_hash_func(const void *p) {
         unsigned hash = 5381;
@@ -175,26 +127,37 @@ int uint64_compare_func(const void *_a, const void *_b) {
         return a < b ? -1 : (a > b ? 1 : 0);
 }
 
+static inline unsigned hash_key(Hashmap *h, const void *key) {
+
+        /* The hash functions above leave the low bits poorly
+         * distributed (pointers are aligned, integers sequential), so
+         * spread them with a Fibonacci multiply. The top bits of the
+         * result pick the home bucket. */
+
+        return h->hash_func(key) * 2654435769U;
+}
+
+static inline unsigned home_bucket(Hashmap *h, unsigned hash) {
+        return hash >> h->shift;
+}
+
+static inline unsigned probe_distance(Hashmap *h, unsigned hash, unsigned bucket) {
+        return (bucket - home_bucket(h, hash)) & (h->n_buckets - 1);
+}
+
 Hashmap *hashmap_new(hash_func_t hash_func, compare_func_t compare_func) {
         Hashmap *h;
-        size_t size;
 
-        size = ALIGN(sizeof(Hashmap)) + INITIAL_N_BUCKETS * sizeof(struct hashmap_entry*);
+        /* The tables are only allocated on the first insertion, a lot
+         * of hashmaps stay empty */
 
-        h = allocate_tile(&first_hashmap_pool, &first_hashmap_tile, size);
+        h = new0(Hashmap, 1);
         if (!h)
                 return NULL;
 
         h->hash_func = hash_func ? hash_func : trivial_hash_func;
         h->compare_func = compare_func ? compare_func : trivial_compare_func;
 
-        h->n_buckets = INITIAL_N_BUCKETS;
-        h->n_entries = 0;
-        h->iterate_list_head = h->iterate_list_tail = NULL;
-
-	h->buckets = (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap)));
-        h->from_pool = true;
-
         return h;
 }
 
@@ -213,75 +176,199 @@ int hashmap_ensure_allocated(Hashmap **h, hash_func_t hash_func, compare_func_t
         return 0;
 }
 
-static void link_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
-        assert(h);
-        assert(e);
-
-        /* Insert into hash table */
-        e->bucket_next = h->buckets[hash];
-        e->bucket_previous = NULL;
-        if (h->buckets[hash])
-                h->buckets[hash]->bucket_previous = e;
-        h->buckets[hash] = e;
-
-        /* Insert into iteration list */
-        e->iterate_previous = h->iterate_list_tail;
-        e->iterate_next = NULL;
-        if (h->iterate_list_tail) {
-                assert(h->iterate_list_head);
-                h->iterate_list_tail->iterate_next = e;
-        } else {
-                assert(!h->iterate_list_head);
-                h->iterate_list_head = e;
+/* Returns the bucket holding key, or -1 */
+static int find_bucket(Hashmap *h, unsigned hash, const void *key) {
+        unsigned mask, i, distance;
+
+        if (h->n_entries == 0)
+                return -1;
+
+        mask = h->n_buckets - 1;
+        for (i = home_bucket(h, hash), distance = 0;; i = (i + 1) & mask, distance++) {
+                struct hashmap_bucket *b = &h->buckets[i];
+
+                if (b->entry == BUCKET_EMPTY)
+                        return -1;
+
+                /* Robin Hood invariant: key would have displaced this
+                 * bucket if it was present */
+                if (probe_distance(h, b->hash, i) < distance)
+                        return -1;
+
+                if (b->hash == hash &&
+                    h->compare_func(h->entries[b->entry].key, key) == 0)
+                        return (int) i;
         }
-        h->iterate_list_tail = e;
+}
 
-        h->n_entries++;
-        assert(h->n_entries >= 1);
+static struct hashmap_entry *find_entry(Hashmap *h, const void *key) {
+        int b;
+
+        b = find_bucket(h, hash_key(h, key), key);
+        if (b < 0)
+                return NULL;
+
+        return &h->entries[h->buckets[b].entry];
 }
 
-static void unlink_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
-        assert(h);
-        assert(e);
+static void link_bucket(Hashmap *h, unsigned hash, uint32_t entry) {
+        struct hashmap_bucket b = { hash, entry };
+        unsigned mask, i, distance;
+
+        mask = h->n_buckets - 1;
+        for (i = home_bucket(h, hash), distance = 0;; i = (i + 1) & mask, distance++) {
+                struct hashmap_bucket *c = &h->buckets[i];
+                unsigned d;
 
-        /* Remove from iteration list */
-        if (e->iterate_next)
-                e->iterate_next->iterate_previous = e->iterate_previous;
-        else
-                h->iterate_list_tail = e->iterate_previous;
+                if (c->entry == BUCKET_EMPTY) {
+                        *c = b;
+                        return;
+                }
 
-        if (e->iterate_previous)
-                e->iterate_previous->iterate_next = e->iterate_next;
-        else
-                h->iterate_list_head = e->iterate_next;
+                /* steal from the rich: displace entries closer to
+                 * their home bucket than we are */
+                d = probe_distance(h, c->hash, i);
+                if (d < distance) {
+                        struct hashmap_bucket t = *c;
 
-        /* Remove from hash table bucket list */
-        if (e->bucket_next)
-                e->bucket_next->bucket_previous = e->bucket_previous;
+                        *c = b;
+                        b = t;
+                        distance = d;
+                }
+        }
+}
 
-        if (e->bucket_previous)
-                e->bucket_previous->bucket_next = e->bucket_next;
-        else
-                h->buckets[hash] = e->bucket_next;
+static void unlink_bucket(Hashmap *h, unsigned i) {
+        unsigned mask, next;
+
+        /* Backward shift deletion, no tombstones */
+
+        mask = h->n_buckets - 1;
+        for (;;) {
+                next = (i + 1) & mask;
+                if (h->buckets[next].entry == BUCKET_EMPTY ||
+                    probe_distance(h, h->buckets[next].hash, next) == 0)
+                        break;
+
+                h->buckets[i] = h->buckets[next];
+                i = next;
+        }
+
+        h->buckets[i].entry = BUCKET_EMPTY;
+}
+
+static void reindex(Hashmap *h) {
+        unsigned i;
+
+        for (i = 0; i < h->n_buckets; i++)
+                h->buckets[i].entry = BUCKET_EMPTY;
+
+        for (i = 0; i < h->n_used; i++)
+                if (h->entries[i].live)
+                        link_bucket(h, h->entries[i].hash, i);
+}
+
+/* Squeeze the holes out of the entry array, keeping the order */
+static void compact(Hashmap *h) {
+        unsigned i, n = 0;
+
+        for (i = h->first; i < h->n_used; i++)
+                if (h->entries[i].live)
+                        h->entries[n++] = h->entries[i];
+
+        h->n_used = n;
+        h->first = 0;
+}
+
+/* Make room for one more entry at the end of the entry array */
+static int reserve_entry(Hashmap *h) {
+        struct hashmap_bucket *buckets;
+        struct hashmap_entry *entries;
+        unsigned n;
+
+        if (h->n_used < ENTRIES_FOR_BUCKETS(h->n_buckets))
+                return 0;
+
+        /* Mostly holes, reclaim them rather than growing */
+        if (h->n_buckets > 0 && h->n_entries < ENTRIES_FOR_BUCKETS(h->n_buckets) / 2) {
+                compact(h);
+                reindex(h);
+                return 0;
+        }
+
+        n = h->n_buckets > 0 ? h->n_buckets * 2 : INITIAL_N_BUCKETS;
+        if (ENTRIES_FOR_BUCKETS(n) >= BUCKET_EMPTY)
+                return -ENOMEM;
+
+        buckets = new(struct hashmap_bucket, n);
+        if (!buckets)
+                return -ENOMEM;
+
+        entries = realloc(h->entries, ENTRIES_FOR_BUCKETS(n) * sizeof(struct hashmap_entry));
+        if (!entries) {
+                free(buckets);
+                return -ENOMEM;
+        }
+
+        free(h->buckets);
+        h->buckets = buckets;
+        h->entries = entries;
+        h->n_buckets = n;
+        h->shift = 32 - (unsigned) __builtin_ctz(n);
+
+        compact(h);
+        reindex(h);
+
+        return 0;
+}
+
+static void remove_entry(Hashmap *h, unsigned bucket) {
+        struct hashmap_entry *e;
+
+        assert(h);
+
+        e = &h->entries[h->buckets[bucket].entry];
+        unlink_bucket(h, bucket);
+
+        e->live = false;
+        e->key = NULL;
+        e->value = NULL;
 
         assert(h->n_entries >= 1);
         h->n_entries--;
+
+        /* trim the holes at the end, so appending reuses them */
+        while (h->n_used > 0 && !h->entries[h->n_used - 1].live)
+                h->n_used--;
+        if (h->first > h->n_used)
+                h->first = h->n_used;
 }
 
-static void remove_entry(Hashmap *h, struct hashmap_entry *e) {
-        unsigned hash;
+static struct hashmap_entry *first_entry(Hashmap *h) {
+        if (!h || h->n_entries == 0)
+                return NULL;
 
-        assert(h);
-        assert(e);
+        while (!h->entries[h->first].live)
+                h->first++;
 
-        hash = h->hash_func(e->key) % h->n_buckets;
+        return &h->entries[h->first];
+}
 
-        unlink_entry(h, e, hash);
+static struct hashmap_entry *last_entry(Hashmap *h) {
+        if (!h || h->n_entries == 0)
+                return NULL;
 
-        if (h->from_pool)
-                deallocate_tile(&first_entry_tile, e);
-        else
-                free(e);
+        /* holes are never left at the end */
+        return &h->entries[h->n_used - 1];
+}
+
+static unsigned entry_bucket(Hashmap *h, struct hashmap_entry *e) {
+        int b;
+
+        b = find_bucket(h, e->hash, e->key);
+        assert(b >= 0);
+
+        return (unsigned) b;
 }
 
 void hashmap_free(Hashmap*h) {
@@ -291,15 +378,9 @@ void hashmap_free(Hashmap*h) {
         if (!h)
                 return;
 
-        hashmap_clear(h);
-
-        if (h->buckets != (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap))))
-                free(h->buckets);
-
-        if (h->from_pool)
-                deallocate_tile(&first_hashmap_tile, h);
-        else
-                free(h);
+        free(h->buckets);
+        free(h->entries);
+        free(h);
 }
 
 void hashmap_free_free(Hashmap *h) {
@@ -326,142 +407,86 @@ void hashmap_free_free_free(Hashmap *h) {
 }
 
 void hashmap_clear(Hashmap *h) {
+        unsigned i;
+
         if (!h)
                 return;
 
-        while (h->iterate_list_head)
-                remove_entry(h, h->iterate_list_head);
+        for (i = 0; i < h->n_buckets; i++)
+                h->buckets[i].entry = BUCKET_EMPTY;
+
+        h->n_entries = 0;
+        h->n_used = 0;
+        h->first = 0;
 }
 
 void hashmap_clear_free(Hashmap *h) {
-        void *p;
+        unsigned i;
 
         if (!h)
                 return;
 
-        while ((p = hashmap_steal_first(h)))
-                free(p);
+        for (i = h->first; i < h->n_used; i++)
+                if (h->entries[i].live)
+                        free(h->entries[i].value);
+
+        hashmap_clear(h);
 }
 
 void hashmap_clear_free_free(Hashmap *h) {
+        unsigned i;
+
         if (!h)
                 return;
 
-        while (h->iterate_list_head) {
-                void *a, *b;
+        for (i = h->first; i < h->n_used; i++)
+                if (h->entries[i].live) {
+                        free(h->entries[i].value);
+                        free((void*) h->entries[i].key);
+                }
 
-                a = h->iterate_list_head->value;
-                b = (void*) h->iterate_list_head->key;
-                remove_entry(h, h->iterate_list_head);
-                free(a);
-                free(b);
-        }
-}
-
-
-static struct hashmap_entry *hash_scan(Hashmap *h, unsigned hash, const void *key) {
-        struct hashmap_entry *e;
-        assert(h);
-        assert(hash < h->n_buckets);
-
-        for (e = h->buckets[hash]; e; e = e->bucket_next)
-                if (h->compare_func(e->key, key) == 0)
-                        return e;
-
-        return NULL;
-}
-
-static bool resize_buckets(Hashmap *h) {
-        unsigned m;
-        struct hashmap_entry **n, *i;
-
-        assert(h);
-
-        if (_likely_(h->n_entries*4 < h->n_buckets*3))
-                return false;
-
-        /* Increase by four */
-        m = (h->n_entries+1)*4-1;
-
-        /* If we hit OOM we simply risk packed hashmaps... */
-        n = new0(struct hashmap_entry*, m);
-        if (!n)
-                return false;
-
-        for (i = h->iterate_list_head; i; i = i->iterate_next) {
-                unsigned hash, x;
-
-                hash = h->hash_func(i->key);
-
-                /* First, drop from old bucket table */
-                if (i->bucket_next)
-                        i->bucket_next->bucket_previous = i->bucket_previous;
-
-                if (i->bucket_previous)
-                        i->bucket_previous->bucket_next = i->bucket_next;
-                else
-                        h->buckets[hash % h->n_buckets] = i->bucket_next;
-
-                /* Then, add to new backet table */
-                x = hash % m;
-
-                i->bucket_next = n[x];
-                i->bucket_previous = NULL;
-                if (n[x])
-                        n[x]->bucket_previous = i;
-                n[x] = i;
-        }
-
-        if (h->buckets != (struct hashmap_entry**) ((uint8_t*) h + ALIGN(sizeof(Hashmap))))
-                free(h->buckets);
-
-        h->buckets = n;
-        h->n_buckets = m;
-
-        return true;
+        hashmap_clear(h);
 }
 
 int hashmap_put(Hashmap *h, const void *key, void *value) {
         struct hashmap_entry *e;
         unsigned hash;
+        int r;
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
-        if (e) {
-                if (e->value == value)
+        hash = hash_key(h, key);
+        r = find_bucket(h, hash, key);
+        if (r >= 0) {
+                if (h->entries[h->buckets[r].entry].value == value)
                         return 0;
                 return -EEXIST;
         }
 
-        if (resize_buckets(h))
-                hash = h->hash_func(key) % h->n_buckets;
-
-        if (h->from_pool)
-                e = allocate_tile(&first_entry_pool, &first_entry_tile, sizeof(struct hashmap_entry));
-        else
-                e = new(struct hashmap_entry, 1);
-
-        if (!e)
-                return -ENOMEM;
+        r = reserve_entry(h);
+        if (r < 0)
+                return r;
 
+        e = &h->entries[h->n_used];
         e->key = key;
         e->value = value;
+        e->hash = hash;
+        e->live = true;
+
+        link_bucket(h, hash, h->n_used);
 
-        link_entry(h, e, hash);
+        h->n_used++;
+        h->n_entries++;
 
         return 1;
 }
 
 int hashmap_replace(Hashmap *h, const void *key, void *value) {
         struct hashmap_entry *e;
-        unsigned hash;
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (e) {
                 e->key = key;
                 e->value = value;
@@ -473,12 +498,10 @@ int hashmap_replace(Hashmap *h, const void *key, void *value) {
 
 int hashmap_update(Hashmap *h, const void *key, void *value) {
         struct hashmap_entry *e;
-        unsigned hash;
 
         assert(h);
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (!e)
                 return -ENOENT;
 
@@ -487,14 +510,12 @@ int hashmap_update(Hashmap *h, const void *key, void *value) {
 }
 
 void* hashmap_get(Hashmap *h, const void *key) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (!e)
                 return NULL;
 
@@ -502,14 +523,12 @@ void* hashmap_get(Hashmap *h, const void *key) {
 }
 
 void* hashmap_get2(Hashmap *h, const void *key, void **key2) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (!e)
                 return NULL;
 
@@ -520,133 +539,126 @@ void* hashmap_get2(Hashmap *h, const void *key, void **key2) {
 }
 
 bool hashmap_contains(Hashmap *h, const void *key) {
-        unsigned hash;
 
         if (!h)
                 return false;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!hash_scan(h, hash, key))
-                return false;
-
-        return true;
+        return find_entry(h, key) != NULL;
 }
 
 void* hashmap_remove(Hashmap *h, const void *key) {
+        return hashmap_remove2(h, key, NULL);
+}
+
+void* hashmap_remove2(Hashmap *h, const void *key, void **remkey) {
         struct hashmap_entry *e;
-        unsigned hash;
         void *data;
+        int b;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!(e = hash_scan(h, hash, key)))
+        b = find_bucket(h, hash_key(h, key), key);
+        if (b < 0)
                 return NULL;
 
+        e = &h->entries[h->buckets[b].entry];
         data = e->value;
-        remove_entry(h, e);
+        if (remkey)
+                *remkey = (void*) e->key;
+        remove_entry(h, (unsigned) b);
 
         return data;
 }
 
-void* hashmap_remove2(Hashmap *h, const void *key, void **remkey) {
+/* Give an entry a new key, keeping its place in the iteration order */
+static void rekey_entry(Hashmap *h, unsigned bucket, unsigned new_hash, const void *new_key, void *value) {
         struct hashmap_entry *e;
-        unsigned hash;
-        void *data;
-
-        if (!h)
-                return NULL;
+        uint32_t entry;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        if (!(e = hash_scan(h, hash, key)))
-                return NULL;
+        entry = h->buckets[bucket].entry;
+        unlink_bucket(h, bucket);
 
-        data = e->value;
-	if (remkey)
-		*remkey = (void*)e->key;
-        remove_entry(h, e);
+        e = &h->entries[entry];
+        e->key = new_key;
+        e->value = value;
+        e->hash = new_hash;
 
-        return data;
+        link_bucket(h, new_hash, entry);
 }
 
 int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key, void *value) {
-        struct hashmap_entry *e;
-        unsigned old_hash, new_hash;
+        unsigned new_hash;
+        int b;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % h->n_buckets;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        b = find_bucket(h, hash_key(h, old_key), old_key);
+        if (b < 0)
                 return -ENOENT;
 
-        new_hash = h->hash_func(new_key) % h->n_buckets;
-        if (hash_scan(h, new_hash, new_key))
+        new_hash = hash_key(h, new_key);
+        if (find_bucket(h, new_hash, new_key) >= 0)
                 return -EEXIST;
 
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
+        rekey_entry(h, (unsigned) b, new_hash, new_key, value);
 
         return 0;
 }
 
 int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_key, void *value) {
-        struct hashmap_entry *e, *k;
-        unsigned old_hash, new_hash;
+        struct hashmap_entry *e;
+        unsigned new_hash;
+        int b, k;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % h->n_buckets;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        b = find_bucket(h, hash_key(h, old_key), old_key);
+        if (b < 0)
                 return -ENOENT;
+        e = &h->entries[h->buckets[b].entry];
+
+        new_hash = hash_key(h, new_key);
+        k = find_bucket(h, new_hash, new_key);
+        if (k >= 0 && k != b) {
+                remove_entry(h, (unsigned) k);
+                /* the removal may have shifted our bucket */
+                b = (int) entry_bucket(h, e);
+        }
 
-        new_hash = h->hash_func(new_key) % h->n_buckets;
-        if ((k = hash_scan(h, new_hash, new_key)))
-                if (e != k)
-                        remove_entry(h, k);
-
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
+        rekey_entry(h, (unsigned) b, new_hash, new_key, value);
 
         return 0;
 }
 
 void* hashmap_remove_value(Hashmap *h, const void *key, void *value) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        int b;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        e = hash_scan(h, hash, key);
-        if (!e)
+        b = find_bucket(h, hash_key(h, key), key);
+        if (b < 0)
                 return NULL;
 
-        if (e->value != value)
+        if (h->entries[h->buckets[b].entry].value != value)
                 return NULL;
 
-        remove_entry(h, e);
+        remove_entry(h, (unsigned) b);
 
         return value;
 }
 
+/* Iterators hold the position of the next entry to return, plus one so
+ * that position 0 differs from ITERATOR_FIRST */
+#define ITERATOR_TO_POS(i) ((unsigned) ((uintptr_t) (i) - 1))
+#define POS_TO_ITERATOR(p) ((Iterator) ((uintptr_t) (p) + 1))
+
 void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         struct hashmap_entry *e;
+        unsigned pos;
 
         assert(i);
 
@@ -656,15 +668,16 @@ void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_LAST)
                 goto at_end;
 
-        if (*i == ITERATOR_FIRST && !h->iterate_list_head)
-                goto at_end;
+        pos = *i == ITERATOR_FIRST ? h->first : ITERATOR_TO_POS(*i);
+
+        while (pos < h->n_used && !h->entries[pos].live)
+                pos++;
 
-        e = *i == ITERATOR_FIRST ? h->iterate_list_head : (struct hashmap_entry*) *i;
+        if (pos >= h->n_used)
+                goto at_end;
 
-        if (e->iterate_next)
-                *i = (Iterator) e->iterate_next;
-        else
-                *i = ITERATOR_LAST;
+        e = &h->entries[pos];
+        *i = POS_TO_ITERATOR(pos + 1);
 
         if (key)
                 *key = e->key;
@@ -682,6 +695,7 @@ at_end:
 
 void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key) {
         struct hashmap_entry *e;
+        unsigned pos;
 
         assert(i);
 
@@ -691,15 +705,20 @@ void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_FIRST)
                 goto at_beginning;
 
-        if (*i == ITERATOR_LAST && !h->iterate_list_tail)
-                goto at_beginning;
+        /* backwards, the iterator holds the position of the last entry
+         * returned, and ITERATOR_LAST starts past the end */
+        pos = *i == ITERATOR_LAST ? h->n_used : ITERATOR_TO_POS(*i);
+        if (pos > h->n_used)
+                pos = h->n_used;
 
-        e = *i == ITERATOR_LAST ? h->iterate_list_tail : (struct hashmap_entry*) *i;
+        do {
+                if (pos <= h->first)
+                        goto at_beginning;
+                pos--;
+        } while (!h->entries[pos].live);
 
-        if (e->iterate_previous)
-                *i = (Iterator) e->iterate_previous;
-        else
-                *i = ITERATOR_FIRST;
+        e = &h->entries[pos];
+        *i = POS_TO_ITERATOR(pos);
 
         if (key)
                 *key = e->key;
@@ -716,82 +735,74 @@ at_beginning:
 }
 
 void *hashmap_iterate_skip(Hashmap *h, const void *key, Iterator *i) {
-        unsigned hash;
         struct hashmap_entry *e;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (!e)
                 return NULL;
 
-        *i = (Iterator) e;
+        *i = POS_TO_ITERATOR(e - h->entries);
 
         return e->value;
 }
 
 void* hashmap_first(Hashmap *h) {
+        struct hashmap_entry *e;
 
-        if (!h)
-                return NULL;
-
-        if (!h->iterate_list_head)
+        e = first_entry(h);
+        if (!e)
                 return NULL;
 
-        return h->iterate_list_head->value;
+        return e->value;
 }
 
 void* hashmap_first_key(Hashmap *h) {
+        struct hashmap_entry *e;
 
-        if (!h)
-                return NULL;
-
-        if (!h->iterate_list_head)
+        e = first_entry(h);
+        if (!e)
                 return NULL;
 
-        return (void*) h->iterate_list_head->key;
+        return (void*) e->key;
 }
 
 void* hashmap_last(Hashmap *h) {
+        struct hashmap_entry *e;
 
-        if (!h)
-                return NULL;
-
-        if (!h->iterate_list_tail)
+        e = last_entry(h);
+        if (!e)
                 return NULL;
 
-        return h->iterate_list_tail->value;
+        return e->value;
 }
 
 void* hashmap_steal_first(Hashmap *h) {
+        struct hashmap_entry *e;
         void *data;
 
-        if (!h)
-                return NULL;
-
-        if (!h->iterate_list_head)
+        e = first_entry(h);
+        if (!e)
                 return NULL;
 
-        data = h->iterate_list_head->value;
-        remove_entry(h, h->iterate_list_head);
+        data = e->value;
+        remove_entry(h, entry_bucket(h, e));
 
         return data;
 }
 
 void* hashmap_steal_first_key(Hashmap *h) {
+        struct hashmap_entry *e;
         void *key;
 
-        if (!h)
-                return NULL;
-
-        if (!h->iterate_list_head)
+        e = first_entry(h);
+        if (!e)
                 return NULL;
 
-        key = (void*) h->iterate_list_head->key;
-        remove_entry(h, h->iterate_list_head);
+        key = (void*) e->key;
+        remove_entry(h, entry_bucket(h, e));
 
         return key;
 }
@@ -821,17 +832,20 @@ bool hashmap_isempty(Hashmap *h) {
 }
 
 int hashmap_merge(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e;
+        unsigned i;
 
         assert(h);
 
         if (!other)
                 return 0;
 
-        for (e = other->iterate_list_head; e; e = e->iterate_next) {
+        for (i = other->first; i < other->n_used; i++) {
                 int r;
 
-                if ((r = hashmap_put(h, e->key, e->value)) < 0)
+                if (!other->entries[i].live)
+                        continue;
+
+                if ((r = hashmap_put(h, other->entries[i].key, other->entries[i].value)) < 0)
                         if (r != -EEXIST)
                                 return r;
         }
@@ -840,53 +854,51 @@ int hashmap_merge(Hashmap *h, Hashmap *other) {
 }
 
 void hashmap_move(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e, *n;
+        unsigned i;
 
         assert(h);
 
         /* The same as hashmap_merge(), but every new item from other
-         * is moved to h. This function is guaranteed to succeed. */
+         * is moved to h. Items that can't be added to h stay in
+         * other. */
 
         if (!other)
                 return;
 
-        for (e = other->iterate_list_head; e; e = n) {
-                unsigned h_hash, other_hash;
-
-                n = e->iterate_next;
+        for (i = other->first; i < other->n_used; i++) {
+                struct hashmap_entry *e = &other->entries[i];
 
-                h_hash = h->hash_func(e->key) % h->n_buckets;
-
-                if (hash_scan(h, h_hash, e->key))
+                if (!e->live)
                         continue;
 
-                other_hash = other->hash_func(e->key) % other->n_buckets;
+                if (hashmap_put(h, e->key, e->value) <= 0)
+                        continue;
 
-                unlink_entry(other, e, other_hash);
-                link_entry(h, e, h_hash);
+                remove_entry(other, entry_bucket(other, e));
         }
 }
 
 int hashmap_move_one(Hashmap *h, Hashmap *other, const void *key) {
-        unsigned h_hash, other_hash;
         struct hashmap_entry *e;
+        int r;
 
         if (!other)
                 return 0;
 
         assert(h);
 
-        h_hash = h->hash_func(key) % h->n_buckets;
-        if (hash_scan(h, h_hash, key))
+        if (hashmap_contains(h, key))
                 return -EEXIST;
 
-        other_hash = other->hash_func(key) % other->n_buckets;
-        e = hash_scan(other, other_hash, key);
+        e = find_entry(other, key);
         if (!e)
                 return -ENOENT;
 
-        unlink_entry(other, e, other_hash);
-        link_entry(h, e, h_hash);
+        r = hashmap_put(h, e->key, e->value);
+        if (r < 0)
+                return r;
+
+        remove_entry(other, entry_bucket(other, e));
 
         return 0;
 }
@@ -927,8 +939,8 @@ char **hashmap_get_strv(Hashmap *h) {
 }
 
 void *hashmap_next(Hashmap *h, const void *key) {
-        unsigned hash;
         struct hashmap_entry *e;
+        unsigned pos;
 
         assert(h);
         assert(key);
@@ -936,14 +948,13 @@ void *hashmap_next(Hashmap *h, const void *key) {
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % h->n_buckets;
-        e = hash_scan(h, hash, key);
+        e = find_entry(h, key);
         if (!e)
                 return NULL;
 
-        e = e->iterate_next;
-        if (!e)
-                return NULL;
+        for (pos = (unsigned) (e - h->entries) + 1; pos < h->n_used; pos++)
+                if (h->entries[pos].live)
+                        return h->entries[pos].value;
 
-        return e->value;
+        return NULL;
 }
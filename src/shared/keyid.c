@@ -0,0 +1,295 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "hashmap.h"
+#include "keyid.h"
+#include "util.h"
+
+struct BuxtonKeyTable {
+	Hashmap *ids; /**<Interned BuxtonKeyIds, mapped to themselves */
+	uint64_t next_id; /**<Number of the next interned identity */
+	pthread_mutex_t lock; /**<Guards ids, next_id and the reference counts */
+};
+
+static void table_lock(BuxtonKeyTable *table)
+{
+	if (pthread_mutex_lock(&table->lock)) {
+		abort();
+	}
+}
+
+static void table_unlock(BuxtonKeyTable *table)
+{
+	if (pthread_mutex_unlock(&table->lock)) {
+		abort();
+	}
+}
+
+static uint32_t hash_strings(BuxtonString *group, BuxtonString *name)
+{
+	uint32_t hash = 5381;
+
+	/* DJB's hash function, over the group then the name */
+	for (uint32_t i = 0; i < group->length; i++) {
+		hash = (hash << 5) + hash + (uint8_t)group->value[i];
+	}
+	if (name->value) {
+		for (uint32_t i = 0; i < name->length; i++) {
+			hash = (hash << 5) + hash + (uint8_t)name->value[i];
+		}
+	}
+
+	return hash;
+}
+
+uint32_t buxton_key_hash(_BuxtonKey *key)
+{
+	assert(key);
+
+	return hash_strings(&key->group, &key->name);
+}
+
+unsigned buxton_key_id_hash_func(const void *p)
+{
+	const BuxtonKeyId *id = p;
+
+	return id->hash;
+}
+
+static int key_id_compare_func(const void *a, const void *b)
+{
+	const BuxtonKeyId *x = a;
+	const BuxtonKeyId *y = b;
+
+	if (x->hash != y->hash || x->group.length != y->group.length ||
+	    !x->name.value != !y->name.value ||
+	    x->name.length != y->name.length) {
+		return 1;
+	}
+	if (memcmp(x->group.value, y->group.value, x->group.length) != 0) {
+		return 1;
+	}
+	if (x->name.length &&
+	    memcmp(x->name.value, y->name.value, x->name.length) != 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+BuxtonKeyTable *buxton_key_table_new(void)
+{
+	BuxtonKeyTable *table;
+
+	table = malloc0(sizeof(BuxtonKeyTable));
+	if (!table) {
+		return NULL;
+	}
+	table->ids = hashmap_new(buxton_key_id_hash_func, key_id_compare_func);
+	if (!table->ids) {
+		free(table);
+		return NULL;
+	}
+	pthread_mutex_init(&table->lock, NULL);
+
+	return table;
+}
+
+static void key_id_free(BuxtonKeyId *id)
+{
+	buxton_alloc_release(BUXTON_ALLOC_KEYS, id);
+	free(id);
+}
+
+void buxton_key_table_free(BuxtonKeyTable *table)
+{
+	BuxtonKeyId *id;
+
+	if (!table) {
+		return;
+	}
+	while ((id = hashmap_steal_first(table->ids))) {
+		key_id_free(id);
+	}
+	hashmap_free(table->ids);
+	pthread_mutex_destroy(&table->lock);
+	free(table);
+}
+
+/*
+ * The group, the name and the path are stored after the header, in a
+ * single allocation
+ */
+static BuxtonKeyId *key_id_new(BuxtonKeyTable *table, BuxtonKeyId *lookup,
+			       BuxtonKeyId *parent)
+{
+	BuxtonKeyId *id;
+	uint32_t size;
+	size_t path_size = 0;
+
+	size = lookup->group.length + lookup->name.length;
+	if (lookup->name.value) {
+		path_size = strlen(lookup->group.value) +
+			strlen(lookup->name.value) + 2;
+	}
+
+	id = malloc0(sizeof(BuxtonKeyId) + size + path_size);
+	if (!id) {
+		abort();
+	}
+	buxton_alloc_hold(BUXTON_ALLOC_KEYS, id);
+	id->table = table;
+	id->parent = parent;
+	id->id = table->next_id++;
+	id->hash = lookup->hash;
+	id->refs = 1;
+	id->size = size;
+
+	memcpy(id->data, lookup->group.value, lookup->group.length);
+	id->group.value = id->data;
+	id->group.length = lookup->group.length;
+	if (lookup->name.value) {
+		memcpy(id->data + id->group.length, lookup->name.value,
+		       lookup->name.length);
+		id->name.value = id->data + id->group.length;
+		id->name.length = lookup->name.length;
+
+		id->path = id->data + size;
+		strcpy(id->path, lookup->group.value);
+		strcat(id->path, "\n");
+		strcat(id->path, lookup->name.value);
+	}
+
+	return id;
+}
+
+static BuxtonKeyId *intern_locked(BuxtonKeyTable *table, BuxtonKeyId *lookup)
+{
+	BuxtonKeyId *id;
+	BuxtonKeyId group;
+	BuxtonKeyId *parent = NULL;
+
+	id = hashmap_get(table->ids, lookup);
+	if (id) {
+		id->refs++;
+		return id;
+	}
+
+	/* Keys hold a reference to their group */
+	if (lookup->name.value) {
+		memzero(&group, sizeof(BuxtonKeyId));
+		group.group = lookup->group;
+		group.hash = hash_strings(&group.group, &group.name);
+		parent = intern_locked(table, &group);
+	}
+
+	id = key_id_new(table, lookup, parent);
+	if (hashmap_put(table->ids, id, id) < 0) {
+		abort();
+	}
+
+	return id;
+}
+
+BuxtonKeyId *buxton_key_intern(BuxtonKeyTable *table, _BuxtonKey *key)
+{
+	BuxtonKeyId lookup;
+	BuxtonKeyId *id;
+
+	assert(table);
+	assert(key);
+
+	if (!key->group.value) {
+		return NULL;
+	}
+
+	memzero(&lookup, sizeof(BuxtonKeyId));
+	lookup.group = key->group;
+	if (key->name.value) {
+		lookup.name = key->name;
+	}
+	lookup.hash = hash_strings(&lookup.group, &lookup.name);
+
+	table_lock(table);
+	id = intern_locked(table, &lookup);
+	table_unlock(table);
+
+	return id;
+}
+
+BuxtonKeyId *buxton_key_id_ref(BuxtonKeyId *id)
+{
+	assert(id);
+
+	table_lock(id->table);
+	id->refs++;
+	table_unlock(id->table);
+
+	return id;
+}
+
+void buxton_key_id_unref(BuxtonKeyId *id)
+{
+	BuxtonKeyTable *table;
+	BuxtonKeyId *parent;
+
+	while (id) {
+		table = id->table;
+		table_lock(table);
+		if (--id->refs) {
+			table_unlock(table);
+			return;
+		}
+		(void)hashmap_remove(table->ids, id);
+		table_unlock(table);
+
+		/* The group goes once its last key does */
+		parent = id->parent;
+		key_id_free(id);
+		id = parent;
+	}
+}
+
+uint32_t buxton_key_table_size(BuxtonKeyTable *table)
+{
+	uint32_t size;
+
+	assert(table);
+
+	table_lock(table);
+	size = hashmap_size(table->ids);
+	table_unlock(table);
+
+	return size;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
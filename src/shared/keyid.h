@@ -0,0 +1,128 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file keyid.h Internal header
+ * This file is used internally by buxton to intern key identities
+ *
+ * buxtond interns the group and name of every request once, when the
+ * request is parsed. The resulting BuxtonKeyId is attached to the
+ * _BuxtonKey, so the notification maps, the direct layer and the
+ * backends reuse its hash and its byte forms instead of deriving
+ * their own from the strings. Layers are not part of the identity:
+ * they are resolved against the configuration separately, and a key
+ * keeps its identity in every layer it is stored in.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include "buxtonkey.h"
+#include "buxtonstring.h"
+
+/**
+ * A table of interned key identities, safe to use from any thread
+ */
+typedef struct BuxtonKeyTable BuxtonKeyTable;
+
+/**
+ * The interned identity of a group, or of a key in a group. Two keys
+ * have the same BuxtonKeyId if and only if their group and name are
+ * equal, so identities can be compared and hashed by pointer.
+ */
+typedef struct BuxtonKeyId {
+	BuxtonKeyTable *table; /**<Table the identity is interned in */
+	struct BuxtonKeyId *parent; /**<Identity of the group of a key, NULL for a group */
+	uint64_t id; /**<Number of the identity, never reused by the table */
+	uint32_t hash; /**<buxton_key_hash() of the group and name */
+	uint32_t refs; /**<References held, guarded by the table */
+	BuxtonString group; /**<Group, pointing into data */
+	BuxtonString name; /**<Name pointing into data, {NULL, 0} for a group */
+	char *path; /**<"group\nname" form used by notifications */
+	uint32_t size; /**<Size of data */
+	char data[]; /**<Group then name with their NULs, as backends key them */
+} BuxtonKeyId;
+
+/**
+ * Hash the group and name of a key, the same way as BuxtonKeyId.hash
+ * @param key Key with a group, its layer and type are ignored
+ * @returns the hash of the key
+ */
+uint32_t buxton_key_hash(_BuxtonKey *key)
+	__attribute__((pure));
+
+/**
+ * Hashmap hash function of a BuxtonKeyId, using its precomputed hash
+ * @param p BuxtonKeyId to hash
+ * @returns the hash of the identity
+ */
+unsigned buxton_key_id_hash_func(const void *p)
+	__attribute__((pure));
+
+/**
+ * Create a new BuxtonKeyTable
+ * @returns BuxtonKeyTable a newly allocated table, NULL on failure
+ */
+BuxtonKeyTable *buxton_key_table_new(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a BuxtonKeyTable and the identities still interned in it
+ * @param table BuxtonKeyTable to free, may be NULL
+ */
+void buxton_key_table_free(BuxtonKeyTable *table);
+
+/**
+ * Intern the group and name of a key
+ * @param table Valid BuxtonKeyTable
+ * @param key Key to intern, its layer and type are ignored
+ * @returns a referenced BuxtonKeyId, NULL if key has no group
+ */
+BuxtonKeyId *buxton_key_intern(BuxtonKeyTable *table, _BuxtonKey *key)
+	__attribute__((warn_unused_result));
+
+/**
+ * Take a reference to an interned identity
+ * @param id Valid BuxtonKeyId
+ * @returns id
+ */
+BuxtonKeyId *buxton_key_id_ref(BuxtonKeyId *id);
+
+/**
+ * Drop a reference to an interned identity, which leaves the table
+ * with the last one
+ * @param id BuxtonKeyId to release, may be NULL
+ */
+void buxton_key_id_unref(BuxtonKeyId *id);
+
+/**
+ * Retrieve the number of identities interned in a BuxtonKeyTable
+ * @param table Valid BuxtonKeyTable
+ * @returns the number of interned identities
+ */
+uint32_t buxton_key_table_size(BuxtonKeyTable *table);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
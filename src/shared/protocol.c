@@ -135,10 +135,14 @@ void run_callback(BuxtonCallback callback, void *data, size_t count,
 		goto out;
 	}
 
-	for (int i = 0; i < count; i++)
+	if (!buxton_array_reserve(array, (uint32_t)count)) {
+		goto out;
+	}
+	for (size_t i = 0; i < count; i++) {
 		if (!buxton_array_add(array, &list[i])) {
 			goto out;
 		}
+	}
 
 	response.type = type;
 	response.data = array;
@@ -252,6 +256,7 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 			      BuxtonData *list, size_t count)
 {
 	struct notify_value *nv;
+	_BuxtonKey changed;
 
 	/* use notification callbacks for notification messages */
 	if (msg == BUXTON_CONTROL_CHANGED) {
@@ -264,13 +269,41 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 			return;
 		}
 
+		/* Prefix notifications name the changed key first */
+		if (nv->type == BUXTON_CONTROL_NOTIFY_PREFIX) {
+			if (count < 2 || list[0].type != BUXTON_TYPE_STRING ||
+			    list[1].type != BUXTON_TYPE_STRING) {
+				return;
+			}
+			memzero(&changed, sizeof(_BuxtonKey));
+			changed.group = list[0].store.d_string;
+			changed.name = list[1].store.d_string;
+			changed.type = count > 2 ? list[2].type : BUXTON_TYPE_UNSET;
+			if (count > 3 && list[3].type == BUXTON_TYPE_STRING) {
+				changed.layer = list[3].store.d_string;
+			}
+			(void)pthread_mutex_unlock(&callback_guard);
+			run_callback((BuxtonCallback)(nv->cb), nv->data,
+				     count > 2 ? 1 : 0, list + 2,
+				     BUXTON_CONTROL_CHANGED, &changed);
+			(void)pthread_mutex_lock(&callback_guard);
+			return;
+		}
+
+		/* The value is followed by the layer it is effective in */
+		changed = *nv->key;
+		if (count > 1 && list[1].type == BUXTON_TYPE_STRING) {
+			changed.layer = list[1].store.d_string;
+		}
+
 		/*
 		* unlocking mutex to be able to call other client api's
 		* in notification callbacks
 		*/
 		(void)pthread_mutex_unlock(&callback_guard);
-		run_callback((BuxtonCallback)(nv->cb), nv->data, count, list,
-			     BUXTON_CONTROL_CHANGED, nv->key);
+		run_callback((BuxtonCallback)(nv->cb), nv->data,
+			     count ? 1 : 0, list,
+			     BUXTON_CONTROL_CHANGED, &changed);
 		(void)pthread_mutex_lock(&callback_guard);
 		return;
 	}
@@ -284,7 +317,8 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 		return;
 	}
 
-	if (nv->type == BUXTON_CONTROL_NOTIFY) {
+	if (nv->type == BUXTON_CONTROL_NOTIFY ||
+	    nv->type == BUXTON_CONTROL_NOTIFY_PREFIX) {
 		if (list[0].type == BUXTON_TYPE_INT32 &&
 		    list[0].store.d_int32 == 0) {
 #if UINTPTR_MAX == 0xffffffffffffffff
@@ -296,7 +330,8 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 				return;
 			}
 		}
-	} else if (nv->type == BUXTON_CONTROL_UNNOTIFY) {
+	} else if (nv->type == BUXTON_CONTROL_UNNOTIFY ||
+		   nv->type == BUXTON_CONTROL_UNNOTIFY_PREFIX) {
 		if (list[0].type == BUXTON_TYPE_INT32 &&
 		    list[0].store.d_int32 == 0) {
 			(void)hashmap_remove(notify_callbacks,
@@ -429,54 +464,64 @@ int buxton_wire_get_response(_BuxtonClient *client)
 	return (int)processed;
 }
 
-bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
-			   const void *value, BuxtonCallback callback,
-			   void *data)
+/* Wrap a value of the type of key in d */
+static void value_to_data(_BuxtonKey *key, const void *value, BuxtonData *d)
 {
-	_cleanup_free_ uint8_t *send = NULL;
-	bool ret = false;
-	size_t send_len = 0;
-	BuxtonArray *list = NULL;
-	BuxtonData d_layer;
-	BuxtonData d_group;
-	BuxtonData d_name;
-	BuxtonData d_value;
-	uint32_t msgid = get_msgid();
-
-	buxton_string_to_data(&key->layer, &d_layer);
-	buxton_string_to_data(&key->group, &d_group);
-	buxton_string_to_data(&key->name, &d_name);
-	d_value.type = key->type;
+	d->type = key->type;
 	switch (key->type) {
 	case BUXTON_TYPE_STRING:
 		/* cast until BuxtonString is updated */
-		d_value.store.d_string.value = (char *)value;
-		d_value.store.d_string.length = (uint32_t)strlen((char *)value) + 1;
+		d->store.d_string.value = (char *)value;
+		d->store.d_string.length = (uint32_t)strlen((char *)value) + 1;
 		break;
 	case BUXTON_TYPE_INT32:
-		d_value.store.d_int32 = *(const int32_t *)value;
+		d->store.d_int32 = *(const int32_t *)value;
 		break;
 	case BUXTON_TYPE_INT64:
-		d_value.store.d_int64 = *(const int64_t *)value;
+		d->store.d_int64 = *(const int64_t *)value;
 		break;
 	case BUXTON_TYPE_UINT32:
-		d_value.store.d_uint32 = *(const uint32_t *)value;
+		d->store.d_uint32 = *(const uint32_t *)value;
 		break;
 	case BUXTON_TYPE_UINT64:
-		d_value.store.d_uint64 = *(const uint64_t *)value;
+		d->store.d_uint64 = *(const uint64_t *)value;
 		break;
 	case BUXTON_TYPE_FLOAT:
-		d_value.store.d_float = *(const float *)value;
+		d->store.d_float = *(const float *)value;
 		break;
 	case BUXTON_TYPE_DOUBLE:
-		memcpy(&d_value.store.d_double, value, sizeof(double));
+		memcpy(&d->store.d_double, value, sizeof(double));
 		break;
 	case BUXTON_TYPE_BOOLEAN:
-		d_value.store.d_boolean = *(const bool *)value;
+		d->store.d_boolean = *(const bool *)value;
 		break;
 	default:
 		break;
 	}
+}
+
+/* Sends a SET, or a CAS carrying version and expected if not NULL */
+static bool wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonControlMessage msg, const void *value,
+			   const void *expected, uint64_t version,
+			   BuxtonCallback callback, void *data)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	bool ret = false;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_layer;
+	BuxtonData d_group;
+	BuxtonData d_name;
+	BuxtonData d_value;
+	BuxtonData d_version;
+	BuxtonData d_expected;
+	uint32_t msgid = get_msgid();
+
+	buxton_string_to_data(&key->layer, &d_layer);
+	buxton_string_to_data(&key->group, &d_group);
+	buxton_string_to_data(&key->name, &d_name);
+	value_to_data(key, value, &d_value);
 
 	list = buxton_array_new();
 	if (!buxton_array_add(list, &d_layer)) {
@@ -495,8 +540,23 @@ bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
 		buxton_log("Failed to add value to set_value array\n");
 		goto end;
 	}
+	if (msg == BUXTON_CONTROL_CAS) {
+		d_version.type = BUXTON_TYPE_UINT64;
+		d_version.store.d_uint64 = version;
+		if (!buxton_array_add(list, &d_version)) {
+			buxton_log("Failed to add version to set_value array\n");
+			goto end;
+		}
+		if (expected) {
+			value_to_data(key, expected, &d_expected);
+			if (!buxton_array_add(list, &d_expected)) {
+				buxton_log("Failed to add expected value to set_value array\n");
+				goto end;
+			}
+		}
+	}
 
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_SET, msgid, list);
+	send_len = buxton_serialize_message(&send, msg, msgid, list);
 
 	if (send_len == 0) {
 		goto end;
@@ -504,7 +564,87 @@ bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
 
 
 	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_SET, key)) {
+			  msg, key)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
+			   const void *value, BuxtonCallback callback,
+			   void *data)
+{
+	return wire_set_value(client, key, BUXTON_CONTROL_SET, value, NULL, 0,
+			      callback, data);
+}
+
+bool buxton_wire_compare_and_set(_BuxtonClient *client, _BuxtonKey *key,
+				 const void *value, const void *expected,
+				 uint64_t version, BuxtonCallback callback,
+				 void *data)
+{
+	return wire_set_value(client, key, BUXTON_CONTROL_CAS, value, expected,
+			      version, callback, data);
+}
+
+bool buxton_wire_add_value(_BuxtonClient *client, _BuxtonKey *key,
+			   int64_t delta, BuxtonCallback callback, void *data)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	bool ret = false;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_layer;
+	BuxtonData d_group;
+	BuxtonData d_name;
+	BuxtonData d_type;
+	BuxtonData d_delta;
+	uint32_t msgid = get_msgid();
+
+	buxton_string_to_data(&key->layer, &d_layer);
+	buxton_string_to_data(&key->group, &d_group);
+	buxton_string_to_data(&key->name, &d_name);
+	d_type.type = BUXTON_TYPE_UINT32;
+	d_type.store.d_uint32 = key->type;
+	d_delta.type = BUXTON_TYPE_INT64;
+	d_delta.store.d_int64 = delta;
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_layer)) {
+		buxton_log("Failed to add layer to add_value array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_group)) {
+		buxton_log("Failed to add group to add_value array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_name)) {
+		buxton_log("Failed to add name to add_value array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_type)) {
+		buxton_log("Failed to add type to add_value array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_delta)) {
+		buxton_log("Failed to add delta to add_value array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_ADD, msgid,
+					    list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  BUXTON_CONTROL_ADD, key)) {
 		goto end;
 	}
 
@@ -666,7 +806,9 @@ end:
 	return ret;
 }
 
-bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
+/* Sends a GET, or a GET_IF_CHANGED carrying version */
+static bool wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonControlMessage msg, uint64_t version,
 			   BuxtonCallback callback, void *data)
 {
 	bool ret = false;
@@ -677,6 +819,7 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_type;
+	BuxtonData d_version;
 	uint32_t msgid = get_msgid();
 
 	buxton_string_to_data(&key->group, &d_group);
@@ -704,15 +847,23 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 		buxton_log("Failed to add type to get_value array\n");
 		goto end;
 	}
+	if (msg == BUXTON_CONTROL_GET_IF_CHANGED) {
+		d_version.type = BUXTON_TYPE_UINT64;
+		d_version.store.d_uint64 = version;
+		if (!buxton_array_add(list, &d_version)) {
+			buxton_log("Failed to add version to get_value array\n");
+			goto end;
+		}
+	}
 
-	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_GET, msgid, list);
+	send_len = buxton_serialize_message(&send, msg, msgid, list);
 
 	if (send_len == 0) {
 		goto end;
 	}
 
 	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_GET, key)) {
+			  msg, key)) {
 		goto end;
 	}
 
@@ -723,6 +874,21 @@ end:
 	return ret;
 }
 
+bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonCallback callback, void *data)
+{
+	return wire_get_value(client, key, BUXTON_CONTROL_GET, 0, callback,
+			      data);
+}
+
+bool buxton_wire_get_value_if_changed(_BuxtonClient *client, _BuxtonKey *key,
+				      uint64_t version, BuxtonCallback callback,
+				      void *data)
+{
+	return wire_get_value(client, key, BUXTON_CONTROL_GET_IF_CHANGED,
+			      version, callback, data);
+}
+
 bool buxton_wire_get_label(_BuxtonClient *client, _BuxtonKey *key,
 			   BuxtonCallback callback, void *data)
 {
@@ -937,8 +1103,91 @@ end:
 	return ret;
 }
 
+bool buxton_wire_get_stats(_BuxtonClient *client,
+			   BuxtonCallback callback,
+			   void *data)
+{
+	assert(client);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	bool ret = false;
+	uint32_t msgid = get_msgid();
+
+	list = buxton_array_new();
+	if (!list) {
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_STATS, msgid,
+					    list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  BUXTON_CONTROL_STATS, NULL)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+
+	return ret;
+}
+
+bool buxton_wire_get_changes(_BuxtonClient *client,
+			     uint64_t since,
+			     BuxtonCallback callback,
+			     void *data)
+{
+	assert(client);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_since;
+	bool ret = false;
+	uint32_t msgid = get_msgid();
+
+	list = buxton_array_new();
+	if (!list) {
+		goto end;
+	}
+
+	d_since.type = BUXTON_TYPE_UINT64;
+	d_since.store.d_uint64 = since;
+	if (!buxton_array_add(list, &d_since)) {
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_CHANGES,
+					    msgid, list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  BUXTON_CONTROL_CHANGES, NULL)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+
+	return ret;
+}
+
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t interval,
 				       BuxtonCallback callback,
 				       void *data)
 {
@@ -951,6 +1200,7 @@ bool buxton_wire_register_notification(_BuxtonClient *client,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_type;
+	BuxtonData d_interval;
 	bool ret = false;
 	uint32_t msgid = get_msgid();
 
@@ -972,6 +1222,15 @@ bool buxton_wire_register_notification(_BuxtonClient *client,
 		buxton_log("Failed to add type to set_value array\n");
 		goto end;
 	}
+	/* Left out when unused, for daemons that don't coalesce */
+	if (interval) {
+		d_interval.type = BUXTON_TYPE_UINT32;
+		d_interval.store.d_uint32 = interval;
+		if (!buxton_array_add(list, &d_interval)) {
+			buxton_log("Failed to add interval to notify array\n");
+			goto end;
+		}
+	}
 
 	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_NOTIFY, msgid,
 					    list);
@@ -1047,6 +1306,81 @@ end:
 	return ret;
 }
 
+/* Sends a NOTIFY_PREFIX or UNNOTIFY_PREFIX message */
+static bool wire_prefix_notification(_BuxtonClient *client,
+				     BuxtonControlMessage type,
+				     BuxtonString *group,
+				     BuxtonString *prefix,
+				     BuxtonCallback callback,
+				     void *data)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_group;
+	BuxtonData d_prefix;
+	bool ret = false;
+	uint32_t msgid = get_msgid();
+
+	buxton_string_to_data(group, &d_group);
+	buxton_string_to_data(prefix, &d_prefix);
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_group)) {
+		buxton_log("Failed to add group to prefix notification array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_prefix)) {
+		buxton_log("Failed to add prefix to prefix notification array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, type, msgid, list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  type, NULL)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+bool buxton_wire_register_prefix_notification(_BuxtonClient *client,
+					      BuxtonString *group,
+					      BuxtonString *prefix,
+					      BuxtonCallback callback,
+					      void *data)
+{
+	assert(client);
+	assert(group);
+	assert(prefix);
+
+	return wire_prefix_notification(client, BUXTON_CONTROL_NOTIFY_PREFIX,
+					group, prefix, callback, data);
+}
+
+bool buxton_wire_unregister_prefix_notification(_BuxtonClient *client,
+						BuxtonString *group,
+						BuxtonString *prefix,
+						BuxtonCallback callback,
+						void *data)
+{
+	assert(client);
+	assert(group);
+	assert(prefix);
+
+	return wire_prefix_notification(client, BUXTON_CONTROL_UNNOTIFY_PREFIX,
+					group, prefix, callback, data);
+}
+
 void include_protocol(void)
 {
 	;
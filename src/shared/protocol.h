@@ -114,6 +114,37 @@ bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
 			   void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a CAS message over the wire protocol, return the response
+ * @param client Client connection
+ * @param key _BuxtonKey pointer
+ * @param value A pointer to a new value
+ * @param expected A pointer to the value the key must have, or NULL to
+ * compare its version instead
+ * @param version Version the key must have if expected is NULL
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_compare_and_set(_BuxtonClient *client, _BuxtonKey *key,
+				 const void *value, const void *expected,
+				 uint64_t version, BuxtonCallback callback,
+				 void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send an ADD message over the wire protocol, return the response
+ * @param client Client connection
+ * @param key _BuxtonKey pointer, of an integer type
+ * @param delta Amount to add to the value
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_add_value(_BuxtonClient *client, _BuxtonKey *key,
+			   int64_t delta, BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send a SET_LABEL message over the wire protocol, return the response
  *
@@ -188,6 +219,21 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 			   BuxtonCallback callback, void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a GET_IF_CHANGED message over the wire protocol, return the
+ * data unless it still has the given version
+ * @param client Client connection
+ * @param key _BuxtonKey pointer
+ * @param version Version of the value known to the client
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_value_if_changed(_BuxtonClient *client, _BuxtonKey *key,
+				      uint64_t version, BuxtonCallback callback,
+				      void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send an UNSET message over the wire protocol, return the response
  * @param client Client connection
@@ -206,12 +252,14 @@ bool buxton_wire_unset_value(_BuxtonClient *client,
  * Send a NOTIFY message over the protocol, register for events
  * @param client Client connection
  * @param key _BuxtonKey pointer
+ * @param interval Minimum milliseconds between events, 0 for every change
  * @param callback A callback function to handle daemon reply
  * @param data User data to be used with callback function
  * @return a boolean value, indicating success of the operation
  */
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t interval,
 				       BuxtonCallback callback,
 				       void *data)
 	__attribute__((warn_unused_result));
@@ -248,6 +296,32 @@ bool buxton_wire_list_names(_BuxtonClient *client,
 			   void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a STATS message over the protocol, retrieve daemon statistics
+ * @param client Client connection
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_stats(_BuxtonClient *client,
+			   BuxtonCallback callback,
+			   void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a CHANGES message over the protocol, retrieve recent changes
+ * @param client Client connection
+ * @param since Sequence number of the last change already known
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_changes(_BuxtonClient *client,
+			     uint64_t since,
+			     BuxtonCallback callback,
+			     void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send an UNNOTIFY message over the protocol, no longer recieve events
  * @param client Client connection
@@ -262,6 +336,40 @@ bool buxton_wire_unregister_notification(_BuxtonClient *client,
 					 void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a NOTIFY_PREFIX message over the protocol, register for events
+ * on every key of a group starting with a prefix
+ * @param client Client connection
+ * @param group Group name
+ * @param prefix Prefix of the key names, empty to watch the whole group
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_register_prefix_notification(_BuxtonClient *client,
+					      BuxtonString *group,
+					      BuxtonString *prefix,
+					      BuxtonCallback callback,
+					      void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send an UNNOTIFY_PREFIX message over the protocol, no longer recieve
+ * events on a prefix
+ * @param client Client connection
+ * @param group Group name
+ * @param prefix Prefix given when registering
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_unregister_prefix_notification(_BuxtonClient *client,
+						BuxtonString *group,
+						BuxtonString *prefix,
+						BuxtonCallback callback,
+						void *data)
+	__attribute__((warn_unused_result));
+
 void include_protocol(void);
 
 /**
@@ -36,12 +36,18 @@ size_t buxton_serialize(BuxtonData *source, BuxtonString *label,
 	size_t offset = 0;
 	uint8_t *data = NULL;
 	size_t ret = 0;
+	uint32_t type;
 
 	assert(source);
 	assert(target);
 
 	/* DataType + length field */
 	size = sizeof(BuxtonDataType) + (sizeof(uint32_t) * 2) + label->length;
+	type = (uint32_t)source->type;
+	if (source->version) {
+		size += sizeof(uint64_t);
+		type |= BUXTON_RECORD_VERSIONED;
+	}
 
 	/* Total size will be different for string data */
 	switch (source->type) {
@@ -62,7 +68,7 @@ size_t buxton_serialize(BuxtonData *source, BuxtonString *label,
 	}
 
 	/* Write the entire BuxtonDataType to the first block */
-	memcpy(data, &(source->type), sizeof(BuxtonDataType));
+	memcpy(data, &type, sizeof(BuxtonDataType));
 	offset += sizeof(BuxtonDataType);
 
 	/* Write out the length of the label field */
@@ -73,6 +79,12 @@ size_t buxton_serialize(BuxtonData *source, BuxtonString *label,
 	memcpy(data+offset, &length, sizeof(uint32_t));
 	offset += sizeof(uint32_t);
 
+	/* Write out the version, if any */
+	if (source->version) {
+		memcpy(data+offset, &(source->version), sizeof(uint64_t));
+		offset += sizeof(uint64_t);
+	}
+
 	/* Write out the label field */
 	memcpy(data+offset, label->value, label->length);
 	offset += label->length;
@@ -121,13 +133,15 @@ void buxton_deserialize(uint8_t *source, BuxtonData *target,
 	size_t offset = 0;
 	size_t length = 0;
 	BuxtonDataType type;
+	uint32_t stored;
 
 	assert(source);
 	assert(target);
 	assert(label);
 
 	/* Retrieve the BuxtonDataType */
-	type = *(BuxtonDataType*)source;
+	memcpy(&stored, source, sizeof(uint32_t));
+	type = (BuxtonDataType)(stored & ~BUXTON_RECORD_VERSIONED);
 	offset += sizeof(BuxtonDataType);
 
 	/* Retrieve the length of the label */
@@ -138,6 +152,13 @@ void buxton_deserialize(uint8_t *source, BuxtonData *target,
 	length = *(uint32_t*)(source+offset);
 	offset += sizeof(uint32_t);
 
+	/* Retrieve the version, values stored before versions have none */
+	target->version = 0;
+	if (stored & BUXTON_RECORD_VERSIONED) {
+		memcpy(&target->version, source+offset, sizeof(uint64_t));
+		offset += sizeof(uint64_t);
+	}
+
 	/* Retrieve the label */
 	label->value = malloc(label->length);
 	if (label->length > 0 && !label->value) {
@@ -189,7 +210,7 @@ void buxton_deserialize(uint8_t *source, BuxtonData *target,
 size_t buxton_serialize_message(uint8_t **dest, BuxtonControlMessage message,
 				uint32_t msgid, BuxtonArray *list)
 {
-	uint16_t i = 0;
+	uint32_t i = 0;
 	uint8_t *data = NULL;
 	size_t ret = 0;
 	size_t offset = 0;
@@ -358,6 +379,13 @@ end:
 	return ret;
 }
 
+void buxton_message_set_msgid(uint8_t *data, uint32_t msgid)
+{
+	assert(data);
+
+	memcpy(data + BUXTON_MSGID_OFFSET, &msgid, sizeof(uint32_t));
+}
+
 ssize_t buxton_deserialize_message(uint8_t *data,
 				  BuxtonControlMessage *r_message,
 				  size_t size, uint32_t *r_msgid,
@@ -44,6 +44,11 @@
 	+ (sizeof(uint32_t) * 2)		\
 	+ 2
 
+/**
+ * Location of message ID in serialized message data
+ */
+#define BUXTON_MSGID_OFFSET (BUXTON_LENGTH_OFFSET + sizeof(uint32_t))
+
 /**
  * Length of valid message header
  */
@@ -59,9 +64,17 @@
  */
 #define BUXTON_MESSAGE_MAX_PARAMS 4096
 
+/**
+ * Flag set in the type of a serialized value followed by its version
+ *
+ * Values without a version keep the original layout, so databases
+ * written before versions were stored remain readable.
+ */
+#define BUXTON_RECORD_VERSIONED 0x80000000u
+
 /**
  * Serialize data internally for backend consumption
- * @param source Data to be serialized
+ * @param source Data to be serialized, with its version
  * @param label Label to be serialized
  * @param target Pointer to store serialized data in
  * @return a size_t value, indicating the size of serialized data
@@ -73,7 +86,8 @@ size_t buxton_serialize(BuxtonData *source, BuxtonString *label,
 /**
  * Deserialize internal data for client consumption
  * @param source Serialized data pointer
- * @param target A pointer where the deserialize data will be stored
+ * @param target A pointer where the deserialize data will be stored,
+ * with a version of 0 if the value has none
  * @param label A pointer where the deserialize label will be stored
  */
 void buxton_deserialize(uint8_t *source, BuxtonData *target,
@@ -93,6 +107,15 @@ size_t buxton_serialize_message(uint8_t **dest,
 				BuxtonArray *list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Replace the message ID of a serialized message
+ *
+ * Lets a message sent to several clients be serialized once.
+ * @param data Message from buxton_serialize_message()
+ * @param msgid The new message ID
+ */
+void buxton_message_set_msgid(uint8_t *data, uint32_t msgid);
+
 /**
  * Deserialize the given data into an array of BuxtonData structs
  * @param data The source data to be deserialized
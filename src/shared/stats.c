@@ -0,0 +1,359 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "util.h"
+
+/* Sub-buckets per power of two, as a shift */
+#define STATS_SUB_BITS 2
+#define STATS_SUB_BUCKETS (1U << STATS_SUB_BITS)
+
+/*
+ * Counters are updated with relaxed atomics by whichever thread handled
+ * the request; readers only need each counter to be untorn, not a
+ * consistent snapshot of all of them.
+ */
+static BuxtonOpStats _stats[BUXTON_CONTROL_MAX];
+
+/* Names used for the counters, "invalid" counts malformed messages */
+static const char *_stats_names[BUXTON_CONTROL_MAX] = {
+	[BUXTON_CONTROL_MIN] = "invalid",
+	[BUXTON_CONTROL_SET] = "set",
+	[BUXTON_CONTROL_SET_LABEL] = "set_label",
+	[BUXTON_CONTROL_CREATE_GROUP] = "create_group",
+	[BUXTON_CONTROL_REMOVE_GROUP] = "remove_group",
+	[BUXTON_CONTROL_GET] = "get",
+	[BUXTON_CONTROL_UNSET] = "unset",
+	[BUXTON_CONTROL_LIST] = "list",
+	[BUXTON_CONTROL_STATUS] = "status",
+	[BUXTON_CONTROL_NOTIFY] = "notify",
+	[BUXTON_CONTROL_UNNOTIFY] = "unnotify",
+	[BUXTON_CONTROL_CHANGED] = "changed",
+	[BUXTON_CONTROL_GET_LABEL] = "get_label",
+	[BUXTON_CONTROL_LIST_NAMES] = "list_names",
+	[BUXTON_CONTROL_STATS] = "stats",
+	[BUXTON_CONTROL_NOTIFY_PREFIX] = "notify_prefix",
+	[BUXTON_CONTROL_UNNOTIFY_PREFIX] = "unnotify_prefix",
+	[BUXTON_CONTROL_CHANGES] = "changes",
+	[BUXTON_CONTROL_GET_IF_CHANGED] = "get_if_changed",
+	[BUXTON_CONTROL_CAS] = "cas",
+	[BUXTON_CONTROL_ADD] = "add",
+};
+
+/* Time charged to the request being handled on this thread */
+static __thread uint64_t _backend_start;
+static __thread uint64_t _backend_ns;
+static __thread uint64_t _smack_ns;
+static __thread uint64_t _allocs;
+static __thread uint64_t _alloc_bytes;
+
+static inline void counter_add(uint64_t *counter, uint64_t value)
+{
+	(void)__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t counter_read(uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+uint64_t buxton_stats_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+unsigned int buxton_stats_bucket(uint64_t ns)
+{
+	unsigned int exp;
+	unsigned int bucket;
+
+	if (ns < STATS_SUB_BUCKETS) {
+		return (unsigned int)ns;
+	}
+
+	exp = 63 - (unsigned int)__builtin_clzll(ns);
+	bucket = (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		(unsigned int)((ns >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+	if (bucket >= BUXTON_STATS_BUCKETS) {
+		bucket = BUXTON_STATS_BUCKETS - 1;
+	}
+	return bucket;
+}
+
+uint64_t buxton_stats_bucket_limit(unsigned int bucket)
+{
+	unsigned int shift;
+	uint64_t sub;
+
+	if (bucket < STATS_SUB_BUCKETS) {
+		return bucket;
+	}
+	if (bucket >= BUXTON_STATS_BUCKETS - 1) {
+		return UINT64_MAX;
+	}
+
+	shift = bucket / STATS_SUB_BUCKETS - 1;
+	sub = bucket % STATS_SUB_BUCKETS;
+	return ((STATS_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void buxton_stats_request_begin(void)
+{
+	_backend_ns = 0;
+	_smack_ns = 0;
+	_allocs = 0;
+	_alloc_bytes = 0;
+}
+
+void buxton_stats_backend_begin(void)
+{
+	_backend_start = buxton_stats_now();
+}
+
+void buxton_stats_backend_end(void)
+{
+	_backend_ns += buxton_stats_now() - _backend_start;
+}
+
+void buxton_stats_smack_time(uint64_t ns)
+{
+	_smack_ns += ns;
+}
+
+void buxton_stats_alloc(size_t bytes)
+{
+	_allocs++;
+	_alloc_bytes += bytes;
+}
+
+void buxton_stats_record(BuxtonControlMessage msg, bool error,
+			 uint64_t bytes_in, uint64_t bytes_out, uint64_t ns)
+{
+	BuxtonOpStats *stats;
+	uint64_t max;
+
+	if (msg <= BUXTON_CONTROL_MIN || msg >= BUXTON_CONTROL_MAX) {
+		msg = BUXTON_CONTROL_MIN;
+	}
+	stats = &_stats[msg];
+
+	counter_add(&stats->count, 1);
+	if (error) {
+		counter_add(&stats->errors, 1);
+	}
+	counter_add(&stats->bytes_in, bytes_in);
+	counter_add(&stats->bytes_out, bytes_out);
+	counter_add(&stats->total_ns, ns);
+	counter_add(&stats->backend_ns, _backend_ns);
+	counter_add(&stats->smack_ns, _smack_ns);
+	counter_add(&stats->allocs, _allocs);
+	counter_add(&stats->alloc_bytes, _alloc_bytes);
+	counter_add(&stats->latency[buxton_stats_bucket(ns)], 1);
+
+	max = counter_read(&stats->max_ns);
+	while (ns > max) {
+		if (__atomic_compare_exchange_n(&stats->max_ns, &max, ns, true,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+}
+
+void buxton_stats_get(BuxtonControlMessage msg, BuxtonOpStats *stats)
+{
+	BuxtonOpStats *src;
+
+	assert(stats);
+	assert(msg >= BUXTON_CONTROL_MIN && msg < BUXTON_CONTROL_MAX);
+
+	src = &_stats[msg];
+	stats->count = counter_read(&src->count);
+	stats->errors = counter_read(&src->errors);
+	stats->bytes_in = counter_read(&src->bytes_in);
+	stats->bytes_out = counter_read(&src->bytes_out);
+	stats->total_ns = counter_read(&src->total_ns);
+	stats->backend_ns = counter_read(&src->backend_ns);
+	stats->smack_ns = counter_read(&src->smack_ns);
+	stats->allocs = counter_read(&src->allocs);
+	stats->alloc_bytes = counter_read(&src->alloc_bytes);
+	stats->max_ns = counter_read(&src->max_ns);
+	for (unsigned int i = 0; i < BUXTON_STATS_BUCKETS; i++) {
+		stats->latency[i] = counter_read(&src->latency[i]);
+	}
+}
+
+uint64_t buxton_stats_percentile(BuxtonOpStats *stats, unsigned int permille)
+{
+	uint64_t total = 0;
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint64_t limit;
+
+	assert(stats);
+
+	/* The histogram may run ahead of count while requests are
+	 * recorded, so rank against the buckets themselves */
+	for (unsigned int i = 0; i < BUXTON_STATS_BUCKETS; i++) {
+		total += stats->latency[i];
+	}
+	if (!total) {
+		return 0;
+	}
+
+	if (permille > 1000) {
+		permille = 1000;
+	}
+	rank = (total * permille + 999) / 1000;
+	if (!rank) {
+		rank = 1;
+	}
+
+	for (unsigned int i = 0; i < BUXTON_STATS_BUCKETS; i++) {
+		seen += stats->latency[i];
+		if (seen >= rank) {
+			limit = buxton_stats_bucket_limit(i);
+			/* Nothing slower than max_ns was recorded */
+			if (stats->max_ns && limit > stats->max_ns) {
+				limit = stats->max_ns;
+			}
+			return limit;
+		}
+	}
+
+	return stats->max_ns;
+}
+
+void buxton_stats_append_value(BuxtonArray *list, const char *name,
+			       uint64_t value)
+{
+	BuxtonData *d_name;
+	BuxtonData *d_value;
+
+	assert(list);
+	assert(name);
+
+	d_name = malloc0(sizeof(BuxtonData));
+	d_value = malloc0(sizeof(BuxtonData));
+	if (!d_name || !d_value) {
+		abort();
+	}
+
+	d_name->type = BUXTON_TYPE_STRING;
+	d_name->store.d_string.value = strdup(name);
+	if (!d_name->store.d_string.value) {
+		abort();
+	}
+	d_name->store.d_string.length = (uint32_t)strlen(name) + 1;
+	d_value->type = BUXTON_TYPE_UINT64;
+	d_value->store.d_uint64 = value;
+
+	if (!buxton_array_add(list, d_name) ||
+	    !buxton_array_add(list, d_value)) {
+		abort();
+	}
+}
+
+static void append_counter(BuxtonArray *list, BuxtonControlMessage msg,
+			   const char *counter, uint64_t value)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s.%s", _stats_names[msg], counter);
+	buxton_stats_append_value(list, name, value);
+}
+
+void buxton_stats_append(BuxtonArray *list)
+{
+	BuxtonOpStats stats;
+
+	assert(list);
+
+	for (BuxtonControlMessage msg = BUXTON_CONTROL_MIN;
+	     msg < BUXTON_CONTROL_MAX; msg++) {
+		if (!_stats_names[msg]) {
+			continue;
+		}
+		buxton_stats_get(msg, &stats);
+		if (!stats.count) {
+			continue;
+		}
+
+		append_counter(list, msg, "count", stats.count);
+		append_counter(list, msg, "errors", stats.errors);
+		append_counter(list, msg, "bytes_in", stats.bytes_in);
+		append_counter(list, msg, "bytes_out", stats.bytes_out);
+		append_counter(list, msg, "total_ns", stats.total_ns);
+		append_counter(list, msg, "backend_ns", stats.backend_ns);
+		append_counter(list, msg, "smack_ns", stats.smack_ns);
+#ifdef ALLOC_ACCOUNTING
+		append_counter(list, msg, "allocs", stats.allocs);
+		append_counter(list, msg, "alloc_bytes", stats.alloc_bytes);
+#endif
+		append_counter(list, msg, "p50_ns",
+			       buxton_stats_percentile(&stats, 500));
+		append_counter(list, msg, "p90_ns",
+			       buxton_stats_percentile(&stats, 900));
+		append_counter(list, msg, "p99_ns",
+			       buxton_stats_percentile(&stats, 990));
+		append_counter(list, msg, "p999_ns",
+			       buxton_stats_percentile(&stats, 999));
+		append_counter(list, msg, "max_ns", stats.max_ns);
+	}
+}
+
+void buxton_stats_reset(void)
+{
+	for (unsigned int i = 0; i < BUXTON_CONTROL_MAX; i++) {
+		__atomic_store_n(&_stats[i].count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].errors, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].bytes_in, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].bytes_out, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].total_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].backend_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].smack_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].allocs, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].alloc_bytes, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&_stats[i].max_ns, 0, __ATOMIC_RELAXED);
+		for (unsigned int j = 0; j < BUXTON_STATS_BUCKETS; j++) {
+			__atomic_store_n(&_stats[i].latency[j], 0,
+					 __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
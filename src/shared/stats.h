@@ -0,0 +1,174 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file stats.h Internal header
+ * This file is used internally by buxton to keep per request type
+ * counters and latency histograms for the daemon
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buxton.h"
+#include "buxtonarray.h"
+
+/**
+ * Number of latency histogram buckets
+ *
+ * Buckets are log-linear: each power of two is split into four linear
+ * sub-buckets, so a bucket is never more than 25% wider than its lower
+ * bound. Latencies of 2^36ns (about 68 seconds) and over all land in
+ * the last bucket.
+ */
+#define BUXTON_STATS_BUCKETS 140
+
+/**
+ * Counters kept for one BuxtonControlMessage type
+ *
+ * Slot BUXTON_CONTROL_MIN counts messages that could not be parsed.
+ */
+typedef struct BuxtonOpStats {
+	uint64_t count; /**<Requests handled */
+	uint64_t errors; /**<Requests failed or rejected */
+	uint64_t bytes_in; /**<Request bytes received */
+	uint64_t bytes_out; /**<Response bytes sent */
+	uint64_t total_ns; /**<Time spent handling the requests */
+	uint64_t backend_ns; /**<Time spent in backend calls */
+	uint64_t smack_ns; /**<Time spent in Smack checks */
+	uint64_t allocs; /**<Heap allocations, with --enable-alloc-accounting */
+	uint64_t alloc_bytes; /**<Heap bytes allocated, with --enable-alloc-accounting */
+	uint64_t max_ns; /**<Slowest request */
+	uint64_t latency[BUXTON_STATS_BUCKETS]; /**<Latency histogram */
+} BuxtonOpStats;
+
+/**
+ * Read the monotonic clock
+ * @return the current time in nanoseconds
+ */
+uint64_t buxton_stats_now(void);
+
+/**
+ * Map a latency to its histogram bucket
+ * @param ns Latency in nanoseconds
+ * @return the bucket index, less than BUXTON_STATS_BUCKETS
+ */
+unsigned int buxton_stats_bucket(uint64_t ns);
+
+/**
+ * Get the largest latency that falls in a histogram bucket
+ * @param bucket Bucket index
+ * @return the upper bound of the bucket in nanoseconds
+ */
+uint64_t buxton_stats_bucket_limit(unsigned int bucket);
+
+/**
+ * Start timing a request on the calling thread
+ *
+ * Clears the backend and Smack time accumulated by the previous
+ * request handled on this thread.
+ */
+void buxton_stats_request_begin(void);
+
+/**
+ * Mark the start of a backend call on the calling thread
+ */
+void buxton_stats_backend_begin(void);
+
+/**
+ * Mark the end of a backend call on the calling thread
+ */
+void buxton_stats_backend_end(void);
+
+/**
+ * Add time spent checking Smack access to the current request
+ * @param ns Time in nanoseconds
+ */
+void buxton_stats_smack_time(uint64_t ns);
+
+/**
+ * Add an allocation to the current request
+ * @param bytes Size of the allocation
+ */
+void buxton_stats_alloc(size_t bytes);
+
+/**
+ * Record a handled request
+ *
+ * Backend and Smack time, and allocations, accumulated since
+ * buxton_stats_request_begin() are charged to the same message type.
+ * @param msg Message type, or BUXTON_CONTROL_MIN for a malformed message
+ * @param error Whether the request failed
+ * @param bytes_in Size of the request
+ * @param bytes_out Size of the response, 0 if none was sent
+ * @param ns Time spent handling the request
+ */
+void buxton_stats_record(BuxtonControlMessage msg, bool error,
+			 uint64_t bytes_in, uint64_t bytes_out, uint64_t ns);
+
+/**
+ * Take a copy of the counters for a message type
+ * @param msg Message type
+ * @param stats A BuxtonOpStats to fill in
+ */
+void buxton_stats_get(BuxtonControlMessage msg, BuxtonOpStats *stats);
+
+/**
+ * Estimate a latency percentile from a histogram
+ * @param stats Counters from buxton_stats_get()
+ * @param permille Percentile to compute, in tenths of a percent
+ * @return the upper bound of the bucket holding the percentile, 0 if
+ * no request was recorded
+ */
+uint64_t buxton_stats_percentile(BuxtonOpStats *stats, unsigned int permille);
+
+/**
+ * Append the counters of all message types seen so far to a list
+ *
+ * Each counter is added as a "<message>.<counter>" string followed by
+ * a uint64 value. The BuxtonData entries are allocated and must be
+ * freed with data_free.
+ * @param list A BuxtonArray to append to
+ */
+void buxton_stats_append(BuxtonArray *list);
+
+/**
+ * Append a single named uint64 counter to a list
+ * @param list A BuxtonArray to append to
+ * @param name Counter name
+ * @param value Counter value
+ */
+void buxton_stats_append_value(BuxtonArray *list, const char *name,
+			       uint64_t value);
+
+/**
+ * Clear all counters
+ */
+void buxton_stats_reset(void);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
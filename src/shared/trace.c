@@ -0,0 +1,199 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "util.h"
+
+/*
+ * Each event is a small seqlock: the writer clears index, stores the
+ * fields and then publishes the new index. A reader accepts an entry
+ * only if it saw the index it expected both before and after copying
+ * the fields. Fields are accessed with relaxed atomics so a concurrent
+ * dump is not a data race.
+ */
+typedef struct BuxtonTraceEvent {
+	uint64_t index; /**<Position in the ring plus one, 0 while written */
+	uint64_t seq; /**<Request number on the thread */
+	uint64_t start; /**<Start of the phase */
+	uint64_t end; /**<End of the phase */
+	uint32_t phase; /**<BuxtonTracePhase */
+	uint32_t msg; /**<BuxtonControlMessage of the request */
+} BuxtonTraceEvent;
+
+typedef struct BuxtonTraceRing {
+	struct BuxtonTraceRing *next; /**<Next ring, for dumps */
+	pid_t tid; /**<Thread writing the ring */
+	uint64_t head; /**<Events written so far */
+	BuxtonTraceEvent events[BUXTON_TRACE_RING_SIZE]; /**<Ring contents */
+} BuxtonTraceRing;
+
+__thread uint64_t buxton_trace_start[BUXTON_TRACE_MAX];
+__thread BuxtonControlMessage buxton_trace_msg;
+
+/* Rings are never freed, threads come and go rarely */
+static BuxtonTraceRing *_rings = NULL;
+static __thread BuxtonTraceRing *_ring = NULL;
+static __thread uint64_t _seq = 0;
+
+static const char *_phase_names[BUXTON_TRACE_MAX] = {
+	[BUXTON_TRACE_READ] = "read",
+	[BUXTON_TRACE_DESERIALIZE] = "deserialize",
+	[BUXTON_TRACE_PARSE] = "parse",
+	[BUXTON_TRACE_SMACK] = "smack",
+	[BUXTON_TRACE_BACKEND] = "backend",
+	[BUXTON_TRACE_SERIALIZE] = "serialize",
+	[BUXTON_TRACE_WRITE] = "write",
+	[BUXTON_TRACE_NOTIFY] = "notify",
+};
+
+uint64_t buxton_trace_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static BuxtonTraceRing *thread_ring(void)
+{
+	BuxtonTraceRing *ring;
+
+	if (_ring) {
+		return _ring;
+	}
+
+	ring = malloc0(sizeof(BuxtonTraceRing));
+	if (!ring) {
+		abort();
+	}
+	ring->tid = (pid_t)syscall(SYS_gettid);
+
+	ring->next = __atomic_load_n(&_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_rings, &ring->next, ring, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED));
+
+	_ring = ring;
+	return ring;
+}
+
+void buxton_trace_record(BuxtonTracePhase phase, uint64_t start, uint64_t end)
+{
+	BuxtonTraceRing *ring = thread_ring();
+	BuxtonTraceEvent *ev;
+	uint64_t head;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	ev = &ring->events[head % BUXTON_TRACE_RING_SIZE];
+
+	__atomic_store_n(&ev->index, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&ev->seq, _seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->start, start, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->end, end, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->phase, (uint32_t)phase, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->msg, (uint32_t)buxton_trace_msg, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->index, head + 1, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void buxton_trace_request(BuxtonControlMessage msg)
+{
+	buxton_trace_msg = msg;
+}
+
+void buxton_trace_request_end(uint64_t start)
+{
+	buxton_trace_probe_request(_seq, buxton_trace_msg, start,
+				   buxton_trace_now());
+	buxton_trace_msg = BUXTON_CONTROL_MIN;
+	_seq++;
+}
+
+static size_t dump_ring(BuxtonTraceRing *ring, FILE *out)
+{
+	BuxtonTraceEvent *ev;
+	BuxtonTraceEvent copy;
+	uint64_t head;
+	uint64_t first;
+	size_t count = 0;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	first = head > BUXTON_TRACE_RING_SIZE ? head - BUXTON_TRACE_RING_SIZE : 0;
+
+	for (uint64_t i = first; i < head; i++) {
+		ev = &ring->events[i % BUXTON_TRACE_RING_SIZE];
+
+		if (__atomic_load_n(&ev->index, __ATOMIC_ACQUIRE) != i + 1) {
+			continue;
+		}
+		copy.seq = __atomic_load_n(&ev->seq, __ATOMIC_RELAXED);
+		copy.start = __atomic_load_n(&ev->start, __ATOMIC_RELAXED);
+		copy.end = __atomic_load_n(&ev->end, __ATOMIC_RELAXED);
+		copy.phase = __atomic_load_n(&ev->phase, __ATOMIC_RELAXED);
+		copy.msg = __atomic_load_n(&ev->msg, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ev->index, __ATOMIC_RELAXED) != i + 1) {
+			continue;
+		}
+		if (copy.phase >= BUXTON_TRACE_MAX) {
+			continue;
+		}
+
+		fprintf(out, "trace tid=%d req=%" PRIu64 " msg=%u phase=%s "
+			"start=%" PRIu64 " ns=%" PRIu64 "\n", (int)ring->tid,
+			copy.seq, copy.msg, _phase_names[copy.phase],
+			copy.start, copy.end - copy.start);
+		count++;
+	}
+
+	return count;
+}
+
+size_t buxton_trace_dump(FILE *out)
+{
+	BuxtonTraceRing *ring;
+	size_t count = 0;
+
+	ring = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE);
+	for (; ring; ring = ring->next) {
+		count += dump_ring(ring, out);
+	}
+	fflush(out);
+
+	return count;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
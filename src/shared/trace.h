@@ -0,0 +1,183 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file trace.h Internal header
+ * This file is used internally by buxton to trace the phases of the
+ * requests handled by the daemon
+ *
+ * Tracing is compiled in with --enable-trace. Each thread then keeps
+ * the most recent phases it timed in its own ring buffer, which the
+ * daemon dumps when it receives SIGUSR1. When sys/sdt.h is available,
+ * every phase also fires a buxton:phase USDT probe at its call site,
+ * and every request a buxton:request probe.
+ *
+ * Without --enable-trace, all functions are empty inlines.
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "buxton.h"
+
+#if defined(TRACE) && defined(HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+#define buxton_trace_probe_phase(phase, msg, start, end) \
+	DTRACE_PROBE4(buxton, phase, phase, msg, start, end)
+#define buxton_trace_probe_request(seq, msg, start, end) \
+	DTRACE_PROBE4(buxton, request, seq, msg, start, end)
+#else
+#define buxton_trace_probe_phase(phase, msg, start, end) do {} while (0)
+#define buxton_trace_probe_request(seq, msg, start, end) do {} while (0)
+#endif
+
+/**
+ * Number of phases kept per thread
+ */
+#define BUXTON_TRACE_RING_SIZE 4096
+
+/**
+ * Phases of a request
+ */
+typedef enum BuxtonTracePhase {
+	BUXTON_TRACE_READ, /**<Reading the request from the socket */
+	BUXTON_TRACE_DESERIALIZE, /**<Deserializing the request */
+	BUXTON_TRACE_PARSE, /**<Checking the request parameters */
+	BUXTON_TRACE_SMACK, /**<Checking Smack access */
+	BUXTON_TRACE_BACKEND, /**<Calling a backend */
+	BUXTON_TRACE_SERIALIZE, /**<Serializing the response */
+	BUXTON_TRACE_WRITE, /**<Writing the response to the socket */
+	BUXTON_TRACE_NOTIFY, /**<Notifying clients of a change */
+	BUXTON_TRACE_MAX
+} BuxtonTracePhase;
+
+#ifdef TRACE
+
+/**
+ * Start of the phases in progress on this thread
+ */
+extern __thread uint64_t buxton_trace_start[BUXTON_TRACE_MAX];
+
+/**
+ * Message type of the request in progress on this thread
+ */
+extern __thread BuxtonControlMessage buxton_trace_msg;
+
+/**
+ * Read the monotonic clock
+ * @return the current time in nanoseconds
+ */
+uint64_t buxton_trace_now(void);
+
+/**
+ * Store a phase in the calling thread's ring buffer
+ * @param phase Phase that completed
+ * @param start Start of the phase in nanoseconds
+ * @param end End of the phase in nanoseconds
+ */
+void buxton_trace_record(BuxtonTracePhase phase, uint64_t start, uint64_t end);
+
+/**
+ * Start a new request on the calling thread
+ *
+ * Phases recorded from now on, until buxton_trace_request_end(), are
+ * tagged with the request. Reads are recorded before the message type
+ * is known and are charged to the next request of the thread.
+ * @param msg Message type of the request
+ */
+void buxton_trace_request(BuxtonControlMessage msg);
+
+/**
+ * Finish the request in progress on the calling thread
+ * @param start Start of the request in nanoseconds
+ */
+void buxton_trace_request_end(uint64_t start);
+
+/**
+ * Write the contents of all ring buffers
+ *
+ * One line is written per phase, oldest first for each thread. Rings
+ * are read while other threads keep writing to them; entries that are
+ * overwritten while being read are skipped.
+ * @param out Stream to write to
+ * @return the number of phases written
+ */
+size_t buxton_trace_dump(FILE *out);
+
+/**
+ * Mark the start of a phase on the calling thread
+ * @param phase Phase that starts
+ */
+static inline void buxton_trace_begin(BuxtonTracePhase phase)
+{
+	buxton_trace_start[phase] = buxton_trace_now();
+}
+
+/**
+ * Mark the end of a phase on the calling thread
+ * @param phase Phase that ends, started with buxton_trace_begin()
+ */
+static inline void buxton_trace_end(BuxtonTracePhase phase)
+{
+	uint64_t start = buxton_trace_start[phase];
+	uint64_t end = buxton_trace_now();
+
+	buxton_trace_probe_phase(phase, buxton_trace_msg, start, end);
+	buxton_trace_record(phase, start, end);
+}
+
+#else
+
+static inline uint64_t buxton_trace_now(void)
+{
+	return 0;
+}
+
+static inline void buxton_trace_request(BuxtonControlMessage msg)
+{
+}
+
+static inline void buxton_trace_request_end(uint64_t start)
+{
+}
+
+static inline size_t buxton_trace_dump(FILE *out)
+{
+	return 0;
+}
+
+static inline void buxton_trace_begin(BuxtonTracePhase phase)
+{
+}
+
+static inline void buxton_trace_end(BuxtonTracePhase phase)
+{
+}
+
+#endif /* TRACE */
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,279 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trie.h"
+#include "util.h"
+
+/*
+ * One node per byte of the stored keys. Children are kept sorted by
+ * their byte and found with a binary search, so a lookup costs at most
+ * eight comparisons per byte of the key.
+ */
+typedef struct BuxtonTrieNode {
+	void *value; /**<Value of the key ending at this node, or NULL */
+	unsigned char *bytes; /**<Byte leading to each child, sorted */
+	struct BuxtonTrieNode **children; /**<Children, in the order of bytes */
+	uint16_t count; /**<Number of children */
+	uint16_t capacity; /**<Number of children allocated */
+} BuxtonTrieNode;
+
+struct BuxtonTrie {
+	BuxtonTrieNode root; /**<Node of the empty key */
+	size_t size; /**<Number of stored keys */
+};
+
+/* Index of the child for c, or where it would be inserted */
+static uint16_t child_index(BuxtonTrieNode *node, unsigned char c)
+{
+	uint16_t low = 0;
+	uint16_t high = node->count;
+	uint16_t mid;
+
+	while (low < high) {
+		mid = (uint16_t)((low + high) / 2);
+		if (node->bytes[mid] < c) {
+			low = (uint16_t)(mid + 1);
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+static BuxtonTrieNode *child_get(BuxtonTrieNode *node, unsigned char c)
+{
+	uint16_t i = child_index(node, c);
+
+	if (i < node->count && node->bytes[i] == c) {
+		return node->children[i];
+	}
+	return NULL;
+}
+
+static BuxtonTrieNode *child_add(BuxtonTrieNode *node, unsigned char c)
+{
+	BuxtonTrieNode *child;
+	unsigned char *bytes;
+	BuxtonTrieNode **children;
+	uint16_t capacity;
+	uint16_t i;
+
+	i = child_index(node, c);
+	if (i < node->count && node->bytes[i] == c) {
+		return node->children[i];
+	}
+
+	if (node->count == node->capacity) {
+		capacity = node->capacity ? (uint16_t)(node->capacity * 2) : 2;
+		bytes = realloc(node->bytes, capacity);
+		if (!bytes) {
+			return NULL;
+		}
+		node->bytes = bytes;
+		children = realloc(node->children,
+				   sizeof(BuxtonTrieNode *) * capacity);
+		if (!children) {
+			return NULL;
+		}
+		node->children = children;
+		node->capacity = capacity;
+	}
+
+	child = malloc0(sizeof(BuxtonTrieNode));
+	if (!child) {
+		return NULL;
+	}
+
+	memmove(&node->bytes[i + 1], &node->bytes[i],
+		(size_t)(node->count - i));
+	memmove(&node->children[i + 1], &node->children[i],
+		sizeof(BuxtonTrieNode *) * (size_t)(node->count - i));
+	node->bytes[i] = c;
+	node->children[i] = child;
+	node->count++;
+
+	return child;
+}
+
+static void child_remove(BuxtonTrieNode *node, unsigned char c)
+{
+	uint16_t i = child_index(node, c);
+
+	assert(i < node->count && node->bytes[i] == c);
+
+	free(node->children[i]->bytes);
+	free(node->children[i]->children);
+	free(node->children[i]);
+	memmove(&node->bytes[i], &node->bytes[i + 1],
+		(size_t)(node->count - i - 1));
+	memmove(&node->children[i], &node->children[i + 1],
+		sizeof(BuxtonTrieNode *) * (size_t)(node->count - i - 1));
+	node->count--;
+}
+
+static void node_free(BuxtonTrieNode *node, buxton_free_func free_method)
+{
+	for (uint16_t i = 0; i < node->count; i++) {
+		node_free(node->children[i], free_method);
+		free(node->children[i]);
+	}
+	if (node->value && free_method) {
+		free_method(node->value);
+	}
+	free(node->bytes);
+	free(node->children);
+}
+
+BuxtonTrie *buxton_trie_new(void)
+{
+	return malloc0(sizeof(BuxtonTrie));
+}
+
+void buxton_trie_free(BuxtonTrie *trie, buxton_free_func free_method)
+{
+	if (!trie) {
+		return;
+	}
+	node_free(&trie->root, free_method);
+	free(trie);
+}
+
+bool buxton_trie_put(BuxtonTrie *trie, const char *key, void *value)
+{
+	BuxtonTrieNode *node;
+
+	assert(trie);
+	assert(key);
+	assert(value);
+
+	node = &trie->root;
+	for (const char *p = key; *p; p++) {
+		node = child_add(node, (unsigned char)*p);
+		if (!node) {
+			return false;
+		}
+	}
+
+	if (!node->value) {
+		trie->size++;
+	}
+	node->value = value;
+
+	return true;
+}
+
+void *buxton_trie_get(BuxtonTrie *trie, const char *key)
+{
+	BuxtonTrieNode *node;
+
+	assert(trie);
+	assert(key);
+
+	node = &trie->root;
+	for (const char *p = key; *p && node; p++) {
+		node = child_get(node, (unsigned char)*p);
+	}
+
+	return node ? node->value : NULL;
+}
+
+/* Removes key below node, then prunes the children left empty */
+static void *node_remove(BuxtonTrieNode *node, const char *key)
+{
+	BuxtonTrieNode *child;
+	void *value;
+
+	if (!*key) {
+		value = node->value;
+		node->value = NULL;
+		return value;
+	}
+
+	child = child_get(node, (unsigned char)*key);
+	if (!child) {
+		return NULL;
+	}
+	value = node_remove(child, key + 1);
+	if (!child->value && !child->count) {
+		child_remove(node, (unsigned char)*key);
+	}
+
+	return value;
+}
+
+void *buxton_trie_remove(BuxtonTrie *trie, const char *key)
+{
+	void *value;
+
+	assert(trie);
+	assert(key);
+
+	value = node_remove(&trie->root, key);
+	if (value) {
+		trie->size--;
+	}
+
+	return value;
+}
+
+size_t buxton_trie_foreach_prefix(BuxtonTrie *trie, const char *string,
+				  buxton_trie_func func, void *data)
+{
+	BuxtonTrieNode *node;
+	size_t count = 0;
+
+	assert(trie);
+	assert(string);
+	assert(func);
+
+	node = &trie->root;
+	for (const char *p = string; node; p++) {
+		if (node->value) {
+			func(node->value, data);
+			count++;
+		}
+		if (!*p) {
+			break;
+		}
+		node = child_get(node, (unsigned char)*p);
+	}
+
+	return count;
+}
+
+size_t buxton_trie_size(BuxtonTrie *trie)
+{
+	assert(trie);
+
+	return trie->size;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,114 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buxtonarray.h"
+
+/**
+ * A map of strings to pointers, which finds every stored key that is a
+ * prefix of a given string in time linear to the length of the string
+ */
+typedef struct BuxtonTrie BuxtonTrie;
+
+/**
+ * Called for a value stored in a BuxtonTrie
+ * @param value Stored value
+ * @param data User data given to the iterating function
+ */
+typedef void (*buxton_trie_func) (void *value, void *data);
+
+/**
+ * Create a new BuxtonTrie
+ * @returns BuxtonTrie a newly allocated BuxtonTrie, NULL on failure
+ */
+BuxtonTrie *buxton_trie_new(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a BuxtonTrie
+ * @param trie BuxtonTrie to free, may be NULL
+ * @param free_method Function to call to free stored values, or NULL
+ */
+void buxton_trie_free(BuxtonTrie *trie,
+		      buxton_free_func free_method);
+
+/**
+ * Store a value, replacing the value already stored under key
+ * @param trie Valid BuxtonTrie
+ * @param key Key to store value under
+ * @param value Value to store, may not be NULL
+ * @returns bool true if the value was stored
+ */
+bool buxton_trie_put(BuxtonTrie *trie,
+		     const char *key,
+		     void *value)
+	__attribute__((warn_unused_result));
+
+/**
+ * Retrieve the value stored under a key
+ * @param trie Valid BuxtonTrie
+ * @param key Key to look up
+ * @returns the stored value, NULL if key is not in the trie
+ */
+void *buxton_trie_get(BuxtonTrie *trie,
+		      const char *key);
+
+/**
+ * Remove a key
+ * @param trie Valid BuxtonTrie
+ * @param key Key to remove
+ * @returns the value that was stored, NULL if key is not in the trie
+ */
+void *buxton_trie_remove(BuxtonTrie *trie,
+			 const char *key);
+
+/**
+ * Call a function for the value of every stored key that is a prefix
+ * of a string, including the string itself, shortest keys first
+ * @note func may not modify the trie
+ * @param trie Valid BuxtonTrie
+ * @param string String to match keys against
+ * @param func Function to call for each matching value
+ * @param data User data passed to func
+ * @returns the number of matching keys
+ */
+size_t buxton_trie_foreach_prefix(BuxtonTrie *trie,
+				  const char *string,
+				  buxton_trie_func func,
+				  void *data);
+
+/**
+ * Retrieve the number of keys in a BuxtonTrie
+ * @param trie Valid BuxtonTrie
+ * @returns the number of stored keys
+ */
+size_t buxton_trie_size(BuxtonTrie *trie);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -136,6 +136,7 @@ bool buxton_data_copy(BuxtonData* original, BuxtonData *copy)
 
 	copy->type = original->type;
 	copy->store = store;
+	copy->version = original->version;
 
 	return true;
 
@@ -48,6 +48,7 @@
 #include "buxton.h"
 #include "buxtonkey.h"
 #include "backend.h"
+#include "alloc.h"
 
 size_t page_size(void);
 #define PAGE_ALIGN(l) ALIGN_TO((l), page_size())
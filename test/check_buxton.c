@@ -16,7 +16,10 @@
 #include <check.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -25,6 +28,7 @@
 #include "buxton.h"
 #include "buxtonresponse.h"
 #include "check_utils.h"
+#include "compiler.h"
 #include "configurator.h"
 #include "direct.h"
 #include "protocol.h"
@@ -81,7 +85,7 @@ START_TEST(buxton_direct_create_group_check)
 	BuxtonControl c;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	_BuxtonKey group;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
 
 	group.layer = buxton_string_pack("base");
 	group.group = buxton_string_pack("tgroup");
@@ -97,7 +101,7 @@ START_TEST(buxton_direct_remove_group_check)
 	BuxtonControl c;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	_BuxtonKey group;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
 
 	group.layer = buxton_string_pack("base");
 	group.group = buxton_string_pack("tgroup");
@@ -108,15 +112,63 @@ START_TEST(buxton_direct_remove_group_check)
 }
 END_TEST
 
+START_TEST(buxton_direct_remove_group_keys_check)
+{
+	BuxtonControl c;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonString glabel;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel;
+
+	group.layer = buxton_string_pack("test-gdbm");
+	group.group = buxton_string_pack("bxt_orphan_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_orphan_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_orphan_value");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value failed.");
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+
+	/* A new group of the same name must not see the old keys */
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Recreating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL) != ENOENT,
+		"Key survived the removal of its group.");
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_direct_set_value_check)
 {
 	BuxtonControl c;
 	fail_if(buxton_direct_open(&c) == false,
 		"Direct open failed without daemon.");
-	_BuxtonKey group;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
 	BuxtonString glabel;
-	_BuxtonKey key;
-	BuxtonData data;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonData data = {0};
 
 	group.layer = buxton_string_pack("test-gdbm");
 	group.group = buxton_string_pack("bxt_test_group");
@@ -142,12 +194,209 @@ START_TEST(buxton_direct_set_value_check)
 }
 END_TEST
 
+START_TEST(buxton_direct_sync_check)
+{
+	BuxtonControl c;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	BuxtonString glabel;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonData data = {0};
+	int timeout;
+
+	group.layer = buxton_string_pack("test-gdbm-user");
+	group.group = buxton_string_pack("bxt_sync_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_sync_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_sync(&c, false) != -1,
+		"Sync pending without any write");
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_sync_value");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value in buxton directly failed.");
+
+	/* test-gdbm-user is a group-commit layer */
+	timeout = buxton_direct_sync(&c, false);
+	fail_if(timeout < 0 || timeout > 100,
+		"Bad timeout for pending group commit: %d", timeout);
+	fail_if(buxton_direct_sync(&c, true) != -1,
+		"Forced sync left writes pending");
+	fail_if(buxton_direct_sync(&c, false) != -1,
+		"Sync pending after forced sync");
+
+	/* test-gdbm-async is only synced on close, no sync is ever due */
+	group.layer = buxton_string_pack("test-gdbm-async");
+	key.layer = group.layer;
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value in buxton directly failed.");
+	fail_if(buxton_direct_sync(&c, false) != -1,
+		"Sync scheduled for an async layer");
+	fail_if(buxton_direct_sync(&c, true) != -1,
+		"Forced sync left writes pending");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_direct_reorganize_check)
+{
+	BuxtonControl c;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	BuxtonString glabel;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonData data = {0};
+	BuxtonCacheStats stats;
+	struct stat st;
+	char path[PATH_MAX];
+	char name[32];
+	char *value;
+	off_t size;
+
+	group.layer = buxton_string_pack("test-gdbm");
+	group.group = buxton_string_pack("bxt_reorganize_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.type = BUXTON_TYPE_STRING;
+
+	value = malloc(8192);
+	fail_if(!value, "Failed to allocate value");
+	memset(value, 'x', 8191);
+	value[8191] = '\0';
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+
+	/* Leave well over the 256KiB reorganization threshold behind */
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack(value);
+	for (int i = 0; i < 64; i++) {
+		snprintf(name, sizeof(name), "bxt_reorganize_key%d", i);
+		key.name = buxton_string_pack(name);
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Setting value in buxton directly failed.");
+	}
+	for (int i = 0; i < 64; i++) {
+		snprintf(name, sizeof(name), "bxt_reorganize_key%d", i);
+		key.name = buxton_string_pack(name);
+		fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+			"Unsetting value in buxton directly failed.");
+	}
+	free(value);
+
+	buxton_direct_cache_stats(&c, &stats);
+	fail_if(stats.dead < 64 * 8192, "Dead bytes weren't counted: %" PRIu64,
+		stats.dead);
+	snprintf(path, PATH_MAX, "%s/test-gdbm.db", buxton_db_path());
+	fail_if(stat(path, &st) == -1, "Failed to stat database");
+	size = st.st_size;
+
+	/* Fragmented databases are reorganized once idle for 2 seconds */
+	usleep(2100 * 1000);
+	buxton_direct_sync(&c, false);
+
+	buxton_direct_cache_stats(&c, &stats);
+	fail_if(stats.dead != 0, "Dead bytes left after reorganization: %"
+		PRIu64, stats.dead);
+	fail_if(stats.live == 0, "No live bytes reported");
+	fail_if(stat(path, &st) == -1, "Failed to stat database");
+	fail_if(st.st_size >= size, "Database didn't shrink: %ld >= %ld",
+		(long)st.st_size, (long)size);
+
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_direct_user_db_cache_check)
+{
+	BuxtonControl c;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	BuxtonString glabel;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel;
+	BuxtonCacheStats stats;
+	uid_t uid = getuid();
+
+	group.layer = buxton_string_pack("test-gdbm-user");
+	group.group = buxton_string_pack("bxt_cache_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_cache_key");
+	key.type = BUXTON_TYPE_INT32;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+
+	/* test.conf limits the cache to two open user databases */
+	for (int32_t i = 0; i < 4; i++) {
+		c.client.uid = uid + (uid_t)i;
+		fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+			"Creating group failed.");
+		fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+			"Setting group label failed.");
+		data.type = BUXTON_TYPE_INT32;
+		data.store.d_int32 = i;
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Setting value in buxton directly failed.");
+	}
+	buxton_direct_cache_stats(&c, &stats);
+	fail_if(stats.open > 2, "Too many open user databases: %u",
+		stats.open);
+	fail_if(stats.evictions < 2, "User databases weren't evicted");
+	fail_if(stats.hits == 0, "No cache hits for repeated accesses");
+
+	/* pending group commits must survive the eviction */
+	for (int32_t i = 0; i < 4; i++) {
+		c.client.uid = uid + (uid_t)i;
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, NULL) != 0,
+			"Retrieving value from evicted database failed.");
+		fail_if(result.store.d_int32 != i,
+			"Wrong value after eviction: %d", result.store.d_int32);
+		free(dlabel.value);
+	}
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_direct_get_value_for_layer_check)
 {
 	BuxtonControl c;
-	BuxtonData result;
+	BuxtonData result = {0};
 	BuxtonString dlabel;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("bxt_test_group");
@@ -173,9 +422,10 @@ END_TEST
 START_TEST(buxton_direct_get_value_check)
 {
 	BuxtonControl c;
-	BuxtonData data, result;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
 	BuxtonString dlabel;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("bxt_test_group");
 	key.name = buxton_string_pack("bxt_test_key");
@@ -213,13 +463,146 @@ START_TEST(buxton_direct_get_value_check)
 }
 END_TEST
 
+START_TEST(buxton_compiled_backend_check)
+{
+	BuxtonControl c;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel;
+	BuxtonString layer = buxton_string_pack("test-gdbm");
+	BuxtonString group_name = buxton_string_pack("bxt_test_group");
+	BuxtonArray *list = NULL;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	char path[PATH_MAX];
+	bool found = false;
+
+	key.layer = buxton_string_pack("test-compiled");
+	key.group = buxton_string_pack("bxt_test_group");
+	key.name = buxton_string_pack("bxt_test_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	snprintf(path, PATH_MAX, "%s/test-compiled.db", buxton_db_path());
+	fail_if(!buxton_compile_layer(&c, &layer, path),
+		"Failed to compile layer");
+
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+		"Retrieving value from compiled layer failed.");
+	fail_if(result.type != BUXTON_TYPE_STRING,
+		"Compiled layer returned incorrect result type.");
+	fail_if(!streq(result.store.d_string.value, "bxt_test_value2"),
+		"Compiled layer returned a different value to that set.");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	fail_if(!buxton_direct_list_names(&c, &key.layer, NULL, NULL, &list),
+		"Listing groups of compiled layer failed.");
+	for (uint32_t i = 0; i < list->len; i++) {
+		BuxtonData *d = buxton_array_get(list, i);
+
+		if (streq(d->store.d_string.value, "bxt_test_group")) {
+			found = true;
+		}
+	}
+	fail_if(!found, "Group missing from compiled layer");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	fail_if(!buxton_direct_list_names(&c, &key.layer, &group_name, NULL, &list),
+		"Listing keys of compiled layer failed.");
+	fail_if(list->len != 1, "Wrong number of keys in compiled layer");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_test_value3");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL),
+		"Set value on compiled layer succeeded.");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_compiled_corrupt_check)
+{
+	BuxtonControl c;
+	BuxtonData result = {0};
+	BuxtonString dlabel;
+	BuxtonString layer = buxton_string_pack("test-gdbm");
+	BuxtonString group_name = buxton_string_pack("bxt_test_group");
+	BuxtonArray *list = NULL;
+	CompiledHeader h;
+	CompiledGroup g;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	char path[PATH_MAX];
+	uint32_t offset;
+	uint32_t bad = 0xfffffff0;
+	int fd;
+
+	key.layer = buxton_string_pack("test-compiled");
+	key.group = buxton_string_pack("bxt_test_group");
+	key.name = buxton_string_pack("bxt_test_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	snprintf(path, PATH_MAX, "%s/test-compiled.db", buxton_db_path());
+	fail_if(!buxton_compile_layer(&c, &layer, path),
+		"Failed to compile layer");
+
+	/* Point every index past the end, and break every record's key size */
+	fd = open(path, O_RDWR);
+	fail_if(fd == -1, "Failed to open compiled layer");
+	fail_if(pread(fd, &h, sizeof(h), 0) != sizeof(h),
+		"Failed to read compiled header");
+	for (uint32_t i = 0; i < h.nrecords; i++) {
+		fail_if(pread(fd, &offset, sizeof(offset),
+			      (off_t)(h.slots + i * sizeof(uint32_t))) != sizeof(offset),
+			"Failed to read slot");
+		fail_if(pwrite(fd, &bad, sizeof(bad), offset) != sizeof(bad),
+			"Failed to corrupt record");
+	}
+	for (uint32_t i = 0; i < h.ngroups; i++) {
+		off_t at = (off_t)(h.groups + i * sizeof(CompiledGroup));
+
+		fail_if(pread(fd, &g, sizeof(g), at) != sizeof(g),
+			"Failed to read group");
+		g.record = (uint32_t)h.size;
+		g.count = bad;
+		fail_if(pwrite(fd, &g, sizeof(g), at) != sizeof(g),
+			"Failed to corrupt group");
+	}
+	for (uint32_t i = 0; i < h.nkeys; i++) {
+		fail_if(pwrite(fd, &bad, sizeof(bad),
+			       (off_t)(h.keys + i * sizeof(uint32_t))) != sizeof(bad),
+			"Failed to corrupt key index");
+	}
+	close(fd);
+
+	fail_if(!buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+		"Retrieved value from corrupt compiled layer.");
+
+	fail_if(!buxton_direct_list_names(&c, &key.layer, NULL, NULL, &list),
+		"Listing groups of corrupt compiled layer failed.");
+	fail_if(list->len != 0, "Listed groups of corrupt compiled layer");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+
+	fail_if(!buxton_direct_list_names(&c, &key.layer, &group_name, NULL, &list),
+		"Listing keys of corrupt compiled layer failed.");
+	fail_if(list->len != 0, "Listed keys of corrupt compiled layer");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_memory_backend_check)
 {
 	BuxtonControl c;
-	BuxtonData data, result;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
 	BuxtonString dlabel, glabel;
-	_BuxtonKey group;
-	_BuxtonKey key;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 
 	group.layer = buxton_string_pack("temp");
 	group.group = buxton_string_pack("bxt_mem_test_group");
@@ -259,6 +642,366 @@ START_TEST(buxton_memory_backend_check)
 }
 END_TEST
 
+START_TEST(buxton_memory_backend_store_check)
+{
+	BuxtonControl c;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel, glabel;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	char name[32];
+	char *big;
+	size_t big_size = 4096;
+	int32_t i;
+
+	group.layer = buxton_string_pack("temp");
+	group.group = buxton_string_pack("bxt_mem_store_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+
+	big = malloc(big_size);
+	fail_if(!big, "Failed to allocate a large value");
+	memset(big, 'x', big_size - 1);
+	big[big_size - 1] = '\0';
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+
+	/* enough keys to grow the table several times */
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "key%d", i);
+		key.name = buxton_string_pack(name);
+		key.type = BUXTON_TYPE_INT32;
+		data.type = BUXTON_TYPE_INT32;
+		data.store.d_int32 = i;
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Setting value in memory store failed.");
+	}
+
+	/* remove every other key, and give the rest a large string value */
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "key%d", i);
+		key.name = buxton_string_pack(name);
+		if (i % 2) {
+			key.type = BUXTON_TYPE_INT32;
+			fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+				"Unsetting value in memory store failed.");
+			continue;
+		}
+		key.type = BUXTON_TYPE_STRING;
+		data.type = BUXTON_TYPE_STRING;
+		data.store.d_string = buxton_string_pack(i % 4 ? big : name);
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Replacing value in memory store failed.");
+	}
+
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "key%d", i);
+		key.name = buxton_string_pack(name);
+		key.type = BUXTON_TYPE_UNSET;
+		if (i % 2) {
+			fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+								  &dlabel, NULL) != ENOENT,
+				"Removed key %s still in memory store", name);
+			continue;
+		}
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, NULL),
+			"Retrieving value from memory store failed.");
+		fail_if(result.type != BUXTON_TYPE_STRING,
+			"Memory store returned the wrong type");
+		fail_if(!streq(result.store.d_string.value, i % 4 ? big : name),
+			"Memory store returned a different value for %s", name);
+		free(result.store.d_string.value);
+		free(dlabel.value);
+	}
+
+	/* a longer label must not clobber the value */
+	key.name = buxton_string_pack("key0");
+	dlabel = buxton_string_pack("a_much_longer_label_than_the_default");
+	fail_if(buxton_direct_set_label(&c, &key, &dlabel) == false,
+		"Setting key label in memory store failed.");
+	key.type = BUXTON_TYPE_STRING;
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+						  &dlabel, NULL),
+		"Retrieving relabeled value from memory store failed.");
+	fail_if(!streq(result.store.d_string.value, "key0"),
+		"Relabeling changed the value in memory store");
+	fail_if(!streq(dlabel.value, "a_much_longer_label_than_the_default"),
+		"Memory store returned the wrong label");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+
+	buxton_direct_close(&c);
+	free(big);
+}
+END_TEST
+
+#define CONCURRENCY_KEYS 64
+#define CONCURRENCY_ROUNDS 200
+
+static void *memory_backend_reader(void *data)
+{
+	BuxtonControl c = *(BuxtonControl *)data;
+	BuxtonData result = {0};
+	BuxtonString dlabel;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	char name[32];
+
+	key.layer = buxton_string_pack("temp");
+	key.group = buxton_string_pack("bxt_mem_concurrency_group");
+	key.type = BUXTON_TYPE_INT32;
+
+	for (int r = 0; r < CONCURRENCY_ROUNDS; r++) {
+		for (int i = 0; i < CONCURRENCY_KEYS; i++) {
+			snprintf(name, sizeof(name), "key%d", i);
+			key.name = buxton_string_pack(name);
+			if (buxton_direct_get_value_for_layer(&c, &key, &result,
+							      &dlabel, NULL)) {
+				return (void *)1;
+			}
+			free(dlabel.value);
+			/* the writer only ever adds multiples of CONCURRENCY_KEYS */
+			if (result.store.d_int32 % CONCURRENCY_KEYS != i) {
+				return (void *)1;
+			}
+		}
+	}
+	return NULL;
+}
+
+START_TEST(buxton_memory_backend_concurrency_check)
+{
+	BuxtonControl c;
+	BuxtonBackend *backend;
+	BuxtonData data = {0};
+	BuxtonString glabel;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	pthread_t readers[4];
+	char name[32];
+	void *ret;
+
+	group.layer = buxton_string_pack("temp");
+	group.group = buxton_string_pack("bxt_mem_concurrency_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+	key.layer = group.layer;
+	key.group = group.group;
+	key.type = BUXTON_TYPE_INT32;
+	data.type = BUXTON_TYPE_INT32;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	fail_if(!buxton_direct_load_backends(&c), "Failed to load backends");
+	backend = backend_for_layer(&c.config,
+				    hashmap_get(c.config.layers, "temp"));
+	fail_if(!backend || !backend->concurrent,
+		"Memory backend isn't concurrent");
+
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	for (int i = 0; i < CONCURRENCY_KEYS; i++) {
+		snprintf(name, sizeof(name), "key%d", i);
+		key.name = buxton_string_pack(name);
+		data.store.d_int32 = i;
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Setting value in memory store failed.");
+	}
+
+	for (int t = 0; t < 4; t++) {
+		fail_if(pthread_create(&readers[t], NULL, memory_backend_reader, &c),
+			"Failed to start reader thread");
+	}
+
+	/* rewrite the keys while they are being read */
+	for (int r = 1; r <= CONCURRENCY_ROUNDS; r++) {
+		for (int i = 0; i < CONCURRENCY_KEYS; i++) {
+			snprintf(name, sizeof(name), "key%d", i);
+			key.name = buxton_string_pack(name);
+			data.store.d_int32 = r * CONCURRENCY_KEYS + i;
+			fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+				"Concurrent set in memory store failed.");
+		}
+	}
+
+	for (int t = 0; t < 4; t++) {
+		fail_if(pthread_join(readers[t], &ret), "Failed to join reader thread");
+		fail_if(ret, "Reader thread got a wrong value");
+	}
+
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_log_backend_check)
+{
+	BuxtonControl c;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel, glabel;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	char path[PATH_MAX];
+	int fd;
+
+	group.layer = buxton_string_pack("test-log");
+	group.group = buxton_string_pack("bxt_log_test_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_log_test_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_test_value");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value in buxton log backend directly failed.");
+	data.store.d_string = buxton_string_pack("bxt_test_value2");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Overwriting value in buxton log backend directly failed.");
+	buxton_direct_close(&c);
+
+	/* Append a torn record, it must be dropped on replay */
+	snprintf(path, PATH_MAX, "%s/test-log.db", buxton_db_path());
+	fd = open(path, O_WRONLY | O_APPEND);
+	fail_if(fd == -1, "Failed to open log file");
+	fail_if(write(fd, "garbage", 7) != 7, "Failed to corrupt log file");
+	close(fd);
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL),
+		"Retrieving value from replayed log failed.");
+	fail_if(!streq(result.store.d_string.value, "bxt_test_value2"),
+		"Buxton log returned a different value to that set.");
+	free(result.store.d_string.value);
+	free(dlabel.value);
+	fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+		"Unsetting value in buxton log backend failed.");
+	buxton_direct_close(&c);
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_get_value_for_layer(&c, &key, &result, &dlabel, NULL) != ENOENT,
+		"Unset value came back after replay.");
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group from buxton log backend failed.");
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_log_compact_check)
+{
+	BuxtonControl c;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
+	BuxtonString dlabel = { NULL, 0 };
+	BuxtonString glabel = { NULL, 0 };
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	struct stat st;
+	char path[PATH_MAX];
+	char name[32];
+	char *value;
+	off_t size;
+
+	group.layer = buxton_string_pack("test-log");
+	group.group = buxton_string_pack("bxt_log_compact_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+	glabel = buxton_string_pack("*");
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.type = BUXTON_TYPE_STRING;
+
+	value = malloc(1024);
+	fail_if(!value, "Failed to allocate value");
+
+	memzero(&c, sizeof(BuxtonControl));
+	c.client.uid = getuid();
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+
+	/* Overwrite a few keys until the log is well past 64KiB, mostly dead */
+	data.type = BUXTON_TYPE_STRING;
+	for (int round = 0; round < 32; round++) {
+		for (int i = 0; i < 8; i++) {
+			snprintf(name, sizeof(name), "bxt_log_compact_key%d", i);
+			key.name = buxton_string_pack(name);
+			memset(value, 'a' + round % 26, 1023);
+			snprintf(value, 1024, "%d-%d", round, i);
+			value[strlen(value)] = '-';
+			value[1023] = '\0';
+			data.store.d_string = buxton_string_pack(value);
+			fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+				"Setting value in buxton log backend failed.");
+		}
+	}
+	snprintf(path, PATH_MAX, "%s/test-log.db", buxton_db_path());
+	fail_if(stat(path, &st) == -1, "Failed to stat log file");
+	size = st.st_size;
+
+	buxton_direct_sync(&c, false);
+	fail_if(stat(path, &st) == -1, "Failed to stat log file");
+	fail_if(st.st_size >= size, "Log wasn't compacted: %ld >= %ld",
+		(long)st.st_size, (long)size);
+	buxton_direct_close(&c);
+
+	/* Every key keeps its last value once the compacted log is replayed */
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	for (int i = 0; i < 8; i++) {
+		snprintf(name, sizeof(name), "bxt_log_compact_key%d", i);
+		key.name = buxton_string_pack(name);
+		memset(value, 'a' + 31 % 26, 1023);
+		snprintf(value, 1024, "%d-%d", 31, i);
+		value[strlen(value)] = '-';
+		value[1023] = '\0';
+		fail_if(buxton_direct_get_value_for_layer(&c, &key, &result,
+							  &dlabel, NULL),
+			"Retrieving value from compacted log failed.");
+		fail_if(!streq(result.store.d_string.value, value),
+			"Compacted log returned a different value to that set.");
+		free(result.store.d_string.value);
+		free(dlabel.value);
+	}
+	free(value);
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group from buxton log backend failed.");
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_key_check)
 {
 	char *group = "group";
@@ -310,7 +1053,7 @@ START_TEST(buxton_set_label_check)
 {
 	BuxtonControl c;
 	BuxtonString label = buxton_string_pack("*");
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("bxt_test");
 	key.name.value = NULL;
@@ -342,10 +1085,10 @@ END_TEST
 START_TEST(buxton_group_label_check)
 {
 	BuxtonControl c;
-	BuxtonData result;
+	BuxtonData result = {0};
 	BuxtonString dlabel;
 	BuxtonString label = buxton_string_pack("*");
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	key.layer = buxton_string_pack("test-gdbm");
 	key.group = buxton_string_pack("test-group");
 	key.name.value = NULL;
@@ -372,9 +1115,10 @@ END_TEST
 START_TEST(buxton_name_label_check)
 {
 	BuxtonControl c;
-	BuxtonData data, result;
+	BuxtonData data = {0};
+	BuxtonData result = {0};
 	BuxtonString label, dlabel;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 
 	/* create the group first, and validate the label */
 	key.layer = buxton_string_pack("test-gdbm");
@@ -484,7 +1228,7 @@ START_TEST(run_callback_check)
 	BuxtonData list[] = {
 		{BUXTON_TYPE_INT32, {.d_int32 = 1}}
 	};
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	key.group = buxton_string_pack("group");
 
 	run_callback(NULL, (void *)&data, 1, list, BUXTON_CONTROL_SET, &key);
@@ -511,7 +1255,7 @@ START_TEST(send_message_check)
 	uint8_t *dest = NULL;
 	uint8_t *source = NULL;
 	size_t size;
-	BuxtonData data;
+	BuxtonData data = {0};
 
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
@@ -557,7 +1301,7 @@ START_TEST(handle_callback_response_check)
 	int server;
 	size_t size;
 	bool test_data;
-	BuxtonData data;
+	BuxtonData data = {0};
 	uint32_t msgid;
 	BuxtonData good[] = {
 		{BUXTON_TYPE_INT32, {.d_int32 = 0}}
@@ -690,7 +1434,7 @@ START_TEST(buxton_wire_handle_response_check)
 	int server;
 	uint8_t *dest = NULL;
 	size_t size;
-	BuxtonData data;
+	BuxtonData data = {0};
 	bool test_data = true;
 
 	setup_socket_pair(&(client.fd), &server);
@@ -738,7 +1482,7 @@ START_TEST(buxton_wire_get_response_check)
 	int server;
 	uint8_t *dest = NULL;
 	size_t size;
-	BuxtonData data;
+	BuxtonData data = {0};
 	bool test_data = true;
 
 	setup_socket_pair(&(client.fd), &server);
@@ -787,7 +1531,7 @@ START_TEST(buxton_wire_set_value_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -847,7 +1591,7 @@ START_TEST(buxton_wire_set_label_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonString value;
 	BuxtonControlMessage msg;
 	uint32_t msgid;
@@ -940,7 +1684,7 @@ START_TEST(buxton_wire_get_value_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -1024,7 +1768,7 @@ START_TEST(buxton_wire_get_label_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -1106,7 +1850,7 @@ START_TEST(buxton_wire_unset_value_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -1165,7 +1909,7 @@ START_TEST(buxton_wire_create_group_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -1216,7 +1960,7 @@ START_TEST(buxton_wire_remove_group_check)
 	BuxtonData *list = NULL;
 	uint8_t buf[4096];
 	ssize_t r;
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonControlMessage msg;
 	uint32_t msgid;
 
@@ -1272,10 +2016,20 @@ buxton_suite(void)
 	tcase_add_test(tc, buxton_direct_open_check);
 	tcase_add_test(tc, buxton_direct_create_group_check);
 	tcase_add_test(tc, buxton_direct_remove_group_check);
+	tcase_add_test(tc, buxton_direct_remove_group_keys_check);
 	tcase_add_test(tc, buxton_direct_set_value_check);
+	tcase_add_test(tc, buxton_direct_sync_check);
+	tcase_add_test(tc, buxton_direct_reorganize_check);
+	tcase_add_test(tc, buxton_direct_user_db_cache_check);
 	tcase_add_test(tc, buxton_direct_get_value_for_layer_check);
 	tcase_add_test(tc, buxton_direct_get_value_check);
+	tcase_add_test(tc, buxton_compiled_backend_check);
+	tcase_add_test(tc, buxton_compiled_corrupt_check);
 	tcase_add_test(tc, buxton_memory_backend_check);
+	tcase_add_test(tc, buxton_memory_backend_store_check);
+	tcase_add_test(tc, buxton_memory_backend_concurrency_check);
+	tcase_add_test(tc, buxton_log_backend_check);
+	tcase_add_test(tc, buxton_log_compact_check);
 	tcase_add_test(tc, buxton_key_check);
 	tcase_add_test(tc, buxton_set_label_check);
 	tcase_add_test(tc, buxton_group_label_check);
@@ -30,8 +30,8 @@
 
 START_TEST(buxton_response_value_type_check)
 {
-	BuxtonData d1;
-	BuxtonData d2;
+	BuxtonData d1 = {0};
+	BuxtonData d2 = {0};
 	BuxtonArray *a = NULL;
 	_BuxtonResponse r;
 
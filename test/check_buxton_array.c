@@ -78,7 +78,7 @@ START_TEST(buxton_array_add_check)
 		"Failed to update array->len with the size of the array");
 	fail_if(*((int *)array->data[0]) != 1,
 		"Failed to store correct data value to array");
-	array->len = (uint16_t)(0 - 1);
+	array->len = UINT32_MAX;
 	fail_if(buxton_array_add(array, &data1),
 		"Able to add more than max number of elements");
 	array->len = 1;
@@ -153,7 +153,7 @@ START_TEST(buxton_array_check)
 
 	f = buxton_array_get(NULL, 0);
 	fail_if(f, "Got value from NULL array");
-	f = buxton_array_get(array, (uint16_t)(array->len + 1));
+	f = buxton_array_get(array, array->len + 1);
 	fail_if(f, "Got value from index bigger than maximum index");
 	value = (char *)buxton_array_get(array, 0);
 
@@ -169,6 +169,84 @@ START_TEST(buxton_array_check)
 }
 END_TEST
 
+START_TEST(buxton_array_reserve_check)
+{
+	BuxtonArray *array = NULL;
+	void **data;
+	int data1 = 1;
+
+	fail_if(buxton_array_reserve(NULL, 1), "Reserved space in NULL array");
+	array = buxton_array_new();
+	fail_if(!array, "Failed to allocate new array");
+	fail_if(!buxton_array_reserve(array, 0), "Failed to reserve nothing");
+	fail_if(array->data, "Allocated data for an empty reservation");
+	fail_if(!buxton_array_reserve(array, 100), "Failed to reserve 100");
+	fail_if(array->capacity < 100, "Reserved too few elements");
+	fail_if(array->len != 0, "Reserving changed array->len");
+	data = array->data;
+	for (int i = 0; i < 100; i++) {
+		fail_if(!buxton_array_add(array, &data1),
+			"Failed to add to reserved array");
+	}
+	fail_if(array->data != data, "Reallocated a reserved array");
+	fail_if(!buxton_array_reserve(array, 10),
+		"Failed to reserve less than the capacity");
+	fail_if(array->len != 100, "Shrinking reservation changed len");
+	buxton_array_free(&array, NULL);
+}
+END_TEST
+
+START_TEST(buxton_array_append_check)
+{
+	BuxtonArray *array = NULL;
+	void *items[3];
+	int data[3] = { 1, 2, 3 };
+	uint32_t capacity = 0;
+	int reallocs = 0;
+
+	for (int i = 0; i < 3; i++) {
+		items[i] = &data[i];
+	}
+	fail_if(buxton_array_append(NULL, items, 3),
+		"Appended data to NULL array");
+	array = buxton_array_new();
+	fail_if(!array, "Failed to allocate new array");
+	fail_if(buxton_array_append(array, NULL, 3),
+		"Appended NULL data to array");
+	fail_if(!buxton_array_append(array, items, 0),
+		"Failed to append nothing");
+	fail_if(!buxton_array_append(array, items, 3),
+		"Failed to append data to array");
+	fail_if(array->len != 3, "Wrong length after append");
+	for (uint32_t i = 0; i < 3; i++) {
+		fail_if(*(int *)buxton_array_get(array, i) != data[i],
+			"Wrong element %u after append", i);
+	}
+	items[1] = NULL;
+	fail_if(buxton_array_append(array, items, 3),
+		"Appended a NULL element to array");
+	fail_if(array->len != 3, "Failed append changed the length");
+	buxton_array_free(&array, NULL);
+
+	/* Arrays used to be limited to 65535 elements */
+	array = buxton_array_new();
+	fail_if(!array, "Failed to allocate new array");
+	for (uint32_t i = 0; i < 100000; i++) {
+		fail_if(!buxton_array_add(array, &data[i % 3]),
+			"Failed to add element %u", i);
+		if (array->capacity != capacity) {
+			capacity = array->capacity;
+			reallocs++;
+		}
+	}
+	fail_if(array->len != 100000, "Wrong length for large array");
+	fail_if(reallocs > 20, "Array grew %d times for 100000 adds", reallocs);
+	fail_if(*(int *)buxton_array_get(array, 99999) != data[99999 % 3],
+		"Wrong value for last element of large array");
+	buxton_array_free(&array, NULL);
+}
+END_TEST
+
 static Suite *
 buxton_array_suite(void)
 {
@@ -182,6 +260,8 @@ buxton_array_suite(void)
 	tcase_add_test(tc, buxton_array_add_check);
 	tcase_add_test(tc, buxton_array_get_check);
 	tcase_add_test(tc, buxton_array_check);
+	tcase_add_test(tc, buxton_array_reserve_check);
+	tcase_add_test(tc, buxton_array_append_check);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -449,7 +449,7 @@ START_TEST (bg_cb_check)
 	vstatus data;
 	data.type = BUXTON_TYPE_STRING;
 	BuxtonKey key = buxton_key_create("tg_s0", "keyname", "user", BUXTON_TYPE_STRING);
-	BuxtonData bd;
+	BuxtonData bd = {0};
 	bd.type = BUXTON_TYPE_STRING;
 	bd.store.d_string = buxton_string_pack("test");
 	BuxtonArray *a = buxton_array_new();
@@ -86,6 +86,18 @@ START_TEST(configurator_default_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_default_user_db_cache_size)
+{
+	fail_ne(buxton_user_db_cache_size(), 64);
+}
+END_TEST
+
+START_TEST(configurator_default_worker_threads)
+{
+	fail_ne(buxton_worker_threads(), 0);
+}
+END_TEST
+
 
 START_TEST(configurator_env_conf_file)
 {
@@ -122,6 +134,34 @@ START_TEST(configurator_env_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_env_user_db_cache_size)
+{
+	putenv("BUXTON_USER_DB_CACHE_SIZE=8");
+	fail_ne(buxton_user_db_cache_size(), 8);
+}
+END_TEST
+
+START_TEST(configurator_env_bad_user_db_cache_size)
+{
+	putenv("BUXTON_USER_DB_CACHE_SIZE=0");
+	fail_ne(buxton_user_db_cache_size(), 64);
+}
+END_TEST
+
+START_TEST(configurator_env_worker_threads)
+{
+	putenv("BUXTON_WORKER_THREADS=4");
+	fail_ne(buxton_worker_threads(), 4);
+}
+END_TEST
+
+START_TEST(configurator_env_bad_worker_threads)
+{
+	putenv("BUXTON_WORKER_THREADS=65");
+	fail_ne(buxton_worker_threads(), 0);
+}
+END_TEST
+
 
 START_TEST(configurator_cmd_conf_file)
 {
@@ -210,6 +250,20 @@ START_TEST(configurator_conf_module_dir)
 }
 END_TEST
 
+START_TEST(configurator_conf_user_db_cache_size)
+{
+	putenv("BUXTON_CONF_FILE=" ABS_TOP_SRCDIR "/test/test-configurator.conf");
+	fail_ne(buxton_user_db_cache_size(), 16);
+}
+END_TEST
+
+START_TEST(configurator_conf_worker_threads)
+{
+	putenv("BUXTON_CONF_FILE=" ABS_TOP_SRCDIR "/test/test-configurator.conf");
+	fail_ne(buxton_worker_threads(), 3);
+}
+END_TEST
+
 START_TEST(configurator_get_layers)
 {
 	ConfigLayer *layers = NULL;
@@ -225,12 +279,16 @@ START_TEST(configurator_get_layers)
 	fail_strne(layers[0].backend, "gdbm", false);
 	fail_strne(layers[0].description, "Operating System configuration layer", false);
 	fail_ne(layers[0].priority, 0);
+	fail_strne(layers[0].durability, "sync", false);
+	fail_ne(layers[0].sync_interval, 100);
 
 	fail_strne(layers[1].name, "isp", false);
 	fail_strne(layers[1].type, "System", false);
 	fail_strne(layers[1].backend, "gdbm", false);
 	fail_strne(layers[1].description, "ISP specific settings", false);
 	fail_ne(layers[1].priority, 1);
+	fail_strne(layers[1].durability, "group-commit", false);
+	fail_ne(layers[1].sync_interval, 50);
 
 	/* ... */
 
@@ -281,6 +339,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_default_db_path);
 	tcase_add_test(tc, configurator_default_smack_load_file);
 	tcase_add_test(tc, configurator_default_buxton_socket);
+	tcase_add_test(tc, configurator_default_user_db_cache_size);
+	tcase_add_test(tc, configurator_default_worker_threads);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("env clobbers defaults");
@@ -289,6 +349,10 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_env_db_path);
 	tcase_add_test(tc, configurator_env_smack_load_file);
 	tcase_add_test(tc, configurator_env_buxton_socket);
+	tcase_add_test(tc, configurator_env_user_db_cache_size);
+	tcase_add_test(tc, configurator_env_bad_user_db_cache_size);
+	tcase_add_test(tc, configurator_env_worker_threads);
+	tcase_add_test(tc, configurator_env_bad_worker_threads);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("command line clobbers all");
@@ -304,6 +368,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_conf_db_path);
 	tcase_add_test(tc, configurator_conf_smack_load_file);
 	tcase_add_test(tc, configurator_conf_buxton_socket);
+	tcase_add_test(tc, configurator_conf_user_db_cache_size);
+	tcase_add_test(tc, configurator_conf_worker_threads);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("config file works");
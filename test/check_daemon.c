@@ -37,6 +37,7 @@
 #include "hashmap.h"
 #include "log.h"
 #include "smack.h"
+#include "stats.h"
 #include "util.h"
 #include "buxtonlist.h"
 
@@ -182,6 +183,33 @@ static void do_write(int fd, const void *buf, size_t count)
 	}
 }
 
+/* Read until count whole messages are buffered, returns their size */
+static size_t read_messages(int fd, uint8_t *buf, size_t len, int count)
+{
+	size_t have = 0;
+	size_t offset;
+	size_t msize;
+	ssize_t ret;
+	int n;
+
+	for (;;) {
+		offset = 0;
+		for (n = 0; n < count; n++) {
+			msize = buxton_get_message_size(buf + offset, have - offset);
+			if (!msize || msize > have - offset) {
+				break;
+			}
+			offset += msize;
+		}
+		if (n == count) {
+			return offset;
+		}
+		ret = read(fd, buf + have, len - have);
+		fail_if(ret <= 0, "Read from client failed");
+		have += (size_t)ret;
+	}
+}
+
 START_TEST(buxton_open_check)
 {
 	BuxtonClient c = NULL;
@@ -529,10 +557,11 @@ END_TEST
 
 START_TEST(parse_list_check)
 {
+	BuxtonData l4[6];
 	BuxtonData l3[2];
 	BuxtonData l2[4];
 	BuxtonData l1[3];
-	_BuxtonKey key;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
 	BuxtonData *value = NULL;
 
 	fail_if(parse_list(BUXTON_CONTROL_NOTIFY, 2, l1, &key, &value),
@@ -566,6 +595,19 @@ START_TEST(parse_list_check)
 		"Failed to set correct notify name");
 	fail_if(key.type != l1[2].store.d_uint32,
 		"Failed to set correct notify type");
+	l2[0] = l1[0];
+	l2[1] = l1[1];
+	l2[2] = l1[2];
+	l2[3].type = BUXTON_TYPE_INT32;
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY, 4, l2, &key, &value),
+		"Parsed bad notify interval type");
+	l2[3].type = BUXTON_TYPE_UINT32;
+	l2[3].store.d_uint32 = 100;
+	value = NULL;
+	fail_if(!parse_list(BUXTON_CONTROL_NOTIFY, 4, l2, &key, &value),
+		"Unable to parse valid notify with interval");
+	fail_if(!value || value->store.d_uint32 != 100,
+		"Failed to set correct notify interval");
 
 	fail_if(parse_list(BUXTON_CONTROL_UNNOTIFY, 2, l1, &key, &value),
 		"Parsed bad unnotify argument count");
@@ -670,6 +712,65 @@ START_TEST(parse_list_check)
 	l1[2].type = BUXTON_TYPE_BOOLEAN;
 	fail_if(parse_list(BUXTON_CONTROL_GET, 3, l1, &key, &value),
 		"Parsed bad get type 7");
+	l2[3].type = BUXTON_TYPE_UINT32;
+	fail_if(parse_list(BUXTON_CONTROL_GET_IF_CHANGED, 4, l2, &key, &value),
+		"Parsed bad get if changed version type");
+	l2[3].type = BUXTON_TYPE_UINT64;
+	l2[3].store.d_uint64 = 42;
+	fail_if(parse_list(BUXTON_CONTROL_GET_IF_CHANGED, 1, &l2[3], &key,
+			   &value), "Parsed bad get if changed argument count");
+	fail_if(!parse_list(BUXTON_CONTROL_GET_IF_CHANGED, 4, l2, &key, &value),
+		"Unable to parse valid get if changed");
+	fail_if(!streq(key.group.value, l2[0].store.d_string.value),
+		"Failed to set correct get if changed group");
+	fail_if(!streq(key.name.value, l2[1].store.d_string.value),
+		"Failed to set correct get if changed name");
+	fail_if(value != &l2[3], "Failed to set correct get if changed version");
+
+	l4[0].type = BUXTON_TYPE_STRING;
+	l4[1].type = BUXTON_TYPE_STRING;
+	l4[2].type = BUXTON_TYPE_STRING;
+	l4[3].type = BUXTON_TYPE_INT32;
+	l4[4].type = BUXTON_TYPE_UINT64;
+	l4[5].type = BUXTON_TYPE_INT64;
+	l4[0].store.d_string = buxton_string_pack("s8");
+	l4[1].store.d_string = buxton_string_pack("s9");
+	l4[2].store.d_string = buxton_string_pack("s10");
+	l4[3].store.d_int32 = 7;
+	l4[4].store.d_uint64 = 42;
+	fail_if(parse_list(BUXTON_CONTROL_CAS, 4, l4, &key, &value),
+		"Parsed bad cas argument count");
+	fail_if(parse_list(BUXTON_CONTROL_CAS, 6, l4, &key, &value),
+		"Parsed cas with a mistyped expected value");
+	l4[5].type = BUXTON_TYPE_INT32;
+	fail_if(!parse_list(BUXTON_CONTROL_CAS, 6, l4, &key, &value),
+		"Unable to parse valid cas by value");
+	fail_if(!parse_list(BUXTON_CONTROL_CAS, 5, l4, &key, &value),
+		"Unable to parse valid cas by version");
+	fail_if(!streq(key.name.value, l4[2].store.d_string.value),
+		"Failed to set correct cas name");
+	fail_if(key.type != BUXTON_TYPE_INT32 || value != &l4[3],
+		"Failed to set correct cas value");
+	l4[4].type = BUXTON_TYPE_UINT32;
+	fail_if(parse_list(BUXTON_CONTROL_CAS, 5, l4, &key, &value),
+		"Parsed cas with a bad version type");
+
+	l4[3].type = BUXTON_TYPE_UINT32;
+	l4[3].store.d_uint32 = BUXTON_TYPE_STRING;
+	l4[4].type = BUXTON_TYPE_INT64;
+	l4[4].store.d_int64 = -1;
+	fail_if(parse_list(BUXTON_CONTROL_ADD, 5, l4, &key, &value),
+		"Parsed add to a string");
+	l4[3].store.d_uint32 = BUXTON_TYPE_UINT64;
+	fail_if(parse_list(BUXTON_CONTROL_ADD, 4, l4, &key, &value),
+		"Parsed bad add argument count");
+	fail_if(!parse_list(BUXTON_CONTROL_ADD, 5, l4, &key, &value),
+		"Unable to parse valid add");
+	fail_if(key.type != BUXTON_TYPE_UINT64 || value != &l4[4],
+		"Failed to set correct add type and delta");
+	l4[4].type = BUXTON_TYPE_UINT64;
+	fail_if(parse_list(BUXTON_CONTROL_ADD, 5, l4, &key, &value),
+		"Parsed add with a bad delta type");
 
 	fail_if(parse_list(BUXTON_CONTROL_GET_LABEL, 4, l2, &key, &value),
 		"Parsed bad get label argument count");
@@ -927,6 +1028,27 @@ START_TEST(parse_list_check)
 		"Failed to set correct remove group group 1");
 	fail_if(key.type != BUXTON_TYPE_STRING, "Failed to key type in remove group");
 
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 1, l3, &key, &value),
+		"Parsed bad notify prefix argument count");
+	l3[0].type = BUXTON_TYPE_STRING;
+	l3[1].type = BUXTON_TYPE_INT32;
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 2, l3, &key, &value),
+		"Parsed bad notify prefix type 2");
+	l3[0].type = BUXTON_TYPE_STRING;
+	l3[1].type = BUXTON_TYPE_STRING;
+	l3[0].store.d_string = buxton_string_pack("s20");
+	l3[1].store.d_string = buxton_string_pack("s21");
+	fail_if(!parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 2, l3, &key, &value),
+		"Unable to parse valid notify prefix 1");
+	fail_if(!streq(key.group.value, l3[0].store.d_string.value),
+		"Failed to set correct notify prefix group 1");
+	fail_if(!streq(key.name.value, l3[1].store.d_string.value),
+		"Failed to set correct notify prefix name 1");
+	fail_if(!parse_list(BUXTON_CONTROL_UNNOTIFY_PREFIX, 2, l3, &key, &value),
+		"Unable to parse valid unnotify prefix 1");
+	fail_if(!streq(key.name.value, l3[1].store.d_string.value),
+		"Failed to set correct unnotify prefix name 1");
+
 	fail_if(parse_list(BUXTON_CONTROL_MIN, 2, l3, &key, &value),
 		"Parsed bad control type 1");
 }
@@ -1001,7 +1123,7 @@ END_TEST
 START_TEST(set_label_check)
 {
 	_BuxtonKey key = { {0}, {0}, {0}, 0};
-	BuxtonData value;
+	BuxtonData value = {0};
 	client_list_item client;
 	int32_t status;
 	BuxtonDaemon server;
@@ -1031,7 +1153,7 @@ END_TEST
 START_TEST(set_value_check)
 {
 	_BuxtonKey key = { {0}, {0}, {0}, 0};
-	BuxtonData value;
+	BuxtonData value = {0};
 	client_list_item client;
 	int32_t status;
 	BuxtonDaemon server;
@@ -1157,6 +1279,7 @@ START_TEST(register_notification_check)
 	int32_t status;
 	BuxtonDaemon server;
 	uint32_t msgid;
+	BuxtonNotification *subscriptions;
 
 	fail_if(!buxton_cache_smack_rules(),
 		"Failed to cache smack rules");
@@ -1165,19 +1288,24 @@ START_TEST(register_notification_check)
 	else
 		client.smack_label = NULL;
 	client.cred.uid = 1002;
+	client.subscriptions = NULL;
+	no_client.subscriptions = NULL;
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
-	server.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	server.key_ids = buxton_key_table_new();
+	fail_if(!server.key_ids, "Failed to allocate key table");
+	server.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!server.notify_mapping, "Failed to allocate hashmap");
-	server.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!server.client_key_mapping, "Failed to allocate hashmap");
+	server.notify_prefixes = buxton_trie_new();
+	fail_if(!server.notify_prefixes, "Failed to allocate trie");
 
 	key.group = buxton_string_pack("group");
 	key.name = buxton_string_pack("name");
 	key.type = BUXTON_TYPE_STRING;
-	register_notification(&server, &client, &key, 1, &status);
+	register_notification(&server, &client, &key, 1, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
-	register_notification(&server, &client, &key, 1, &status);
+	register_notification(&server, &client, &key, 1, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
 	//FIXME: Figure out what to do with duplicates
 	key.group = buxton_string_pack("no-key");
@@ -1195,11 +1323,19 @@ START_TEST(register_notification_check)
 		"Unable to unregister from notifications");
 	fail_if(msgid != 1, "Failed to get correct notify message id");
 	key.group = buxton_string_pack("key2");
-	register_notification(&server, &client, &key, 0, &status);
+	register_notification(&server, &client, &key, 0, 0, &status);
 	fail_if(status == 0, "Registered notification with key not in db");
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("");
+	subscriptions = client.subscriptions;
+	register_notification(&server, &client, &key, 0, 0, &status);
+	fail_if(status == 0, "Registered notification without a key name");
+	fail_if(client.subscriptions != subscriptions,
+		"Linked a refused notification");
 
 	hashmap_free(server.notify_mapping);
-	hashmap_free(server.client_key_mapping);
+	buxton_key_table_free(server.key_ids);
+	buxton_trie_free(server.notify_prefixes, NULL);
 	buxton_direct_close(&server.buxton);
 }
 END_TEST
@@ -1209,7 +1345,7 @@ START_TEST(buxtond_handle_message_error_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1;
+	BuxtonData data1 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonArray *list = NULL;
@@ -1230,6 +1366,10 @@ START_TEST(buxtond_handle_message_error_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
 
 	cl.data = malloc(4);
 	fail_if(!cl.data, "Couldn't allocate blank message");
@@ -1260,6 +1400,8 @@ START_TEST(buxtond_handle_message_error_check)
 	fail_if(r, "Failed to detect max control size");
 
 	close(client);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&list, NULL);
 }
@@ -1270,7 +1412,8 @@ START_TEST(buxtond_handle_message_create_group_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1299,10 +1442,15 @@ START_TEST(buxtond_handle_message_create_group_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	out_list1 = buxton_array_new();
 	fail_if(!out_list1, "Failed to allocate list");
@@ -1367,7 +1515,9 @@ START_TEST(buxtond_handle_message_create_group_check)
 	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list1, NULL);
 	buxton_array_free(&out_list2, NULL);
@@ -1379,7 +1529,8 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1410,10 +1561,15 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1447,7 +1603,9 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1458,7 +1616,9 @@ START_TEST(buxtond_handle_message_set_label_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2, data3;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1489,10 +1649,15 @@ START_TEST(buxtond_handle_message_set_label_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1530,7 +1695,9 @@ START_TEST(buxtond_handle_message_set_label_check)
 	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1541,7 +1708,10 @@ START_TEST(buxtond_handle_message_set_value_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2, data3, data4;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1572,10 +1742,15 @@ START_TEST(buxtond_handle_message_set_value_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1623,19 +1798,202 @@ START_TEST(buxtond_handle_message_set_value_check)
 	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
 END_TEST
 
+/* Handle a request of up to 6 parameters, and read back its reply */
+static ssize_t handle_request(BuxtonDaemon *daemon, client_list_item *cl,
+			      int client, BuxtonControlMessage msg,
+			      BuxtonData *params, uint32_t count,
+			      BuxtonData **list)
+{
+	BuxtonArray *in;
+	BuxtonControlMessage reply;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	size_t size;
+	ssize_t s;
+
+	in = buxton_array_new();
+	fail_if(!in, "Failed to allocate list");
+	for (uint32_t i = 0; i < count; i++) {
+		fail_if(!buxton_array_add(in, &params[i]),
+			"Failed to add element to array");
+	}
+	size = buxton_serialize_message(&cl->data, msg, 0, in);
+	fail_if(size == 0, "Failed to serialize message");
+	fail_if(!buxtond_handle_message(daemon, cl, size),
+		"Failed to handle message");
+	free(cl->data);
+	buxton_array_free(&in, NULL);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	s = buxton_deserialize_message(buf, &reply, (size_t)s, &msgid, list);
+	fail_if(reply != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+
+	return s;
+}
+
+START_TEST(buxtond_handle_message_cas_add_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	BuxtonData params[6];
+	client_list_item cl;
+	BuxtonData *list;
+	ssize_t csize;
+	int client, server;
+	uint64_t version;
+	uint32_t count;
+	uint64_t head;
+	BuxtonChange changes[8];
+
+	setup_socket_pair(&client, &server);
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+
+	params[0].type = BUXTON_TYPE_STRING;
+	params[0].store.d_string = buxton_string_pack("base");
+	params[1].type = BUXTON_TYPE_STRING;
+	params[1].store.d_string = buxton_string_pack("daemon-check");
+	params[2].type = BUXTON_TYPE_STRING;
+	params[2].store.d_string = buxton_string_pack("counter");
+
+	/* Start from a known value */
+	params[3].type = BUXTON_TYPE_INT64;
+	params[3].store.d_int64 = 10;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_SET,
+			       params, 4, &list);
+	fail_if(csize != 1 || list[0].store.d_int32 != 0,
+		"Failed to set counter");
+	free(list);
+
+	params[3].type = BUXTON_TYPE_UINT32;
+	params[3].store.d_uint32 = BUXTON_TYPE_INT64;
+	params[4].type = BUXTON_TYPE_INT64;
+	params[4].store.d_int64 = 5;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_ADD,
+			       params, 5, &list);
+	fail_if(csize != 3, "Failed to get correct response to add");
+	fail_if(list[0].store.d_int32 != 0, "Failed to add to counter");
+	fail_if(list[1].type != BUXTON_TYPE_INT64 ||
+		list[1].store.d_int64 != 15, "Failed to get added value");
+	fail_if(list[2].type != BUXTON_TYPE_UINT64 ||
+		list[2].store.d_uint64 == 0, "Failed to get added version");
+	version = list[2].store.d_uint64;
+	free(list);
+
+	params[4].store.d_int64 = INT64_MAX;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_ADD,
+			       params, 5, &list);
+	fail_if(csize != 1 || list[0].store.d_int32 == 0,
+		"Failed to detect add overflow");
+	free(list);
+
+	params[3].store.d_uint32 = BUXTON_TYPE_INT32;
+	params[4].store.d_int64 = 1;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_ADD,
+			       params, 5, &list);
+	fail_if(csize != 1 || list[0].store.d_int32 == 0,
+		"Failed to detect add type mismatch");
+	free(list);
+
+	/* Set by version, then again with the now stale version */
+	params[3].type = BUXTON_TYPE_INT64;
+	params[3].store.d_int64 = 100;
+	params[4].type = BUXTON_TYPE_UINT64;
+	params[4].store.d_uint64 = version;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_CAS,
+			       params, 5, &list);
+	fail_if(csize != 3, "Failed to get correct response to cas");
+	fail_if(list[0].store.d_int32 != 0, "Failed to compare and set");
+	fail_if(list[1].store.d_int64 != 100, "Failed to get set value");
+	fail_if(list[2].store.d_uint64 <= version, "Failed to get new version");
+	version = list[2].store.d_uint64;
+	free(list);
+
+	params[3].store.d_int64 = 200;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_CAS,
+			       params, 5, &list);
+	fail_if(csize != 3, "Failed to get correct response to stale cas");
+	fail_if(list[0].store.d_int32 != BUXTON_STATUS_MISMATCH,
+		"Failed to detect version mismatch");
+	fail_if(list[1].store.d_int64 != 100, "Failed to get current value");
+	fail_if(list[2].store.d_uint64 != version,
+		"Failed to get current version");
+	free(list);
+
+	/* Set by value */
+	params[5].type = BUXTON_TYPE_INT64;
+	params[5].store.d_int64 = 99;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_CAS,
+			       params, 6, &list);
+	fail_if(csize != 3 || list[0].store.d_int32 != BUXTON_STATUS_MISMATCH,
+		"Failed to detect value mismatch");
+	free(list);
+
+	params[5].store.d_int64 = 100;
+	csize = handle_request(&daemon, &cl, client, BUXTON_CONTROL_CAS,
+			       params, 6, &list);
+	fail_if(csize != 3 || list[0].store.d_int32 != 0,
+		"Failed to compare and set by value");
+	fail_if(list[1].store.d_int64 != 200, "Failed to set by value");
+	free(list);
+
+	/* Each update that succeeded is a single change */
+	fail_if(!buxton_change_log_read(daemon.changes, 0, changes, 8, &count,
+					&head), "Failed to read changes");
+	fail_if(count != 4, "Failed to record updates as changes");
+	for (uint32_t i = 0; i < count; i++) {
+		buxton_key_id_unref(changes[i].id);
+	}
+
+	cleanup_callbacks();
+	close(client);
+	hashmap_free(daemon.notify_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
 START_TEST(buxtond_handle_message_get_check)
 {
 	int client, server;
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2, data3, data4;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
+	BuxtonData data5 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1646,6 +2004,8 @@ START_TEST(buxtond_handle_message_get_check)
 	ssize_t s;
 	uint8_t buf[4096];
 	uint32_t msgid;
+	uint64_t version;
+	BuxtonOpStats stats;
 
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
@@ -1662,6 +2022,10 @@ START_TEST(buxtond_handle_message_get_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("test-gdbm-user");
@@ -1689,7 +2053,7 @@ START_TEST(buxtond_handle_message_get_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 2, "Failed to get valid message from buffer");
+	fail_if(csize != 3, "Failed to get valid message from buffer");
 	fail_if(msg != BUXTON_CONTROL_STATUS,
 		"Failed to get correct control type");
 	fail_if(msgid != 0, "Failed to get correct message id");
@@ -1699,7 +2063,60 @@ START_TEST(buxtond_handle_message_get_check)
 	fail_if(list[1].type != BUXTON_TYPE_STRING, "Failed to get correct value type");
 	fail_if(!streq(list[1].store.d_string.value, "user-layer-value"),
 		"Failed to get correct value");
+	fail_if(list[2].type != BUXTON_TYPE_UINT64,
+		"Failed to get correct version type");
+	version = list[2].store.d_uint64;
+	fail_if(version == 0, "Failed to get value version");
+
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* The version just read is current, so only it comes back */
+	data5.type = BUXTON_TYPE_UINT64;
+	data5.store.d_uint64 = version;
+	r = buxton_array_add(out_list, &data5);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_IF_CHANGED,
+					0, out_list);
+	fail_if(size == 0, "Failed to serialize conditional get");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle conditional get");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get unmodified response");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(list[0].store.d_int32 != BUXTON_STATUS_NOT_MODIFIED,
+		"Failed to report unmodified value");
+	fail_if(list[1].type != BUXTON_TYPE_UINT64 ||
+		list[1].store.d_uint64 != version,
+		"Failed to get unmodified version");
+	free(list);
+	buxton_stats_get(BUXTON_CONTROL_GET_IF_CHANGED, &stats);
+	fail_if(stats.count == 0 || stats.errors != 0,
+		"Counted an unmodified value as an error");
+
+	/* Any other version gets the value */
+	data5.store.d_uint64 = version - 1;
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_IF_CHANGED,
+					0, out_list);
+	fail_if(size == 0, "Failed to serialize conditional get");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle conditional get");
 
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 3, "Failed to get modified response");
+	fail_if(list[0].store.d_int32 != 0, "Failed to get modified value");
+	fail_if(!streq(list[1].store.d_string.value, "user-layer-value"),
+		"Failed to get correct modified value");
+	fail_if(list[2].store.d_uint64 != version,
+		"Failed to get current version");
 	free(list[1].store.d_string.value);
 	free(list);
 
@@ -1721,7 +2138,7 @@ START_TEST(buxtond_handle_message_get_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed 2");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 2, "Failed to get correct response to get 2");
+	fail_if(csize != 3, "Failed to get correct response to get 2");
 	fail_if(msg != BUXTON_CONTROL_STATUS,
 		"Failed to get correct control type 2");
 	fail_if(msgid != 0, "Failed to get correct message id 2");
@@ -1735,6 +2152,8 @@ START_TEST(buxtond_handle_message_get_check)
 	free(list[1].store.d_string.value);
 	free(list);
 	close(client);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 	buxton_array_free(&out_list2, NULL);
@@ -1746,7 +2165,8 @@ START_TEST(buxtond_handle_message_get_label_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1777,10 +2197,15 @@ START_TEST(buxtond_handle_message_get_label_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1817,7 +2242,9 @@ START_TEST(buxtond_handle_message_get_label_check)
 	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1829,7 +2256,9 @@ START_TEST(buxtond_handle_message_notify_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2, data3;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1851,11 +2280,17 @@ START_TEST(buxtond_handle_message_notify_check)
 	else
 		cl.smack_label = NULL;
 	cl.cred.uid = 1002;
+	cl.subscriptions = NULL;
 	daemon.buxton.client.uid = 1001;
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
@@ -1919,7 +2354,9 @@ START_TEST(buxtond_handle_message_notify_check)
 	free(list);
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1931,7 +2368,10 @@ START_TEST(buxtond_handle_message_unset_check)
 	BuxtonDaemon daemon;
 	BuxtonString slabel;
 	size_t size;
-	BuxtonData data1, data2, data3, data4;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
 	client_list_item cl;
 	bool r;
 	BuxtonData *list;
@@ -1957,10 +2397,15 @@ START_TEST(buxtond_handle_message_unset_check)
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -2000,123 +2445,372 @@ START_TEST(buxtond_handle_message_unset_check)
 	free(list);
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
 END_TEST
 
-START_TEST(buxtond_notify_clients_check)
+START_TEST(buxtond_handle_message_stats_check)
 {
 	int client, server;
 	BuxtonDaemon daemon;
-	_BuxtonKey key;
-	BuxtonString slabel;
-	BuxtonData value1, value2;
+	size_t size;
+	BuxtonData data1 = {0};
 	client_list_item cl;
-	int32_t status;
 	bool r;
 	BuxtonData *list;
+	BuxtonArray *out_list;
 	BuxtonControlMessage msg;
 	ssize_t csize;
 	ssize_t s;
 	uint8_t buf[4096];
 	uint32_t msgid;
+	bool found = false;
 
 	setup_socket_pair(&client, &server);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
 
 	cl.fd = server;
-	slabel = buxton_string_pack("_");
-	if (use_smack())
-		cl.smack_label = &slabel;
-	else
-		cl.smack_label = NULL;
+	cl.smack_label = NULL;
 	cl.cred.uid = 1002;
-	daemon.notify_mapping = hashmap_new(string_hash_func,
-					    string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
-	fail_if(!buxton_cache_smack_rules(),
-		"Failed to cache Smack rules");
+	daemon.buxton.client.uid = 1001;
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
 
-	value1.type = BUXTON_TYPE_STRING;
-	value1.store.d_string = buxton_string_pack("dummy value");
-	key.group = buxton_string_pack("dummy");
-	key.name = buxton_string_pack("name");
-	buxtond_notify_clients(&daemon, &cl, &key, &value1);
-
-	value1.store.d_string = buxton_string_pack("real value");
-	key.group = buxton_string_pack("daemon-check");
-	key.name = buxton_string_pack("name");
-	key.layer = buxton_string_pack("base");
-	key.type = BUXTON_TYPE_STRING;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value1);
+	/* The request takes no parameters */
+	data1.type = BUXTON_TYPE_STRING;
+	data1.store.d_string = buxton_string_pack("base");
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_STATS, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Accepted stats request with parameters");
 
-	value2.type = BUXTON_TYPE_STRING;
-	value2.store.d_string = buxton_string_pack("new value");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_STATS, 4,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle stats request");
 
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify string");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
+	fail_if(csize < 1 || (csize - 1) % 2 != 0,
+		"Failed to get correct response to stats");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
 		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_STRING,
-		"Failed to get correct notification value type string");
-	fail_if(!streq(list[0].store.d_string.value, "new value"),
-		"Failed to get correct notification value data string");
+	fail_if(msgid != 4, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32,
+		"Failed to get correct indicator type");
+	fail_if(list[0].store.d_int32 != 0, "Failed to get stats");
+
+	/* The rejected request has been counted */
+	for (ssize_t i = 1; i < csize; i += 2) {
+		fail_if(list[i].type != BUXTON_TYPE_STRING,
+			"Failed to get counter name");
+		fail_if(list[i + 1].type != BUXTON_TYPE_UINT64,
+			"Failed to get counter value");
+		if (streq(list[i].store.d_string.value, "stats.errors")) {
+			fail_if(list[i + 1].store.d_uint64 != 1,
+				"Failed to count failed stats request");
+			found = true;
+		}
+		free(list[i].store.d_string.value);
+	}
+	fail_if(!found, "Failed to report stats counters");
 
-	free(list[0].store.d_string.value);
 	free(list);
+	close(client);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
 
-	key.group = buxton_string_pack("group");
-	key.name.value = NULL;
-	key.name.length = 0;
-	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
-	fail_if(!r, "Unable to create group");
-	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
-	fail_if(!r, "Unable set group label");
+START_TEST(buxtond_handle_message_changes_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	size_t size;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
+	client_list_item cl;
+	bool r;
+	BuxtonData *list;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
 
-	value1.type = BUXTON_TYPE_INT32;
-	value1.store.d_int32 = 1;
-	value2.type = BUXTON_TYPE_INT32;
-	value2.store.d_int32 = 2;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("name32");
-	key.type = BUXTON_TYPE_INT32;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	setup_socket_pair(&client, &server);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 100);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+
+	/* The sequence number is a BUXTON_TYPE_UINT64 */
+	data1.type = BUXTON_TYPE_STRING;
+	data1.store.d_string = buxton_string_pack("base");
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_CHANGES, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Accepted changes request without sequence number");
 
+	/* A successful set is recorded */
+	data2.type = BUXTON_TYPE_STRING;
+	data2.store.d_string = buxton_string_pack("daemon-check");
+	data3.type = BUXTON_TYPE_STRING;
+	data3.store.d_string = buxton_string_pack("name");
+	data4.type = BUXTON_TYPE_STRING;
+	data4.store.d_string = buxton_string_pack("bxt_test_value3");
+	r = buxton_array_add(out_list, &data2);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data3);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data4);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_SET, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle set message");
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify int32");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
-		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_INT32,
-		"Failed to get correct notification value type int32");
-	fail_if(list[0].store.d_int32 != 2,
-		"Failed to get correct notification value data int32");
-
+	fail_if(csize != 1 || list[0].store.d_int32 != 0, "Failed to set");
+	free(list);
+
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_UINT64;
+	data1.store.d_uint64 = 100;
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_CHANGES, 3,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle changes request");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 7, "Failed to get correct response to changes");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(msgid != 3, "Failed to get correct message id");
+	fail_if(list[0].store.d_int32 != 0, "Failed to get changes");
+	fail_if(list[1].type != BUXTON_TYPE_UINT64 ||
+		list[1].store.d_uint64 != 101,
+		"Failed to get sequence number to resume from");
+	fail_if(list[2].store.d_boolean || list[3].store.d_boolean,
+		"Failed to get changes flags");
+	fail_if(!streq(list[4].store.d_string.value, "base") ||
+		!streq(list[5].store.d_string.value, "daemon-check") ||
+		!streq(list[6].store.d_string.value, "name"),
+		"Failed to get changed key");
+	for (ssize_t i = 4; i < csize; i++) {
+		free(list[i].store.d_string.value);
+	}
+	free(list);
+
+	/* Sequence numbers of an earlier instance need a resync */
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.store.d_uint64 = 5000;
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_CHANGES, 4,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle stale changes request");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 4, "Failed to get correct response to stale changes");
+	fail_if(list[1].store.d_uint64 != 101 || !list[2].store.d_boolean ||
+		list[3].store.d_boolean,
+		"Failed to request a resync");
+	free(list);
+
+	close(client);
+	hashmap_free(daemon.notify_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_notify_clients_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value1 = {0};
+	BuxtonData value2 = {0};
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_socket_pair(&client, &server);
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	cl.subscriptions = NULL;
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value1.type = BUXTON_TYPE_STRING;
+	value1.store.d_string = buxton_string_pack("dummy value");
+	key.group = buxton_string_pack("dummy");
+	key.name = buxton_string_pack("name");
+	buxtond_notify_clients(&daemon, &cl, &key, &value1);
+
+	value1.store.d_string = buxton_string_pack("real value");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("name");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value1);
+
+	value2.type = BUXTON_TYPE_STRING;
+	value2.store.d_string = buxton_string_pack("new value");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2,
+		"Failed to get correct response to notify string");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_STRING,
+		"Failed to get correct notification value type string");
+	fail_if(!streq(list[0].store.d_string.value, "new value"),
+		"Failed to get correct notification value data string");
+
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list);
+
+	key.group = buxton_string_pack("group");
+	key.name.value = NULL;
+	key.name.length = 0;
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set group label");
+
+	value1.type = BUXTON_TYPE_INT32;
+	value1.store.d_int32 = 1;
+	value2.type = BUXTON_TYPE_INT32;
+	value2.store.d_int32 = 2;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("name32");
+	key.type = BUXTON_TYPE_INT32;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2,
+		"Failed to get correct response to notify int32");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32,
+		"Failed to get correct notification value type int32");
+	fail_if(list[0].store.d_int32 != 2,
+		"Failed to get correct notification value data int32");
+
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_UINT32;
@@ -2129,7 +2823,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2137,7 +2831,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify uint32");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2147,6 +2841,7 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_uint32 != 2,
 		"Failed to get correct notification value data uint32");
 
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_INT64;
@@ -2159,7 +2854,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2167,7 +2862,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify int64");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2177,6 +2872,7 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_int64 != 3,
 		"Failed to get correct notification value data int64");
 
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_UINT64;
@@ -2189,7 +2885,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2197,7 +2893,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify uint64");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2207,6 +2903,7 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_uint64 != 3,
 		"Failed to get correct notification value data uint64");
 
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_FLOAT;
@@ -2219,7 +2916,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2227,7 +2924,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify float");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2237,6 +2934,7 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_float != 3.14F,
 		"Failed to get correct notification value data float");
 
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_DOUBLE;
@@ -2249,7 +2947,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2257,7 +2955,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify double");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2267,6 +2965,7 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_double != 3.1415F,
 		"Failed to get correct notification value data double");
 
+	free(list[1].store.d_string.value);
 	free(list);
 
 	value1.type = BUXTON_TYPE_BOOLEAN;
@@ -2279,7 +2978,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2287,7 +2986,7 @@ START_TEST(buxtond_notify_clients_check)
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
+	fail_if(csize != 2,
 		"Failed to get correct response to notify bool");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
@@ -2297,12 +2996,604 @@ START_TEST(buxtond_notify_clients_check)
 	fail_if(list[0].store.d_boolean != true,
 		"Failed to get correct notification value data bool");
 
+	free(list[1].store.d_string.value);
 	free(list);
 	close(client);
 	buxton_direct_close(&daemon.buxton);
 }
 END_TEST
 
+START_TEST(buxtond_notify_shared_value_check)
+{
+	int client1, server1, client2, server2;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value1 = {0};
+	BuxtonData value2 = {0};
+	client_list_item cl1, cl2;
+	BuxtonNotifyKey *nkey;
+	BuxtonKeyId *id;
+	BuxtonNotification *n1, *n2;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_socket_pair(&client1, &server1);
+	setup_socket_pair(&client2, &server2);
+	fail_if(fcntl(client1, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(client2, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	slabel = buxton_string_pack("_");
+	cl1.fd = server1;
+	cl2.fd = server2;
+	if (use_smack()) {
+		cl1.smack_label = &slabel;
+		cl2.smack_label = &slabel;
+	} else {
+		cl1.smack_label = NULL;
+		cl2.smack_label = NULL;
+	}
+	cl1.cred.uid = 1002;
+	cl2.cred.uid = 1002;
+	cl1.subscriptions = NULL;
+	cl2.subscriptions = NULL;
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	key.layer = buxton_string_pack("base");
+	key.group = buxton_string_pack("notify-shared");
+	key.name.value = NULL;
+	key.name.length = 0;
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set group label");
+
+	value1.type = BUXTON_TYPE_INT32;
+	value1.store.d_int32 = 1;
+	value2.type = BUXTON_TYPE_INT32;
+	value2.store.d_int32 = 2;
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_INT32;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl1, &key, 1, 0, &status);
+	fail_if(status != 0, "Failed to register first notification");
+	register_notification(&daemon, &cl2, &key, 2, 0, &status);
+	fail_if(status != 0, "Failed to register second notification");
+
+	id = buxton_key_intern(daemon.key_ids, &key);
+	fail_if(!id, "Failed to intern watched key");
+	nkey = hashmap_get(daemon.notify_mapping, id);
+	fail_if(!nkey || nkey->id != id, "Failed to find watched key");
+	n1 = cl1.subscriptions;
+	n2 = cl2.subscriptions;
+	fail_if(!n1 || !n2 || n1->nkey != nkey || n2->nkey != nkey,
+		"Failed to link registrations to key and clients");
+	fail_if(n1->value != n2->value || n1->value != nkey->value,
+		"Failed to share the registered value");
+	fail_if(nkey->value->refcount != 3,
+		"Failed to count references to the registered value");
+
+	/* Unchanged values are not sent */
+	buxtond_notify_clients(&daemon, &cl1, &key, &value1);
+	fail_if(read(client1, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified first client of an unchanged value");
+	fail_if(read(client2, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified second client of an unchanged value");
+
+	buxtond_notify_clients(&daemon, &cl1, &key, &value2);
+	fail_if(n1->value != n2->value || n1->value != nkey->value,
+		"Failed to share the notified value");
+	fail_if(nkey->value->refcount != 3,
+		"Failed to release the replaced value");
+	fail_if(nkey->value->data->store.d_int32 != 2,
+		"Failed to save the notified value");
+
+	s = read(client1, buf, 4096);
+	fail_if(s < 0, "Read from first client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get notification for first client");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 1, "Failed to get first client's message id");
+	fail_if(list[0].store.d_int32 != 2,
+		"Failed to get correct notification value for first client");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	s = read(client2, buf, 4096);
+	fail_if(s < 0, "Read from second client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get notification for second client");
+	fail_if(msgid != 2, "Failed to get second client's message id");
+	fail_if(list[0].store.d_int32 != 2,
+		"Failed to get correct notification value for second client");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	buxtond_notify_clients(&daemon, &cl1, &key, &value2);
+	fail_if(read(client1, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified first client twice of the same value");
+
+	/* A set overtaken by a newer one of the same key is dropped */
+	value2.store.d_int32 = 3;
+	value2.version = value1.version + 2;
+	buxtond_notify_clients(&daemon, &cl1, &key, &value2);
+	s = read(client1, buf, 4096);
+	fail_if(s < 0, "Failed to notify first client of the newer value");
+	s = read(client2, buf, 4096);
+	fail_if(s < 0, "Failed to notify second client of the newer value");
+	value1.version++;
+	buxtond_notify_clients(&daemon, &cl1, &key, &value1);
+	fail_if(read(client1, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified first client of a stale value");
+	fail_if(read(client2, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified second client of a stale value");
+	fail_if(nkey->value->data->store.d_int32 != 3,
+		"Stale value replaced the newer one");
+
+	msgid = unregister_notification(&daemon, &cl1, &key, &status);
+	fail_if(status != 0 || msgid != 1,
+		"Failed to unregister first notification");
+	fail_if(nkey->value->refcount != 2,
+		"Failed to release value of unregistered client");
+	msgid = unregister_notification(&daemon, &cl2, &key, &status);
+	fail_if(status != 0 || msgid != 2,
+		"Failed to unregister second notification");
+	fail_if(hashmap_get(daemon.notify_mapping, id),
+		"Failed to remove key without watchers");
+	buxton_key_id_unref(id);
+	fail_if(buxton_key_table_size(daemon.key_ids) != 0,
+		"Failed to release identity of key without watchers");
+
+	close(client1);
+	close(client2);
+	close(server1);
+	close(server2);
+	hashmap_free(daemon.notify_mapping);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_coalesce_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value = {0};
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	int timeout;
+
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	slabel = buxton_string_pack("_");
+	cl.fd = server;
+	if (use_smack()) {
+		cl.smack_label = &slabel;
+	} else {
+		cl.smack_label = NULL;
+	}
+	cl.cred.uid = 1002;
+	cl.subscriptions = NULL;
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	key.layer = buxton_string_pack("base");
+	key.group = buxton_string_pack("notify-coalesce");
+	key.name.value = NULL;
+	key.name.length = 0;
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set group label");
+
+	value.type = BUXTON_TYPE_INT32;
+	value.store.d_int32 = 0;
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_INT32;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 7, 200, &status);
+	fail_if(status != 0, "Failed to register coalesced notification");
+	fail_if(buxtond_notify_flush() != -1, "Held a change before any");
+
+	/* The first change is sent, the burst after it is held */
+	for (int32_t i = 1; i <= 5; i++) {
+		value.store.d_int32 = i;
+		buxtond_notify_clients(&daemon, &cl, &key, &value);
+	}
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2 || msgid != 7 || list[0].store.d_int32 != 1,
+		"Failed to send the first change right away");
+	free(list[1].store.d_string.value);
+	free(list);
+	fail_if(read(client, buf, 4096) != -1 || errno != EAGAIN,
+		"Sent changes within the interval");
+
+	timeout = buxtond_notify_flush();
+	fail_if(timeout <= 0 || timeout > 200, "Wrong flush timeout %d", timeout);
+	fail_if(read(client, buf, 4096) != -1 || errno != EAGAIN,
+		"Flushed a change before the interval elapsed");
+	usleep((useconds_t)(timeout + 10) * 1000);
+	fail_if(buxtond_notify_flush() != -1, "Held changes after a flush");
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2 || msgid != 7 || list[0].store.d_int32 != 5,
+		"Failed to coalesce the burst into its newest value");
+	free(list[1].store.d_string.value);
+	free(list);
+	fail_if(read(client, buf, 4096) != -1 || errno != EAGAIN,
+		"Sent more than the newest value");
+
+	/* A burst back to the value the client has sends nothing */
+	value.store.d_int32 = 6;
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	value.store.d_int32 = 5;
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	fail_if(buxtond_notify_flush() != -1,
+		"Held a change back to the client's value");
+	fail_if(read(client, buf, 4096) != -1 || errno != EAGAIN,
+		"Sent a change back to the client's value");
+
+	/* Unregistering drops the held change */
+	value.store.d_int32 = 8;
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	fail_if(buxtond_notify_flush() <= 0, "Failed to hold a change");
+	msgid = unregister_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0 || msgid != 7,
+		"Failed to unregister coalesced notification");
+	fail_if(buxtond_notify_flush() != -1,
+		"Kept the change held for an unregistered client");
+
+	close(client);
+	close(server);
+	hashmap_free(daemon.notify_mapping);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_layers_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value = {0};
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	slabel = buxton_string_pack("_");
+	cl.fd = server;
+	if (use_smack()) {
+		cl.smack_label = &slabel;
+	} else {
+		cl.smack_label = NULL;
+	}
+	cl.cred.uid = 1002;
+	cl.subscriptions = NULL;
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	/* temp has a higher priority than base */
+	key.group = buxton_string_pack("notify-layers");
+	key.name.value = NULL;
+	key.name.length = 0;
+	key.type = BUXTON_TYPE_STRING;
+	key.layer = buxton_string_pack("base");
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create base group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set base group label");
+	key.layer = buxton_string_pack("temp");
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create temp group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set temp group label");
+
+	value.type = BUXTON_TYPE_INT32;
+	value.store.d_int32 = 1;
+	key.layer = buxton_string_pack("base");
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_INT32;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
+	fail_if(!r, "Failed to set base value");
+	register_notification(&daemon, &cl, &key, 3, 0, &status);
+	fail_if(status != 0, "Failed to register notification");
+
+	/* A higher layer is sent with its name */
+	value.store.d_int32 = 2;
+	key.layer = buxton_string_pack("temp");
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
+	fail_if(!r, "Failed to set temp value");
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2 || msg != BUXTON_CONTROL_CHANGED || msgid != 3,
+		"Failed to get notification of temp value");
+	fail_if(list[0].store.d_int32 != 2, "Failed to get temp value");
+	fail_if(list[1].type != BUXTON_TYPE_STRING ||
+		!streq(list[1].store.d_string.value, "temp"),
+		"Failed to get layer of temp value");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* Changes hidden by the higher layer are not sent */
+	value.store.d_int32 = 3;
+	key.layer = buxton_string_pack("base");
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
+	fail_if(!r, "Failed to set base value");
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	fail_if(read(client, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified client of a hidden change");
+
+	/* Unsetting the higher layer reveals the lower one */
+	key.layer = buxton_string_pack("temp");
+	r = buxton_direct_unset_value(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Failed to unset temp value");
+	buxtond_notify_clients(&daemon, &cl, &key, NULL);
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get notification of revealed value");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 ||
+		list[0].store.d_int32 != 3,
+		"Failed to get revealed base value");
+	fail_if(!streq(list[1].store.d_string.value, "base"),
+		"Failed to get layer of revealed value");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* Unset from every layer, nothing follows */
+	key.layer = buxton_string_pack("base");
+	r = buxton_direct_unset_value(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Failed to unset base value");
+	buxtond_notify_clients(&daemon, &cl, &key, NULL);
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 0, "Failed to get notification of unset key");
+	free(list);
+
+	msgid = unregister_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0 || msgid != 3, "Failed to unregister notification");
+
+	close(client);
+	close(server);
+	hashmap_free(daemon.notify_mapping);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_prefix_check)
+{
+	int client1, server1, client2, server2;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	_BuxtonKey watch = {{0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value = {0};
+	client_list_item cl1, cl2;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	setup_socket_pair(&client1, &server1);
+	setup_socket_pair(&client2, &server2);
+	fail_if(fcntl(client1, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(client2, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	slabel = buxton_string_pack("_");
+	cl1.fd = server1;
+	cl2.fd = server2;
+	if (use_smack()) {
+		cl1.smack_label = &slabel;
+		cl2.smack_label = &slabel;
+	} else {
+		cl1.smack_label = NULL;
+		cl2.smack_label = NULL;
+	}
+	cl1.cred.uid = 1002;
+	cl2.cred.uid = 1002;
+	cl1.subscriptions = NULL;
+	cl2.subscriptions = NULL;
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	watch.layer.value = NULL;
+	watch.layer.length = 0;
+	watch.group = buxton_string_pack("notify-prefix");
+	watch.name = buxton_string_pack("net.");
+	watch.type = BUXTON_TYPE_UNSET;
+	register_prefix_notification(&daemon, &cl1, &watch, 5, &status);
+	fail_if(status == 0, "Registered prefix of a missing group");
+
+	key.layer = buxton_string_pack("base");
+	key.group = buxton_string_pack("notify-prefix");
+	key.name.value = NULL;
+	key.name.length = 0;
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set group label");
+
+	register_prefix_notification(&daemon, &cl1, &watch, 5, &status);
+	fail_if(status != 0, "Failed to register prefix notification");
+	watch.name.value = NULL;
+	watch.name.length = 0;
+	register_prefix_notification(&daemon, &cl2, &watch, 6, &status);
+	fail_if(status != 0, "Failed to register group notification");
+	fail_if(buxton_trie_size(daemon.notify_prefixes) != 2,
+		"Failed to store watched prefixes");
+
+	/* The key is created after the registrations */
+	value.type = BUXTON_TYPE_INT32;
+	value.store.d_int32 = 3;
+	key.name = buxton_string_pack("net.wifi");
+	key.type = BUXTON_TYPE_INT32;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	buxtond_notify_clients(&daemon, &cl1, &key, &value);
+
+	s = read(client1, buf, 4096);
+	fail_if(s < 0, "Read from prefix client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 4, "Failed to get prefix notification");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 5, "Failed to get prefix message id");
+	fail_if(!streq(list[0].store.d_string.value, "notify-prefix"),
+		"Failed to get group of changed key");
+	fail_if(!streq(list[1].store.d_string.value, "net.wifi"),
+		"Failed to get name of changed key");
+	fail_if(list[2].type != BUXTON_TYPE_INT32 ||
+		list[2].store.d_int32 != 3,
+		"Failed to get value of changed key");
+	fail_if(!streq(list[3].store.d_string.value, "base"),
+		"Failed to get layer of changed key");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list[3].store.d_string.value);
+	free(list);
+
+	s = read(client2, buf, 4096);
+	fail_if(s < 0, "Read from group client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 4, "Failed to get group notification");
+	fail_if(msgid != 6, "Failed to get group message id");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list[3].store.d_string.value);
+	free(list);
+
+	/* Only the group matches, unsetting sends no value */
+	key.name = buxton_string_pack("other");
+	buxtond_notify_clients(&daemon, &cl1, &key, NULL);
+	fail_if(read(client1, buf, 4096) != -1 || errno != EAGAIN,
+		"Notified prefix client of a key without the prefix");
+	s = read(client2, buf, 4096);
+	fail_if(s < 0, "Read from group client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get group notification of unset key");
+	fail_if(!streq(list[1].store.d_string.value, "other"),
+		"Failed to get name of unset key");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list);
+
+	watch.name = buxton_string_pack("net.");
+	msgid = unregister_prefix_notification(&daemon, &cl2, &watch, &status);
+	fail_if(status == 0, "Unregistered prefix the client doesn't watch");
+	msgid = unregister_prefix_notification(&daemon, &cl1, &watch, &status);
+	fail_if(status != 0 || msgid != 5,
+		"Failed to unregister prefix notification");
+	fail_if(cl1.subscriptions,
+		"Failed to forget prefixes of the client");
+	watch.name.value = NULL;
+	watch.name.length = 0;
+	msgid = unregister_prefix_notification(&daemon, &cl2, &watch, &status);
+	fail_if(status != 0 || msgid != 6,
+		"Failed to unregister group notification");
+	fail_if(buxton_trie_size(daemon.notify_prefixes) != 0,
+		"Failed to remove prefixes without watchers");
+
+	close(client1);
+	close(client2);
+	close(server1);
+	close(server2);
+	hashmap_free(daemon.notify_mapping);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
 START_TEST(identify_client_check)
 {
 	int sender;
@@ -2413,15 +3704,17 @@ END_TEST
 START_TEST(terminate_client_check)
 {
 	client_list_item *client;
+	client_list_item other;
 	BuxtonDaemon daemon;
 	int dummy;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	char *key_name = strdup("groupkey");
-	char *key_name_copy = strdup("groupkey");
 	int ret = -1;
-	uint64_t *fd = NULL;
 	BuxtonNotification *nitem = NULL;
+	BuxtonNotification *oitem = NULL;
+	BuxtonNotifyKey *nkey = NULL;
+	BuxtonNotifyKey *skey = NULL;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonKeyId *id;
+	BuxtonKeyId *sid;
 
 	client = malloc0(sizeof(client_list_item));
 	fail_if(!client, "client malloc failed");
@@ -2439,36 +3732,74 @@ START_TEST(terminate_client_check)
 	client->smack_label->value = strdup("dummy");
 	client->smack_label->length = 6;
 	fail_if(!client->smack_label->value, "label strdup failed");
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	memzero(&other, sizeof(client_list_item));
 
+	/* A key only the client watches */
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("key");
+	id = buxton_key_intern(daemon.key_ids, &key);
+	fail_if(!id, "Failed to intern key\n");
+	nkey = malloc0(sizeof(BuxtonNotifyKey));
+	fail_if(!nkey, "Failed to allocate notification key\n");
+	nkey->id = buxton_key_id_ref(id);
 	nitem = malloc0(sizeof(BuxtonNotification));
 	fail_if(!nitem,"Failed to allocate notification item\n");
 	nitem->client = client;
-	nitem->old_data = NULL;
-	nitem->msgid = 0;
-
-	ret = buxton_list_append(&n_list, nitem);
-	fail_if(!ret, "Failed to append to list\n");
-	ret = buxton_list_append(&key_list, key_name_copy);
-	fail_if(!ret, "Failed to append to list\n");
-
-	fd = malloc0(sizeof(uint64_t));
-	fail_if(!fd, "Failed to allocate fd\n");
-	*fd = (uint64_t)client->fd;
-
-	ret = hashmap_put(daemon.notify_mapping, key_name, n_list);
+	nitem->nkey = nkey;
+	LIST_PREPEND(BuxtonNotification, subscribers, nkey->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, client_subs, client->subscriptions, nitem);
+	ret = hashmap_put(daemon.notify_mapping, nkey->id, nkey);
 	fail_if(ret < 0,"Failed to put in hashmap\n");
-	ret = hashmap_put(daemon.client_key_mapping, fd, key_list);
+
+	/* A key watched by another client too */
+	key.name = buxton_string_pack("shared");
+	sid = buxton_key_intern(daemon.key_ids, &key);
+	fail_if(!sid, "Failed to intern key\n");
+	skey = malloc0(sizeof(BuxtonNotifyKey));
+	fail_if(!skey, "Failed to allocate notification key\n");
+	skey->id = buxton_key_id_ref(sid);
+	nitem = malloc0(sizeof(BuxtonNotification));
+	fail_if(!nitem,"Failed to allocate notification item\n");
+	nitem->client = client;
+	nitem->nkey = skey;
+	LIST_PREPEND(BuxtonNotification, subscribers, skey->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, client_subs, client->subscriptions, nitem);
+	oitem = malloc0(sizeof(BuxtonNotification));
+	fail_if(!oitem,"Failed to allocate notification item\n");
+	oitem->client = &other;
+	oitem->nkey = skey;
+	LIST_PREPEND(BuxtonNotification, subscribers, skey->subscribers, oitem);
+	LIST_PREPEND(BuxtonNotification, client_subs, other.subscriptions, oitem);
+	ret = hashmap_put(daemon.notify_mapping, skey->id, skey);
 	fail_if(ret < 0,"Failed to put in hashmap\n");
 
 	terminate_client(&daemon, client, 0);
 	fail_if(daemon.client_list, "Failed to set client list item to NULL");
-
+	fail_if(hashmap_get(daemon.notify_mapping, id),
+		"Failed to remove key without watchers");
+	fail_if(id->refs != 1, "Failed to release identity of removed key");
+	fail_if(hashmap_get(daemon.notify_mapping, sid) != skey,
+		"Removed key still watched by another client");
+	fail_if(skey->subscribers != oitem || oitem->subscribers_next ||
+		oitem->subscribers_prev,
+		"Failed to unlink the client from the shared key");
+
+	hashmap_remove(daemon.notify_mapping, sid);
+	buxtond_notify_key_free(skey);
+	buxton_key_id_unref(id);
+	buxton_key_id_unref(sid);
+	fail_if(buxton_key_table_size(daemon.key_ids) != 0,
+		"Failed to release key identities");
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
 	close(dummy);
 }
 END_TEST
@@ -2479,7 +3810,10 @@ START_TEST(handle_client_check)
 	int dummy;
 	uint8_t buf[4096];
 	uint8_t *message = NULL;
-	BuxtonData data1, data2, data3, data4;
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
 	BuxtonArray *list = NULL;
 	bool r;
 	size_t ret;
@@ -2513,10 +3847,15 @@ START_TEST(handle_client_check)
 	daemon.nfds = 0;
 	daemon.pollfds = NULL;
 	daemon.accepting = NULL;
-	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
 
 	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
 	fail_if(daemon.nfds != 1, "Failed to add pollfd 1");
@@ -2589,7 +3928,165 @@ START_TEST(handle_client_check)
 	/* fail_if(daemon.client_list, "Failed to terminate client"); */
 
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_workers_check)
+{
+	BuxtonDaemon daemon;
+	client_list_item *cl;
+	int client[2];
+	uint8_t *message = NULL;
+	uint8_t buf[4096];
+	BuxtonData data1 = {0};
+	BuxtonData data2 = {0};
+	BuxtonData data3 = {0};
+	BuxtonData data4 = {0};
+	BuxtonData data5 = {0};
+	BuxtonArray *out_list;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	uint32_t msgid;
+	ssize_t csize;
+	ssize_t s;
+	size_t size;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	fail_if(!buxton_direct_load_backends(&daemon.buxton),
+		"Failed to load backends");
+	daemon.key_ids = buxton_key_table_new();
+	fail_if(!daemon.key_ids, "Failed to allocate key table");
+	daemon.changes = buxton_change_log_new(BUXTON_CHANGE_LOG_SIZE, 0);
+	fail_if(!daemon.changes, "Failed to allocate change log");
+	daemon.notify_mapping = hashmap_new(buxton_key_id_hash_func,
+					    trivial_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_STRING;
+	data1.store.d_string = buxton_string_pack("test-gdbm-user");
+	data2.type = BUXTON_TYPE_STRING;
+	data2.store.d_string = buxton_string_pack("daemon-check");
+	data3.type = BUXTON_TYPE_STRING;
+	data3.store.d_string = buxton_string_pack("name");
+	data4.type = BUXTON_TYPE_UINT32;
+	data4.store.d_uint32 = BUXTON_TYPE_STRING;
+	fail_if(!buxton_array_add(out_list, &data1), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &data2), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &data3), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &data4), "Failed to add element to array");
+	size = buxton_serialize_message(&message, BUXTON_CONTROL_GET, 0, out_list);
+	fail_if(size == 0, "Failed to serialize message");
+
+	buxtond_start_workers(&daemon, 2);
+	fail_if(daemon.nworkers != 2, "Failed to start workers");
+
+	/* Clients are handed out round robin, one to each worker */
+	for (int i = 0; i < 2; i++) {
+		cl = malloc0(sizeof(client_list_item));
+		fail_if(!cl, "client malloc failed");
+		LIST_INIT(client_list_item, item, cl);
+		setup_socket_pair(&client[i], &cl->fd);
+		fcntl(cl->fd, F_SETFL, O_NONBLOCK);
+		buxtond_add_client(&daemon, cl);
+	}
+	fail_if(daemon.client_list, "Added client to the main thread");
+
+	for (int i = 0; i < 2; i++) {
+		do_write(client[i], message, size);
+		s = read(client[i], buf, 4096);
+		fail_if(s < 0, "Read from client failed");
+		csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+		fail_if(csize != 3, "Failed to get valid message from buffer");
+		fail_if(msg != BUXTON_CONTROL_STATUS,
+			"Failed to get correct control type");
+		fail_if(list[0].store.d_int32 != 0, "Failed to get value");
+		fail_if(!streq(list[1].store.d_string.value, "user-layer-value"),
+			"Failed to get correct value");
+		free(list[1].store.d_string.value);
+		free(list);
+	}
+
+	/* Notifications of a worker's own clients are sent after the reply */
+	buxton_array_free(&out_list, NULL);
+	free(message);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &data2), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &data3), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &data4), "Failed to add element to array");
+	size = buxton_serialize_message(&message, BUXTON_CONTROL_NOTIFY, 1, out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	do_write(client[0], message, size);
+	s = (ssize_t)read_messages(client[0], buf, sizeof(buf), 1);
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1 || msg != BUXTON_CONTROL_STATUS ||
+		list[0].store.d_int32 != 0, "Failed to register notification");
+	free(list);
+
+	for (int i = 0; i < 2; i++) {
+		buxton_array_free(&out_list, NULL);
+		free(message);
+		out_list = buxton_array_new();
+		fail_if(!out_list, "Failed to allocate list");
+		data5.type = BUXTON_TYPE_STRING;
+		data5.store.d_string = buxton_string_pack(i ? "user-layer-value" :
+							  "worker-layer-value");
+		fail_if(!buxton_array_add(out_list, &data1), "Failed to add element to array");
+		fail_if(!buxton_array_add(out_list, &data2), "Failed to add element to array");
+		fail_if(!buxton_array_add(out_list, &data3), "Failed to add element to array");
+		fail_if(!buxton_array_add(out_list, &data5), "Failed to add element to array");
+		size = buxton_serialize_message(&message, BUXTON_CONTROL_SET, 2, out_list);
+		fail_if(size == 0, "Failed to serialize message");
+		do_write(client[0], message, size);
+
+		s = (ssize_t)read_messages(client[0], buf, sizeof(buf), 2);
+		size = buxton_get_message_size(buf, (size_t)s);
+		csize = buxton_deserialize_message(buf, &msg, size, &msgid, &list);
+		fail_if(csize < 1 || msg != BUXTON_CONTROL_STATUS || msgid != 2 ||
+			list[0].store.d_int32 != 0, "Failed to set value");
+		for (ssize_t j = 1; j < csize; j++) {
+			if (list[j].type == BUXTON_TYPE_STRING) {
+				free(list[j].store.d_string.value);
+			}
+		}
+		free(list);
+		csize = buxton_deserialize_message(buf + size, &msg,
+						   (size_t)s - size, &msgid, &list);
+		fail_if(csize != 2 || msg != BUXTON_CONTROL_CHANGED || msgid != 1,
+			"Failed to get notification from the same worker");
+		fail_if(!streq(list[0].store.d_string.value,
+			       data5.store.d_string.value),
+			"Failed to get the notified value");
+		free(list[0].store.d_string.value);
+		free(list[1].store.d_string.value);
+		free(list);
+	}
+
+	buxtond_stop_workers(&daemon);
+	fail_if(daemon.workers, "Failed to stop workers");
+	fail_if(hashmap_size(daemon.notify_mapping) != 0,
+		"Registrations outlived the clients of stopped workers");
+	fail_if(buxton_key_table_size(daemon.key_ids) != 0,
+		"Keys watched by stopped workers' clients were kept");
+	close(client[0]);
+	close(client[1]);
+	free(message);
+	buxton_array_free(&out_list, NULL);
+	hashmap_free(daemon.notify_mapping);
+	buxton_change_log_free(daemon.changes);
+	buxton_key_table_free(daemon.key_ids);
+	buxton_trie_free(daemon.notify_prefixes, NULL);
+	buxton_direct_close(&daemon.buxton);
 }
 END_TEST
 
@@ -3007,17 +4504,25 @@ daemon_suite(void)
 	tcase_add_test(tc, buxtond_handle_message_remove_group_check);
 	tcase_add_test(tc, buxtond_handle_message_set_label_check);
 	tcase_add_test(tc, buxtond_handle_message_set_value_check);
+	tcase_add_test(tc, buxtond_handle_message_cas_add_check);
 	tcase_add_test(tc, buxtond_handle_message_get_check);
 	tcase_add_test(tc, buxtond_handle_message_get_label_check);
 	tcase_add_test(tc, buxtond_handle_message_notify_check);
 	tcase_add_test(tc, buxtond_handle_message_unset_check);
+	tcase_add_test(tc, buxtond_handle_message_stats_check);
+	tcase_add_test(tc, buxtond_handle_message_changes_check);
 	tcase_add_test(tc, buxtond_notify_clients_check);
+	tcase_add_test(tc, buxtond_notify_shared_value_check);
+	tcase_add_test(tc, buxtond_notify_coalesce_check);
+	tcase_add_test(tc, buxtond_notify_layers_check);
+	tcase_add_test(tc, buxtond_notify_prefix_check);
 	tcase_add_test(tc, identify_client_check);
 	tcase_add_test(tc, add_pollfd_check);
 	tcase_add_test(tc, del_pollfd_check);
 	tcase_add_test(tc, handle_smack_label_check);
 	tcase_add_test(tc, terminate_client_check);
 	tcase_add_test(tc, handle_client_check);
+	tcase_add_test(tc, buxtond_workers_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxton daemon evil tests");
@@ -14,6 +14,7 @@
 #endif
 
 #include <check.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
 #include <stdlib.h>
@@ -22,13 +23,19 @@
 #include <string.h>
 #include <limits.h>
 
+#include "alloc.h"
 #include "backend.h"
 #include "buxtonlist.h"
+#include "changelog.h"
 #include "check_utils.h"
 #include "hashmap.h"
+#include "keyid.h"
 #include "log.h"
 #include "serialize.h"
 #include "smack.h"
+#include "stats.h"
+#include "trace.h"
+#include "trie.h"
 #include "util.h"
 #include "configurator.h"
 
@@ -97,6 +104,260 @@ START_TEST(hashmap_check)
 }
 END_TEST
 
+START_TEST(hashmap_grow_check)
+{
+	Hashmap *map;
+	Iterator iterator;
+	char keys[1000][16];
+	const char *key;
+	char *value;
+	int count;
+	int last;
+	int r;
+
+	map = hashmap_new(string_hash_func, string_compare_func);
+	fail_if(map == NULL, "Failed to allocated hashmap");
+
+	for (int i = 0; i < 1000; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+		r = hashmap_put(map, keys[i], keys[i]);
+		fail_if(r != 1, "Failed to add element %d to hashmap", i);
+	}
+	fail_if(hashmap_put(map, "key10", keys[11]) != -EEXIST,
+		"Added a duplicate key to hashmap");
+	fail_if(hashmap_size(map) != 1000, "Wrong hashmap size");
+
+	for (int i = 0; i < 1000; i += 2) {
+		fail_if(hashmap_remove(map, keys[i]) != keys[i],
+			"Failed to remove element %d from hashmap", i);
+	}
+	for (int i = 0; i < 1000; i++) {
+		value = hashmap_get(map, keys[i]);
+		fail_if((i % 2 && value != keys[i]) || (!(i % 2) && value),
+			"Wrong hashmap lookup result for %s", keys[i]);
+	}
+
+	/* iteration follows insertion order */
+	last = -1;
+	HASHMAP_FOREACH(value, map, iterator) {
+		int index = (int)((value - keys[0]) / (int)sizeof(keys[0]));
+
+		fail_if(index <= last, "Hashmap iterated out of insertion order");
+		last = index;
+	}
+	fail_if(hashmap_first(map) != keys[1], "Wrong first hashmap entry");
+	fail_if(hashmap_last(map) != keys[999], "Wrong last hashmap entry");
+
+	/* removing the current entry doesn't break iteration */
+	count = 0;
+	HASHMAP_FOREACH_KEY(value, key, map, iterator) {
+		fail_if(hashmap_remove(map, key) != value,
+			"Failed to remove current entry while iterating");
+		count++;
+	}
+	fail_if(count != 500, "Iterated over %d entries instead of 500", count);
+	fail_if(!hashmap_isempty(map), "Hashmap not empty after removals");
+
+	hashmap_free(map);
+}
+END_TEST
+
+static void trie_collect(void *value, void *data)
+{
+	char *seen = data;
+
+	strcat(seen, value);
+	strcat(seen, ";");
+}
+
+START_TEST(buxton_trie_check)
+{
+	BuxtonTrie *trie;
+	char seen[64];
+	size_t count;
+
+	trie = buxton_trie_new();
+	fail_if(!trie, "Failed to allocate trie");
+
+	fail_if(!buxton_trie_put(trie, "g\n", "g"), "Failed to add group");
+	fail_if(!buxton_trie_put(trie, "g\nnet.", "net"), "Failed to add prefix");
+	fail_if(!buxton_trie_put(trie, "g\nnet.wifi", "wifi"), "Failed to add key");
+	fail_if(!buxton_trie_put(trie, "gx\n", "gx"), "Failed to add other group");
+	fail_if(!buxton_trie_put(trie, "g\nnet.", "net2"), "Failed to replace prefix");
+	fail_if(buxton_trie_size(trie) != 4, "Wrong trie size");
+
+	fail_if(!streq(buxton_trie_get(trie, "g\nnet."), "net2"),
+		"Failed to get replaced value");
+	fail_if(buxton_trie_get(trie, "g\nnet"), "Got a value for a missing key");
+	fail_if(buxton_trie_get(trie, "g\nnet.wifi.x"),
+		"Got a value for a key longer than stored keys");
+
+	/* prefixes are visited shortest first */
+	seen[0] = '\0';
+	count = buxton_trie_foreach_prefix(trie, "g\nnet.wifi", trie_collect, seen);
+	fail_if(count != 3 || !streq(seen, "g;net2;wifi;"),
+		"Wrong prefixes of key: %s", seen);
+	seen[0] = '\0';
+	count = buxton_trie_foreach_prefix(trie, "g\nother", trie_collect, seen);
+	fail_if(count != 1 || !streq(seen, "g;"), "Wrong prefixes of group key");
+	count = buxton_trie_foreach_prefix(trie, "h\nnet.", trie_collect, seen);
+	fail_if(count != 0, "Matched prefixes of another group");
+
+	/* removing a key keeps the keys below and above it */
+	fail_if(!streq(buxton_trie_remove(trie, "g\nnet."), "net2"),
+		"Failed to remove prefix");
+	fail_if(buxton_trie_remove(trie, "g\nnet."), "Removed a key twice");
+	fail_if(buxton_trie_remove(trie, "g\nne"), "Removed a missing key");
+	fail_if(!streq(buxton_trie_get(trie, "g\nnet.wifi"), "wifi"),
+		"Lost a longer key on removal");
+	fail_if(!streq(buxton_trie_get(trie, "g\n"), "g"),
+		"Lost a shorter key on removal");
+	fail_if(!streq(buxton_trie_remove(trie, "g\nnet.wifi"), "wifi"),
+		"Failed to remove key");
+	fail_if(buxton_trie_size(trie) != 2, "Wrong trie size after removals");
+
+	buxton_trie_free(trie, NULL);
+}
+END_TEST
+
+START_TEST(buxton_key_intern_check)
+{
+	BuxtonKeyTable *table;
+	BuxtonKeyId *id, *same, *other, *group;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+
+	table = buxton_key_table_new();
+	fail_if(!table, "Failed to allocate key table");
+
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("name");
+	key.layer = buxton_string_pack("base");
+	id = buxton_key_intern(table, &key);
+	fail_if(!id, "Failed to intern key");
+	fail_if(!streq(id->path, "group\nname"), "Wrong path of key");
+	fail_if(id->size != 11 || memcmp(id->data, "group\0name\0", 11) != 0,
+		"Wrong backend form of key");
+	fail_if(id->hash != buxton_key_hash(&key), "Wrong hash of key");
+	fail_if(!id->parent || id->parent->name.value ||
+		!streq(id->parent->group.value, "group"),
+		"Failed to intern group of key");
+	fail_if(buxton_key_table_size(table) != 2, "Wrong key table size");
+
+	/* Layers are not part of the identity */
+	key.layer = buxton_string_pack("temp");
+	same = buxton_key_intern(table, &key);
+	fail_if(same != id || id->refs != 2, "Failed to share interned key");
+
+	key.name = buxton_string_pack("other");
+	other = buxton_key_intern(table, &key);
+	fail_if(!other || other == id || other->id == id->id,
+		"Failed to intern another key");
+	fail_if(other->parent != id->parent, "Failed to share interned group");
+
+	key.name = (BuxtonString){ NULL, 0 };
+	group = buxton_key_intern(table, &key);
+	fail_if(group != id->parent || group->path,
+		"Failed to find interned group");
+	fail_if(buxton_key_table_size(table) != 3, "Wrong key table size");
+
+	/* Identities leave the table with their last reference */
+	buxton_key_id_unref(same);
+	buxton_key_id_unref(id);
+	fail_if(buxton_key_table_size(table) != 2, "Failed to release key");
+	buxton_key_id_unref(other);
+	fail_if(buxton_key_table_size(table) != 1,
+		"Failed to release other key");
+	buxton_key_id_unref(group);
+	fail_if(buxton_key_table_size(table) != 0, "Failed to release group");
+
+	key.group = (BuxtonString){ NULL, 0 };
+	fail_if(buxton_key_intern(table, &key), "Interned a key without group");
+
+	buxton_key_table_free(table);
+}
+END_TEST
+
+START_TEST(buxton_change_log_check)
+{
+	BuxtonKeyTable *table;
+	BuxtonChangeLog *log;
+	BuxtonChange changes[4];
+	BuxtonLayer layer;
+	BuxtonKeyId *a, *b;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	uint32_t count;
+	uint64_t head;
+
+	table = buxton_key_table_new();
+	fail_if(!table, "Failed to allocate key table");
+	log = buxton_change_log_new(2, 100);
+	fail_if(!log, "Failed to allocate change log");
+	memzero(&layer, sizeof(BuxtonLayer));
+	layer.name = buxton_string_pack("base");
+
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("a");
+	a = buxton_key_intern(table, &key);
+	key.name = buxton_string_pack("b");
+	b = buxton_key_intern(table, &key);
+	fail_if(!a || !b, "Failed to intern keys");
+
+	fail_if(!buxton_change_log_read(log, 100, changes, 4, &count, &head),
+		"Failed to read empty change log");
+	fail_if(count != 0 || head != 100, "Wrong empty change log");
+
+	fail_if(buxton_change_log_append(log, a, &layer, 0) != 101,
+		"Wrong sequence number of first change");
+	fail_if(buxton_change_log_append(log, b, &layer, 5) != 102,
+		"Wrong sequence number of second change");
+	fail_if(a->refs != 2, "Change log failed to reference key");
+
+	fail_if(!buxton_change_log_read(log, 100, changes, 4, &count, &head),
+		"Failed to read change log");
+	fail_if(count != 2 || head != 102, "Wrong count of changes");
+	fail_if(changes[0].seq != 101 || changes[0].id != a ||
+		changes[1].seq != 102 || changes[1].id != b ||
+		changes[1].uid != 5 || changes[1].layer != &layer,
+		"Wrong changes read");
+	buxton_key_id_unref(changes[0].id);
+	buxton_key_id_unref(changes[1].id);
+
+	/* Reads stop at max and resume after the last change returned */
+	fail_if(!buxton_change_log_read(log, 100, changes, 1, &count, &head),
+		"Failed to read first change");
+	fail_if(count != 1 || changes[0].seq != 101, "Wrong first change");
+	buxton_key_id_unref(changes[0].id);
+	fail_if(!buxton_change_log_read(log, 101, changes, 4, &count, &head),
+		"Failed to resume change log");
+	fail_if(count != 1 || changes[0].seq != 102, "Wrong resumed change");
+	buxton_key_id_unref(changes[0].id);
+
+	/* The oldest change is evicted, so it can't be resumed from before */
+	fail_if(buxton_change_log_append(log, b, &layer, 0) != 103,
+		"Wrong sequence number of third change");
+	fail_if(a->refs != 1, "Change log failed to release evicted key");
+	fail_if(buxton_change_log_read(log, 100, changes, 4, &count, &head),
+		"Read evicted changes");
+	fail_if(count != 0 || head != 103, "Wrong stale read");
+	fail_if(!buxton_change_log_read(log, 101, changes, 4, &count, &head),
+		"Failed to read retained changes");
+	fail_if(count != 2, "Wrong count of retained changes");
+	buxton_key_id_unref(changes[0].id);
+	buxton_key_id_unref(changes[1].id);
+
+	/* Sequence numbers of an earlier instance may be ahead */
+	fail_if(buxton_change_log_read(log, 104, changes, 4, &count, &head),
+		"Read changes from the future");
+
+	buxton_change_log_free(log);
+	fail_if(b->refs != 1, "Change log failed to release keys");
+	buxton_key_id_unref(a);
+	buxton_key_id_unref(b);
+	fail_if(buxton_key_table_size(table) != 0, "Leaked key identities");
+	buxton_key_table_free(table);
+}
+END_TEST
+
 START_TEST(get_layer_path_check)
 {
 	BuxtonLayer layer;
@@ -141,7 +402,8 @@ END_TEST
 
 START_TEST(buxton_data_copy_check)
 {
-	BuxtonData original, copy;
+	BuxtonData original = {0};
+	BuxtonData copy = {0};
 
 	original.type = BUXTON_TYPE_STRING;
 	original.store.d_string = buxton_string_pack("test-data-copy");
@@ -272,10 +534,13 @@ END_TEST
 
 START_TEST(buxton_db_serialize_check)
 {
-	BuxtonData dsource, dtarget;
+	BuxtonData dsource = {0};
+	BuxtonData dtarget = {0};
 	uint8_t *packed = NULL;
 	BuxtonString lsource, ltarget;
+	uint32_t stored;
 
+	dsource.version = 0;
 	dsource.type = BUXTON_TYPE_STRING;
 	lsource = buxton_string_pack("label");
 	dsource.store.d_string = buxton_string_pack("test-string");
@@ -388,6 +653,38 @@ START_TEST(buxton_db_serialize_check)
 		"Source and destination boolean labels differ");
 	free(ltarget.value);
 	free(packed);
+
+	/* Values without a version keep the original layout */
+	dsource.type = BUXTON_TYPE_INT32;
+	dsource.store.d_int32 = 7;
+	fail_if(buxton_serialize(&dsource, &lsource, &packed) !=
+		sizeof(BuxtonDataType) + sizeof(uint32_t) * 2 +
+		lsource.length + sizeof(int32_t),
+		"Failed to serialize unversioned data");
+	memcpy(&stored, packed, sizeof(uint32_t));
+	fail_if(stored != BUXTON_TYPE_INT32,
+		"Unversioned data has a versioned layout");
+	buxton_deserialize(packed, &dtarget, &ltarget);
+	fail_if(dtarget.version != 0, "Unversioned data has a version");
+	free(ltarget.value);
+	free(packed);
+
+	dsource.version = 1234567890123ULL;
+	fail_if(buxton_serialize(&dsource, &lsource, &packed) !=
+		sizeof(BuxtonDataType) + sizeof(uint32_t) * 2 +
+		sizeof(uint64_t) + lsource.length + sizeof(int32_t),
+		"Failed to serialize versioned data");
+	buxton_deserialize(packed, &dtarget, &ltarget);
+	fail_if(dtarget.type != BUXTON_TYPE_INT32,
+		"Source and destination type differ for versioned data");
+	fail_if(dtarget.version != dsource.version,
+		"Source and destination versions differ");
+	fail_if(strcmp(lsource.value, ltarget.value) != 0,
+		"Source and destination versioned labels differ");
+	fail_if(dtarget.store.d_int32 != 7,
+		"Source and destination versioned data differ");
+	free(ltarget.value);
+	free(packed);
 }
 END_TEST
 
@@ -395,7 +692,8 @@ START_TEST(buxton_message_serialize_check)
 {
 	BuxtonControlMessage csource;
 	BuxtonControlMessage ctarget;
-	BuxtonData dsource1, dsource2;
+	BuxtonData dsource1 = {0};
+	BuxtonData dsource2 = {0};
 	uint16_t control, message;
 	BuxtonData *dtarget = NULL;
 	uint8_t *packed = NULL;
@@ -685,7 +983,7 @@ END_TEST
 START_TEST(buxton_get_message_size_check)
 {
 	BuxtonControlMessage csource;
-	BuxtonData dsource;
+	BuxtonData dsource = {0};
 	uint8_t *packed = NULL;
 	BuxtonArray *list = NULL;
 	size_t ret;
@@ -710,6 +1008,239 @@ START_TEST(buxton_get_message_size_check)
 }
 END_TEST
 
+START_TEST(buxton_message_set_msgid_check)
+{
+	BuxtonControlMessage ctarget;
+	BuxtonData dsource = {0};
+	BuxtonData *dtarget = NULL;
+	uint8_t *packed = NULL;
+	uint8_t *expected = NULL;
+	BuxtonArray *list = NULL;
+	size_t ret;
+	uint32_t mtarget;
+
+	list = buxton_array_new();
+	fail_if(!list, "Failed to allocate list");
+	dsource.type = BUXTON_TYPE_STRING;
+	dsource.store.d_string = buxton_string_pack("test-value");
+	fail_if(!buxton_array_add(list, &dsource),
+		"Failed to add element to array");
+
+	ret = buxton_serialize_message(&packed, BUXTON_CONTROL_CHANGED, 1, list);
+	fail_if(ret == 0, "Failed to serialize message");
+	fail_if(buxton_serialize_message(&expected, BUXTON_CONTROL_CHANGED,
+					 0xdeadbeef, list) != ret,
+		"Failed to serialize expected message");
+
+	buxton_message_set_msgid(packed, 0xdeadbeef);
+	fail_if(memcmp(packed, expected, ret) != 0,
+		"Patched message differs from serialized one");
+	fail_if(buxton_deserialize_message(packed, &ctarget, ret, &mtarget,
+					   &dtarget) != 1,
+		"Failed to deserialize patched message");
+	fail_if(mtarget != 0xdeadbeef, "Failed to patch message id");
+	fail_if(ctarget != BUXTON_CONTROL_CHANGED,
+		"Patched message type changed");
+	fail_if(!streq(dtarget[0].store.d_string.value, "test-value"),
+		"Patched message value changed");
+
+	free(dtarget[0].store.d_string.value);
+	free(dtarget);
+	free(packed);
+	free(expected);
+	buxton_array_free(&list, NULL);
+}
+END_TEST
+
+START_TEST(buxton_stats_histogram_check)
+{
+	BuxtonOpStats stats;
+	unsigned int last = 0;
+	unsigned int b;
+
+	/* Buckets are exact below four and never shrink */
+	for (uint64_t ns = 0; ns < 4; ns++) {
+		fail_if(buxton_stats_bucket(ns) != ns,
+			"Failed to map small latency to its own bucket");
+	}
+	for (uint64_t ns = 1; ns < (1ULL << 40); ns += ns / 3 + 1) {
+		b = buxton_stats_bucket(ns);
+		fail_if(b < last, "Bucket order does not follow latency");
+		fail_if(b >= BUXTON_STATS_BUCKETS, "Bucket out of range");
+		fail_if(buxton_stats_bucket_limit(b) < ns,
+			"Latency above its bucket limit");
+		if (b > 0 && b < BUXTON_STATS_BUCKETS - 1) {
+			fail_if(buxton_stats_bucket_limit(b - 1) >= ns,
+				"Latency below its bucket");
+		}
+		last = b;
+	}
+	fail_if(buxton_stats_bucket(UINT64_MAX) != BUXTON_STATS_BUCKETS - 1,
+		"Failed to clamp huge latency");
+
+	buxton_stats_reset();
+	buxton_stats_request_begin();
+	for (uint64_t i = 1; i <= 1000; i++) {
+		buxton_stats_record(BUXTON_CONTROL_GET, i > 990, 10, 20,
+				    i * 1000);
+	}
+	buxton_stats_record(BUXTON_CONTROL_MAX, true, 3, 0, 1);
+
+	buxton_stats_get(BUXTON_CONTROL_GET, &stats);
+	fail_if(stats.count != 1000, "Failed to count requests");
+	fail_if(stats.errors != 10, "Failed to count errors");
+	fail_if(stats.bytes_in != 10000 || stats.bytes_out != 20000,
+		"Failed to count bytes");
+	fail_if(stats.max_ns != 1000000, "Failed to track slowest request");
+	/* Percentiles are bucket limits, at most 25% above the real value */
+	fail_if(buxton_stats_percentile(&stats, 500) < 500000 ||
+		buxton_stats_percentile(&stats, 500) > 625000,
+		"Failed to compute median");
+	fail_if(buxton_stats_percentile(&stats, 990) < 990000 ||
+		buxton_stats_percentile(&stats, 990) > 1000000,
+		"Failed to compute 99th percentile");
+	fail_if(buxton_stats_percentile(&stats, 1000) != 1000000,
+		"Failed to compute maximum");
+
+	buxton_stats_get(BUXTON_CONTROL_MIN, &stats);
+	fail_if(stats.count != 1 || stats.errors != 1,
+		"Failed to count invalid request");
+
+	buxton_stats_reset();
+	buxton_stats_get(BUXTON_CONTROL_GET, &stats);
+	fail_if(stats.count != 0 || buxton_stats_percentile(&stats, 500) != 0,
+		"Failed to reset counters");
+}
+END_TEST
+
+#ifdef TRACE
+START_TEST(buxton_trace_check)
+{
+	FILE *out;
+	char line[256];
+	char msg[32];
+	size_t count;
+	size_t parsed = 0;
+	bool found = false;
+
+	snprintf(msg, sizeof(msg), " msg=%u ",
+		 (unsigned)BUXTON_CONTROL_LIST_NAMES);
+	out = tmpfile();
+	fail_if(!out, "Failed to create trace output");
+
+	buxton_trace_request(BUXTON_CONTROL_LIST_NAMES);
+	buxton_trace_begin(BUXTON_TRACE_BACKEND);
+	buxton_trace_end(BUXTON_TRACE_BACKEND);
+	buxton_trace_request_end(buxton_trace_now());
+
+	count = buxton_trace_dump(out);
+	fail_if(count < 1, "Failed to dump traced phase");
+	rewind(out);
+	while (fgets(line, sizeof(line), out)) {
+		parsed++;
+		if (strstr(line, " phase=backend ") &&
+		    strstr(line, msg)) {
+			found = true;
+		}
+	}
+	fail_if(parsed != count, "Dumped line count mismatch");
+	fail_if(!found, "Failed to find traced phase");
+	fclose(out);
+
+	/* The ring keeps only the most recent phases */
+	for (int i = 0; i < BUXTON_TRACE_RING_SIZE * 2; i++) {
+		buxton_trace_begin(BUXTON_TRACE_READ);
+		buxton_trace_end(BUXTON_TRACE_READ);
+	}
+	out = fopen("/dev/null", "w");
+	fail_if(!out, "Failed to open /dev/null");
+	count = buxton_trace_dump(out);
+	fail_if(count < BUXTON_TRACE_RING_SIZE, "Failed to dump full ring");
+	fail_if(count >= BUXTON_TRACE_RING_SIZE * 2, "Ring did not wrap");
+	fclose(out);
+}
+END_TEST
+#endif
+
+#ifdef ALLOC_ACCOUNTING
+static uint64_t alloc_counter(const char *name)
+{
+	BuxtonArray *list;
+	BuxtonData *d;
+	uint64_t value = UINT64_MAX;
+
+	list = buxton_array_new();
+	fail_if(!list, "Failed to allocate list");
+	buxton_alloc_append(list);
+	for (uint32_t i = 0; i + 1 < list->len; i += 2) {
+		d = buxton_array_get(list, i);
+		if (streq(d->store.d_string.value, name)) {
+			d = buxton_array_get(list, i + 1);
+			value = d->store.d_uint64;
+		}
+	}
+	buxton_array_free(&list, (buxton_free_func)data_free);
+	fail_if(value == UINT64_MAX, "Failed to find counter %s", name);
+	return value;
+}
+
+START_TEST(buxton_alloc_check)
+{
+	BuxtonOpStats stats;
+	FILE *out;
+	char line[256];
+	char site[256];
+	char *p;
+	int at;
+	uint64_t blocks;
+	uint64_t bytes;
+	bool found = false;
+
+	/* allocations are counted at their call site */
+	p = malloc0(100); at = __LINE__;
+	fail_if(!p, "Failed to allocate");
+	snprintf(site, sizeof(site), " site=%s:%d ", __FILE__, at);
+	out = tmpfile();
+	fail_if(!out, "Failed to create dump output");
+	fail_if(buxton_alloc_dump(out) < 1, "Failed to dump call sites");
+	rewind(out);
+	while (fgets(line, sizeof(line), out)) {
+		if (strstr(line, site) && strstr(line, " count=1 bytes=100")) {
+			found = true;
+		}
+	}
+	fail_if(!found, "Failed to find call site");
+	fclose(out);
+
+	/* held memory is live until released */
+	blocks = alloc_counter("alloc.smack.live_blocks");
+	bytes = alloc_counter("alloc.smack.live_bytes");
+	buxton_alloc_hold(BUXTON_ALLOC_SMACK, p);
+	fail_if(alloc_counter("alloc.smack.live_blocks") != blocks + 1,
+		"Held block not counted");
+	fail_if(alloc_counter("alloc.smack.live_bytes") < bytes + 100,
+		"Held bytes not counted");
+	buxton_alloc_release(BUXTON_ALLOC_SMACK, p);
+	fail_if(alloc_counter("alloc.smack.live_blocks") != blocks,
+		"Released block still counted");
+	fail_if(alloc_counter("alloc.smack.live_bytes") != bytes,
+		"Released bytes still counted");
+	free(p);
+
+	/* and charged to the request being handled */
+	buxton_stats_reset();
+	buxton_stats_request_begin();
+	p = strdup("0123456789");
+	fail_if(!p, "Failed to copy string");
+	free(p);
+	buxton_stats_record(BUXTON_CONTROL_LIST_NAMES, false, 0, 0, 10);
+	buxton_stats_get(BUXTON_CONTROL_LIST_NAMES, &stats);
+	fail_if(stats.allocs != 1, "Allocation not charged to request");
+	fail_if(stats.alloc_bytes != 11, "Bytes not charged to request");
+}
+END_TEST
+#endif
+
 static Suite *
 shared_lib_suite(void)
 {
@@ -723,6 +1254,10 @@ shared_lib_suite(void)
 
 	tc = tcase_create("hashmap_functions");
 	tcase_add_test(tc, hashmap_check);
+	tcase_add_test(tc, hashmap_grow_check);
+	tcase_add_test(tc, buxton_trie_check);
+	tcase_add_test(tc, buxton_key_intern_check);
+	tcase_add_test(tc, buxton_change_log_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("util_functions");
@@ -736,6 +1271,14 @@ shared_lib_suite(void)
 	tcase_add_test(tc, buxton_db_serialize_check);
 	tcase_add_test(tc, buxton_message_serialize_check);
 	tcase_add_test(tc, buxton_get_message_size_check);
+	tcase_add_test(tc, buxton_message_set_msgid_check);
+	tcase_add_test(tc, buxton_stats_histogram_check);
+#ifdef TRACE
+	tcase_add_test(tc, buxton_trace_check);
+#endif
+#ifdef ALLOC_ACCOUNTING
+	tcase_add_test(tc, buxton_alloc_check);
+#endif
 	suite_add_tcase(s, tc);
 
 	return s;